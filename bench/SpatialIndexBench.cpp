@@ -0,0 +1,333 @@
+// Timings for SpatialIndexSystem and DynamicBVH at 100k static and 10k
+// moving objects, the sizes the rebuild and bulk insert settings are tuned
+// for. Needs no window or GL context, run it from a release build:
+//
+//   cmake --build build --target spatial_bench && ./build/spatial_bench
+
+#include "../src/components/MeshComponent.hpp"
+#include "../src/components/TransformComponent.hpp"
+#include "../src/ecs/World.hpp"
+#include "../src/spatial/DynamicBVH.hpp"
+#include "../src/systems/SpatialIndexSystem.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+World gWorld;
+
+namespace {
+
+constexpr int STATIC_OBJECTS = 100000;
+constexpr int MOVING_OBJECTS = 10000;
+constexpr float WORLD_SIZE = 2000.0f;
+constexpr int FRAMES = 300;
+constexpr int QUERIES = 1000;
+
+std::mt19937 rng(42);
+
+float randomFloat(float low, float high) {
+  return std::uniform_real_distribution<float>(low, high)(rng);
+}
+
+glm::vec3 randomPosition() {
+  return glm::vec3(randomFloat(0.0f, WORLD_SIZE), randomFloat(0.0f, 20.0f),
+                   randomFloat(0.0f, WORLD_SIZE));
+}
+
+AABB randomBox() {
+  glm::vec3 center = randomPosition();
+  glm::vec3 half(randomFloat(0.5f, 2.0f), randomFloat(0.5f, 4.0f),
+                 randomFloat(0.5f, 2.0f));
+  return AABB(center - half, center + half);
+}
+
+class Timer {
+public:
+  double milliseconds() const {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+};
+
+// Cameras a few units above the ground looking roughly along it
+std::vector<Frustum> randomViews() {
+  std::vector<Frustum> views;
+  glm::mat4 projection =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+  for (int i = 0; i < 100; i++) {
+    glm::vec3 eye = randomPosition() + glm::vec3(0.0f, 10.0f, 0.0f);
+    glm::vec3 target = eye + glm::vec3(randomFloat(-1.0f, 1.0f), -0.2f,
+                                       randomFloat(-1.0f, 1.0f));
+    views.push_back(Frustum::fromMatrix(
+        projection * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f))));
+  }
+  return views;
+}
+
+double frustumMilliseconds(const DynamicBVH &bvh,
+                           const std::vector<Frustum> &views) {
+  size_t hits = 0;
+  Timer timer;
+  for (const Frustum &view : views) {
+    bvh.queryFrustum(view, [&](Entity, int) {
+      hits++;
+      return true;
+    });
+  }
+  return timer.milliseconds() / views.size();
+}
+struct Mover {
+  Entity entity;
+  glm::vec3 velocity;
+};
+
+// Frame by frame through the system, the way the engine uses it
+void benchSystem() {
+  gWorld.registerComponent<TransformComponent>();
+  gWorld.registerComponent<MeshComponent>();
+
+  MeshComponent mesh;
+  mesh.vao = 1;
+  mesh.bounds = AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+
+  std::vector<Mover> movers;
+  for (int i = 0; i < STATIC_OBJECTS + MOVING_OBJECTS; i++) {
+    Entity entity = gWorld.createEntity();
+    glm::vec3 scale(randomFloat(0.5f, 2.0f), randomFloat(0.5f, 4.0f),
+                    randomFloat(0.5f, 2.0f));
+    gWorld.addComponent(entity, TransformComponent(randomPosition(),
+                                                   glm::vec3(0.0f), scale));
+    gWorld.addComponent(entity, mesh);
+    if (i >= STATIC_OBJECTS) {
+      glm::vec3 velocity(randomFloat(-1.0f, 1.0f), 0.0f,
+                         randomFloat(-1.0f, 1.0f));
+      movers.push_back({entity, velocity});
+    }
+  }
+
+  SpatialIndexSystem index;
+  float deltaTime = 1.0f / 60.0f;
+  Timer load;
+  index.update(deltaTime);
+  std::printf("System, %d static + %d moving\n", STATIC_OBJECTS,
+              MOVING_OBJECTS);
+  std::printf("  first sync (bulk build): %8.2f ms\n", load.milliseconds());
+
+  double total = 0.0;
+  double worst = 0.0;
+  for (int frame = 0; frame < FRAMES; frame++) {
+    for (Mover &mover : movers) {
+      auto *transform = gWorld.getComponent<TransformComponent>(mover.entity);
+      // Fast movers, ~10 units/s, leave their fat box every few frames
+      transform->position += mover.velocity * 10.0f * deltaTime;
+    }
+    Timer sync;
+    index.update(deltaTime);
+    double ms = sync.milliseconds();
+    total += ms;
+    worst = std::max(worst, ms);
+  }
+  DynamicBVH::Stats stats = index.getStats();
+  std::printf("  moving frame sync:        %8.2f ms avg, %.2f ms worst "
+              "(%d frames, quality %.2f, height %d)\n",
+              total / FRAMES, worst, FRAMES, stats.qualityRatio,
+              stats.height);
+
+  // A few entities spawning during play
+  Timer spawn;
+  for (int i = 0; i < 100; i++) {
+    Entity entity = gWorld.createEntity();
+    gWorld.addComponent(entity, TransformComponent(randomPosition()));
+    gWorld.addComponent(entity, mesh);
+  }
+  index.update(deltaTime);
+  std::printf("  sync with 100 spawned:    %8.2f ms\n", spawn.milliseconds());
+}
+
+// Inserting one by one against rebuilding, the bulkInsertFraction trade-off.
+// Inserting is faster but leaves a tree that is slower to query
+void benchInsert(const std::vector<AABB> &boxes) {
+  std::vector<Frustum> views = randomViews();
+  std::printf("DynamicBVH, new proxies on top of %zu\n", boxes.size());
+  for (int count : {100, 1000, 10000, 27500, 55000}) {
+    double milliseconds[2];
+    double frustum[2];
+    for (int rebuildAll = 0; rebuildAll < 2; rebuildAll++) {
+      DynamicBVH bvh;
+      for (size_t i = 0; i < boxes.size(); i++) {
+        bvh.createProxy(boxes[i], static_cast<Entity>(i), false);
+      }
+      bvh.rebuild();
+      for (int i = 0; i < count; i++) {
+        bvh.createProxy(randomBox(), static_cast<Entity>(i), false);
+      }
+      Timer timer;
+      if (rebuildAll) {
+        bvh.rebuild();
+      } else {
+        bvh.insertPending();
+      }
+      milliseconds[rebuildAll] = timer.milliseconds();
+      frustum[rebuildAll] = frustumMilliseconds(bvh, views);
+    }
+    std::printf("  %6d new (%4.1f%%): insert %7.2f ms (frustum %.3f ms), "
+                "rebuild %7.2f ms (frustum %.3f ms)\n",
+                count, 100.0f * count / boxes.size(), milliseconds[0],
+                frustum[0], milliseconds[1], frustum[1]);
+  }
+}
+
+struct QueryTimes {
+  double frustum = 0.0;
+  double ray = 0.0;
+  double sphere = 0.0;
+  size_t hits = 0;
+};
+
+QueryTimes runQueries(const DynamicBVH &bvh,
+                      const std::vector<Frustum> &views,
+                      const std::vector<Ray> &rays,
+                      const std::vector<Sphere> &spheres) {
+  QueryTimes times;
+  Timer frustum;
+  for (const Frustum &view : views) {
+    bvh.queryFrustum(view, [&](Entity, int) {
+      times.hits++;
+      return true;
+    });
+  }
+  times.frustum = frustum.milliseconds() / views.size();
+
+  Timer ray;
+  for (const Ray &r : rays) {
+    bvh.raycast(r, WORLD_SIZE, [&](Entity, int, float distance) {
+      times.hits++;
+      return distance;
+    });
+  }
+  times.ray = ray.milliseconds() * 1000.0 / rays.size();
+
+  Timer sphere;
+  for (const Sphere &s : spheres) {
+    bvh.querySphere(s, [&](Entity, int) {
+      times.hits++;
+      return true;
+    });
+  }
+  times.sphere = sphere.milliseconds() * 1000.0 / spheres.size();
+  return times;
+}
+
+// Queries on a fresh tree, on one loosened by refits and against brute force
+void benchQueries(const std::vector<AABB> &staticBoxes) {
+  std::vector<Frustum> views = randomViews();
+  std::vector<Ray> rays;
+  std::vector<Sphere> spheres;
+  for (int i = 0; i < QUERIES; i++) {
+    glm::vec3 direction = glm::normalize(
+        glm::vec3(randomFloat(-1.0f, 1.0f), randomFloat(-0.3f, 0.0f),
+                  randomFloat(-1.0f, 1.0f)));
+    rays.emplace_back(randomPosition() + glm::vec3(0.0f, 10.0f, 0.0f),
+                      direction);
+    spheres.push_back({randomPosition(), 10.0f});
+  }
+
+  DynamicBVH bvh;
+  std::vector<AABB> boxes = staticBoxes;
+  std::vector<glm::vec3> velocities;
+  for (int i = 0; i < MOVING_OBJECTS; i++) {
+    boxes.push_back(randomBox());
+    velocities.emplace_back(randomFloat(-1.0f, 1.0f), 0.0f,
+                            randomFloat(-1.0f, 1.0f));
+  }
+  for (size_t i = 0; i < boxes.size(); i++) {
+    bvh.createProxy(boxes[i], static_cast<Entity>(i), false);
+  }
+  Timer build;
+  bvh.rebuild();
+  double buildMs = build.milliseconds();
+  DynamicBVH::Stats built = bvh.getStats();
+  QueryTimes fresh = runQueries(bvh, views, rays, spheres);
+
+  // Refit only, long enough for the movers to cross a good part of the map.
+  // Queries are timed again once the quality reaches the system's threshold
+  SpatialIndexSystem defaults;
+  QueryTimes atThreshold;
+  float thresholdQuality = 0.0f;
+  double refitMs = 0.0;
+  for (int frame = 0; frame < 3000; frame++) {
+    if (frame % defaults.rebuildInterval == 0 && thresholdQuality == 0.0f &&
+        bvh.getQualityRatio() > defaults.rebuildQualityThreshold) {
+      thresholdQuality = bvh.getQualityRatio();
+      atThreshold = runQueries(bvh, views, rays, spheres);
+    }
+    Timer refit;
+    for (int i = 0; i < MOVING_OBJECTS; i++) {
+      int proxy = STATIC_OBJECTS + i;
+      AABB &box = boxes[proxy];
+      glm::vec3 step = velocities[i] * 0.2f;
+      box = AABB(box.min + step, box.max + step);
+      bvh.moveProxy(proxy, box);
+    }
+    refitMs += refit.milliseconds();
+  }
+  float quality = bvh.getQualityRatio();
+  QueryTimes loose = runQueries(bvh, views, rays, spheres);
+
+  Timer rebuild;
+  bvh.rebuild();
+  double rebuildMs = rebuild.milliseconds();
+  QueryTimes rebuilt = runQueries(bvh, views, rays, spheres);
+
+  // Brute force frustum test, for scale
+  Timer brute;
+  size_t bruteHits = 0;
+  for (const Frustum &view : views) {
+    for (const AABB &box : boxes) {
+      bruteHits += view.intersects(box);
+    }
+  }
+  double bruteMs = brute.milliseconds() / views.size();
+
+  std::printf("DynamicBVH, %zu proxies\n", boxes.size());
+  std::printf("  SAH build:                %8.2f ms (height %d)\n", buildMs,
+              built.height);
+  std::printf("  refit %d movers:       %8.3f ms per frame\n",
+              MOVING_OBJECTS, refitMs / 3000);
+  std::printf("  rebuild at quality %.2f:  %8.2f ms\n", quality, rebuildMs);
+  std::printf("  %-10s frustum %8.3f ms, ray %6.2f us, sphere %6.2f us\n",
+              "fresh", fresh.frustum, fresh.ray, fresh.sphere);
+  std::printf("  q %-8.2f frustum %8.3f ms, ray %6.2f us, sphere %6.2f us\n",
+              thresholdQuality, atThreshold.frustum, atThreshold.ray,
+              atThreshold.sphere);
+  std::printf("  %-10s frustum %8.3f ms, ray %6.2f us, sphere %6.2f us\n",
+              "refit", loose.frustum, loose.ray, loose.sphere);
+  std::printf("  %-10s frustum %8.3f ms, ray %6.2f us, sphere %6.2f us\n",
+              "rebuilt", rebuilt.frustum, rebuilt.ray, rebuilt.sphere);
+  std::printf("  brute force frustum:      %8.3f ms (%zu hits)\n", bruteMs,
+              bruteHits / views.size());
+}
+
+} // namespace
+
+int main() {
+  std::vector<AABB> staticBoxes;
+  for (int i = 0; i < STATIC_OBJECTS; i++) {
+    staticBoxes.push_back(randomBox());
+  }
+
+  benchSystem();
+  benchInsert(staticBoxes);
+  benchQueries(staticBoxes);
+  return 0;
+}
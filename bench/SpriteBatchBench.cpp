@@ -0,0 +1,209 @@
+// Frame times of SpriteRenderSystem against the per sprite draw loop it
+// replaced, with WaterSim's particles: 1000 (the scene's default) and 100k.
+// Opens a hidden 800x600 window with vsync off. The shader paths are
+// relative like the app's, so run it from the build directory:
+//
+//   cmake --build build --target sprite_bench && cd build && ./sprite_bench
+//
+// Each frame is timed up to glFinish(), so the numbers include the GPU.
+// "submit" is the CPU side alone, up to the return of render().
+
+#include "../src/components/MaterialComponent.hpp"
+#include "../src/components/MeshComponent.hpp"
+#include "../src/components/SceneComponent.hpp"
+#include "../src/components/TransformComponent.hpp"
+#include "../src/ecs/Tag.hpp"
+#include "../src/ecs/World.hpp"
+#include "../src/resources/ResourceManager.hpp"
+#include "../src/scenes/watersim/components/SimulatorSettings.hpp"
+#include "../src/systems/RenderCommon.hpp"
+#include "../src/systems/SpriteRenderSystem.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+World gWorld;
+
+namespace {
+
+constexpr int WIDTH = 800;
+constexpr int HEIGHT = 600;
+constexpr int WARMUP_FRAMES = 3;
+constexpr int FRAMES = 30;
+
+std::mt19937 rng(42);
+
+float randomFloat(float low, float high) {
+  return std::uniform_real_distribution<float>(low, high)(rng);
+}
+
+class Timer {
+public:
+  double milliseconds() const {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+};
+
+// SpriteRenderSystem::render() before SpriteBatch: uniforms and a draw call
+// per sprite
+void renderPerSprite() {
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  auto &glState = GLStateCache::instance();
+  glState.disable(GL_DEPTH_TEST);
+  glState.disable(GL_CULL_FACE);
+  glState.enable(GL_BLEND);
+  glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glm::mat4 projection = glm::ortho(0.0f, static_cast<float>(WIDTH),
+                                    static_cast<float>(HEIGHT), 0.0f, -1.0f,
+                                    1.0f);
+  auto &resources = ResourceManager::instance();
+
+  gWorld.forEachWith<TransformComponent, MeshComponent, MaterialComponent>(
+      [&](Entity, TransformComponent &transform, MeshComponent &mesh,
+          MaterialComponent &material) {
+        if (!mesh.isValid() || material.alpha <= 0.0f)
+          return;
+        Shader *shader = resources.getShader(material.shaderProgram);
+        if (!shader)
+          return;
+
+        shader->use();
+        shader->setMat4("projection", projection);
+        shader->setMat4("model", transform.getSpriteModelMatrix());
+        shader->setVec3("spriteColor", material.color);
+        shader->setFloat("spriteAlpha", material.alpha);
+        shader->setBool("useTexture", material.useTextures);
+        shader->setBool("isCircle", material.isCircle);
+        RenderUtils::drawMesh(mesh);
+      });
+}
+
+struct FrameTimes {
+  double submit = 0.0;
+  double frame = 0.0;
+  double worst = 0.0;
+};
+
+template <typename Render> FrameTimes measure(Render render) {
+  FrameTimes times;
+  for (int frame = 0; frame < WARMUP_FRAMES + FRAMES; frame++) {
+    glFinish();
+    Timer timer;
+    render();
+    double submit = timer.milliseconds();
+    glFinish();
+    double total = timer.milliseconds();
+    if (frame < WARMUP_FRAMES)
+      continue;
+    times.submit += submit / FRAMES;
+    times.frame += total / FRAMES;
+    times.worst = std::max(times.worst, total);
+  }
+  return times;
+}
+
+// Same entities FluidPhysicsSystem::createParticle makes, minus physics
+void addParticles(int count, const MeshData &quad, uint32_t shaderID) {
+  SimulatorSettings settings;
+  float diameter = settings.particleRadius * 2.0f;
+  for (int i = 0; i < count; i++) {
+    Entity particle = gWorld.createEntity();
+
+    TransformComponent transform;
+    transform.position = glm::vec3(randomFloat(0.0f, WIDTH - diameter),
+                                   randomFloat(0.0f, HEIGHT - diameter), 0.0f);
+    transform.scale = glm::vec3(diameter, diameter, 1.0f);
+    gWorld.addComponent(particle, transform);
+
+    gWorld.addComponent(particle, quad.toComponent());
+
+    MaterialComponent material;
+    material.shaderProgram = shaderID;
+    material.useTextures = false;
+    material.color = glm::vec3(1.0f, 0.0f, 0.0f);
+    material.isCircle = true;
+    gWorld.addComponent(particle, material);
+  }
+}
+
+} // namespace
+
+int main() {
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window =
+      glfwCreateWindow(WIDTH, HEIGHT, "sprite_bench", NULL, NULL);
+  if (!window) {
+    std::printf("Failed to create GLFW window\n");
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+  if (!gladLoadGL()) {
+    std::printf("Failed to initialize GLAD\n");
+    return 1;
+  }
+  glViewport(0, 0, WIDTH, HEIGHT);
+  std::printf("%s, %dx%d\n", glGetString(GL_RENDERER), WIDTH, HEIGHT);
+
+  gWorld.registerComponent<TransformComponent>();
+  gWorld.registerComponent<MeshComponent>();
+  gWorld.registerComponent<MaterialComponent>();
+  gWorld.registerComponent<SceneComponent>();
+  gWorld.registerComponent<TagComponent>();
+
+  auto &resources = ResourceManager::instance();
+  uint32_t shaderID = resources.loadShader(
+      "spriteShader", "../src/scenes/breakout/shaders/spriteShaderVertex.glsl",
+      "../src/scenes/breakout/shaders/spriteShaderFragment.glsl");
+
+  // FluidPhysicsSystem's particle quad
+  float vertices[] = {0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f,
+                      0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,
+                      1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f};
+  std::vector<VertexAttribute> layout = {
+      {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
+  MeshData quad =
+        resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
+
+  SpriteRenderSystem batched(WIDTH, HEIGHT);
+  int total = 0;
+  for (int count : {1000, 100000}) {
+    addParticles(count - total, quad, shaderID);
+    total = count;
+
+    FrameTimes perSprite = measure(renderPerSprite);
+    FrameTimes batch = measure([&] { batched.render(); });
+    const SpriteBatch::Stats &stats = batched.getBatchStats();
+
+    std::printf("%d sprites\n", count);
+    std::printf("  per sprite: frame %8.2f ms (worst %8.2f), submit %8.2f ms,"
+                " %d draws\n",
+                perSprite.frame, perSprite.worst, perSprite.submit, count);
+    std::printf("  batched:    frame %8.2f ms (worst %8.2f), submit %8.2f ms,"
+                " %u draws, %u orphans\n",
+                batch.frame, batch.worst, batch.submit, stats.drawCalls,
+                stats.orphans);
+  }
+
+  glfwTerminate();
+  return 0;
+}
@@ -3,7 +3,9 @@
 #include "ecs/Tag.hpp"
 #include "ecs/World.hpp"
 #include "gl_common.hpp"
+#include "resources/GLStateCache.hpp"
 #include "systems/CameraControllerSystem.hpp"
+#include <cstdio>
 #include <iostream>
 #include <string>
 
@@ -13,11 +15,14 @@
 #include "systems/CameraFollowSystem.hpp"
 #include "systems/CameraSystem.hpp"
 #include "systems/CompositeRenderSystem.hpp"
+#include "systems/DynamicResolutionSystem.hpp"
 #include "systems/LightingSystem.hpp"
+#include "systems/OcclusionCullingSystem.hpp"
 #include "systems/PhysicsSystem.hpp"
 #include "systems/PlayerControllerSystem.hpp"
 #include "systems/RenderSystem.hpp" // Now OpaqueRenderSystem
 #include "systems/SkyboxSystem.hpp"
+#include "systems/TextureStreamingSystem.hpp"
 #include "systems/TransparentRenderSystem.hpp"
 
 // Extern declarations for globals defined in main.cpp
@@ -53,15 +58,20 @@ public:
       return -1;
     }
 
-    stbi_set_flip_vertically_on_load(true);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    auto &glState = GLStateCache::instance();
+    glState.enable(GL_CULL_FACE);
+    glState.setCullFace(GL_BACK);
     glFrontFace(GL_CCW);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_STENCIL_TEST);
-    glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_STENCIL_TEST);
+    glState.setStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
+    glState.enable(GL_BLEND);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Same size the scenes are created with, resizes come through
+    // onFramebufferResize
+    ResourceManager::instance().getRenderGraph().setOutputSize(SCR_WIDTH,
+                                                               SCR_HEIGHT);
     return 1;
   }
 
@@ -74,8 +84,47 @@ public:
       frameCount++;
       if (currentFrame - lastTitleUpdate >= 0.1f) {
         float fps = frameCount / (currentFrame - lastTitleUpdate);
+        auto glStats = GLStateCache::instance().getLastFrameStats();
         std::string title = "OpenGL Application - FPS: " +
-                            std::to_string(static_cast<int>(fps));
+                            std::to_string(static_cast<int>(fps)) +
+                            " - GL state calls: " +
+                            std::to_string(glStats.issued) + " (" +
+                            std::to_string(glStats.skipped) + " skipped)";
+        if (auto *opaque = gWorld.getSystem<OpaqueRenderSystem>()) {
+          auto passStats = opaque->getPassStats();
+          double opaqueMs = passStats.litPass.milliseconds;
+          if (passStats.depthPrePass)
+            opaqueMs += passStats.prePass.milliseconds;
+          char opaqueInfo[160];
+          std::snprintf(opaqueInfo, sizeof(opaqueInfo),
+                        " - Opaque: %.2f ms, %llu samples (pre-pass %s), "
+                        "%u draws for %u meshes",
+                        opaqueMs,
+                        (unsigned long long)passStats.litPass.samples,
+                        passStats.depthPrePass ? "on" : "off",
+                        passStats.drawCalls, passStats.meshes);
+          title += opaqueInfo;
+        }
+        auto graphStats =
+            ResourceManager::instance().getRenderGraph().getStats();
+        title += " - Passes: " + std::to_string(graphStats.passes -
+                                                graphStats.culled) +
+                 " (" + std::to_string(graphStats.framebufferChanges) +
+                 " FBO changes)";
+        if (auto *resolution = gWorld.getSystem<DynamicResolutionSystem>()) {
+          char scaleInfo[64];
+          std::snprintf(scaleInfo, sizeof(scaleInfo),
+                        " - Scale: %d%% (GPU %.2f ms)",
+                        static_cast<int>(graphStats.renderScale * 100.0f),
+                        resolution->getFrameTime());
+          title += scaleInfo;
+        }
+        auto textureStats =
+            ResourceManager::instance().getTextureLoader().getStats();
+        if (textureStats.pending > 0) {
+          title += " - Loading " + std::to_string(textureStats.pending) +
+                   " textures";
+        }
         glfwSetWindowTitle(window, title.c_str());
         frameCount = 0;
         lastTitleUpdate = currentFrame;
@@ -83,14 +132,22 @@ public:
       gWorld.getInput().newFrame();
       glfwPollEvents();
       gWorld.update(deltaTime);
+      auto &resources = ResourceManager::instance();
+      resources.updateTextureLoads(TEXTURE_UPLOAD_BUDGET_MS);
+      // Systems record their passes, the graph then runs them
+      resources.getRenderGraph().beginFrame();
       gWorld.render();
+      resources.getRenderGraph().execute();
       glfwSwapBuffers(window);
+      GLStateCache::instance().endFrame();
     }
   }
 
 private:
   const unsigned int SCR_WIDTH = 800;
   const unsigned int SCR_HEIGHT = 600;
+  // Main thread time per frame spent uploading decoded textures
+  const double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
   bool wireframe = false;
   float lastFrame = 0.0f;
   float lastTitleUpdate = 0.0f;
@@ -108,38 +165,9 @@ private:
   }
 
   void onFramebufferResize(int width, int height) {
-    glViewport(0, 0, width, height);
-
-    auto &resources = ResourceManager::instance();
-    std::string activeSceneName;
-    gWorld.forEachWith<SceneComponent, TagComponent>(
-        [&](Entity &entity, SceneComponent &scene, TagComponent &tag) {
-          if (tag.has(ACTIVESCENE)) {
-            activeSceneName = scene.name;
-          }
-        });
-
-    if (activeSceneName.length() <= 0)
-      std::cout << "No active scenes" << std::endl;
-    resources.resizeFramebuffer(activeSceneName, width, height);
-
-    // TODO: better way of managing systems that need framebuffer resizing
-    // resizing
-    if (auto *opaqueSystem = gWorld.getSystem<OpaqueRenderSystem>()) {
-      opaqueSystem->setScreenSize(width, height);
-    }
-    if (auto *skyboxSystem = gWorld.getSystem<SkyboxSystem>()) {
-      skyboxSystem->setScreenSize(width, height);
-    }
-    if (auto *transparentSystem = gWorld.getSystem<TransparentRenderSystem>()) {
-      transparentSystem->setScreenSize(width, height);
-    }
-    if (auto *compositeSystem = gWorld.getSystem<CompositeRenderSystem>()) {
-      compositeSystem->setScreenSize(width, height);
-    }
-    if (auto *postProcessSystem = gWorld.getSystem<PostProcessingSystem>()) {
-      postProcessSystem->setScreenSize(width, height);
-    }
+    GLStateCache::instance().setViewport(0, 0, width, height);
+    ResourceManager::instance().getRenderGraph().setOutputSize(width, height);
+    gWorld.setScreenSize(width, height);
   }
 
   static void key_callback(GLFWwindow *window, int key, int scancode,
@@ -164,6 +192,24 @@ private:
       glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
     }
 
+    // Toggle the depth pre-pass of the active scene, compare the opaque
+    // timings in the window title
+    if (key == GLFW_KEY_END && action == GLFW_PRESS) {
+      gWorld.forEachWith<SceneComponent, TagComponent>(
+          [](Entity entity, SceneComponent &scene, TagComponent &tag) {
+            if (tag.has(ACTIVESCENE)) {
+              scene.depthPrePass = !scene.depthPrePass;
+            }
+          });
+    }
+
+    // Toggle dynamic resolution, the scale shows in the window title
+    if (key == GLFW_KEY_PAGE_DOWN && action == GLFW_PRESS) {
+      if (auto *resolution = gWorld.getSystem<DynamicResolutionSystem>()) {
+        resolution->setEnabled(!resolution->isEnabled());
+      }
+    }
+
     // Post-processing effect controls (number keys 0-5)
     // TODO: Move to a system
     // if (action == GLFW_PRESS) {
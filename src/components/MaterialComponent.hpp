@@ -19,10 +19,27 @@ struct MaterialComponent {
 
   // Index 0 = diffuse, 1 = specular, 2 = normal, 3 = emission
   std::array<uint32_t, MAX_MATERIAL_TEXTURES> textures = {0, 0, 0, 0};
+  // Sub-rectangle (u0, v0, u1, v1) of textures[0] used by sprites, set from
+  // an AtlasRegion when the texture is an atlas page
+  glm::vec4 uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
 
   bool useTextures = false;
   bool receivesLighting = true;
   bool hasTransparency = false;
   bool doubleSided = false;
   bool isCircle = false;
+
+  // Entry of MaterialTable holding ambient, diffuse, specular and shininess,
+  // kept up to date by MaterialSystem
+  uint32_t materialID = 0;
+
+  // Sets exactly the same uniforms and textures as other, so draws using
+  // either can be merged
+  bool sharesRenderState(const MaterialComponent &other) const {
+    return shaderProgram == other.shaderProgram &&
+           textures == other.textures && useTextures == other.useTextures &&
+           receivesLighting == other.receivesLighting &&
+           ambient == other.ambient && diffuse == other.diffuse &&
+           specular == other.specular && shininess == other.shininess;
+  }
 };
@@ -1,13 +1,48 @@
 #pragma once
 #include "../gl_common.hpp"
+#include "../resources/ResourcePool.hpp"
+#include "../spatial/Geometry.hpp"
 #include <stdint.h>
 
+struct MeshData;
+
 struct MeshComponent {
   uint32_t vao = 0;
   uint32_t vertexCount = 0;
   uint32_t indexCount = 0;
   GLenum indexType = GL_UNSIGNED_INT;
+  // Where the mesh starts in the buffers behind vao (see GeometryArena)
+  uint32_t baseVertex = 0;
+  uint32_t firstIndex = 0;
+
+  // CompactVertex meshes store 16 bit positions inside a box, the vertex
+  // shader decodes them as positionOffset + position * positionScale
+  bool compact = false;
+  glm::vec3 positionScale = glm::vec3(1.0f);
+  glm::vec3 positionOffset = glm::vec3(0.0f);
+
+  // Local space bounds, left invalid when the mesh layout has no positions
+  AABB bounds;
+
+  // The pooled mesh behind vao, null for meshes ResourceManager didn't make
+  ResourceHandle<MeshData> handle;
 
   bool isIndexed() const { return indexCount > 0; }
   bool isValid() const { return vao != 0; }
+  bool hasBounds() const { return bounds.isValid(); }
+
+  // Same vertex decode uniforms, draws of both can be merged
+  bool sameDecode(const MeshComponent &other) const {
+    return compact == other.compact &&
+           (!compact || (positionScale == other.positionScale &&
+                         positionOffset == other.positionOffset));
+  }
+
+  // Byte offset of the first index, as passed to glDrawElements*
+  const void *indexOffset() const {
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT  ? 2
+                       : indexType == GL_UNSIGNED_BYTE ? 1
+                                                       : 4;
+    return reinterpret_cast<const void *>(firstIndex * indexSize);
+  }
 };
@@ -0,0 +1,15 @@
+#pragma once
+#include "../spatial/Geometry.hpp"
+
+// Marks an entity as an occluder for OcclusionCullingSystem.
+// The occluder is rasterised as a box in the entity's local space. The box
+// must lie inside the visible geometry or objects behind it would be culled
+// wrongly, so by default it is only safe for box shaped meshes (walls, floors,
+// crates) where the mesh bounds are used.
+struct OccluderComponent {
+  // Local space box, invalid means "use the mesh bounds"
+  AABB box;
+
+  OccluderComponent() = default;
+  OccluderComponent(const AABB &localBox) : box(localBox) {}
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 #include <glm/glm.hpp>
 
 // Point Light Component - omnidirectional light with distance attenuation
@@ -10,6 +11,8 @@ struct PointLightComponent {
   float constant;
   float linear;
   float quadratic;
+  // Distance the light reaches, 0 derives it from the attenuation
+  float range = 0.0f;
 
   PointLightComponent(glm::vec3 amb = glm::vec3(0.05f),
                       glm::vec3 diff = glm::vec3(0.8f),
@@ -17,4 +20,24 @@ struct PointLightComponent {
                       float l = 0.09f, float q = 0.032f)
       : ambient(amb), diffuse(diff), specular(spec), constant(c), linear(l),
         quadratic(q) {}
+
+  // Distance where the attenuated light drops below 1/256 of full intensity,
+  // used to bin the light into clusters
+  float getRange() const {
+    if (range > 0.0f)
+      return range;
+    glm::vec3 peak = glm::max(ambient, glm::max(diffuse, specular));
+    float intensity = std::max(peak.x, std::max(peak.y, peak.z));
+    // Solve constant + linear * d + quadratic * d^2 = 256 * intensity
+    float target = 256.0f * intensity - constant;
+    if (target <= 0.0f)
+      return 0.0f;
+    if (quadratic > 0.0f) {
+      float discriminant = linear * linear + 4.0f * quadratic * target;
+      return (-linear + std::sqrt(discriminant)) / (2.0f * quadratic);
+    }
+    if (linear > 0.0f)
+      return target / linear;
+    return 1e6f; // No falloff at all
+  }
 };
@@ -5,6 +5,9 @@
 struct SceneComponent {
   std::string name;
   glm::vec3 clearColor;
+  // Lay down depth for lit geometry first so the expensive lighting shader
+  // only runs once per pixel, see OpaqueRenderSystem
+  bool depthPrePass = false;
 
   SceneComponent() = default;
   SceneComponent(const std::string &n) : name(n) {}
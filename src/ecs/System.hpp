@@ -9,4 +9,7 @@ public:
   virtual void update(float &deltaTime) {}
 
   virtual void render() {}
+
+  // The window's framebuffer was resized, see World::setScreenSize
+  virtual void setScreenSize(unsigned int width, unsigned int height) {}
 };
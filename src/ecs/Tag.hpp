@@ -11,6 +11,8 @@ enum TagComponentTypes {
   SKYBOX,
   PLAYER,
   ACTIVELEVEL,
+  STATIC,       // Never moves after load, merged by StaticBatcher
+  STATIC_BATCH, // Output of StaticBatcher, already in world space
 };
 
 struct TagComponent {
@@ -238,6 +238,12 @@ public:
     }
   }
 
+  void setScreenSize(unsigned int width, unsigned int height) {
+    for (auto &system : systems) {
+      system->setScreenSize(width, height);
+    }
+  }
+
 private:
   // ========== QUERY CACHE HELPERS ==========
   template <typename... ComponentTypes> ComponentMask buildQueryMask() {
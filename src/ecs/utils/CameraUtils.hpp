@@ -3,6 +3,7 @@
 #include "../../components/CameraComponent.hpp"
 #include "../../components/TransformComponent.hpp"
 #include "../../ecs/Tag.hpp"
+#include "../../spatial/Geometry.hpp"
 #include "../World.hpp"
 #include <glm/glm.hpp>
 #include <iostream>
@@ -53,3 +54,21 @@ inline ActiveCameraData getActiveCamera(World &world, float aspectRatio,
 
   return data;
 }
+
+// World space ray through a screen point (pixels, origin top left), used for
+// picking against the SpatialIndexSystem
+inline Ray screenPointToRay(const ActiveCameraData &camera, float screenX,
+                            float screenY, float screenWidth,
+                            float screenHeight) {
+  float ndcX = (2.0f * screenX) / screenWidth - 1.0f;
+  float ndcY = 1.0f - (2.0f * screenY) / screenHeight;
+
+  glm::mat4 invViewProjection = glm::inverse(camera.projection * camera.view);
+  glm::vec4 nearPoint = invViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+  glm::vec4 farPoint = invViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+  nearPoint /= nearPoint.w;
+  farPoint /= farPoint.w;
+
+  return Ray(glm::vec3(nearPoint),
+             glm::normalize(glm::vec3(farPoint - nearPoint)));
+}
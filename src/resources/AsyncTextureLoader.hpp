@@ -0,0 +1,318 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../utils/MappedFile.hpp"
+#include "../utils/ThreadPool.hpp"
+#include "CookedTexture.hpp"
+#include "GLStateCache.hpp"
+#include "TextureStreamer.hpp"
+
+#include "stb_image.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Decodes images on the ThreadPool and uploads them on the render thread.
+// The GL texture is created by the caller right away and holds a 1x1
+// placeholder (see uploadPlaceholder) until its pixels arrive, so materials
+// can keep the ID from the first frame on.
+//
+// Workers load the image's CookedTexture (<source>.mtex) when it is up to
+// date. Otherwise they decode the source, cook the mip chain and write the
+// .mtex for next time, so every image is decoded once per change.
+//
+// update() uploads finished images level by level until the frame's time
+// budget is spent, at least one image per call so loading always makes
+// progress. With pixel buffers enabled the pixels are copied into an
+// orphaned GL_PIXEL_UNPACK_BUFFER and the driver transfers them
+// asynchronously.
+//
+// With a TextureStreamer set, 2D textures only get the tail of their mip
+// chain here and the streamer adds finer levels as they are needed. Freshly
+// cooked chains are mapped back from the written .mtex so the streamer
+// keeps file pages instead of heap memory.
+//
+// Workers set stb's per thread flip flag on every decode, they never touch
+// the global stbi_set_flip_vertically_on_load state.
+class AsyncTextureLoader {
+public:
+  struct Stats {
+    uint32_t pending = 0; // Requested, not uploaded yet
+    uint32_t uploadedLastUpdate = 0;
+    double uploadMsLastUpdate = 0.0;
+    uint64_t uploadedBytes = 0;
+    uint32_t cooked = 0; // Decoded and cooked this run
+    uint32_t mapped = 0; // Loaded from an up to date .mtex
+  };
+
+  // Called after a texture's upload with its size in bytes, also when the
+  // load failed and the placeholder stays
+  using UploadCallback = std::function<void(uint32_t texture, size_t bytes)>;
+
+  AsyncTextureLoader() : shared(std::make_shared<Shared>()) {}
+
+  ~AsyncTextureLoader() {
+    if (pixelBuffer)
+      glDeleteBuffers(1, &pixelBuffer);
+  }
+
+  AsyncTextureLoader(const AsyncTextureLoader &) = delete;
+  AsyncTextureLoader &operator=(const AsyncTextureLoader &) = delete;
+
+  // Fills the bound texture (every face of a cubemap) with one grey pixel.
+  // Its only level is the last one, so it is complete even with a mipmap
+  // min filter; the upload sets the real range
+  static void uploadPlaceholder(GLenum target) {
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+    static const unsigned char grey[4] = {128, 128, 128, 255};
+    if (target == GL_TEXTURE_CUBE_MAP) {
+      for (int face = 0; face < 6; face++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1,
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+      }
+    } else {
+      glTexImage2D(target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                   grey);
+    }
+  }
+
+  void load2D(uint32_t texture, const std::string &path, bool flipY) {
+    queue(texture, GL_TEXTURE_2D, {path}, flipY, true);
+  }
+
+  // Faces in GL order: +X, -X, +Y, -Y, +Z, -Z. No mip levels
+  void loadCubemap(uint32_t texture, const std::vector<std::string> &faces) {
+    queue(texture, GL_TEXTURE_CUBE_MAP, faces, false, false);
+  }
+
+  // Call once per frame on the thread owning the GL context
+  void update(double budgetMs) {
+    auto start = std::chrono::steady_clock::now();
+    stats.uploadedLastUpdate = 0;
+    stats.uploadMsLastUpdate = 0.0;
+    stats.cooked = shared->cooked.load();
+    stats.mapped = shared->mapped.load();
+
+    while (true) {
+      std::shared_ptr<Request> request;
+      {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        if (shared->decoded.empty())
+          break;
+        request = std::move(shared->decoded.front());
+        shared->decoded.pop_front();
+      }
+      // Requests from before clear() belong to deleted textures
+      if (request->epoch != epoch)
+        continue;
+
+      size_t bytes = upload(*request);
+      stats.pending--;
+      stats.uploadedLastUpdate++;
+      if (onUploaded)
+        onUploaded(request->texture, bytes);
+
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      stats.uploadMsLastUpdate = elapsed.count();
+      if (elapsed.count() >= budgetMs)
+        break;
+    }
+  }
+
+  // Forgets every pending request, for when their textures are deleted.
+  // Decodes already running finish in the background and are dropped
+  void clear() {
+    epoch++;
+    stats.pending = 0;
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->decoded.clear();
+  }
+
+  void setUploadCallback(UploadCallback callback) {
+    onUploaded = std::move(callback);
+  }
+  void setUsePixelBuffers(bool enabled) { usePixelBuffers = enabled; }
+  // nullptr uploads whole chains
+  void setStreamer(TextureStreamer *textureStreamer) {
+    streamer = textureStreamer;
+  }
+  bool isIdle() const { return stats.pending == 0; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  struct Image {
+    std::string path;
+    CookedTexture texture; // No levels when loading failed
+  };
+
+  struct Request {
+    uint32_t texture = 0;
+    GLenum target = GL_TEXTURE_2D;
+    bool mipmaps = false;
+    uint64_t epoch = 0;
+    std::vector<Image> images;
+    std::atomic<size_t> remaining{0}; // Images still being loaded
+  };
+
+  // Outlives the loader while decodes are in flight
+  struct Shared {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<Request>> decoded;
+    std::atomic<uint32_t> cooked{0};
+    std::atomic<uint32_t> mapped{0};
+  };
+
+  std::shared_ptr<Shared> shared;
+  uint64_t epoch = 0;
+  bool usePixelBuffers = false;
+  uint32_t pixelBuffer = 0;
+  TextureStreamer *streamer = nullptr;
+  UploadCallback onUploaded;
+  Stats stats;
+
+  void queue(uint32_t texture, GLenum target,
+             const std::vector<std::string> &paths, bool flipY,
+             bool mipmaps) {
+    auto request = std::make_shared<Request>();
+    request->texture = texture;
+    request->target = target;
+    request->mipmaps = mipmaps;
+    request->epoch = epoch;
+    request->images.resize(paths.size());
+    request->remaining = paths.size();
+    for (size_t i = 0; i < paths.size(); i++) {
+      request->images[i].path = paths[i];
+    }
+    stats.pending++;
+
+    // Every image decodes on its own, the last one done hands the request
+    // over to the render thread
+    auto &pool = ThreadPool::instance();
+    for (size_t i = 0; i < paths.size(); i++) {
+      std::shared_ptr<Shared> state = shared;
+      pool.submit([state, request, i, flipY, mipmaps] {
+        loadImage(*state, request->images[i], flipY, mipmaps);
+        if (request->remaining.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->decoded.push_back(request);
+        }
+      });
+    }
+  }
+
+  // Runs on a worker
+  static void loadImage(Shared &state, Image &image, bool flipY,
+                        bool mipmaps) {
+    MappedFile source(image.path);
+    if (!source.isOpen())
+      return;
+
+    CookedTexture::Key key;
+    key.sourceHash = source.hash();
+    key.flags = (flipY ? CookedTexture::FLIP_Y : 0) |
+                (mipmaps ? CookedTexture::MIPMAPS : 0);
+    std::string cookedPath = CookedTexture::pathFor(image.path);
+    if (CookedTexture::read(cookedPath, key, image.texture)) {
+      state.mapped++;
+      return;
+    }
+
+    // Always RGBA, the cooked format has a single layout
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(flipY);
+    unsigned char *pixels =
+        stbi_load_from_memory(source.data(), static_cast<int>(source.size()),
+                              &width, &height, &channels, 4);
+    if (!pixels)
+      return;
+    CookedTexture::cook(pixels, width, height, mipmaps, image.texture);
+    stbi_image_free(pixels);
+    if (CookedTexture::write(cookedPath, key, image.texture) && mipmaps)
+      CookedTexture::read(cookedPath, key, image.texture);
+    state.cooked++;
+  }
+
+  // Returns the bytes uploaded
+  size_t upload(Request &request) {
+    auto &glState = GLStateCache::instance();
+    glState.bindTexture(request.target, request.texture);
+
+    bool loaded = true;
+    size_t firstLevel = 0;
+    size_t levelCount = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < request.images.size(); i++) {
+      Image &image = request.images[i];
+      if (image.texture.levels.empty()) {
+        std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << image.path
+                  << std::endl;
+        loaded = false;
+        continue;
+      }
+
+      GLenum target = request.target == GL_TEXTURE_CUBE_MAP
+                          ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+                          : request.target;
+      levelCount = image.texture.levels.size();
+      if (streamer && request.target == GL_TEXTURE_2D && request.mipmaps)
+        firstLevel = TextureStreamer::tailLevel(image.texture);
+      for (size_t level = firstLevel; level < levelCount; level++) {
+        const CookedTexture::Level &mip = image.texture.levels[level];
+        const void *source = usePixelBuffers
+                                 ? stage(mip.pixels, mip.bytes())
+                                 : mip.pixels;
+        glTexImage2D(target, static_cast<GLint>(level), GL_RGBA8, mip.width,
+                     mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, source);
+        if (usePixelBuffers)
+          glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        bytes += mip.bytes();
+      }
+    }
+
+    // The chain is complete as cooked, no glGenerateMipmap
+    if (loaded) {
+      glTexParameteri(request.target, GL_TEXTURE_BASE_LEVEL,
+                      static_cast<GLint>(firstLevel));
+      glTexParameteri(request.target, GL_TEXTURE_MAX_LEVEL,
+                      static_cast<GLint>(levelCount) - 1);
+    }
+    if (loaded && firstLevel > 0) {
+      streamer->add(request.texture, std::move(request.images[0].texture),
+                    static_cast<uint32_t>(firstLevel));
+    }
+    stats.uploadedBytes += bytes;
+    return bytes;
+  }
+
+  // Copies pixels into the unpack buffer and leaves it bound. Returns the
+  // pointer glTexImage2D should get: offset 0 into the buffer, or the
+  // pixels themselves if mapping failed
+  const void *stage(const unsigned char *pixels, size_t bytes) {
+    if (!pixelBuffer)
+      glGenBuffers(1, &pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    // Orphaning gives fresh storage, no waiting for the previous transfer
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                    GL_MAP_WRITE_BIT |
+                                        GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return pixels;
+    }
+    std::memcpy(mapped, pixels, bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    return nullptr;
+  }
+};
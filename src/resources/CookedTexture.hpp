@@ -0,0 +1,272 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../utils/MappedFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Cooked texture container (<source>.mtex), built from a source image the
+// first time it is loaded. A small header, one record per mip level, then
+// the levels tightly packed as RGBA8, ready for glTexImage2D. Reading maps
+// the file, levels point straight into the mapping and nothing is decoded.
+//
+// Like MeshCache it is keyed by the source file hash and the load flags.
+// The header has no timestamps and the downsampler is exact integer math,
+// so cooking the same image always gives the same bytes.
+//
+// Only RGBA8 for now: GL 3.3 core has no block compression for colour
+// textures (RGTC covers one and two channels), internalFormat is there so
+// compressed levels can be added behind an extension check.
+class CookedTexture {
+public:
+  // Bump whenever the layout or the downsampler changes
+  static const uint32_t VERSION = 1;
+
+  enum Flags : uint32_t { FLIP_Y = 1, MIPMAPS = 2 };
+
+  struct Key {
+    uint64_t sourceHash = 0;
+    uint32_t flags = 0;
+  };
+
+  struct Level {
+    const uint8_t *pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    size_t bytes() const { return size_t(width) * height * 4; }
+  };
+
+  // Levels point into mapping after read() and into storage after cook()
+  std::vector<Level> levels;
+  std::unique_ptr<MappedFile> mapping;
+  std::vector<uint8_t> storage;
+
+  static std::string pathFor(const std::string &source) {
+    return source + ".mtex";
+  }
+
+  // False when there is no usable cooked file for key
+  static bool read(const std::string &path, const Key &key,
+                   CookedTexture &out) {
+    auto mapping = std::make_unique<MappedFile>(path);
+    if (!mapping->isOpen())
+      return false;
+    const uint8_t *base = mapping->data();
+    size_t size = mapping->size();
+
+    Header header;
+    if (size < sizeof(Header))
+      return false;
+    std::memcpy(&header, base, sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VERSION || header.sourceHash != key.sourceHash ||
+        header.flags != key.flags || header.internalFormat != GL_RGBA8)
+      return false;
+    if (header.levelCount == 0 || header.levelCount > 32 ||
+        sizeof(Header) + header.levelCount * sizeof(LevelRecord) > size)
+      return false;
+
+    std::vector<Level> levels(header.levelCount);
+    uint32_t width = header.width;
+    uint32_t height = header.height;
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+      LevelRecord record;
+      std::memcpy(&record, base + sizeof(Header) + i * sizeof(LevelRecord),
+                  sizeof(LevelRecord));
+      levels[i].width = record.width;
+      levels[i].height = record.height;
+      if (record.width != width || record.height != height ||
+          record.offset > size || levels[i].bytes() > size - record.offset)
+        return reject(path);
+      levels[i].pixels = base + record.offset;
+      width = std::max(1u, width / 2);
+      height = std::max(1u, height / 2);
+    }
+
+    out.levels = std::move(levels);
+    out.mapping = std::move(mapping);
+    out.storage.clear();
+    return true;
+  }
+
+  // Builds the level chain from RGBA8 pixels, out owns the result
+  static void cook(const uint8_t *rgba, uint32_t width, uint32_t height,
+                   bool mipmaps, CookedTexture &out) {
+    std::vector<Level> levels;
+    size_t total = 0;
+    uint32_t w = width;
+    uint32_t h = height;
+    while (true) {
+      Level level;
+      level.width = w;
+      level.height = h;
+      levels.push_back(level);
+      total += level.bytes();
+      if (!mipmaps || (w == 1 && h == 1))
+        break;
+      w = std::max(1u, w / 2);
+      h = std::max(1u, h / 2);
+    }
+
+    out.mapping.reset();
+    out.storage.assign(total, 0);
+    size_t offset = 0;
+    for (Level &level : levels) {
+      level.pixels = out.storage.data() + offset;
+      offset += level.bytes();
+    }
+
+    std::memcpy(out.storage.data(), rgba, levels[0].bytes());
+    for (size_t i = 1; i < levels.size(); i++) {
+      downsample(levels[i - 1].pixels, levels[i - 1].width,
+                 levels[i - 1].height,
+                 const_cast<uint8_t *>(levels[i].pixels));
+    }
+    out.levels = std::move(levels);
+  }
+
+  // Writes to a temporary file first, see MeshCache::write
+  static bool write(const std::string &path, const Key &key,
+                    const CookedTexture &texture) {
+    if (texture.levels.empty())
+      return false;
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.flags = key.flags;
+    header.sourceHash = key.sourceHash;
+    header.width = texture.levels[0].width;
+    header.height = texture.levels[0].height;
+    header.levelCount = static_cast<uint32_t>(texture.levels.size());
+    header.internalFormat = GL_RGBA8;
+
+    std::vector<LevelRecord> records(texture.levels.size());
+    uint64_t offset =
+        sizeof(Header) + texture.levels.size() * sizeof(LevelRecord);
+    for (size_t i = 0; i < texture.levels.size(); i++) {
+      records[i].offset = offset;
+      records[i].width = texture.levels[i].width;
+      records[i].height = texture.levels[i].height;
+      offset += texture.levels[i].bytes();
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE *file = std::fopen(tempPath.c_str(), "wb");
+    if (!file) {
+      std::cout << "ERROR::COOKED_TEXTURE::WRITE_FAILED: " << path
+                << std::endl;
+      return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+              std::fwrite(records.data(), sizeof(LevelRecord),
+                          records.size(), file) == records.size();
+    for (const Level &level : texture.levels) {
+      ok = ok &&
+           std::fwrite(level.pixels, 1, level.bytes(), file) == level.bytes();
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+      std::remove(tempPath.c_str());
+      std::cout << "ERROR::COOKED_TEXTURE::WRITE_FAILED: " << path
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // 2x2 box filter of an RGBA8 level into the next one (floor(size / 2),
+  // at least 1), rounded to nearest. Odd sizes drop the last row or column.
+  // The SSE2 path computes exactly what the scalar loop does
+  static void downsample(const uint8_t *src, uint32_t width, uint32_t height,
+                         uint8_t *dst) {
+    uint32_t outWidth = std::max(1u, width / 2);
+    uint32_t outHeight = std::max(1u, height / 2);
+
+    for (uint32_t y = 0; y < outHeight; y++) {
+      const uint8_t *row0 =
+          src + size_t(std::min(2 * y, height - 1)) * width * 4;
+      const uint8_t *row1 =
+          src + size_t(std::min(2 * y + 1, height - 1)) * width * 4;
+      uint8_t *out = dst + size_t(y) * outWidth * 4;
+      uint32_t x = 0;
+
+#if defined(__SSE2__)
+      // Four output pixels from eight input pixels of both rows
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i two = _mm_set1_epi16(2);
+      for (; width >= 2 && x + 4 <= outWidth; x += 4) {
+        __m128i result[2];
+        for (int half = 0; half < 2; half++) {
+          const uint8_t *a = row0 + (x + half * 2) * 8;
+          const uint8_t *b = row1 + (x + half * 2) * 8;
+          __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+          __m128i bottom =
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+          // 16 bit vertical sums of input pixels 0,1 and 2,3
+          __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero),
+                                      _mm_unpacklo_epi8(bottom, zero));
+          __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero),
+                                       _mm_unpackhi_epi8(bottom, zero));
+          // Horizontal pairs, each result in the low 64 bits
+          low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+          high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+          __m128i sum = _mm_unpacklo_epi64(low, high);
+          result[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x * 4),
+                         _mm_packus_epi16(result[0], result[1]));
+      }
+#endif
+
+      for (; x < outWidth; x++) {
+        uint32_t x0 = std::min(2 * x, width - 1) * 4;
+        uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+        for (int c = 0; c < 4; c++) {
+          uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                         row1[x1 + c];
+          out[x * 4 + c] = static_cast<uint8_t>((sum + 2) >> 2);
+        }
+      }
+    }
+  }
+
+private:
+  static constexpr char MAGIC[8] = {'M', 'T', 'E', 'X', '\0', '\0', '\0',
+                                    '\0'};
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t sourceHash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t internalFormat;
+  };
+
+  struct LevelRecord {
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  static bool reject(const std::string &path) {
+    std::cout << "COOKED_TEXTURE::CORRUPT: " << path << ", recooking"
+              << std::endl;
+    return false;
+  }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../gl_common.hpp"
+#include "GLStateCache.hpp"
 #include <iostream>
 
 class Framebuffer {
@@ -51,11 +52,11 @@ public:
   void create() {
     // Generate framebuffer
     glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLStateCache::instance().bindFramebuffer(fbo);
 
     // Create color texture attachment
     glGenTextures(1, &colorTexture);
-    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, colorTexture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
                  GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -75,12 +76,12 @@ public:
                 << std::endl;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLStateCache::instance().bindFramebuffer(0);
   }
 
-  void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
+  void bind() const { GLStateCache::instance().bindFramebuffer(fbo); }
 
-  void unbind() const { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+  void unbind() const { GLStateCache::instance().bindFramebuffer(0); }
 
   void resize(unsigned int w, unsigned int h) {
     if (width == w && height == h)
@@ -94,11 +95,11 @@ public:
 
   void cleanup() {
     if (fbo) {
-      glDeleteFramebuffers(1, &fbo);
+      GLStateCache::instance().deleteFramebuffer(fbo);
       fbo = 0;
     }
     if (colorTexture) {
-      glDeleteTextures(1, &colorTexture);
+      GLStateCache::instance().deleteTexture(colorTexture);
       colorTexture = 0;
     }
     if (rbo) {
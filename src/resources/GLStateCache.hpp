@@ -0,0 +1,337 @@
+#pragma once
+
+#include "../gl_common.hpp"
+
+#include <stdint.h>
+
+// Shadow copy of the GL state the engine touches. Every bind/enable/blend call
+// goes through here so calls that would not change anything are dropped.
+// State starts out unknown, so the first call of each kind always reaches GL.
+// Code that changes state behind the cache's back must call invalidate().
+class GLStateCache {
+public:
+  static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+  struct Stats {
+    uint32_t issued = 0;
+    uint32_t skipped = 0;
+  };
+
+  // Singleton
+  static GLStateCache &instance() {
+    static GLStateCache inst;
+    return inst;
+  }
+
+  GLStateCache(const GLStateCache &) = delete;
+  GLStateCache &operator=(const GLStateCache &) = delete;
+
+  // Forget everything, the next call of each kind is always issued
+  void invalidate() {
+    program = UNKNOWN;
+    vertexArray = UNKNOWN;
+    arrayBuffer = UNKNOWN;
+    framebuffer = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for (auto &unit : textures) {
+      unit.texture2D = UNKNOWN;
+      unit.cubeMap = UNKNOWN;
+    }
+    for (int &cap : capabilities) {
+      cap = -1;
+    }
+    blendSrc = blendDst = UNKNOWN;
+    depthFunc = UNKNOWN;
+    depthMask = -1;
+    colorMask = -1;
+    stencilFunc = stencilRef = stencilFuncMask = UNKNOWN;
+    stencilMask = UNKNOWN;
+    stencilFail = stencilDepthFail = stencilPass = UNKNOWN;
+    cullFace = UNKNOWN;
+    viewport[0] = viewport[1] = viewport[2] = viewport[3] = -1;
+  }
+
+  // ========== STATS ==========
+
+  // Called once per frame by the main loop, moves the counters to lastFrame
+  void endFrame() {
+    lastFrame = current;
+    current = Stats{};
+  }
+
+  const Stats &getLastFrameStats() const { return lastFrame; }
+
+  // ========== OBJECT BINDINGS ==========
+
+  void useProgram(GLuint id) {
+    if (check(program, id))
+      glUseProgram(id);
+  }
+
+  void bindVertexArray(GLuint id) {
+    if (check(vertexArray, id))
+      glBindVertexArray(id);
+  }
+
+  // GL_ELEMENT_ARRAY_BUFFER is VAO state, so only GL_ARRAY_BUFFER is tracked
+  void bindBuffer(GLenum target, GLuint id) {
+    if (target != GL_ARRAY_BUFFER) {
+      glBindBuffer(target, id);
+      current.issued++;
+      return;
+    }
+    if (check(arrayBuffer, id))
+      glBindBuffer(target, id);
+  }
+
+  void bindFramebuffer(GLuint id) {
+    if (check(framebuffer, id))
+      glBindFramebuffer(GL_FRAMEBUFFER, id);
+  }
+
+  void activeTexture(GLuint unit) {
+    if (check(activeUnit, unit))
+      glActiveTexture(GL_TEXTURE0 + unit);
+  }
+
+  // Binds on the given unit, only switching the active unit when needed.
+  // 2D and cube map bindings are tracked, other targets always go through
+  void bindTexture(GLuint unit, GLenum target, GLuint id) {
+    GLuint *bound = trackedTexture(unit, target);
+    if (bound && *bound == id) {
+      current.skipped++;
+      return;
+    }
+    activeTexture(unit);
+    glBindTexture(target, id);
+    current.issued++;
+    if (bound)
+      *bound = id;
+  }
+
+  // Binds on whatever unit is active, used when creating/uploading textures
+  void bindTexture(GLenum target, GLuint id) {
+    bindTexture(activeUnit == UNKNOWN ? 0 : activeUnit, target, id);
+  }
+
+  // ========== FIXED FUNCTION STATE ==========
+
+  void enable(GLenum cap) { setCapability(cap, true); }
+  void disable(GLenum cap) { setCapability(cap, false); }
+
+  void blendFunc(GLenum src, GLenum dst) {
+    if (blendSrc == src && blendDst == dst) {
+      current.skipped++;
+      return;
+    }
+    blendSrc = src;
+    blendDst = dst;
+    glBlendFunc(src, dst);
+    current.issued++;
+  }
+
+  void setDepthFunc(GLenum func) {
+    if (check(depthFunc, func))
+      glDepthFunc(func);
+  }
+
+  void setDepthMask(bool write) {
+    if (depthMask == static_cast<int>(write)) {
+      current.skipped++;
+      return;
+    }
+    depthMask = write;
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+    current.issued++;
+  }
+
+  // All four channels together, the engine never masks single channels
+  void setColorMask(bool write) {
+    if (colorMask == static_cast<int>(write)) {
+      current.skipped++;
+      return;
+    }
+    colorMask = write;
+    GLboolean value = write ? GL_TRUE : GL_FALSE;
+    glColorMask(value, value, value, value);
+    current.issued++;
+  }
+
+  void setStencilFunc(GLenum func, GLint ref, GLuint mask) {
+    if (stencilFunc == func && stencilRef == static_cast<GLuint>(ref) &&
+        stencilFuncMask == mask) {
+      current.skipped++;
+      return;
+    }
+    stencilFunc = func;
+    stencilRef = ref;
+    stencilFuncMask = mask;
+    glStencilFunc(func, ref, mask);
+    current.issued++;
+  }
+
+  void setStencilMask(GLuint mask) {
+    if (check(stencilMask, mask))
+      glStencilMask(mask);
+  }
+
+  void setStencilOp(GLenum fail, GLenum depthFail, GLenum pass) {
+    if (stencilFail == fail && stencilDepthFail == depthFail &&
+        stencilPass == pass) {
+      current.skipped++;
+      return;
+    }
+    stencilFail = fail;
+    stencilDepthFail = depthFail;
+    stencilPass = pass;
+    glStencilOp(fail, depthFail, pass);
+    current.issued++;
+  }
+
+  void setCullFace(GLenum face) {
+    if (check(cullFace, face))
+      glCullFace(face);
+  }
+
+  void setViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (viewport[0] == x && viewport[1] == y && viewport[2] == width &&
+        viewport[3] == height) {
+      current.skipped++;
+      return;
+    }
+    viewport[0] = x;
+    viewport[1] = y;
+    viewport[2] = width;
+    viewport[3] = height;
+    glViewport(x, y, width, height);
+    current.issued++;
+  }
+
+  // ========== DELETION ==========
+  // GL unbinds deleted objects (and may reuse their names), so the cache
+  // has to forget them too
+
+  void deleteProgram(GLuint id) {
+    if (program == id)
+      program = UNKNOWN;
+    glDeleteProgram(id);
+  }
+
+  void deleteVertexArray(GLuint id) {
+    if (vertexArray == id)
+      vertexArray = 0;
+    glDeleteVertexArrays(1, &id);
+  }
+
+  void deleteBuffer(GLuint id) {
+    if (arrayBuffer == id)
+      arrayBuffer = 0;
+    glDeleteBuffers(1, &id);
+  }
+
+  void deleteTexture(GLuint id) {
+    for (auto &unit : textures) {
+      if (unit.texture2D == id)
+        unit.texture2D = 0;
+      if (unit.cubeMap == id)
+        unit.cubeMap = 0;
+    }
+    glDeleteTextures(1, &id);
+  }
+
+  void deleteFramebuffer(GLuint id) {
+    if (framebuffer == id)
+      framebuffer = 0;
+    glDeleteFramebuffers(1, &id);
+  }
+
+private:
+  static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+  enum Capability { CAP_DEPTH, CAP_BLEND, CAP_STENCIL, CAP_CULL, CAP_COUNT };
+
+  struct TextureUnit {
+    GLuint texture2D = UNKNOWN;
+    GLuint cubeMap = UNKNOWN;
+  };
+
+  GLuint program = UNKNOWN;
+  GLuint vertexArray = UNKNOWN;
+  GLuint arrayBuffer = UNKNOWN;
+  GLuint framebuffer = UNKNOWN;
+  GLuint activeUnit = UNKNOWN;
+  TextureUnit textures[MAX_TEXTURE_UNITS];
+
+  int capabilities[CAP_COUNT] = {-1, -1, -1, -1}; // -1 unknown, 0 off, 1 on
+  GLenum blendSrc = UNKNOWN;
+  GLenum blendDst = UNKNOWN;
+  GLenum depthFunc = UNKNOWN;
+  int depthMask = -1;
+  int colorMask = -1;
+  GLenum stencilFunc = UNKNOWN;
+  GLuint stencilRef = UNKNOWN;
+  GLuint stencilFuncMask = UNKNOWN;
+  GLuint stencilMask = UNKNOWN;
+  GLenum stencilFail = UNKNOWN;
+  GLenum stencilDepthFail = UNKNOWN;
+  GLenum stencilPass = UNKNOWN;
+  GLenum cullFace = UNKNOWN;
+  GLint viewport[4] = {-1, -1, -1, -1};
+
+  Stats current;
+  Stats lastFrame;
+
+  GLStateCache() = default;
+
+  // Updates the shadow value, returns true if the GL call has to be made
+  bool check(GLuint &cached, GLuint value) {
+    if (cached == value) {
+      current.skipped++;
+      return false;
+    }
+    cached = value;
+    current.issued++;
+    return true;
+  }
+
+  GLuint *trackedTexture(GLuint unit, GLenum target) {
+    if (unit >= MAX_TEXTURE_UNITS)
+      return nullptr;
+    if (target == GL_TEXTURE_2D)
+      return &textures[unit].texture2D;
+    if (target == GL_TEXTURE_CUBE_MAP)
+      return &textures[unit].cubeMap;
+    return nullptr;
+  }
+
+  void setCapability(GLenum cap, bool on) {
+    int index = capabilityIndex(cap);
+    if (index < 0) {
+      on ? glEnable(cap) : glDisable(cap);
+      current.issued++;
+      return;
+    }
+    if (capabilities[index] == static_cast<int>(on)) {
+      current.skipped++;
+      return;
+    }
+    capabilities[index] = on;
+    on ? glEnable(cap) : glDisable(cap);
+    current.issued++;
+  }
+
+  static int capabilityIndex(GLenum cap) {
+    switch (cap) {
+    case GL_DEPTH_TEST:
+      return CAP_DEPTH;
+    case GL_BLEND:
+      return CAP_BLEND;
+    case GL_STENCIL_TEST:
+      return CAP_STENCIL;
+    case GL_CULL_FACE:
+      return CAP_CULL;
+    default:
+      return -1;
+    }
+  }
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "GLStateCache.hpp"
+#include "VertexLayout.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+// Shared vertex and index buffers for every mesh with one vertex layout.
+// Meshes are addressed by a base vertex and a first index, so all of them
+// draw from the same VAO and consecutive draws can be merged into one
+// glMultiDraw* call, see MultiDrawBatch.
+//
+// free() hands a mesh's ranges back. Allocations take the first free range
+// that fits and are appended at the end otherwise; freed ranges at the end
+// shrink the used size again.
+//
+// Buffers start small and double when full. Growing copies the old contents
+// on the GPU and re-points the VAO, whose ID never changes, so MeshComponents
+// created earlier stay valid.
+class GeometryArena {
+public:
+  struct Allocation {
+    uint32_t baseVertex = 0;
+    uint32_t firstIndex = 0;
+  };
+
+  struct Stats {
+    uint32_t meshes = 0;
+    uint32_t vertices = 0;
+    uint32_t indices = 0;
+    uint32_t growths = 0;
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+  };
+
+  GeometryArena(const std::vector<VertexAttribute> &attributes,
+                size_t initialVertexBytes = 1 << 20,
+                size_t initialIndexBytes = 1 << 18)
+      : attributes(attributes), stride(VertexLayout::stride(attributes)),
+        vertexCapacity(initialVertexBytes), indexCapacity(initialIndexBytes) {
+    auto &glState = GLStateCache::instance();
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCapacity, nullptr, GL_STATIC_DRAW);
+    glState.bindVertexArray(vao);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity, nullptr,
+                 GL_STATIC_DRAW);
+    setupAttributes();
+    glState.bindVertexArray(0);
+  }
+
+  ~GeometryArena() {
+    auto &glState = GLStateCache::instance();
+    glState.deleteVertexArray(vao);
+    glState.deleteBuffer(vbo);
+    glState.deleteBuffer(ebo);
+  }
+
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena &operator=(const GeometryArena &) = delete;
+
+  bool matches(const std::vector<VertexAttribute> &layout) const {
+    return layout == attributes;
+  }
+
+  // Copies vertexCount vertices of this layout (and, optionally, indices
+  // relative to the mesh's first vertex) into the shared buffers. Meshes
+  // with 16 and 32 bit indices can share an arena, firstIndex counts
+  // elements of the mesh's own index type
+  Allocation allocate(const void *vertices, uint32_t vertexCount,
+                      const void *indices = nullptr, uint32_t indexCount = 0,
+                      GLenum indexType = GL_UNSIGNED_INT) {
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    size_t vertexBytes = static_cast<size_t>(vertexCount) * stride;
+    size_t indexBytes = static_cast<size_t>(indexCount) * indexSize;
+
+    // Offsets are multiples of the element size, see reserve()
+    size_t vertexOffset = reserve(freeVertices, vertexBytes, stride,
+                                  GL_ARRAY_BUFFER, vbo, vertexCapacity,
+                                  vertexUsed);
+    size_t indexOffset = reserve(freeIndices, indexBytes, indexSize,
+                                 GL_ELEMENT_ARRAY_BUFFER, ebo, indexCapacity,
+                                 indexUsed);
+
+    Allocation allocation;
+    allocation.baseVertex = static_cast<uint32_t>(vertexOffset / stride);
+    allocation.firstIndex = static_cast<uint32_t>(indexOffset / indexSize);
+
+    auto &glState = GLStateCache::instance();
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexOffset, vertexBytes, vertices);
+    if (indexCount > 0) {
+      glState.bindVertexArray(vao);
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffset, indexBytes,
+                      indices);
+      glState.bindVertexArray(0);
+    }
+
+    stats.meshes++;
+    stats.vertices += vertexCount;
+    stats.indices += indexCount;
+    stats.vertexBytes += vertexBytes;
+    stats.indexBytes += indexBytes;
+    return allocation;
+  }
+
+  // Returns an allocation's ranges, arguments as given to allocate(). The
+  // mesh must not be drawn afterwards, its ranges will be overwritten
+  void free(const Allocation &allocation, uint32_t vertexCount,
+            uint32_t indexCount = 0, GLenum indexType = GL_UNSIGNED_INT) {
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    size_t vertexBytes = static_cast<size_t>(vertexCount) * stride;
+    size_t indexBytes = static_cast<size_t>(indexCount) * indexSize;
+    release(freeVertices, allocation.baseVertex * stride, vertexBytes,
+            vertexUsed);
+    release(freeIndices, allocation.firstIndex * indexSize, indexBytes,
+            indexUsed);
+
+    stats.meshes--;
+    stats.vertices -= vertexCount;
+    stats.indices -= indexCount;
+    stats.vertexBytes -= vertexBytes;
+    stats.indexBytes -= indexBytes;
+  }
+
+  // Reads a mesh back from the GPU, only meant for load time tools such as
+  // StaticBatcher. Vertices come back in this arena's layout
+  void readVertices(uint32_t baseVertex, uint32_t count,
+                    std::vector<uint8_t> &out) const {
+    out.resize(static_cast<size_t>(count) * stride);
+    glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, baseVertex * stride, out.size(),
+                       out.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+
+  // Indices are widened to 32 bit
+  void readIndices(uint32_t firstIndex, uint32_t count, GLenum indexType,
+                   std::vector<uint32_t> &out) const {
+    out.resize(count);
+    glBindBuffer(GL_COPY_READ_BUFFER, ebo);
+    if (indexType == GL_UNSIGNED_SHORT) {
+      std::vector<uint16_t> shortIndices(count);
+      glGetBufferSubData(GL_COPY_READ_BUFFER, firstIndex * sizeof(uint16_t),
+                         count * sizeof(uint16_t), shortIndices.data());
+      out.assign(shortIndices.begin(), shortIndices.end());
+    } else {
+      glGetBufferSubData(GL_COPY_READ_BUFFER, firstIndex * sizeof(uint32_t),
+                         count * sizeof(uint32_t), out.data());
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+
+  uint32_t getVAO() const { return vao; }
+  size_t getStride() const { return stride; }
+  const std::vector<VertexAttribute> &getAttributes() const {
+    return attributes;
+  }
+  const Stats &getStats() const { return stats; }
+  // GPU memory held by the buffers, used or not
+  size_t getCapacityBytes() const { return vertexCapacity + indexCapacity; }
+
+private:
+  struct Range {
+    size_t offset;
+    size_t size;
+  };
+
+  std::vector<VertexAttribute> attributes;
+  size_t stride;
+
+  uint32_t vao = 0;
+  uint32_t vbo = 0;
+  uint32_t ebo = 0;
+  size_t vertexCapacity;
+  size_t indexCapacity;
+  size_t vertexUsed = 0;
+  size_t indexUsed = 0;
+  std::vector<Range> freeVertices; // Sorted by offset, below vertexUsed
+  std::vector<Range> freeIndices;
+  Stats stats;
+
+  void setupAttributes() {
+    for (const VertexAttribute &attr : attributes) {
+      glVertexAttribPointer(attr.location, attr.componentCount, attr.type,
+                            attr.normalized ? GL_TRUE : GL_FALSE,
+                            static_cast<GLsizei>(stride), attr.offset);
+      glEnableVertexAttribArray(attr.location);
+    }
+  }
+
+  // Byte offset for size bytes: the first free range with room for them at
+  // an aligned offset, otherwise the end of the buffer (grown if needed)
+  size_t reserve(std::vector<Range> &ranges, size_t size, size_t alignment,
+                 GLenum target, uint32_t &buffer, size_t &capacity,
+                 size_t &used) {
+    if (size == 0)
+      return 0;
+
+    for (size_t i = 0; i < ranges.size(); i++) {
+      size_t start =
+          (ranges[i].offset + alignment - 1) / alignment * alignment;
+      size_t end = ranges[i].offset + ranges[i].size;
+      if (start + size > end)
+        continue;
+      // Whatever is left on either side stays free
+      Range head = {ranges[i].offset, start - ranges[i].offset};
+      Range tail = {start + size, end - start - size};
+      ranges.erase(ranges.begin() + i);
+      if (tail.size > 0)
+        ranges.insert(ranges.begin() + i, tail);
+      if (head.size > 0)
+        ranges.insert(ranges.begin() + i, head);
+      return start;
+    }
+
+    size_t start = (used + alignment - 1) / alignment * alignment;
+    if (start + size > capacity)
+      grow(target, buffer, capacity, used, start + size);
+    used = start + size;
+    return start;
+  }
+
+  // Merges the range with its free neighbours. A free range at the end of
+  // the buffer is given back to the bump pointer instead
+  static void release(std::vector<Range> &ranges, size_t offset, size_t size,
+                      size_t &used) {
+    if (size == 0)
+      return;
+
+    auto it = ranges.begin();
+    while (it != ranges.end() && it->offset < offset) {
+      ++it;
+    }
+    it = ranges.insert(it, {offset, size});
+    if (it + 1 != ranges.end() && it->offset + it->size == (it + 1)->offset) {
+      it->size += (it + 1)->size;
+      ranges.erase(it + 1);
+    }
+    if (it != ranges.begin() && (it - 1)->offset + (it - 1)->size == offset) {
+      (it - 1)->size += it->size;
+      it = ranges.erase(it) - 1;
+    }
+
+    if (!ranges.empty() &&
+        ranges.back().offset + ranges.back().size == used) {
+      used = ranges.back().offset;
+      ranges.pop_back();
+    }
+  }
+
+  // Replaces buffer by a larger one holding the same first `used` bytes
+  void grow(GLenum target, uint32_t &buffer, size_t &capacity, size_t used,
+            size_t required) {
+    auto &glState = GLStateCache::instance();
+    size_t newCapacity = capacity;
+    while (newCapacity < required) {
+      newCapacity *= 2;
+    }
+
+    uint32_t newBuffer = 0;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_STATIC_DRAW);
+    if (used > 0) {
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                          used);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glState.deleteBuffer(buffer);
+    buffer = newBuffer;
+    capacity = newCapacity;
+
+    // The VAO still references the old buffer
+    glState.bindVertexArray(vao);
+    if (target == GL_ELEMENT_ARRAY_BUFFER) {
+      glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    } else {
+      glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+      setupAttributes();
+    }
+    glState.bindVertexArray(0);
+    stats.growths++;
+  }
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "../components/MaterialComponent.hpp"
+#include "../gl_common.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Lighting parameters of every material in one buffer texture, each distinct
+// set of values stored once. A lit draw only selects its entry with the
+// materialIndex uniform; the shaders read the values with texelFetch (see
+// staticFragment.glsl), the same way LightingSystem hands over the lights.
+//
+// MaterialSystem walks the materials once per frame: acquire() finds (or
+// adds) the entry for their values, entries no material used that frame are
+// recycled and only entries that changed are uploaded.
+class MaterialTable {
+public:
+  // Above the material textures and LightingSystem's cluster buffers
+  static const unsigned int TEXTURE_UNIT = 11;
+  // RGBA32F texels per entry: ambient, diffuse, (specular, shininess)
+  static const uint32_t TEXELS_PER_MATERIAL = 3;
+
+  struct Params {
+    glm::vec3 ambient = glm::vec3(0.0f);
+    glm::vec3 diffuse = glm::vec3(0.0f);
+    glm::vec3 specular = glm::vec3(0.0f);
+    float shininess = 0.0f;
+
+    static Params of(const MaterialComponent &material) {
+      Params params;
+      params.ambient = material.ambient;
+      params.diffuse = material.diffuse;
+      params.specular = material.specular;
+      params.shininess = material.shininess;
+      return params;
+    }
+
+    bool operator==(const Params &other) const {
+      return ambient == other.ambient && diffuse == other.diffuse &&
+             specular == other.specular && shininess == other.shininess;
+    }
+  };
+
+  struct Stats {
+    uint32_t materials = 0; // Distinct entries in use
+    uint32_t capacity = 0;
+    uint32_t uploadedLastFrame = 0; // Entries written to the buffer
+  };
+
+  MaterialTable() = default;
+  MaterialTable(const MaterialTable &) = delete;
+  MaterialTable &operator=(const MaterialTable &) = delete;
+
+  ~MaterialTable() { clear(); }
+
+  // Forgets every entry and deletes the buffer
+  void clear() {
+    auto &glState = GLStateCache::instance();
+    if (texture)
+      glState.deleteTexture(texture);
+    if (buffer)
+      glState.deleteBuffer(buffer);
+    texture = 0;
+    buffer = 0;
+    capacity = 0;
+    entries.clear();
+    live.clear();
+    used.clear();
+    freeEntries.clear();
+    byValue.clear();
+    texels.clear();
+    dirtyBegin = UINT32_MAX;
+    dirtyEnd = 0;
+    stats = Stats();
+  }
+
+  void beginFrame() {
+    std::fill(used.begin(), used.end(), false);
+    stats.uploadedLastFrame = 0;
+  }
+
+  // Index of the entry holding params. current is the index the material
+  // had last frame, checked first since values rarely change
+  uint32_t acquire(const Params &params, uint32_t current) {
+    if (current < entries.size() && live[current] &&
+        entries[current] == params) {
+      used[current] = true;
+      return current;
+    }
+
+    auto found = byValue.find(params);
+    if (found != byValue.end()) {
+      used[found->second] = true;
+      return found->second;
+    }
+
+    uint32_t index;
+    if (!freeEntries.empty()) {
+      index = freeEntries.back();
+      freeEntries.pop_back();
+    } else {
+      index = static_cast<uint32_t>(entries.size());
+      entries.emplace_back();
+      live.push_back(false);
+      used.push_back(false);
+      texels.resize(texels.size() + TEXELS_PER_MATERIAL);
+    }
+    entries[index] = params;
+    live[index] = true;
+    used[index] = true;
+    byValue[params] = index;
+
+    glm::vec4 *texel = &texels[index * TEXELS_PER_MATERIAL];
+    texel[0] = glm::vec4(params.ambient, 0.0f);
+    texel[1] = glm::vec4(params.diffuse, 0.0f);
+    texel[2] = glm::vec4(params.specular, params.shininess);
+    dirtyBegin = std::min(dirtyBegin, index);
+    dirtyEnd = std::max(dirtyEnd, index + 1);
+    return index;
+  }
+
+  // Recycles the entries nobody acquired since beginFrame(), uploads what
+  // changed and binds the table to TEXTURE_UNIT. Needs a current context
+  void endFrame() {
+    uint32_t count = 0;
+    for (uint32_t index = 0; index < entries.size(); index++) {
+      if (!live[index])
+        continue;
+      if (used[index]) {
+        count++;
+        continue;
+      }
+      live[index] = false;
+      byValue.erase(entries[index]);
+      freeEntries.push_back(index);
+    }
+    stats.materials = count;
+
+    upload();
+    if (texture) {
+      GLStateCache::instance().bindTexture(TEXTURE_UNIT, GL_TEXTURE_BUFFER,
+                                           texture);
+    }
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  struct ParamsHash {
+    size_t operator()(const Params &params) const {
+      float values[10] = {params.ambient.x,  params.ambient.y,
+                          params.ambient.z,  params.diffuse.x,
+                          params.diffuse.y,  params.diffuse.z,
+                          params.specular.x, params.specular.y,
+                          params.specular.z, params.shininess};
+      size_t hash = 0;
+      for (float value : values) {
+        // + 0.0f turns -0 into 0, they compare equal so must hash equal
+        value += 0.0f;
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        hash = hash * 31 + bits;
+      }
+      return hash;
+    }
+  };
+
+  std::vector<Params> entries;
+  std::vector<bool> live; // Holds a material's values
+  std::vector<bool> used; // Acquired this frame
+  std::vector<uint32_t> freeEntries;
+  std::unordered_map<Params, uint32_t, ParamsHash> byValue;
+
+  std::vector<glm::vec4> texels; // CPU copy of the buffer
+  uint32_t dirtyBegin = UINT32_MAX;
+  uint32_t dirtyEnd = 0;
+  uint32_t capacity = 0; // Entries the buffer has room for
+  uint32_t buffer = 0;
+  uint32_t texture = 0;
+  Stats stats;
+
+  void upload() {
+    if (dirtyBegin >= dirtyEnd)
+      return;
+
+    auto &glState = GLStateCache::instance();
+    if (!buffer) {
+      glGenBuffers(1, &buffer);
+      glGenTextures(1, &texture);
+      glState.bindTexture(GL_TEXTURE_BUFFER, texture);
+      glState.bindBuffer(GL_TEXTURE_BUFFER, buffer);
+      glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    }
+
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    size_t entryBytes = TEXELS_PER_MATERIAL * sizeof(glm::vec4);
+    if (entries.size() > capacity) {
+      // Grow with headroom and send everything, the texture keeps pointing
+      // at the buffer object
+      capacity = std::max<uint32_t>(64, static_cast<uint32_t>(
+                                            entries.size() * 2));
+      glBufferData(GL_TEXTURE_BUFFER, capacity * entryBytes, nullptr,
+                   GL_DYNAMIC_DRAW);
+      dirtyBegin = 0;
+      dirtyEnd = static_cast<uint32_t>(entries.size());
+    }
+    glBufferSubData(GL_TEXTURE_BUFFER, dirtyBegin * entryBytes,
+                    (dirtyEnd - dirtyBegin) * entryBytes,
+                    &texels[dirtyBegin * TEXELS_PER_MATERIAL]);
+
+    stats.uploadedLastFrame = dirtyEnd - dirtyBegin;
+    stats.capacity = capacity;
+    dirtyBegin = UINT32_MAX;
+    dirtyEnd = 0;
+  }
+};
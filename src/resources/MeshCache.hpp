@@ -0,0 +1,403 @@
+#pragma once
+
+#include "../utils/MappedFile.hpp"
+#include "ResourceManager.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Binary container for imported models, written beside the source asset
+// (<source>.meshcache) the first time ModelLoader imports it. It holds the
+// meshes exactly as they are uploaded (optimised order, packed vertices,
+// narrowed indices), the material texture paths and the node hierarchy.
+//
+// A cache is only used when the source file hash, the import flags, the
+// loader options and the contents of every other file the import read
+// (material libraries) all match, otherwise the model is imported again and
+// the cache rewritten. Reading maps the file and hands out pointers into the
+// mapping, which ResourceManager::createPackedMesh uploads directly.
+//
+// Layout: Header, MeshRecord[], NodeRecord[], node mesh indices, string
+// table (uint32 length + bytes each), then 16 byte aligned vertex and index
+// blobs. Little endian, same machine only.
+class MeshCache {
+public:
+  // Bump whenever the file layout or the import pipeline output changes
+  static const uint32_t VERSION = 2;
+
+  enum Options : uint32_t { COMPACT_VERTICES = 1 };
+
+  struct Key {
+    uint64_t sourceHash = 0;
+    uint32_t importFlags = 0;
+    uint32_t options = 0;
+  };
+
+  struct Mesh {
+    std::string name;
+    PackedMesh data;
+    // Relative to the model's directory, empty when there is none
+    std::string diffuseTexture;
+    std::string specularTexture;
+  };
+
+  struct Node {
+    std::string name;
+    int32_t parent = -1;
+    std::vector<uint32_t> meshes;
+  };
+
+  // Mesh data points into blobs after an import and into mapping after a
+  // read, so it is only valid as long as the model is
+  struct Model {
+    std::vector<Mesh> meshes;
+    std::vector<Node> nodes; // Depth first, parents before children
+    std::vector<std::vector<uint8_t>> blobs;
+    std::unique_ptr<MappedFile> mapping;
+    // Files besides the source the import read, e.g. .mtl material
+    // libraries, as paths Assimp opened them by
+    std::vector<std::string> dependencies;
+  };
+
+  static std::string pathFor(const std::string &source) {
+    return source + ".meshcache";
+  }
+
+  // 0 when the file can't be read
+  static uint64_t hashFile(const std::string &path) {
+    MappedFile file(path);
+    return file.isOpen() ? file.hash() : 0;
+  }
+
+  // Changes when any of the files changes, goes missing or is renamed
+  static uint64_t hashFiles(const std::vector<std::string> &paths) {
+    uint64_t value = 14695981039346656037ull;
+    for (const std::string &path : paths) {
+      for (char c : path) {
+        value = (value ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+      }
+      value = (value ^ hashFile(path)) * 1099511628211ull;
+    }
+    return value;
+  }
+
+  // False when there is no usable cache for key
+  static bool read(const std::string &path, const Key &key, Model &model) {
+    auto mapping = std::make_unique<MappedFile>(path);
+    if (!mapping->isOpen())
+      return false;
+    const uint8_t *base = mapping->data();
+    size_t size = mapping->size();
+
+    Header header;
+    if (size < sizeof(Header))
+      return reject(path, "truncated");
+    std::memcpy(&header, base, sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VERSION)
+      return reject(path, "old format");
+    if (header.sourceHash != key.sourceHash ||
+        header.importFlags != key.importFlags ||
+        header.options != key.options)
+      return reject(path, "source or import settings changed");
+
+    size_t meshesOffset = sizeof(Header);
+    size_t nodesOffset =
+        meshesOffset + size_t(header.meshCount) * sizeof(MeshRecord);
+    size_t nodeMeshesOffset =
+        nodesOffset + size_t(header.nodeCount) * sizeof(NodeRecord);
+    size_t recordsEnd =
+        nodeMeshesOffset + size_t(header.nodeMeshCount) * sizeof(uint32_t);
+    if (recordsEnd > size || header.stringsOffset > size ||
+        header.stringsSize > size - header.stringsOffset)
+      return reject(path, "corrupt");
+
+    const uint8_t *strings = base + header.stringsOffset;
+    auto readString = [&](uint32_t offset, std::string &out) {
+      uint32_t length = 0;
+      if (size_t(offset) + sizeof(uint32_t) > header.stringsSize)
+        return false;
+      std::memcpy(&length, strings + offset, sizeof(uint32_t));
+      if (size_t(offset) + sizeof(uint32_t) + length > header.stringsSize)
+        return false;
+      out.assign(reinterpret_cast<const char *>(strings + offset) +
+                     sizeof(uint32_t),
+                 length);
+      return true;
+    };
+    auto inFile = [&](uint64_t offset, size_t bytes) {
+      return offset <= size && bytes <= size - offset;
+    };
+
+    Model result;
+    result.dependencies.resize(header.dependencyCount);
+    uint64_t dependency = header.firstDependency;
+    for (std::string &file : result.dependencies) {
+      if (dependency > UINT32_MAX ||
+          !readString(static_cast<uint32_t>(dependency), file))
+        return reject(path, "corrupt");
+      dependency += sizeof(uint32_t) + file.size();
+    }
+    if (hashFiles(result.dependencies) != header.dependencyHash)
+      return reject(path, "material files changed");
+
+    result.meshes.resize(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+      MeshRecord record;
+      std::memcpy(&record, base + meshesOffset + i * sizeof(MeshRecord),
+                  sizeof(MeshRecord));
+      if (record.indexType != GL_UNSIGNED_SHORT &&
+          record.indexType != GL_UNSIGNED_INT)
+        return reject(path, "corrupt");
+      if (!inFile(record.vertexOffset, vertexBytes(record)) ||
+          !inFile(record.indexOffset, indexBytes(record)))
+        return reject(path, "corrupt");
+
+      Mesh &mesh = result.meshes[i];
+      if (!readString(record.name, mesh.name) ||
+          !readString(record.diffuseTexture, mesh.diffuseTexture) ||
+          !readString(record.specularTexture, mesh.specularTexture))
+        return reject(path, "corrupt");
+
+      PackedMesh &data = mesh.data;
+      data.vertices = base + record.vertexOffset;
+      data.vertexCount = record.vertexCount;
+      data.indices = base + record.indexOffset;
+      data.indexCount = record.indexCount;
+      data.indexType = record.indexType;
+      data.compact = record.compact != 0;
+      data.positionScale = toVec3(record.positionScale);
+      data.positionOffset = toVec3(record.positionOffset);
+      data.bounds.min = toVec3(record.boundsMin);
+      data.bounds.max = toVec3(record.boundsMax);
+    }
+
+    result.nodes.resize(header.nodeCount);
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+      NodeRecord record;
+      std::memcpy(&record, base + nodesOffset + i * sizeof(NodeRecord),
+                  sizeof(NodeRecord));
+      if (record.parent >= static_cast<int32_t>(i) ||
+          size_t(record.firstMesh) + record.meshCount > header.nodeMeshCount)
+        return reject(path, "corrupt");
+
+      Node &node = result.nodes[i];
+      node.parent = record.parent;
+      if (!readString(record.name, node.name))
+        return reject(path, "corrupt");
+      node.meshes.resize(record.meshCount);
+      if (record.meshCount > 0)
+        std::memcpy(node.meshes.data(),
+                    base + nodeMeshesOffset +
+                        size_t(record.firstMesh) * sizeof(uint32_t),
+                    record.meshCount * sizeof(uint32_t));
+      for (uint32_t mesh : node.meshes) {
+        if (mesh >= header.meshCount)
+          return reject(path, "corrupt");
+      }
+    }
+
+    result.mapping = std::move(mapping);
+    model = std::move(result);
+    return true;
+  }
+
+  // Writes to a temporary file first so a crash never leaves a half written
+  // cache behind
+  static bool write(const std::string &path, const Key &key,
+                    const Model &model) {
+    std::vector<uint8_t> strings;
+    auto addString = [&](const std::string &value) {
+      uint32_t offset = static_cast<uint32_t>(strings.size());
+      uint32_t length = static_cast<uint32_t>(value.size());
+      const uint8_t *lengthBytes = reinterpret_cast<const uint8_t *>(&length);
+      strings.insert(strings.end(), lengthBytes, lengthBytes + sizeof(length));
+      strings.insert(strings.end(), value.begin(), value.end());
+      return offset;
+    };
+
+    std::vector<NodeRecord> nodes;
+    std::vector<uint32_t> nodeMeshes;
+    for (const Node &node : model.nodes) {
+      NodeRecord record;
+      record.parent = node.parent;
+      record.name = addString(node.name);
+      record.firstMesh = static_cast<uint32_t>(nodeMeshes.size());
+      record.meshCount = static_cast<uint32_t>(node.meshes.size());
+      nodeMeshes.insert(nodeMeshes.end(), node.meshes.begin(),
+                        node.meshes.end());
+      nodes.push_back(record);
+    }
+
+    std::vector<MeshRecord> meshes;
+    for (const Mesh &mesh : model.meshes) {
+      const PackedMesh &data = mesh.data;
+      MeshRecord record = {};
+      record.vertexCount = data.vertexCount;
+      record.indexCount = data.indexCount;
+      record.indexType = data.indexType;
+      record.compact = data.compact ? 1 : 0;
+      fromVec3(data.positionScale, record.positionScale);
+      fromVec3(data.positionOffset, record.positionOffset);
+      fromVec3(data.bounds.min, record.boundsMin);
+      fromVec3(data.bounds.max, record.boundsMax);
+      record.name = addString(mesh.name);
+      record.diffuseTexture = addString(mesh.diffuseTexture);
+      record.specularTexture = addString(mesh.specularTexture);
+      meshes.push_back(record);
+    }
+
+    // Stored back to back, read in order from the first one
+    uint32_t firstDependency = static_cast<uint32_t>(strings.size());
+    for (const std::string &file : model.dependencies) {
+      addString(file);
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.importFlags = key.importFlags;
+    header.sourceHash = key.sourceHash;
+    header.options = key.options;
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+    header.nodeMeshCount = static_cast<uint32_t>(nodeMeshes.size());
+    header.stringsOffset = sizeof(Header) +
+                           meshes.size() * sizeof(MeshRecord) +
+                           nodes.size() * sizeof(NodeRecord) +
+                           nodeMeshes.size() * sizeof(uint32_t);
+    header.stringsSize = strings.size();
+    header.dependencyHash = hashFiles(model.dependencies);
+    header.dependencyCount = static_cast<uint32_t>(model.dependencies.size());
+    header.firstDependency = firstDependency;
+
+    // Blob offsets, now that everything in front of them is known
+    uint64_t offset = align(header.stringsOffset + header.stringsSize);
+    for (MeshRecord &record : meshes) {
+      record.vertexOffset = offset;
+      offset = align(offset + vertexBytes(record));
+      record.indexOffset = offset;
+      offset = align(offset + indexBytes(record));
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE *file = std::fopen(tempPath.c_str(), "wb");
+    if (!file) {
+      std::cout << "ERROR::MESH_CACHE::WRITE_FAILED: " << path << std::endl;
+      return false;
+    }
+
+    uint64_t written = 0;
+    bool ok = true;
+    auto put = [&](const void *bytes, size_t count) {
+      if (count > 0 && ok)
+        ok = std::fwrite(bytes, 1, count, file) == count;
+      written += count;
+    };
+    auto padTo = [&](uint64_t target) {
+      static const uint8_t zeros[BLOB_ALIGNMENT] = {};
+      put(zeros, static_cast<size_t>(target - written));
+    };
+
+    put(&header, sizeof(Header));
+    put(meshes.data(), meshes.size() * sizeof(MeshRecord));
+    put(nodes.data(), nodes.size() * sizeof(NodeRecord));
+    put(nodeMeshes.data(), nodeMeshes.size() * sizeof(uint32_t));
+    put(strings.data(), strings.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+      const PackedMesh &data = model.meshes[i].data;
+      padTo(meshes[i].vertexOffset);
+      put(data.vertices, vertexBytes(meshes[i]));
+      padTo(meshes[i].indexOffset);
+      put(data.indices, indexBytes(meshes[i]));
+    }
+
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+      std::remove(tempPath.c_str());
+      std::cout << "ERROR::MESH_CACHE::WRITE_FAILED: " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static constexpr char MAGIC[8] = {'M', 'E', 'S', 'H', 'C', 'C', 'H', '\0'};
+  static const size_t BLOB_ALIGNMENT = 16;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t importFlags;
+    uint64_t sourceHash;
+    uint32_t options;
+    uint32_t meshCount;
+    uint32_t nodeCount;
+    uint32_t nodeMeshCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t dependencyHash; // hashFiles() of the dependency paths
+    uint32_t dependencyCount;
+    uint32_t firstDependency; // Offset into the string table
+  };
+
+  struct MeshRecord {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexType;
+    uint32_t compact;
+    float positionScale[3];
+    float positionOffset[3];
+    float boundsMin[3];
+    float boundsMax[3];
+    // Offsets into the string table
+    uint32_t name;
+    uint32_t diffuseTexture;
+    uint32_t specularTexture;
+    uint32_t padding;
+  };
+
+  struct NodeRecord {
+    int32_t parent;
+    uint32_t name;
+    uint32_t firstMesh; // Into the node mesh indices
+    uint32_t meshCount;
+  };
+
+  static uint64_t align(uint64_t offset) {
+    return (offset + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT;
+  }
+
+  static size_t vertexBytes(const MeshRecord &record) {
+    size_t stride = record.compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    return size_t(record.vertexCount) * stride;
+  }
+
+  static size_t indexBytes(const MeshRecord &record) {
+    size_t size = record.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    return size_t(record.indexCount) * size;
+  }
+
+  static glm::vec3 toVec3(const float values[3]) {
+    return glm::vec3(values[0], values[1], values[2]);
+  }
+
+  static void fromVec3(const glm::vec3 &value, float out[3]) {
+    out[0] = value.x;
+    out[1] = value.y;
+    out[2] = value.z;
+  }
+
+  static bool reject(const std::string &path, const char *reason) {
+    std::cout << "MESH_CACHE::STALE: " << path << " (" << reason
+              << "), reimporting" << std::endl;
+    return false;
+  }
+};
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "VertexLayout.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// Import time index/vertex reordering for triangle lists, run by ModelLoader
+// before upload so the GPU sees:
+//  1. duplicate vertices merged (bitwise equal Vertex)
+//  2. triangles ordered for the post-transform vertex cache (Tom Forsyth's
+//     "Linear-Speed Vertex Cache Optimisation")
+//  3. cache friendly clusters of those triangles sorted outside-in to reduce
+//     overdraw (after Sander, Nehab and Barczak, "Fast Triangle Reordering
+//     for Vertex Locality and Reduced Overdraw")
+//  4. vertices stored in first-use order, unused ones dropped, for fetch
+//     locality
+//
+// Quality is reported as ACMR (transformed vertices per triangle) and ATVR
+// (transformed vertices per unique vertex, 1.0 is optimal), measured against
+// a FIFO cache of CACHE_SIZE entries.
+namespace MeshOptimizer {
+
+const uint32_t CACHE_SIZE = 16;
+
+struct CacheStats {
+  uint32_t triangles = 0;
+  uint32_t vertices = 0;
+  uint32_t misses = 0; // Vertices transformed
+
+  float acmr() const {
+    return triangles ? static_cast<float>(misses) / triangles : 0.0f;
+  }
+  float atvr() const {
+    return vertices ? static_cast<float>(misses) / vertices : 0.0f;
+  }
+
+  CacheStats &operator+=(const CacheStats &other) {
+    triangles += other.triangles;
+    vertices += other.vertices;
+    misses += other.misses;
+    return *this;
+  }
+};
+
+struct Report {
+  CacheStats before;
+  CacheStats after;
+
+  Report &operator+=(const Report &other) {
+    before += other.before;
+    after += other.after;
+    return *this;
+  }
+};
+
+inline CacheStats analyzeVertexCache(const std::vector<uint32_t> &indices,
+                                     size_t vertexCount,
+                                     uint32_t cacheSize = CACHE_SIZE) {
+  CacheStats stats;
+  stats.triangles = static_cast<uint32_t>(indices.size() / 3);
+  stats.vertices = static_cast<uint32_t>(vertexCount);
+
+  // A vertex is cached if it was pushed within the last cacheSize misses
+  std::vector<uint32_t> pushedAt(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  for (uint32_t index : indices) {
+    if (time - pushedAt[index] > cacheSize) {
+      pushedAt[index] = time++;
+      stats.misses++;
+    }
+  }
+  return stats;
+}
+
+// ========== DEDUPLICATION ==========
+
+// Returns the new vertex count, indices are rewritten in place
+inline size_t deduplicateVertices(std::vector<Vertex> &vertices,
+                                  std::vector<uint32_t> &indices) {
+  size_t tableSize = 1;
+  while (tableSize < vertices.size() * 2) {
+    tableSize *= 2;
+  }
+  const uint32_t EMPTY = UINT32_MAX;
+  std::vector<uint32_t> table(tableSize, EMPTY);
+  std::vector<uint32_t> remap(vertices.size());
+  std::vector<Vertex> unique;
+  unique.reserve(vertices.size());
+
+  for (size_t i = 0; i < vertices.size(); i++) {
+    // FNV-1a over the raw bytes, Vertex has no padding
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&vertices[i]);
+    uint32_t hash = 2166136261u;
+    for (size_t b = 0; b < sizeof(Vertex); b++) {
+      hash = (hash ^ bytes[b]) * 16777619u;
+    }
+
+    size_t slot = hash & (tableSize - 1);
+    while (table[slot] != EMPTY &&
+           std::memcmp(&unique[table[slot]], &vertices[i], sizeof(Vertex))) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    if (table[slot] == EMPTY) {
+      table[slot] = static_cast<uint32_t>(unique.size());
+      unique.push_back(vertices[i]);
+    }
+    remap[i] = table[slot];
+  }
+
+  for (uint32_t &index : indices) {
+    index = remap[index];
+  }
+  vertices.swap(unique);
+  return vertices.size();
+}
+
+// ========== VERTEX CACHE ==========
+
+namespace detail {
+
+// Scoring cache is larger than the simulated FIFO on purpose, as in the paper
+const int SCORE_CACHE_SIZE = 32;
+
+inline float vertexScore(int cachePosition, uint32_t liveTriangles) {
+  if (liveTriangles == 0)
+    return -1.0f;
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // The last triangle's vertices, deliberately less than the next ones
+      // so strips don't flip back and forth
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (SCORE_CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+    }
+  }
+  // Favour finishing off vertices with few triangles left
+  score += 2.0f / std::sqrt(static_cast<float>(liveTriangles));
+  return score;
+}
+
+} // namespace detail
+
+inline void optimizeVertexCache(std::vector<uint32_t> &indices,
+                                size_t vertexCount) {
+  using detail::SCORE_CACHE_SIZE;
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0)
+    return;
+
+  // Triangles using each vertex, the first liveTriangles[v] are unemitted
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices) {
+    liveTriangles[index]++;
+  }
+  std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; v++) {
+    adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> scores(vertexCount);
+  for (size_t v = 0; v < vertexCount; v++) {
+    scores[v] = detail::vertexScore(-1, liveTriangles[v]);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  std::vector<bool> emitted(triangleCount, false);
+  for (size_t t = 0; t < triangleCount; t++) {
+    triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] +
+                        scores[indices[t * 3 + 2]];
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> nextCache;
+  cache.reserve(SCORE_CACHE_SIZE + 3);
+  nextCache.reserve(SCORE_CACHE_SIZE + 3);
+
+  size_t best = std::max_element(triangleScores.begin(),
+                                 triangleScores.end()) -
+                triangleScores.begin();
+  size_t scanCursor = 0;
+
+  while (result.size() < indices.size()) {
+    if (best == SIZE_MAX) {
+      // Dead end, nothing in the cache has triangles left
+      while (emitted[scanCursor]) {
+        scanCursor++;
+      }
+      best = scanCursor;
+    }
+
+    const uint32_t *triangle = &indices[best * 3];
+    emitted[best] = true;
+    nextCache.assign(triangle, triangle + 3);
+    for (int i = 0; i < 3; i++) {
+      uint32_t v = triangle[i];
+      result.push_back(v);
+
+      // Drop the triangle from the vertex's live list
+      uint32_t *begin = &adjacency[adjacencyStart[v]];
+      uint32_t *end = begin + liveTriangles[v];
+      uint32_t *it = std::find(begin, end, static_cast<uint32_t>(best));
+      std::swap(*it, *(end - 1));
+      liveTriangles[v]--;
+    }
+    for (uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        nextCache.push_back(v);
+      }
+    }
+
+    // Rescore everything that was or is in the cache, vertices pushed out
+    // lose their cache bonus
+    for (size_t i = 0; i < nextCache.size(); i++) {
+      uint32_t v = nextCache[i];
+      cachePosition[v] = i < SCORE_CACHE_SIZE ? static_cast<int>(i) : -1;
+      scores[v] = detail::vertexScore(cachePosition[v], liveTriangles[v]);
+    }
+    if (nextCache.size() > SCORE_CACHE_SIZE) {
+      nextCache.resize(SCORE_CACHE_SIZE);
+    }
+
+    best = SIZE_MAX;
+    float bestScore = -1.0f;
+    for (uint32_t v : nextCache) {
+      for (uint32_t a = 0; a < liveTriangles[v]; a++) {
+        uint32_t t = adjacency[adjacencyStart[v] + a];
+        float score = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] +
+                      scores[indices[t * 3 + 2]];
+        triangleScores[t] = score;
+        if (score > bestScore) {
+          bestScore = score;
+          best = t;
+        }
+      }
+    }
+    cache.swap(nextCache);
+  }
+
+  indices.swap(result);
+}
+
+// ========== OVERDRAW ==========
+
+// Splits the (already cache optimised) triangle order into clusters and
+// sorts them so that clusters facing away from the mesh centre are drawn
+// first; they are the ones most likely to occlude the rest. A cluster ends
+// where the FIFO cache would have been flushed anyway (all three vertices
+// miss), or where it has become cheap enough that restarting costs less than
+// threshold times the mesh ACMR.
+inline void optimizeOverdraw(std::vector<uint32_t> &indices,
+                             const std::vector<Vertex> &vertices,
+                             float threshold = 1.05f) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount < 2)
+    return;
+
+  float meshAcmr = analyzeVertexCache(indices, vertices.size()).acmr();
+  std::vector<size_t> clusterStarts;
+  std::vector<uint32_t> pushedAt(vertices.size(), 0);
+  uint32_t time = CACHE_SIZE + 1;
+  uint32_t clusterMisses = 0;
+  size_t clusterStart = 0;
+
+  for (size_t t = 0; t < triangleCount; t++) {
+    uint32_t misses = 0;
+    for (int i = 0; i < 3; i++) {
+      uint32_t v = indices[t * 3 + i];
+      if (time - pushedAt[v] > CACHE_SIZE) {
+        pushedAt[v] = time++;
+        misses++;
+      }
+    }
+
+    size_t clusterSize = t - clusterStart;
+    bool hardBoundary = misses == 3;
+    bool softBoundary =
+        clusterSize > 0 &&
+        static_cast<float>(clusterMisses) / clusterSize <= threshold * meshAcmr;
+    if (t == 0 || hardBoundary || (softBoundary && misses > 0)) {
+      clusterStarts.push_back(t);
+      clusterStart = t;
+      clusterMisses = 0;
+    }
+    clusterMisses += misses;
+  }
+
+  glm::vec3 meshCentre(0.0f);
+  for (const Vertex &vertex : vertices) {
+    meshCentre += vertex.Position;
+  }
+  meshCentre /= static_cast<float>(vertices.size());
+
+  struct Cluster {
+    size_t first;
+    size_t count;
+    float sortKey;
+  };
+  std::vector<Cluster> clusters;
+  clusters.reserve(clusterStarts.size());
+  for (size_t c = 0; c < clusterStarts.size(); c++) {
+    size_t first = clusterStarts[c];
+    size_t last = c + 1 < clusterStarts.size() ? clusterStarts[c + 1]
+                                                : triangleCount;
+    // Area weighted centroid and normal
+    glm::vec3 centroid(0.0f);
+    glm::vec3 normal(0.0f);
+    float area = 0.0f;
+    for (size_t t = first; t < last; t++) {
+      const glm::vec3 &a = vertices[indices[t * 3]].Position;
+      const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+      const glm::vec3 &c2 = vertices[indices[t * 3 + 2]].Position;
+      glm::vec3 cross = glm::cross(b - a, c2 - a);
+      float triangleArea = glm::length(cross);
+      centroid += (a + b + c2) * (triangleArea / 3.0f);
+      normal += cross;
+      area += triangleArea;
+    }
+    float sortKey = 0.0f;
+    float normalLength = glm::length(normal);
+    if (area > 0.0f && normalLength > 0.0f) {
+      centroid /= area;
+      sortKey = glm::dot(centroid - meshCentre, normal / normalLength);
+    }
+    clusters.push_back({first, last - first, sortKey});
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.sortKey > b.sortKey;
+                   });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (const Cluster &cluster : clusters) {
+    result.insert(result.end(), indices.begin() + cluster.first * 3,
+                  indices.begin() + (cluster.first + cluster.count) * 3);
+  }
+  indices.swap(result);
+}
+
+// ========== VERTEX FETCH ==========
+
+// Stores vertices in the order the index buffer first uses them
+inline size_t optimizeVertexFetch(std::vector<Vertex> &vertices,
+                                  std::vector<uint32_t> &indices) {
+  std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+  std::vector<Vertex> ordered;
+  ordered.reserve(vertices.size());
+  for (uint32_t &index : indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = static_cast<uint32_t>(ordered.size());
+      ordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(ordered);
+  return vertices.size();
+}
+
+// Runs every stage above in order
+inline Report optimize(std::vector<Vertex> &vertices,
+                       std::vector<uint32_t> &indices) {
+  Report report;
+  report.before = analyzeVertexCache(indices, vertices.size());
+
+  deduplicateVertices(vertices, indices);
+  optimizeVertexCache(indices, vertices.size());
+  optimizeOverdraw(indices, vertices);
+  optimizeVertexFetch(vertices, indices);
+
+  report.after = analyzeVertexCache(indices, vertices.size());
+  return report;
+}
+
+} // namespace MeshOptimizer
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
 #include "ResourceManager.hpp"
 
 #include "../components/MaterialComponent.hpp"
@@ -8,68 +10,147 @@
 #include "../components/TransformComponent.hpp"
 #include "../ecs/World.hpp"
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 
+// compactVertices stores the meshes as CompactVertex, quantised inside the
+// bounds of the whole model so that all sub-meshes share decode uniforms.
+//
+// Triangle meshes go through MeshOptimizer before upload, the vertex cache
+// numbers for the whole model are printed before and after. The result is
+// kept in a MeshCache beside the source, later loads map that file and skip
+// Assimp entirely.
 class ModelLoader {
 public:
   static std::vector<Entity> load(World &world, const std::string &path,
                                   uint32_t shaderProgram,
                                   const glm::vec3 &position = glm::vec3(0.0f),
-                                  const glm::vec3 &scale = glm::vec3(1.0f)) {
+                                  const glm::vec3 &scale = glm::vec3(1.0f),
+                                  bool compactVertices = false) {
     std::vector<Entity> entities;
     std::string directory = path.substr(0, path.find_last_of('/'));
 
+    MeshCache::Key key;
+    key.sourceHash = MeshCache::hashFile(path);
+    key.importFlags = IMPORT_FLAGS;
+    key.options = compactVertices ? MeshCache::COMPACT_VERTICES : 0;
+
+    std::string cachePath = MeshCache::pathFor(path);
+    MeshCache::Model model;
+    if (MeshCache::read(cachePath, key, model)) {
+      std::cout << "Loaded " << path << " from " << cachePath << std::endl;
+    } else {
+      if (!import(path, compactVertices, model))
+        return entities;
+      MeshCache::write(cachePath, key, model);
+    }
+
+    instantiate(world, model, directory, shaderProgram, position, scale,
+                entities);
+    return entities;
+  }
+
+private:
+  static const unsigned int IMPORT_FLAGS =
+      aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs |
+      aiProcess_OptimizeMeshes;
+
+  // Notes every file Assimp opens for reading
+  class RecordingIOSystem : public Assimp::DefaultIOSystem {
+  public:
+    std::vector<std::string> opened;
+
+    Assimp::IOStream *Open(const char *file, const char *mode = "rb") override {
+      Assimp::IOStream *stream = Assimp::DefaultIOSystem::Open(file, mode);
+      if (stream && mode[0] == 'r')
+        opened.push_back(file);
+      return stream;
+    }
+  };
+
+  // Converts the Assimp scene into GPU ready meshes owned by model
+  static bool import(const std::string &path, bool compactVertices,
+                     MeshCache::Model &model) {
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(
-        path, aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs |
-                  aiProcess_OptimizeMeshes);
+    auto *files = new RecordingIOSystem(); // Owned by the importer
+    importer.SetIOHandler(files);
+    const aiScene *scene = importer.ReadFile(path, IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
       std::cerr << "ASSIMP ERROR: " << importer.GetErrorString() << std::endl;
-      return entities;
+      return false;
     }
 
-    processNode(world, scene->mRootNode, scene, directory, shaderProgram,
-                position, scale, entities);
-
-    return entities;
-  }
+    // Material libraries and anything else the import read, the cache is
+    // only valid while none of them change
+    for (const std::string &file : files->opened) {
+      if (file != path && std::find(model.dependencies.begin(),
+                                    model.dependencies.end(),
+                                    file) == model.dependencies.end())
+        model.dependencies.push_back(file);
+    }
 
-private:
-  static void processNode(World &world, aiNode *node, const aiScene *scene,
-                          const std::string &directory, uint32_t shaderProgram,
-                          const glm::vec3 &position, const glm::vec3 &scale,
-                          std::vector<Entity> &entities) {
-    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-      aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      Entity entity = processMesh(world, mesh, scene, directory, shaderProgram);
-
-      auto *transform = world.getComponent<TransformComponent>(entity);
-      if (transform) {
-        transform->position = position;
-        transform->scale = scale;
+    // Invalid box means full precision vertices
+    AABB quantizationBox;
+    if (compactVertices) {
+      for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+        const aiMesh *mesh = scene->mMeshes[i];
+        for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+          const aiVector3D &p = mesh->mVertices[v];
+          quantizationBox.expand(glm::vec3(p.x, p.y, p.z));
+        }
       }
+    }
 
-      entities.push_back(entity);
+    MeshOptimizer::Report optimization;
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+      model.meshes.push_back(processMesh(scene->mMeshes[i], scene,
+                                         quantizationBox, optimization,
+                                         model));
     }
+    processNode(scene->mRootNode, -1, model);
+
+    if (optimization.before.triangles > 0) {
+      std::cout << "Optimised " << path << ": ACMR "
+                << optimization.before.acmr() << " -> "
+                << optimization.after.acmr() << ", ATVR "
+                << optimization.before.atvr() << " -> "
+                << optimization.after.atvr() << ", "
+                << optimization.before.vertices << " -> "
+                << optimization.after.vertices << " vertices" << std::endl;
+    }
+    return true;
+  }
+
+  // Flattens the hierarchy depth first, so parents come before children
+  static void processNode(const aiNode *node, int32_t parent,
+                          MeshCache::Model &model) {
+    MeshCache::Node flat;
+    flat.name = node->mName.C_Str();
+    flat.parent = parent;
+    flat.meshes.assign(node->mMeshes, node->mMeshes + node->mNumMeshes);
+
+    int32_t index = static_cast<int32_t>(model.nodes.size());
+    model.nodes.push_back(std::move(flat));
 
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
-      processNode(world, node->mChildren[i], scene, directory, shaderProgram,
-                  position, scale, entities);
+      processNode(node->mChildren[i], index, model);
     }
   }
 
-  static Entity processMesh(World &world, aiMesh *mesh, const aiScene *scene,
-                            const std::string &directory,
-                            uint32_t shaderProgram) {
+  static MeshCache::Mesh processMesh(const aiMesh *mesh, const aiScene *scene,
+                                     const AABB &quantizationBox,
+                                     MeshOptimizer::Report &optimization,
+                                     MeshCache::Model &model) {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
-    std::string meshName = mesh->mName.C_Str();
 
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
       Vertex vertex;
@@ -98,25 +179,47 @@ private:
       }
     }
 
-    auto &resources = ResourceManager::instance();
-    MeshData meshData = resources.createIndexedMesh(vertices, indices);
-
-    Entity entity = world.createEntity();
-
-    TransformComponent transform;
-    world.addComponent(entity, transform);
+    // Lines and points can survive aiProcess_Triangulate, leave those as is
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+      optimization += MeshOptimizer::optimize(vertices, indices);
+    }
 
-    NameComponent name(meshName);
-    world.addComponent(entity, name);
+    MeshCache::Mesh result;
+    result.name = mesh->mName.C_Str();
+    PackedMesh &data = result.data;
+    data.vertexCount = static_cast<uint32_t>(vertices.size());
+    data.indexCount = static_cast<uint32_t>(indices.size());
+    for (const Vertex &vertex : vertices) {
+      data.bounds.expand(vertex.Position);
+    }
 
-    MeshComponent meshComp;
-    meshComp.vao = meshData.vao;
-    meshComp.vertexCount = meshData.vertexCount;
-    meshComp.indexCount = meshData.indexCount;
-    world.addComponent(entity, meshComp);
+    if (quantizationBox.isValid()) {
+      auto *packed = static_cast<CompactVertex *>(
+          addBlob(model, vertices.size() * sizeof(CompactVertex)));
+      for (size_t i = 0; i < vertices.size(); i++) {
+        packed[i] = VertexLayout::compress(vertices[i], quantizationBox);
+      }
+      data.vertices = packed;
+      data.compact = true;
+      data.positionOffset = quantizationBox.min;
+      data.positionScale = quantizationBox.max - quantizationBox.min;
+    } else {
+      void *blob = addBlob(model, vertices.size() * sizeof(Vertex));
+      std::memcpy(blob, vertices.data(), vertices.size() * sizeof(Vertex));
+      data.vertices = blob;
+    }
 
-    MaterialComponent material;
-    material.shaderProgram = shaderProgram;
+    data.indexType = VertexLayout::indexTypeFor(vertices.size());
+    if (data.indexType == GL_UNSIGNED_SHORT) {
+      auto *shortIndices = static_cast<uint16_t *>(
+          addBlob(model, indices.size() * sizeof(uint16_t)));
+      std::copy(indices.begin(), indices.end(), shortIndices);
+      data.indices = shortIndices;
+    } else {
+      void *blob = addBlob(model, indices.size() * sizeof(uint32_t));
+      std::memcpy(blob, indices.data(), indices.size() * sizeof(uint32_t));
+      data.indices = blob;
+    }
 
     if (mesh->mMaterialIndex >= 0) {
       aiMaterial *mat = scene->mMaterials[mesh->mMaterialIndex];
@@ -124,21 +227,68 @@ private:
       if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
         aiString str;
         mat->GetTexture(aiTextureType_DIFFUSE, 0, &str);
-        std::string texPath = directory + '/' + str.C_Str();
-        material.textures[0] = resources.loadTexture(texPath);
-        material.useTextures = true;
+        result.diffuseTexture = str.C_Str();
       }
 
       if (mat->GetTextureCount(aiTextureType_SPECULAR) > 0) {
         aiString str;
         mat->GetTexture(aiTextureType_SPECULAR, 0, &str);
-        std::string texPath = directory + '/' + str.C_Str();
-        material.textures[1] = resources.loadTexture(texPath);
+        result.specularTexture = str.C_Str();
       }
     }
 
-    world.addComponent(entity, material);
+    return result;
+  }
+
+  static void *addBlob(MeshCache::Model &model, size_t bytes) {
+    model.blobs.emplace_back(bytes);
+    return model.blobs.back().data();
+  }
+
+  // One entity per mesh reference in the hierarchy. Each mesh is uploaded
+  // once, nodes referencing the same mesh share its GPU data
+  static void instantiate(World &world, const MeshCache::Model &model,
+                          const std::string &directory,
+                          uint32_t shaderProgram, const glm::vec3 &position,
+                          const glm::vec3 &scale,
+                          std::vector<Entity> &entities) {
+    auto &resources = ResourceManager::instance();
+    std::vector<MeshData> uploaded;
+    uploaded.reserve(model.meshes.size());
+    for (const MeshCache::Mesh &mesh : model.meshes) {
+      uploaded.push_back(resources.createPackedMesh(mesh.data));
+    }
+
+    for (const MeshCache::Node &node : model.nodes) {
+      for (uint32_t meshIndex : node.meshes) {
+        const MeshCache::Mesh &mesh = model.meshes[meshIndex];
+        Entity entity = world.createEntity();
+
+        TransformComponent transform;
+        transform.position = position;
+        transform.scale = scale;
+        world.addComponent(entity, transform);
 
-    return entity;
+        NameComponent name(mesh.name);
+        world.addComponent(entity, name);
+
+        world.addComponent(entity, uploaded[meshIndex].toComponent());
+
+        MaterialComponent material;
+        material.shaderProgram = shaderProgram;
+        if (!mesh.diffuseTexture.empty()) {
+          std::string texPath = directory + '/' + mesh.diffuseTexture;
+          material.textures[0] = resources.loadTexture(texPath);
+          material.useTextures = true;
+        }
+        if (!mesh.specularTexture.empty()) {
+          std::string texPath = directory + '/' + mesh.specularTexture;
+          material.textures[1] = resources.loadTexture(texPath);
+        }
+        world.addComponent(entity, material);
+
+        entities.push_back(entity);
+      }
+    }
   }
 };
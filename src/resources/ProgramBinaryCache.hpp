@@ -0,0 +1,246 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../utils/MappedFile.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Linked programs saved to disk (one <key>.bin per program in DIRECTORY)
+// so later runs skip compiling and linking. Needs GL 4.1 or
+// GL_ARB_get_program_binary. glad is generated for 3.3 core, so the entry
+// points are looked up through GLFW the first time a program is built;
+// without them every call here is a no-op and programs compile as before.
+//
+// The key hashes the sources and everything else that affects linking
+// together with the driver's vendor, renderer and version strings, so a
+// driver update invalidates the cache. Drivers may still reject a binary
+// (glProgramBinary fails to link), Shader then compiles normally and the
+// entry is replaced.
+class ProgramBinaryCache {
+public:
+  static constexpr const char *DIRECTORY = "shader_cache";
+
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;   // Compiled, usually stored afterwards
+    uint32_t rejected = 0; // Binaries the driver refused
+    uint32_t stored = 0;
+  };
+
+  // Singleton
+  static ProgramBinaryCache &instance() {
+    static ProgramBinaryCache inst;
+    return inst;
+  }
+
+  bool enabled = true;
+
+  bool isSupported() {
+    if (!initialized)
+      initialize();
+    return enabled && supported;
+  }
+
+  // FNV-1a over parts and the driver strings
+  uint64_t keyFor(std::initializer_list<std::string> parts) {
+    if (!initialized)
+      initialize();
+    uint64_t value = 14695981039346656037ull;
+    auto mix = [&](const std::string &part) {
+      for (unsigned char c : part) {
+        value = (value ^ c) * 1099511628211ull;
+      }
+      // Separator, so ("ab", "c") and ("a", "bc") differ
+      value = (value ^ 0xFF) * 1099511628211ull;
+    };
+    mix(driver);
+    for (const std::string &part : parts) {
+      mix(part);
+    }
+    return value;
+  }
+
+  // A linked program for key, 0 when there is no usable binary
+  GLuint load(uint64_t key) {
+    if (!isSupported())
+      return 0;
+
+    MappedFile file(pathFor(key));
+    Header header;
+    if (!file.isOpen() || file.size() < sizeof(Header)) {
+      stats.misses++;
+      return 0;
+    }
+    std::memcpy(&header, file.data(), sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VERSION || header.key != key ||
+        header.length != file.size() - sizeof(Header)) {
+      stats.misses++;
+      return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    programBinary(program, header.format, file.data() + sizeof(Header),
+                  static_cast<GLsizei>(header.length));
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      glDeleteProgram(program);
+      stats.rejected++;
+      stats.misses++;
+      return 0;
+    }
+    stats.hits++;
+    return program;
+  }
+
+  // Call before linking a program that will be stored
+  void prepare(GLuint program) {
+    if (isSupported())
+      programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  // Saves a successfully linked program
+  void store(GLuint program, uint64_t key) {
+    if (!isSupported())
+      return;
+    GLint linked = 0;
+    GLint length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!linked || length <= 0)
+      return;
+
+    std::vector<uint8_t> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    GLsizei written = 0;
+    getProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+      return;
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.format = format;
+    header.key = key;
+    header.length = static_cast<uint64_t>(written);
+
+    // Same temporary file and rename as MeshCache::write
+    mkdir(DIRECTORY, 0755);
+    std::string path = pathFor(key);
+    std::string tempPath = path + ".tmp";
+    FILE *file = std::fopen(tempPath.c_str(), "wb");
+    if (!file) {
+      std::cout << "ERROR::PROGRAM_BINARY_CACHE::WRITE_FAILED: " << path
+                << std::endl;
+      return;
+    }
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1 &&
+              std::fwrite(binary.data(), 1, written, file) ==
+                  static_cast<size_t>(written);
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+      std::remove(tempPath.c_str());
+      std::cout << "ERROR::PROGRAM_BINARY_CACHE::WRITE_FAILED: " << path
+                << std::endl;
+      return;
+    }
+    stats.stored++;
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  using GetProgramBinary = void(APIENTRYP)(GLuint, GLsizei, GLsizei *,
+                                           GLenum *, void *);
+  using ProgramBinary = void(APIENTRYP)(GLuint, GLenum, const void *,
+                                        GLsizei);
+  using ProgramParameteri = void(APIENTRYP)(GLuint, GLenum, GLint);
+
+  // Bump whenever the file layout changes
+  static const uint32_t VERSION = 1;
+  static constexpr char MAGIC[4] = {'M', 'P', 'R', 'G'};
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t padding;
+    uint64_t key;
+    uint64_t length;
+  };
+
+  bool initialized = false;
+  bool supported = false;
+  std::string driver;
+  GetProgramBinary getProgramBinary = nullptr;
+  ProgramBinary programBinary = nullptr;
+  ProgramParameteri programParameteri = nullptr;
+  Stats stats;
+
+  ProgramBinaryCache() = default;
+  ProgramBinaryCache(const ProgramBinaryCache &) = delete;
+  ProgramBinaryCache &operator=(const ProgramBinaryCache &) = delete;
+
+  // Needs a current context
+  void initialize() {
+    initialized = true;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      const GLubyte *value = glGetString(name);
+      driver += value ? reinterpret_cast<const char *>(value) : "";
+      driver += '\n';
+    }
+
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool available = major > 4 || (major == 4 && minor >= 1);
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount && !available; i++) {
+      const GLubyte *extension = glGetStringi(GL_EXTENSIONS, i);
+      available = extension &&
+                  std::strcmp(reinterpret_cast<const char *>(extension),
+                              "GL_ARB_get_program_binary") == 0;
+    }
+    if (!available)
+      return;
+
+    getProgramBinary = reinterpret_cast<GetProgramBinary>(
+        glfwGetProcAddress("glGetProgramBinary"));
+    programBinary = reinterpret_cast<ProgramBinary>(
+        glfwGetProcAddress("glProgramBinary"));
+    programParameteri = reinterpret_cast<ProgramParameteri>(
+        glfwGetProcAddress("glProgramParameteri"));
+    // Drivers may expose the functions but no binary format to use them with
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = getProgramBinary && programBinary && programParameteri &&
+                formats > 0;
+  }
+
+  static std::string pathFor(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin",
+                  static_cast<unsigned long long>(key));
+    return std::string(DIRECTORY) + "/" + name;
+  }
+};
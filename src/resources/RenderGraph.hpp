@@ -0,0 +1,534 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../utils/GPUTimer.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The GPU passes of a frame, recorded again every frame. Render systems add
+// their passes in render(), each naming the textures it samples and the
+// attachments it draws into, with a callback holding the actual draws.
+// execute() then:
+//  - culls passes whose output never reaches the backbuffer,
+//  - runs the others in the order they were added, which is a valid order
+//    since a pass can only depend on passes added before it,
+//  - backs transient textures with pooled GL textures, two transients whose
+//    lifetimes don't overlap share the same one,
+//  - binds one cached FBO per set of attachments, consecutive passes drawing
+//    into the same attachments don't switch framebuffers.
+// Transient sizes are relative to the output size, which is the only thing
+// that changes on a resize.
+//
+// Dynamic transients also follow the render scale (see setRenderScale). Their
+// pooled textures stay at full scale and passes only draw into the scaled
+// corner, so changing the scale every frame never reallocates anything;
+// readers find the part in use with getContentScale().
+class RenderGraph {
+public:
+  using ResourceID = uint32_t;
+  // The default framebuffer, always sized like the output
+  static constexpr ResourceID BACKBUFFER = 0;
+  static constexpr ResourceID INVALID_RESOURCE = UINT32_MAX;
+  // Pooled textures nothing used for that many frames are deleted
+  static constexpr uint32_t POOL_FRAMES_KEPT = 60;
+  // Lowest render scale setRenderScale() accepts
+  static constexpr float MIN_RENDER_SCALE = 0.25f;
+
+  enum Format : uint32_t { RGB8, RGBA8, RGBA16F, DEPTH24_STENCIL8 };
+
+  struct TextureDesc {
+    Format format = RGBA8;
+    float scale = 1.0f; // Of the output size
+    bool dynamic = false; // Drawn at the render scale as well
+  };
+
+  struct Stats {
+    uint32_t passes = 0; // Added last frame
+    uint32_t culled = 0;
+    uint32_t transients = 0;     // Transient textures declared
+    uint32_t pooledTextures = 0; // GL textures backing them
+    size_t pooledBytes = 0;
+    uint32_t framebufferChanges = 0;
+    float renderScale = 1.0f;
+    double gpuMilliseconds = 0.0; // Of execute(), a few frames old
+  };
+
+  // What a pass sees while it executes
+  struct PassContext {
+    const RenderGraph &graph;
+    uint32_t width; // The viewport, the drawn part of the attachments
+    uint32_t height;
+
+    GLuint getTexture(ResourceID id) const { return graph.getTexture(id); }
+  };
+
+  using ExecuteFn = std::function<void(const PassContext &)>;
+
+  class PassBuilder {
+  public:
+    PassBuilder(RenderGraph &graph, uint32_t pass)
+        : graph(graph), pass(pass) {}
+
+    // Sampled by the pass
+    PassBuilder &read(ResourceID id) {
+      graph.passes[pass].reads.push_back(id);
+      return *this;
+    }
+
+    // Colour attachment, in attachment order. The pass draws on top of what
+    // is there, so whoever wrote it before is needed as well
+    PassBuilder &write(ResourceID id) {
+      graph.passes[pass].colors.push_back(id);
+      return *this;
+    }
+
+    PassBuilder &depthStencil(ResourceID id) {
+      graph.passes[pass].depthStencil = id;
+      return *this;
+    }
+
+  private:
+    RenderGraph &graph;
+    uint32_t pass;
+  };
+
+  RenderGraph() { beginFrame(); }
+  RenderGraph(const RenderGraph &) = delete;
+  RenderGraph &operator=(const RenderGraph &) = delete;
+
+  ~RenderGraph() { clear(); }
+
+  // Deletes the pooled textures, framebuffers and the timer queries
+  void clear() {
+    auto &glState = GLStateCache::instance();
+    for (auto &entry : framebuffers) {
+      glState.deleteFramebuffer(entry.second);
+    }
+    framebuffers.clear();
+    for (const PooledTexture &pooled : pool) {
+      glState.deleteTexture(pooled.texture);
+    }
+    pool.clear();
+    physical.clear();
+    timer.reset();
+  }
+
+  // Nothing pooled survives a resize, every transient is relative to it
+  void setOutputSize(uint32_t width, uint32_t height) {
+    if (width == outputWidth && height == outputHeight)
+      return;
+    outputWidth = std::max(width, 1u);
+    outputHeight = std::max(height, 1u);
+    clear();
+  }
+
+  uint32_t getOutputWidth() const { return outputWidth; }
+  uint32_t getOutputHeight() const { return outputHeight; }
+
+  // Fraction of the output size dynamic transients are drawn at, from
+  // MIN_RENDER_SCALE to 1. Set before the systems record the frame
+  void setRenderScale(float scale) {
+    renderScale = std::clamp(scale, MIN_RENDER_SCALE, 1.0f);
+  }
+
+  float getRenderScale() const { return renderScale; }
+
+  // ========== RECORDING ==========
+
+  // Forgets last frame's passes and transients, called before the systems
+  // render
+  void beginFrame() {
+    passes.clear();
+    resources.clear();
+    names.clear();
+    resources.emplace_back();
+    resources[BACKBUFFER].name = "backbuffer";
+  }
+
+  // Declares a transient texture for this frame. Asking again for a name
+  // already declared returns the same resource
+  ResourceID createTexture(const std::string &name, const TextureDesc &desc) {
+    auto found = names.find(name);
+    if (found != names.end())
+      return found->second;
+
+    ResourceID id = static_cast<ResourceID>(resources.size());
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resources.push_back(resource);
+    names[name] = id;
+    return id;
+  }
+
+  // A transient declared earlier this frame, INVALID_RESOURCE if none
+  ResourceID find(const std::string &name) const {
+    auto found = names.find(name);
+    return found != names.end() ? found->second : INVALID_RESOURCE;
+  }
+
+  PassBuilder addPass(const std::string &name, ExecuteFn execute) {
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+    return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+  }
+
+  uint32_t getWidth(ResourceID id) const {
+    return id == BACKBUFFER ? outputWidth : scaled(outputWidth, id);
+  }
+
+  uint32_t getHeight(ResourceID id) const {
+    return id == BACKBUFFER ? outputHeight : scaled(outputHeight, id);
+  }
+
+  // The part of the texture drawn into this frame, in UV. Less than 1 only
+  // for dynamic transients
+  glm::vec2 getContentScale(ResourceID id) const {
+    if (id == BACKBUFFER || id >= resources.size() ||
+        !resources[id].desc.dynamic)
+      return glm::vec2(1.0f);
+    return glm::vec2(static_cast<float>(viewportWidth(id)) / getWidth(id),
+                     static_cast<float>(viewportHeight(id)) / getHeight(id));
+  }
+
+  // ========== EXECUTION ==========
+
+  // Culls, allocates and runs the passes recorded since beginFrame().
+  // Leaves the default framebuffer bound
+  void execute() {
+    frame++;
+    stats = Stats();
+    stats.passes = static_cast<uint32_t>(passes.size());
+    stats.transients = static_cast<uint32_t>(resources.size() - 1);
+    stats.renderScale = renderScale;
+
+    // Timestamps, the passes may run timers of their own
+    if (!timer)
+      timer = std::make_unique<GPUTimer>(false, true);
+    timer->begin();
+
+    std::vector<bool> needed = cullPasses();
+    allocate(needed);
+
+    auto &glState = GLStateCache::instance();
+    GLuint bound = UINT32_MAX;
+    for (size_t index = 0; index < passes.size(); index++) {
+      if (!needed[index]) {
+        stats.culled++;
+        continue;
+      }
+      const Pass &pass = passes[index];
+      ResourceID target = pass.colors.empty() ? pass.depthStencil
+                                              : pass.colors[0];
+      GLuint fbo = framebufferFor(pass);
+      if (fbo != bound) {
+        glState.bindFramebuffer(fbo);
+        stats.framebufferChanges++;
+        bound = fbo;
+      }
+
+      PassContext context{*this, outputWidth, outputHeight};
+      if (target != INVALID_RESOURCE) {
+        context.width = viewportWidth(target);
+        context.height = viewportHeight(target);
+      }
+      glState.setViewport(0, 0, context.width, context.height);
+      pass.execute(context);
+    }
+    glState.bindFramebuffer(0);
+    timer->end();
+    stats.gpuMilliseconds = timer->getLastResult().milliseconds;
+
+    releaseUnused();
+    stats.pooledTextures = static_cast<uint32_t>(pool.size());
+    for (const PooledTexture &pooled : pool) {
+      stats.pooledBytes += static_cast<size_t>(pooled.width) *
+                           pooled.height * formatInfo(pooled.format).bytes;
+    }
+  }
+
+  // The GL texture behind a resource, only meaningful while executing
+  GLuint getTexture(ResourceID id) const {
+    if (id >= physical.size() || physical[id] == NO_TEXTURE)
+      return 0;
+    return pool[physical[id]].texture;
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  static constexpr uint32_t NO_PASS = UINT32_MAX;
+  static constexpr uint32_t NO_TEXTURE = UINT32_MAX;
+
+  struct Resource {
+    std::string name;
+    TextureDesc desc;
+  };
+
+  struct Pass {
+    std::string name;
+    ExecuteFn execute;
+    std::vector<ResourceID> reads;
+    std::vector<ResourceID> colors;
+    ResourceID depthStencil = INVALID_RESOURCE;
+  };
+
+  struct PooledTexture {
+    GLuint texture = 0;
+    Format format = RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t lastFrame = 0; // Last frame a transient used it
+    uint32_t busyUntil = 0; // Last pass of that transient
+  };
+
+  struct FormatInfo {
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+    uint32_t bytes; // Per texel, as the driver most likely stores it
+  };
+
+  static FormatInfo formatInfo(Format format) {
+    switch (format) {
+    case RGB8:
+      return {GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 4};
+    case RGBA16F:
+      return {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8};
+    case DEPTH24_STENCIL8:
+      return {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4};
+    case RGBA8:
+    default:
+      return {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};
+    }
+  }
+
+  std::vector<Pass> passes;
+  std::vector<Resource> resources; // [0] is the backbuffer
+  std::unordered_map<std::string, ResourceID> names;
+
+  std::vector<PooledTexture> pool;
+  std::vector<uint32_t> physical; // Pool index per resource, this frame
+  // Attachment textures (colours, then depth or 0) to their FBO
+  std::map<std::vector<GLuint>, GLuint> framebuffers;
+
+  uint32_t outputWidth = 800;
+  uint32_t outputHeight = 600;
+  float renderScale = 1.0f;
+  uint32_t frame = 0;
+  std::unique_ptr<GPUTimer> timer; // Created with the first frame
+  Stats stats;
+
+  uint32_t scaled(uint32_t size, ResourceID id) const {
+    float value = static_cast<float>(size) * resources[id].desc.scale;
+    return std::max(1u, static_cast<uint32_t>(value + 0.5f));
+  }
+
+  uint32_t rendered(uint32_t size) const {
+    float value = static_cast<float>(size) * renderScale;
+    return std::max(1u, static_cast<uint32_t>(value + 0.5f));
+  }
+
+  // What passes draw of a resource, all of it unless it is dynamic
+  uint32_t viewportWidth(ResourceID id) const {
+    if (id == BACKBUFFER || !resources[id].desc.dynamic)
+      return getWidth(id);
+    return std::min(getWidth(id), scaled(rendered(outputWidth), id));
+  }
+
+  uint32_t viewportHeight(ResourceID id) const {
+    if (id == BACKBUFFER || !resources[id].desc.dynamic)
+      return getHeight(id);
+    return std::min(getHeight(id), scaled(rendered(outputHeight), id));
+  }
+
+  template <typename F> static void forEachUse(const Pass &pass, F &&f) {
+    for (ResourceID id : pass.reads)
+      f(id, false);
+    for (ResourceID id : pass.colors)
+      f(id, true);
+    if (pass.depthStencil != INVALID_RESOURCE)
+      f(pass.depthStencil, true);
+  }
+
+  // A pass is needed when it draws to the backbuffer or a needed pass uses
+  // what it wrote. Dependencies only point backwards, so one reverse walk
+  // settles everything
+  std::vector<bool> cullPasses() {
+    std::vector<std::vector<uint32_t>> inputs(passes.size());
+    std::vector<uint32_t> lastWriter(resources.size(), NO_PASS);
+    for (uint32_t index = 0; index < passes.size(); index++) {
+      forEachUse(passes[index], [&](ResourceID id, bool writes) {
+        if (id >= resources.size())
+          return;
+        if (lastWriter[id] != NO_PASS) {
+          inputs[index].push_back(lastWriter[id]);
+        } else if (!writes && id != BACKBUFFER) {
+          std::cout << "ERROR::RENDER_GRAPH::READ_BEFORE_WRITE: "
+                    << passes[index].name << " reads "
+                    << resources[id].name << std::endl;
+        }
+      });
+      forEachUse(passes[index], [&](ResourceID id, bool writes) {
+        if (writes && id < resources.size())
+          lastWriter[id] = index;
+      });
+    }
+
+    std::vector<bool> needed(passes.size(), false);
+    for (uint32_t index = static_cast<uint32_t>(passes.size()); index-- > 0;) {
+      const Pass &pass = passes[index];
+      if (std::find(pass.colors.begin(), pass.colors.end(), BACKBUFFER) !=
+          pass.colors.end())
+        needed[index] = true;
+      if (!needed[index])
+        continue;
+      for (uint32_t input : inputs[index]) {
+        needed[input] = true;
+      }
+    }
+    return needed;
+  }
+
+  // Gives every transient a pooled texture, reusing one whose previous
+  // transient is done by the time this one is first used
+  void allocate(const std::vector<bool> &needed) {
+    std::vector<uint32_t> lastUse(resources.size(), NO_PASS);
+    for (uint32_t index = 0; index < passes.size(); index++) {
+      if (!needed[index])
+        continue;
+      forEachUse(passes[index], [&](ResourceID id, bool) {
+        if (id < resources.size())
+          lastUse[id] = index;
+      });
+    }
+
+    physical.assign(resources.size(), NO_TEXTURE);
+    for (uint32_t index = 0; index < passes.size(); index++) {
+      if (!needed[index])
+        continue;
+      forEachUse(passes[index], [&](ResourceID id, bool) {
+        if (id == BACKBUFFER || id >= resources.size() ||
+            physical[id] != NO_TEXTURE)
+          return;
+        physical[id] = acquire(id, index, lastUse[id]);
+      });
+    }
+  }
+
+  uint32_t acquire(ResourceID id, uint32_t firstUse, uint32_t lastUse) {
+    Format format = resources[id].desc.format;
+    uint32_t width = getWidth(id);
+    uint32_t height = getHeight(id);
+    for (uint32_t slot = 0; slot < pool.size(); slot++) {
+      PooledTexture &pooled = pool[slot];
+      bool free = pooled.lastFrame != frame || pooled.busyUntil < firstUse;
+      if (free && pooled.format == format && pooled.width == width &&
+          pooled.height == height) {
+        pooled.lastFrame = frame;
+        pooled.busyUntil = lastUse;
+        return slot;
+      }
+    }
+
+    PooledTexture pooled;
+    pooled.format = format;
+    pooled.width = width;
+    pooled.height = height;
+    pooled.lastFrame = frame;
+    pooled.busyUntil = lastUse;
+
+    FormatInfo info = formatInfo(format);
+    bool depth = format == DEPTH24_STENCIL8;
+    glGenTextures(1, &pooled.texture);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, pooled.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, info.internalFormat, width, height, 0,
+                 info.format, info.type, nullptr);
+    GLint filter = depth ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    pool.push_back(pooled);
+    return static_cast<uint32_t>(pool.size() - 1);
+  }
+
+  // 0 for passes drawing to the backbuffer
+  GLuint framebufferFor(const Pass &pass) {
+    std::vector<GLuint> key;
+    for (ResourceID id : pass.colors) {
+      if (id == BACKBUFFER)
+        return 0;
+      key.push_back(getTexture(id));
+    }
+    key.push_back(pass.depthStencil == INVALID_RESOURCE
+                      ? 0
+                      : getTexture(pass.depthStencil));
+
+    auto found = framebuffers.find(key);
+    if (found != framebuffers.end())
+      return found->second;
+
+    auto &glState = GLStateCache::instance();
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glState.bindFramebuffer(fbo);
+    std::vector<GLenum> drawBuffers;
+    for (GLenum i = 0; i + 1 < key.size(); i++) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                             GL_TEXTURE_2D, key[i], 0);
+      drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+    }
+    if (key.back()) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                             GL_TEXTURE_2D, key.back(), 0);
+    }
+    if (drawBuffers.empty()) {
+      glDrawBuffer(GL_NONE);
+      glReadBuffer(GL_NONE);
+    } else {
+      glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()),
+                    drawBuffers.data());
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_INCOMPLETE: " << pass.name
+                << std::endl;
+    }
+    framebuffers[key] = fbo;
+    return fbo;
+  }
+
+  // Pooled textures (and the FBOs using them) no pass needed lately, e.g.
+  // after an effect was switched off
+  void releaseUnused() {
+    auto &glState = GLStateCache::instance();
+    for (size_t slot = pool.size(); slot-- > 0;) {
+      if (frame - pool[slot].lastFrame <= POOL_FRAMES_KEPT)
+        continue;
+      GLuint texture = pool[slot].texture;
+      for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+        if (std::find(it->first.begin(), it->first.end(), texture) !=
+            it->first.end()) {
+          glState.deleteFramebuffer(it->second);
+          it = framebuffers.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      glState.deleteTexture(texture);
+      pool.erase(pool.begin() + slot);
+    }
+  }
+};
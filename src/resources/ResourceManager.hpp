@@ -1,44 +1,122 @@
 #pragma once
 
+#include "../components/MeshComponent.hpp"
+#include "../spatial/Geometry.hpp"
+#include "AsyncTextureLoader.hpp"
 #include "Cubemap.hpp"
-#include "Framebuffer.hpp"
+#include "GLStateCache.hpp"
+#include "GeometryArena.hpp"
+#include "MaterialTable.hpp"
+#include "RenderGraph.hpp"
+#include "ResourcePool.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureAtlas.hpp"
+#include "VertexLayout.hpp"
 #include "shader_h.hpp"
 #include "texture_2d_h.hpp"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+struct MeshData;
+
+using TextureHandle = ResourceHandle<Texture2D>;
+using CubemapHandle = ResourceHandle<Cubemap>;
+using ShaderHandle = ResourceHandle<Shader>;
+using MeshHandle = ResourceHandle<MeshData>;
+
+// vbo and ebo are 0 when the mesh lives in a GeometryArena, whose VAO is
+// then shared with every other mesh of the same layout
 struct MeshData {
   uint32_t vao = 0;
   uint32_t vbo = 0;
   uint32_t ebo = 0;
   uint32_t vertexCount = 0;
   uint32_t indexCount = 0;
+  uint32_t baseVertex = 0;
+  uint32_t firstIndex = 0;
+  GLenum indexType = GL_UNSIGNED_INT;
+  bool compact = false;
+  glm::vec3 positionScale = glm::vec3(1.0f);
+  glm::vec3 positionOffset = glm::vec3(0.0f);
+  AABB bounds;
+  MeshHandle handle;
+
+  MeshComponent toComponent() const {
+    MeshComponent mesh;
+    mesh.vao = vao;
+    mesh.vertexCount = vertexCount;
+    mesh.indexCount = indexCount;
+    mesh.baseVertex = baseVertex;
+    mesh.firstIndex = firstIndex;
+    mesh.indexType = indexType;
+    mesh.compact = compact;
+    mesh.positionScale = positionScale;
+    mesh.positionOffset = positionOffset;
+    mesh.bounds = bounds;
+    mesh.handle = handle;
+    return mesh;
+  }
 };
 
-struct Vertex {
-  glm::vec3 Position;
-  glm::vec3 Normal;
-  glm::vec2 TexCoords;
+// Mesh data already in its GPU format (Vertex or CompactVertex, 16 or 32 bit
+// indices), e.g. a mesh inside a memory mapped MeshCache file. Uploaded as
+// is, without conversion or intermediate copies
+struct PackedMesh {
+  const void *vertices = nullptr;
+  uint32_t vertexCount = 0;
+  const void *indices = nullptr;
+  uint32_t indexCount = 0;
+  GLenum indexType = GL_UNSIGNED_INT;
+  bool compact = false;
+  glm::vec3 positionScale = glm::vec3(1.0f);
+  glm::vec3 positionOffset = glm::vec3(0.0f);
+  AABB bounds;
 };
 
-struct VertexAttribute {
-  unsigned int location; // Shader location (0, 1, 2, etc.)
-  int componentCount;    // Number of components (3 for vec3, 2 for vec2)
-  unsigned int type;     // GL_FLOAT, GL_INT, etc.
-  bool normalized;       // Should values be normalized?
-  int stride;            // Bytes between consecutive vertices
-  const void *offset;    // Offset of this attribute in the vertex data
-
-  VertexAttribute(unsigned int loc, int count, unsigned int t = GL_FLOAT,
-                  bool norm = false, int str = 0, const void *off = nullptr)
-      : location(loc), componentCount(count), type(t), normalized(norm),
-        stride(str), offset(off) {}
+// References held on behalf of one owner, usually a Scene. Everything loaded
+// or created while the scope is bound (ResourceManager::pushScope) is
+// referenced by it until ResourceManager::releaseScope
+struct ResourceScope {
+  std::vector<TextureHandle> textures;
+  std::vector<CubemapHandle> cubemaps;
+  std::vector<ShaderHandle> shaders;
+  std::vector<MeshHandle> meshes;
 };
 
+// Textures, cubemaps, shaders and meshes are reference counted in a
+// ResourcePool each. Loading something that is already resident returns the
+// resident copy. Resources nothing references any more stay cached until
+// the GPU memory budget is exceeded, then the least recently released ones
+// are evicted first, whatever their type.
+//
+// Loads add a reference on behalf of the bound ResourceScope, or of the
+// engine when none is bound (those are never released). Handles let code
+// outside scenes hold references of its own, see retain()
 class ResourceManager {
 public:
+  static const size_t DEFAULT_GPU_BUDGET = size_t(512) << 20;
+
+  struct MemoryStats {
+    ResourcePoolStats textures;
+    ResourcePoolStats cubemaps;
+    ResourcePoolStats shaders; // Counts only, the driver owns programs
+    ResourcePoolStats meshes;
+    // Compiled by Shader::variant and owned by the pooled shaders
+    uint32_t shaderVariants = 0;
+    // Atlas pages stay resident until cleanup(), never evicted
+    uint32_t atlasPages = 0;
+    size_t atlasBytes = 0;
+    size_t gpuBytes = 0; // Textures, cubemaps, meshes and atlas pages
+    size_t gpuBudget = 0;
+    size_t arenaBytes = 0; // Geometry arena buffers, free ranges included
+  };
+
   // Singleton
   static ResourceManager &instance() {
     static ResourceManager inst;
@@ -46,137 +124,205 @@ public:
   }
 
   // ========== SHADERS ==========
+  // Shaders are keyed by name, a name that is already loaded is not
+  // compiled again
   uint32_t loadShader(const std::string &name, const char *vertexPath,
                       const char *fragmentPath) {
-    auto shader = std::make_shared<Shader>(vertexPath, fragmentPath);
-    uint32_t id = shader->ID;
-    shaders[name] = shader;
-    shadersByID[id] = shader;
-    return id;
+    return get(acquireShader(name, vertexPath, fragmentPath))->ID;
+  }
+
+  ShaderHandle acquireShader(const std::string &name, const char *vertexPath,
+                             const char *fragmentPath) {
+    ShaderHandle handle = shaderPool.find(name);
+    if (!handle.isValid()) {
+      handle = addShader(
+          name, std::make_unique<Shader>(vertexPath, fragmentPath));
+    }
+    retainInScope(handle);
+    return handle;
+  }
+
+  // Vertex only program for transform feedback, see Shader
+  uint32_t loadFeedbackShader(const std::string &name, const char *vertexPath,
+                              const std::vector<std::string> &varyings) {
+    ShaderHandle handle = shaderPool.find(name);
+    if (!handle.isValid()) {
+      handle =
+          addShader(name, std::make_unique<Shader>(vertexPath, varyings));
+    }
+    retainInScope(handle);
+    return get(handle)->ID;
   }
 
   Shader *getShader(uint32_t id) {
-    auto it = shadersByID.find(id);
-    return (it != shadersByID.end()) ? it->second.get() : nullptr;
+    auto it = shaderIDs.find(id);
+    return (it != shaderIDs.end()) ? get(it->second) : nullptr;
   }
 
   Shader *getShader(const std::string &name) {
-    auto it = shaders.find(name);
-    return (it != shaders.end()) ? it->second.get() : nullptr;
+    return get(shaderPool.find(name));
   }
 
   // ========== TEXTURES ==========
+  // Textures load asynchronously: the ID is valid at once and shows a
+  // placeholder until the image has been decoded and uploaded, see
+  // AsyncTextureLoader
   uint32_t loadTexture(const std::string &path, bool flipY = true) {
-    auto it = textureCache.find(path);
-    if (it != textureCache.end()) {
-      return it->second->getID();
-    }
-
-    stbi_set_flip_vertically_on_load(flipY);
+    return get(acquireTexture(path, flipY))->getID();
+  }
 
-    auto texture = std::make_shared<Texture2D>();
-    texture->loadImage(path);
+  TextureHandle acquireTexture(const std::string &path, bool flipY = true) {
+    TextureHandle handle = texturePool.find(path);
+    if (handle.isValid()) {
+      retainInScope(handle);
+      return handle;
+    }
 
+    auto texture = std::make_unique<Texture2D>();
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                     GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    AsyncTextureLoader::uploadPlaceholder(GL_TEXTURE_2D);
 
     uint32_t id = texture->getID();
-    textureCache[path] = texture;
-    texturesByID[id] = texture;
-    return id;
+    handle = texturePool.insert(std::move(texture), path,
+                                PLACEHOLDER_BYTES, tick++);
+    textureIDs[id] = handle;
+    // The loader's reference keeps the ID from being deleted (and reused)
+    // before the upload, released in onTextureUploaded
+    texturePool.addRef(handle);
+    textureLoader.load2D(id, path, flipY);
+    retainInScope(handle);
+    return handle;
   }
 
   // Cubemap
   uint32_t loadCubemapTexture(const std::string &path) {
-    int width, height, nrChannels;
+    return get(acquireCubemap(path))->getID();
+  }
+
+  CubemapHandle acquireCubemap(const std::string &path) {
+    CubemapHandle handle = cubemapPool.find(path);
+    if (handle.isValid()) {
+      retainInScope(handle);
+      return handle;
+    }
     std::vector<std::string> faces = {
         path + "right.jpg",  path + "left.jpg",  path + "top.jpg",
         path + "bottom.jpg", path + "front.jpg", path + "back.jpg",
     };
 
-    auto cubemap = std::make_shared<Cubemap>();
-    auto it = cubemapCache.find(path);
-    if (it != cubemapCache.end()) {
-      return it->second->getID();
-    }
-    stbi_set_flip_vertically_on_load(false);
-    for (unsigned int i = 0; i < faces.size(); i++) {
-      cubemap->loadImage(width, height, nrChannels, faces[i], i);
-    }
-
-    stbi_set_flip_vertically_on_load(false);
+    auto cubemap = std::make_unique<Cubemap>();
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    AsyncTextureLoader::uploadPlaceholder(GL_TEXTURE_CUBE_MAP);
 
     uint32_t id = cubemap->getID();
-    cubemapCache[path] = cubemap;
-    return id;
+    handle = cubemapPool.insert(std::move(cubemap), path,
+                                PLACEHOLDER_BYTES * 6, tick++);
+    cubemapIDs[id] = handle;
+    cubemapPool.addRef(handle);
+    textureLoader.loadCubemap(id, faces);
+    retainInScope(handle);
+    return handle;
+  }
+
+  // Uploads finished texture loads and streamed mip levels, call once per
+  // frame. Streaming gets whatever time the loads left
+  void updateTextureLoads(double budgetMs) {
+    textureLoader.update(budgetMs);
+    textureStreamer.update(std::max(
+        0.0, budgetMs - textureLoader.getStats().uploadMsLastUpdate));
+    enforceBudget();
+  }
+  AsyncTextureLoader &getTextureLoader() { return textureLoader; }
+  TextureStreamer &getTextureStreamer() { return textureStreamer; }
+
+  // ========== MATERIALS ==========
+  MaterialTable &getMaterialTable() { return materialTable; }
+
+  // ========== TEXTURE ATLASES ==========
+  // Empty atlas to add() images to, call build() on it once they are all in
+  TextureAtlas &createAtlas(const std::string &name, int pageSize = 2048,
+                            int padding = 4) {
+    auto atlas = std::make_unique<TextureAtlas>(pageSize, padding);
+    TextureAtlas &ref = *atlas;
+    atlases[name] = std::move(atlas);
+    return ref;
+  }
+
+  TextureAtlas *getAtlas(const std::string &name) {
+    auto it = atlases.find(name);
+    return (it != atlases.end()) ? it->second.get() : nullptr;
   }
 
   // ========== MESHES ==========
+  // Meshes are sub-allocated from one GeometryArena per vertex layout, so
+  // meshes sharing a layout share a VAO and can be drawn with one multi-draw
+
+  // Separate position/normal/texcoord arrays, interleaved into Vertex
   MeshData createMesh(const float *positions, size_t positionsSize,
                       const float *normals, size_t normalsSize,
                       const float *texCoords, size_t texCoordsSize,
                       uint32_t vertexCount) {
-    MeshData data;
-    data.vertexCount = vertexCount;
-    data.indexCount = 0;
-
-    size_t totalSize = positionsSize + normalsSize + texCoordsSize;
-
-    glGenVertexArrays(1, &data.vao);
-    glGenBuffers(1, &data.vbo);
-
-    glBindVertexArray(data.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, data.vbo);
-
-    // Allocate buffer with total size
-    glBufferData(GL_ARRAY_BUFFER, totalSize, nullptr, GL_STATIC_DRAW);
-
-    // Upload each attribute array to its region
-    glBufferSubData(GL_ARRAY_BUFFER, 0, positionsSize, positions);
-    glBufferSubData(GL_ARRAY_BUFFER, positionsSize, normalsSize, normals);
-    glBufferSubData(GL_ARRAY_BUFFER, positionsSize + normalsSize, texCoordsSize,
-                    texCoords);
-
-    // Position (location 0) - 3 floats, stride 0 (tightly packed)
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-
-    // Normal (location 1) - 3 floats
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *)positionsSize);
-
-    // TexCoords (location 2) - 2 floats
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0,
-                          (void *)(positionsSize + normalsSize));
-
-    glBindVertexArray(0);
-
-    meshes.emplace_back(data);
-    return data;
+    std::vector<Vertex> vertices(vertexCount);
+    for (uint32_t i = 0; i < vertexCount; i++) {
+      Vertex &vertex = vertices[i];
+      vertex.Position = (i + 1) * 3 * sizeof(float) <= positionsSize
+                            ? glm::vec3(positions[i * 3], positions[i * 3 + 1],
+                                        positions[i * 3 + 2])
+                            : glm::vec3(0.0f);
+      vertex.Normal = (i + 1) * 3 * sizeof(float) <= normalsSize
+                          ? glm::vec3(normals[i * 3], normals[i * 3 + 1],
+                                      normals[i * 3 + 2])
+                          : glm::vec3(0.0f);
+      vertex.TexCoords =
+          (i + 1) * 2 * sizeof(float) <= texCoordsSize
+              ? glm::vec2(texCoords[i * 2], texCoords[i * 2 + 1])
+              : glm::vec2(0.0f);
+    }
+    return createMesh(reinterpret_cast<const float *>(vertices.data()),
+                      vertices.size() * sizeof(Vertex),
+                      VertexLayout::standard(), vertexCount);
   }
 
-  // Creates a mesh with interleaved vertex data and custom attributes
+  // Creates a mesh with interleaved vertex data and custom attributes.
+  // positionComponents is how many leading floats of location 0 are the
+  // position for the bounds, e.g. 2 for the 2D <vec2 pos, vec2 tex> layout.
+  // 0 takes the whole attribute, at most xyz
   MeshData createMesh(const float *vertices, size_t sizeInBytes,
                       const std::vector<VertexAttribute> &attributes,
-                      uint32_t vertexCount) {
+                      uint32_t vertexCount, int positionComponents = 0) {
     MeshData data;
     data.vertexCount = vertexCount;
     data.indexCount = 0;
 
+    for (const VertexAttribute &attr : attributes) {
+      if (attr.location == 0) {
+        data.bounds = computeBounds(vertices, sizeInBytes, attr, vertexCount,
+                                    positionComponents);
+      }
+    }
+
+    size_t stride = VertexLayout::stride(attributes);
+    if (stride != 0 && vertexCount * stride <= sizeInBytes) {
+      GeometryArena &arena = getArena(attributes);
+      data.vao = arena.getVAO();
+      data.baseVertex = arena.allocate(vertices, vertexCount).baseVertex;
+      return track(data, vertexCount * stride);
+    }
+
+    // Attributes in separate blocks of the buffer can't share an arena
     glGenVertexArrays(1, &data.vao);
     glGenBuffers(1, &data.vbo);
 
-    glBindVertexArray(data.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, data.vbo);
+    GLStateCache::instance().bindVertexArray(data.vao);
+    GLStateCache::instance().bindBuffer(GL_ARRAY_BUFFER, data.vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeInBytes, vertices, GL_STATIC_DRAW);
 
     for (const VertexAttribute &attr : attributes) {
@@ -186,10 +332,8 @@ public:
       glEnableVertexAttribArray(attr.location);
     }
 
-    glBindVertexArray(0);
-
-    meshes.emplace_back(data);
-    return data;
+    GLStateCache::instance().bindVertexArray(0);
+    return track(data, sizeInBytes);
   }
 
   MeshData createIndexedMesh(const std::vector<Vertex> &vertices,
@@ -198,38 +342,73 @@ public:
     data.vertexCount = static_cast<uint32_t>(vertices.size());
     data.indexCount = static_cast<uint32_t>(indices.size());
 
-    glGenVertexArrays(1, &data.vao);
-    glGenBuffers(1, &data.vbo);
-    glGenBuffers(1, &data.ebo);
-
-    glBindVertexArray(data.vao);
+    for (const Vertex &vertex : vertices) {
+      data.bounds.expand(vertex.Position);
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, data.vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 vertices.data(), GL_STATIC_DRAW);
+    uploadIndexed(getArena(VertexLayout::standard()), vertices.data(),
+                  indices, data);
+    return track(data, arenaBytes(data));
+  }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t),
-                 indices.data(), GL_STATIC_DRAW);
+  // Same as createIndexedMesh with CompactVertex (16 bytes instead of 32).
+  // Positions are quantised inside quantizationBox, the mesh bounds when it
+  // is invalid. Sub-meshes of one model should share a box so that they
+  // keep identical decode uniforms and can still be multi-drawn together
+  MeshData createCompactMesh(const std::vector<Vertex> &vertices,
+                             const std::vector<uint32_t> &indices,
+                             const AABB &quantizationBox = AABB()) {
+    MeshData data;
+    data.vertexCount = static_cast<uint32_t>(vertices.size());
+    data.indexCount = static_cast<uint32_t>(indices.size());
 
-    // Position (location 0)
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+    for (const Vertex &vertex : vertices) {
+      data.bounds.expand(vertex.Position);
+    }
+    AABB box = quantizationBox.isValid() ? quantizationBox : data.bounds;
 
-    // Normal (location 1)
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Normal));
+    std::vector<CompactVertex> packed;
+    packed.reserve(vertices.size());
+    for (const Vertex &vertex : vertices) {
+      packed.push_back(VertexLayout::compress(vertex, box));
+    }
 
-    // TexCoords (location 2)
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, TexCoords));
+    data.compact = true;
+    data.positionOffset = box.min;
+    data.positionScale = box.max - box.min;
+    uploadIndexed(getArena(VertexLayout::compact()), packed.data(), indices,
+                  data);
+    return track(data, arenaBytes(data));
+  }
 
-    glBindVertexArray(0);
+  MeshData createPackedMesh(const PackedMesh &mesh) {
+    MeshData data;
+    data.vertexCount = mesh.vertexCount;
+    data.indexCount = mesh.indexCount;
+    data.indexType = mesh.indexType;
+    data.compact = mesh.compact;
+    data.positionScale = mesh.positionScale;
+    data.positionOffset = mesh.positionOffset;
+    data.bounds = mesh.bounds;
+
+    GeometryArena &arena = getArena(mesh.compact ? VertexLayout::compact()
+                                                 : VertexLayout::standard());
+    GeometryArena::Allocation allocation =
+        arena.allocate(mesh.vertices, mesh.vertexCount, mesh.indices,
+                       mesh.indexCount, mesh.indexType);
+    data.vao = arena.getVAO();
+    data.baseVertex = allocation.baseVertex;
+    data.firstIndex = allocation.firstIndex;
+    return track(data, arenaBytes(data));
+  }
 
-    meshes.emplace_back(data);
-    return data;
+  // Arena a mesh was allocated from, nullptr for meshes with own buffers
+  GeometryArena *findArena(uint32_t vao) {
+    for (auto &arena : arenas) {
+      if (arena->getVAO() == vao)
+        return arena.get();
+    }
+    return nullptr;
   }
 
   MeshData createCircleMesh(float radius, int segments) {
@@ -251,69 +430,379 @@ public:
     std::vector<VertexAttribute> layout = {
         {0, 4, GL_FLOAT, false, 4 * sizeof(float), (void *)0}};
     return createMesh(verts.data(), verts.size() * sizeof(float), layout,
-                      segments * 3);
+                      segments * 3, 2);
   }
 
-  // ========== FRAMEBUFFERS ==========
-  Framebuffer *createFramebuffer(const std::string &name, unsigned int width,
-                                 unsigned int height) {
-    auto fb = std::make_unique<Framebuffer>(width, height);
-    Framebuffer *ptr = fb.get();
-    framebuffers[name] = std::move(fb);
-    return ptr;
+  // ========== LIFETIME ==========
+  // Loads reference resources on behalf of scope until popScope()
+  void pushScope(ResourceScope &scope) { scopes.push_back(&scope); }
+  void popScope() {
+    if (!scopes.empty())
+      scopes.pop_back();
   }
 
-  Framebuffer *getFramebuffer(const std::string &name) {
-    auto it = framebuffers.find(name);
-    return (it != framebuffers.end()) ? it->second.get() : nullptr;
+  // Drops every reference the scope holds. What nothing else references
+  // stays cached until its memory is needed
+  void releaseScope(ResourceScope &scope) {
+    for (TextureHandle handle : scope.textures) {
+      texturePool.release(handle, tick++);
+    }
+    for (CubemapHandle handle : scope.cubemaps) {
+      cubemapPool.release(handle, tick++);
+    }
+    for (ShaderHandle handle : scope.shaders) {
+      shaderPool.release(handle, tick++);
+    }
+    for (MeshHandle handle : scope.meshes) {
+      meshPool.release(handle, tick++);
+    }
+    scope = ResourceScope();
+    enforceBudget();
   }
 
-  void resizeFramebuffer(const std::string &name, unsigned int width,
-                         unsigned int height) {
-    auto it = framebuffers.find(name);
-    if (it != framebuffers.end()) {
-      it->second->resize(width, height);
-    }
+  // A reference of the caller's own, in addition to the scope's. Every
+  // retain() needs a release()
+  template <typename T> void retain(ResourceHandle<T> handle) {
+    poolFor(handle).addRef(handle);
   }
 
-  void setClearColorForFramebuffer(const std::string &name,
-                                   glm::vec3 clearColor) {
-    auto it = framebuffers.find(name);
-    if (it == framebuffers.end())
+  template <typename T> void release(ResourceHandle<T> handle) {
+    poolFor(handle).release(handle, tick++);
+    enforceBudget();
+  }
+
+  // Gives up the reference the bound scope took when handle was loaded, for
+  // resources its owner is done with before the scope itself is released
+  template <typename T> void releaseFromScope(ResourceHandle<T> handle) {
+    ResourceScope &scope = scopes.empty() ? engineScope : *scopes.back();
+    std::vector<ResourceHandle<T>> &held = heldBy(scope, handle);
+    auto it = std::find(held.begin(), held.end(), handle);
+    if (it == held.end())
       return;
-    auto frameBuffer = it->second.get();
-    frameBuffer->clearColor = clearColor;
+    held.erase(it);
+    release(handle);
   }
 
-  void cleanup() {
-    for (auto &mesh : meshes) {
-      if (mesh.vao)
-        glDeleteVertexArrays(1, &mesh.vao);
-      if (mesh.vbo)
-        glDeleteBuffers(1, &mesh.vbo);
-      if (mesh.ebo)
-        glDeleteBuffers(1, &mesh.ebo);
+  // nullptr once the resource has been evicted
+  template <typename T> T *get(ResourceHandle<T> handle) {
+    return poolFor(handle).get(handle);
+  }
+
+  // Bytes of GPU memory for textures and meshes. Referenced resources are
+  // never evicted, so the budget can be exceeded while they are in use
+  void setMemoryBudget(size_t gpuBytes) {
+    gpuBudget = gpuBytes;
+    enforceBudget();
+  }
+
+  MemoryStats getMemoryStats() const {
+    MemoryStats stats;
+    stats.textures = texturePool.getStats();
+    stats.cubemaps = cubemapPool.getStats();
+    stats.shaders = shaderPool.getStats();
+    stats.meshes = meshPool.getStats();
+    for (const auto &[id, handle] : shaderIDs) {
+      if (const Shader *shader = shaderPool.get(handle))
+        stats.shaderVariants +=
+            static_cast<uint32_t>(shader->getVariantCount());
+    }
+    for (const auto &[name, atlas] : atlases) {
+      stats.atlasPages += static_cast<uint32_t>(atlas->getPageCount());
+    }
+    stats.atlasBytes = atlasBytes();
+    stats.gpuBytes = gpuBytes();
+    stats.gpuBudget = gpuBudget;
+    for (const auto &arena : arenas) {
+      stats.arenaBytes += arena->getCapacityBytes();
     }
-    meshes.clear();
-    shaders.clear();
-    shadersByID.clear();
-    textureCache.clear();
-    texturesByID.clear();
-    framebuffers.clear();
+    return stats;
+  }
+
+  void printMemoryStats() const {
+    MemoryStats stats = getMemoryStats();
+    auto line = [](const char *type, const ResourcePoolStats &pool) {
+      std::cout << "  " << type << ": " << pool.resident << " resident ("
+                << pool.resident - pool.referenced << " cached), "
+                << megabytes(pool.bytes) << " MB ("
+                << megabytes(pool.unreferencedBytes) << " MB cached), "
+                << pool.evicted << " evicted" << std::endl;
+    };
+    std::cout << std::fixed << std::setprecision(1)
+              << "Resources: " << megabytes(stats.gpuBytes) << " of "
+              << megabytes(stats.gpuBudget) << " MB GPU budget, "
+              << megabytes(stats.arenaBytes) << " MB in geometry arenas"
+              << std::endl;
+    line("Textures", stats.textures);
+    line("Cubemaps", stats.cubemaps);
+    line("Meshes", stats.meshes);
+    std::cout << "  Shaders: " << stats.shaders.resident << " resident ("
+              << stats.shaders.resident - stats.shaders.referenced
+              << " cached), " << stats.shaderVariants << " variants"
+              << std::endl;
+    std::cout << "  Atlases: " << stats.atlasPages << " pages, "
+              << megabytes(stats.atlasBytes) << " MB" << std::endl;
+    const TextureStreamer::Stats &streaming = textureStreamer.getStats();
+    std::cout << "  Streamed mips: " << streaming.textures << " textures, "
+              << megabytes(streaming.streamedBytes) << " of "
+              << megabytes(streaming.budget) << " MB budget" << std::endl;
+    const RenderGraph::Stats &graph = renderGraph.getStats();
+    std::cout << "  Render targets: " << graph.pooledTextures
+              << " textures for " << graph.transients << " transients, "
+              << megabytes(graph.pooledBytes) << " MB" << std::defaultfloat
+              << std::endl;
+    std::cout << "  Materials: " << materialTable.getStats().materials
+              << " distinct" << std::endl;
+  }
+
+  // ========== RENDER GRAPH ==========
+  // Passes of the current frame and the attachments behind them
+  RenderGraph &getRenderGraph() { return renderGraph; }
+
+  void cleanup() {
+    textureLoader.clear();
+    textureStreamer.clear();
+    materialTable.clear();
+    renderGraph.clear();
+    meshPool.clear();
+    arenas.clear();
+    shaderPool.clear();
+    texturePool.clear();
+    cubemapPool.clear();
+    scopes.clear();
+    engineScope = ResourceScope();
+    atlases.clear();
   }
 
   ~ResourceManager() { cleanup(); }
 
 private:
-  ResourceManager() = default;
+  // 1x1 RGBA8 until the real pixels are uploaded
+  static const size_t PLACEHOLDER_BYTES = 4;
+
+  ResourceManager()
+      : texturePool([this](Texture2D &texture) {
+          textureIDs.erase(texture.getID());
+          textureStreamer.remove(texture.getID());
+        }),
+        cubemapPool([this](Cubemap &cubemap) {
+          cubemapIDs.erase(cubemap.getID());
+        }),
+        shaderPool([this](Shader &shader) { shaderIDs.erase(shader.ID); }),
+        meshPool([this](MeshData &mesh) { destroyMesh(mesh); }) {
+    textureLoader.setUploadCallback([this](uint32_t id, size_t bytes) {
+      onTextureUploaded(id, bytes);
+    });
+    textureLoader.setStreamer(&textureStreamer);
+    textureStreamer.setResidencyCallback([this](uint32_t id, size_t bytes) {
+      auto texture = textureIDs.find(id);
+      if (texture != textureIDs.end())
+        texturePool.setBytes(texture->second, bytes);
+    });
+  }
+
+  // Bounds from the first components floats of the position attribute
+  // (location 0) of an interleaved float buffer, 0 for the whole attribute
+  static AABB computeBounds(const float *vertices, size_t sizeInBytes,
+                            const VertexAttribute &position,
+                            uint32_t vertexCount, int components) {
+    AABB bounds;
+    if (position.type != GL_FLOAT)
+      return bounds;
+
+    if (components <= 0 || components > position.componentCount)
+      components = position.componentCount;
+    components = std::min(components, 3);
+    size_t stride = position.stride != 0
+                        ? position.stride
+                        : position.componentCount * sizeof(float);
+    size_t offset = reinterpret_cast<size_t>(position.offset);
+    const char *base = reinterpret_cast<const char *>(vertices);
+
+    for (uint32_t i = 0; i < vertexCount; i++) {
+      size_t byteOffset = offset + i * stride;
+      if (byteOffset + components * sizeof(float) > sizeInBytes)
+        break;
+      const float *p = reinterpret_cast<const float *>(base + byteOffset);
+      glm::vec3 point(0.0f);
+      for (int c = 0; c < components; c++) {
+        point[c] = p[c];
+      }
+      bounds.expand(point);
+    }
+    return bounds;
+  }
   ResourceManager(const ResourceManager &) = delete;
   ResourceManager &operator=(const ResourceManager &) = delete;
 
-  std::vector<MeshData> meshes;
-  std::unordered_map<std::string, std::shared_ptr<Shader>> shaders;
-  std::unordered_map<uint32_t, std::shared_ptr<Shader>> shadersByID;
-  std::unordered_map<std::string, std::shared_ptr<Texture2D>> textureCache;
-  std::unordered_map<std::string, std::shared_ptr<Cubemap>> cubemapCache;
-  std::unordered_map<uint32_t, std::shared_ptr<Texture2D>> texturesByID;
-  std::unordered_map<std::string, std::unique_ptr<Framebuffer>> framebuffers;
+  ResourcePool<Texture2D> &poolFor(TextureHandle) { return texturePool; }
+  ResourcePool<Cubemap> &poolFor(CubemapHandle) { return cubemapPool; }
+  ResourcePool<Shader> &poolFor(ShaderHandle) { return shaderPool; }
+  ResourcePool<MeshData> &poolFor(MeshHandle) { return meshPool; }
+
+  std::vector<TextureHandle> &heldBy(ResourceScope &scope, TextureHandle) {
+    return scope.textures;
+  }
+  std::vector<CubemapHandle> &heldBy(ResourceScope &scope, CubemapHandle) {
+    return scope.cubemaps;
+  }
+  std::vector<ShaderHandle> &heldBy(ResourceScope &scope, ShaderHandle) {
+    return scope.shaders;
+  }
+  std::vector<MeshHandle> &heldBy(ResourceScope &scope, MeshHandle) {
+    return scope.meshes;
+  }
+
+  // A reference for the bound scope, the engine's if there is none
+  template <typename T> void retainInScope(ResourceHandle<T> handle) {
+    ResourceScope &scope = scopes.empty() ? engineScope : *scopes.back();
+    poolFor(handle).addRef(handle);
+    heldBy(scope, handle).push_back(handle);
+    enforceBudget();
+  }
+
+  ShaderHandle addShader(const std::string &name,
+                         std::unique_ptr<Shader> shader) {
+    uint32_t id = shader->ID;
+    ShaderHandle handle = shaderPool.insert(std::move(shader), name, 0, tick++);
+    shaderIDs[id] = handle;
+    return handle;
+  }
+
+  // Pools every mesh the create functions hand out, data gets its handle
+  MeshData track(MeshData data, size_t bytes) {
+    data.handle =
+        meshPool.insert(std::make_unique<MeshData>(data), "", bytes, tick++);
+    meshPool.get(data.handle)->handle = data.handle;
+    retainInScope(data.handle);
+    return data;
+  }
+
+  static size_t arenaBytes(const MeshData &data) {
+    size_t stride = data.compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    size_t indexSize = data.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    return data.vertexCount * stride + data.indexCount * indexSize;
+  }
+
+  void destroyMesh(const MeshData &mesh) {
+    auto &glState = GLStateCache::instance();
+    if (mesh.vbo) {
+      glState.deleteVertexArray(mesh.vao);
+      glState.deleteBuffer(mesh.vbo);
+      if (mesh.ebo)
+        glState.deleteBuffer(mesh.ebo);
+      return;
+    }
+    if (GeometryArena *arena = findArena(mesh.vao)) {
+      GeometryArena::Allocation allocation;
+      allocation.baseVertex = mesh.baseVertex;
+      allocation.firstIndex = mesh.firstIndex;
+      arena->free(allocation, mesh.vertexCount, mesh.indexCount,
+                  mesh.indexType);
+    }
+  }
+
+  void onTextureUploaded(uint32_t id, size_t bytes) {
+    auto texture = textureIDs.find(id);
+    if (texture != textureIDs.end()) {
+      texturePool.setBytes(texture->second, bytes);
+      texturePool.release(texture->second, tick++);
+      return;
+    }
+    auto cubemap = cubemapIDs.find(id);
+    if (cubemap != cubemapIDs.end()) {
+      cubemapPool.setBytes(cubemap->second, bytes);
+      cubemapPool.release(cubemap->second, tick++);
+    }
+  }
+
+  size_t atlasBytes() const {
+    size_t bytes = 0;
+    for (const auto &[name, atlas] : atlases) {
+      bytes += atlas->getBytes();
+    }
+    return bytes;
+  }
+
+  // Atlas pages count against the budget too, cached resources make room
+  // for them
+  size_t gpuBytes() const {
+    return texturePool.getStats().bytes + cubemapPool.getStats().bytes +
+           meshPool.getStats().bytes + atlasBytes();
+  }
+
+  // Evicts the least recently released resources of any type until the GPU
+  // memory in use fits the budget or everything left is referenced
+  void enforceBudget() {
+    while (gpuBytes() > gpuBudget) {
+      uint64_t oldest = UINT64_MAX;
+      std::function<size_t()> evict;
+      considerEviction(texturePool, oldest, evict);
+      considerEviction(cubemapPool, oldest, evict);
+      considerEviction(shaderPool, oldest, evict);
+      considerEviction(meshPool, oldest, evict);
+      if (!evict)
+        break;
+      evict();
+    }
+  }
+
+  template <typename T>
+  static void considerEviction(ResourcePool<T> &pool, uint64_t &oldest,
+                               std::function<size_t()> &evict) {
+    uint64_t released;
+    if (pool.oldestUnreferenced(released) && released < oldest) {
+      oldest = released;
+      evict = [&pool] { return pool.evictOldest(); };
+    }
+  }
+
+  static double megabytes(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+  // Picks 16 bit indices whenever the mesh allows it
+  void uploadIndexed(GeometryArena &arena, const void *vertices,
+                     const std::vector<uint32_t> &indices, MeshData &data) {
+    GeometryArena::Allocation allocation;
+    if (VertexLayout::indexTypeFor(data.vertexCount) == GL_UNSIGNED_SHORT) {
+      std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+      data.indexType = GL_UNSIGNED_SHORT;
+      allocation = arena.allocate(vertices, data.vertexCount,
+                                  shortIndices.data(), data.indexCount,
+                                  GL_UNSIGNED_SHORT);
+    } else {
+      data.indexType = GL_UNSIGNED_INT;
+      allocation = arena.allocate(vertices, data.vertexCount, indices.data(),
+                                  data.indexCount, GL_UNSIGNED_INT);
+    }
+    data.vao = arena.getVAO();
+    data.baseVertex = allocation.baseVertex;
+    data.firstIndex = allocation.firstIndex;
+  }
+
+  // Only a handful of layouts exist, a linear search is fine
+  GeometryArena &getArena(const std::vector<VertexAttribute> &attributes) {
+    for (auto &arena : arenas) {
+      if (arena->matches(attributes))
+        return *arena;
+    }
+    arenas.push_back(std::make_unique<GeometryArena>(attributes));
+    return *arenas.back();
+  }
+
+  std::vector<std::unique_ptr<GeometryArena>> arenas;
+  TextureStreamer textureStreamer;
+  AsyncTextureLoader textureLoader;
+  MaterialTable materialTable;
+  RenderGraph renderGraph;
+  ResourcePool<Texture2D> texturePool; // Keyed by path
+  ResourcePool<Cubemap> cubemapPool;   // Keyed by directory
+  ResourcePool<Shader> shaderPool;     // Keyed by name
+  ResourcePool<MeshData> meshPool;     // Unkeyed
+  std::unordered_map<uint32_t, TextureHandle> textureIDs;
+  std::unordered_map<uint32_t, CubemapHandle> cubemapIDs;
+  std::unordered_map<uint32_t, ShaderHandle> shaderIDs;
+  ResourceScope engineScope;
+  std::vector<ResourceScope *> scopes;
+  size_t gpuBudget = DEFAULT_GPU_BUDGET;
+  uint64_t tick = 0; // Orders releases across the pools
+  std::unordered_map<std::string, std::unique_ptr<TextureAtlas>> atlases;
 };
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Typed reference to a pooled resource. The generation changes whenever a
+// slot is reused, so a handle to an evicted resource never resolves to the
+// resource that took its place. Generation 0 is the null handle
+template <typename T> struct ResourceHandle {
+  uint32_t index = 0;
+  uint32_t generation = 0;
+
+  bool isValid() const { return generation != 0; }
+  bool operator==(const ResourceHandle &other) const {
+    return index == other.index && generation == other.generation;
+  }
+};
+
+struct ResourcePoolStats {
+  uint32_t resident = 0;
+  uint32_t referenced = 0;
+  uint32_t evicted = 0; // Since startup
+  size_t bytes = 0;
+  size_t unreferencedBytes = 0;
+};
+
+// Reference counted resources of one type, optionally found by key (a path
+// or a name). Resources start unreferenced. Once the last reference is
+// released they are not destroyed but queued in least recently released
+// order, so loading them again is free until ResourceManager evicts them to
+// stay within its memory budget
+template <typename T> class ResourcePool {
+public:
+  using Handle = ResourceHandle<T>;
+  // Called right before an evicted resource is destroyed
+  using Evictor = std::function<void(T &)>;
+
+  explicit ResourcePool(Evictor onEvict = nullptr)
+      : onEvict(std::move(onEvict)) {}
+
+  ResourcePool(const ResourcePool &) = delete;
+  ResourcePool &operator=(const ResourcePool &) = delete;
+
+  // Null handle when nothing with key is resident
+  Handle find(const std::string &key) const {
+    auto it = byKey.find(key);
+    if (it == byKey.end())
+      return Handle();
+    return {it->second, slots[it->second].generation};
+  }
+
+  // Unkeyed resources can't be found again once released, they simply wait
+  // for eviction
+  Handle insert(std::unique_ptr<T> resource, const std::string &key,
+                size_t bytes, uint64_t tick) {
+    uint32_t index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      index = static_cast<uint32_t>(slots.size());
+      slots.emplace_back();
+    }
+
+    Slot &slot = slots[index];
+    slot.resource = std::move(resource);
+    slot.key = key;
+    slot.refs = 0;
+    slot.bytes = bytes;
+    slot.releasedAt = tick;
+    slot.lru = lru.insert(lru.end(), index);
+    if (!key.empty())
+      byKey[key] = index;
+
+    stats.resident++;
+    stats.bytes += bytes;
+    stats.unreferencedBytes += bytes;
+    return {index, slot.generation};
+  }
+
+  T *get(Handle handle) const {
+    const Slot *slot = resolve(handle);
+    return slot ? slot->resource.get() : nullptr;
+  }
+
+  bool addRef(Handle handle) {
+    Slot *slot = resolve(handle);
+    if (!slot)
+      return false;
+    if (slot->refs++ == 0) {
+      lru.erase(slot->lru);
+      stats.referenced++;
+      stats.unreferencedBytes -= slot->bytes;
+    }
+    return true;
+  }
+
+  // tick orders releases across pools, see ResourceManager
+  void release(Handle handle, uint64_t tick) {
+    Slot *slot = resolve(handle);
+    if (!slot || slot->refs == 0)
+      return;
+    if (--slot->refs == 0) {
+      slot->releasedAt = tick;
+      slot->lru = lru.insert(lru.end(), handle.index);
+      stats.referenced--;
+      stats.unreferencedBytes += slot->bytes;
+    }
+  }
+
+  // For sizes only known later (textures finish loading asynchronously)
+  void setBytes(Handle handle, size_t bytes) {
+    Slot *slot = resolve(handle);
+    if (!slot)
+      return;
+    stats.bytes += bytes - slot->bytes;
+    if (slot->refs == 0)
+      stats.unreferencedBytes += bytes - slot->bytes;
+    slot->bytes = bytes;
+  }
+
+  // Release tick of the least recently released resource, false when every
+  // resident resource is referenced
+  bool oldestUnreferenced(uint64_t &tick) const {
+    if (lru.empty())
+      return false;
+    tick = slots[lru.front()].releasedAt;
+    return true;
+  }
+
+  // Destroys the least recently released resource, returns its size
+  size_t evictOldest() {
+    if (lru.empty())
+      return 0;
+    uint32_t index = lru.front();
+    lru.pop_front();
+    stats.unreferencedBytes -= slots[index].bytes;
+    return destroy(index);
+  }
+
+  // Destroys everything, referenced or not
+  void clear() {
+    for (uint32_t i = 0; i < slots.size(); i++) {
+      if (slots[i].resource)
+        destroy(i);
+    }
+    lru.clear();
+    stats.referenced = 0;
+    stats.unreferencedBytes = 0;
+  }
+
+  const ResourcePoolStats &getStats() const { return stats; }
+
+private:
+  struct Slot {
+    std::unique_ptr<T> resource;
+    std::string key;
+    uint32_t generation = 1;
+    uint32_t refs = 0;
+    size_t bytes = 0;
+    uint64_t releasedAt = 0;
+    std::list<uint32_t>::iterator lru; // Valid while refs == 0
+  };
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+  std::unordered_map<std::string, uint32_t> byKey;
+  std::list<uint32_t> lru; // Unreferenced slots, oldest release first
+  Evictor onEvict;
+  ResourcePoolStats stats;
+
+  Slot *resolve(Handle handle) {
+    if (handle.index >= slots.size())
+      return nullptr;
+    Slot &slot = slots[handle.index];
+    return slot.resource && slot.generation == handle.generation ? &slot
+                                                                 : nullptr;
+  }
+
+  const Slot *resolve(Handle handle) const {
+    return const_cast<ResourcePool *>(this)->resolve(handle);
+  }
+
+  size_t destroy(uint32_t index) {
+    Slot &slot = slots[index];
+    if (onEvict)
+      onEvict(*slot.resource);
+    if (!slot.key.empty())
+      byKey.erase(slot.key);
+    size_t bytes = slot.bytes;
+    slot.resource.reset();
+    slot.key.clear();
+    slot.refs = 0;
+    slot.bytes = 0;
+    // Skip 0, it marks the null handle
+    slot.generation = slot.generation + 1 ? slot.generation + 1 : 1;
+    freeSlots.push_back(index);
+
+    stats.resident--;
+    stats.evicted++;
+    stats.bytes -= bytes;
+    return bytes;
+  }
+};
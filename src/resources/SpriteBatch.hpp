@@ -0,0 +1,267 @@
+#pragma once
+
+#include "../components/MaterialComponent.hpp"
+#include "../components/MeshComponent.hpp"
+#include "../components/TransformComponent.hpp"
+#include "../gl_common.hpp"
+#include "GLStateCache.hpp"
+#include "ResourceManager.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// Batched 2D sprite renderer. Sprites are transformed on the CPU into screen
+// space quads, consecutive sprites sharing a texture and blend mode are merged
+// into one draw, and the vertices are streamed through a ring buffered VBO
+// that is orphaned when it fills up.
+//
+// A sprite is the local space rect of its mesh bounds (unit quad when the mesh
+// has none) with UVs spanning the material's uvRect (0..1 unless the texture
+// is a TextureAtlas page), which matches every quad mesh the 2D scenes
+// create. Submission order is kept so overlapping sprites still blend
+// correctly.
+class SpriteBatch {
+public:
+  enum class BlendMode { ALPHA, ADDITIVE };
+
+  struct Stats {
+    uint32_t sprites = 0;
+    uint32_t drawCalls = 0;
+    uint32_t orphans = 0;
+  };
+
+  // Indices are 16 bit, a single draw covers at most this many quads
+  static const uint32_t MAX_SPRITES_PER_DRAW = 16384;
+
+  SpriteBatch(uint32_t ringCapacitySprites = MAX_SPRITES_PER_DRAW * 4)
+      : ringCapacity(ringCapacitySprites * QUAD_BYTES) {
+    auto &resources = ResourceManager::instance();
+    if (!resources.getShader("spriteBatch")) {
+      resources.loadShader("spriteBatch",
+                           "../src/shaders/sprite/spriteBatchVertex.glsl",
+                           "../src/shaders/sprite/spriteBatchFragment.glsl");
+    }
+    initBuffers();
+    vertices.reserve(MAX_SPRITES_PER_DRAW * 4);
+  }
+
+  ~SpriteBatch() {
+    auto &glState = GLStateCache::instance();
+    if (vao)
+      glState.deleteVertexArray(vao);
+    if (vbo)
+      glState.deleteBuffer(vbo);
+    if (ebo)
+      glState.deleteBuffer(ebo);
+  }
+
+  SpriteBatch(const SpriteBatch &) = delete;
+  SpriteBatch &operator=(const SpriteBatch &) = delete;
+
+  void begin(const glm::mat4 &projection) {
+    currentProjection = projection;
+    projectionDirty = true;
+    stats = Stats{};
+    vertices.clear();
+  }
+
+  void draw(const TransformComponent &transform,
+            const MaterialComponent &material, const MeshComponent &mesh,
+            BlendMode blend = BlendMode::ALPHA) {
+    bool textured = material.useTextures && material.textures[0] != 0;
+    uint32_t texture = textured ? material.textures[0] : 0;
+
+    // Untextured sprites don't care which texture is bound
+    bool sameState = blend == currentBlend &&
+                     (!textured || texture == currentTexture ||
+                      currentTexture == 0);
+    if (!vertices.empty() && !sameState) {
+      flush();
+    }
+    if (textured) {
+      currentTexture = texture;
+    }
+    currentBlend = blend;
+
+    glm::vec2 rectMin(0.0f);
+    glm::vec2 rectMax(1.0f);
+    if (mesh.hasBounds()) {
+      rectMin = glm::vec2(mesh.bounds.min);
+      rectMax = glm::vec2(mesh.bounds.max);
+    }
+
+    // Same transform as TransformComponent::getSpriteModelMatrix: scale,
+    // then rotate around the centre of the scaled unit quad, then translate
+    glm::vec2 scale(transform.scale);
+    glm::vec2 pivot = 0.5f * scale;
+    glm::vec2 origin = glm::vec2(transform.position) + pivot;
+    float c = 1.0f;
+    float s = 0.0f;
+    if (transform.rotation.z != 0.0f) {
+      float angle = glm::radians(transform.rotation.z);
+      c = std::cos(angle);
+      s = std::sin(angle);
+    }
+
+    uint8_t color[4] = {toByte(material.color.r), toByte(material.color.g),
+                        toByte(material.color.b), toByte(material.alpha)};
+    uint8_t flags[4] = {static_cast<uint8_t>(textured ? 255 : 0),
+                        static_cast<uint8_t>(material.isCircle ? 255 : 0), 0,
+                        0};
+
+    static const glm::vec2 corners[4] = {
+        {0.0f, 0.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 1.0f}};
+    for (const glm::vec2 &uv : corners) {
+      glm::vec2 local = (rectMin + (rectMax - rectMin) * uv) * scale - pivot;
+      SpriteVertex v;
+      v.x = origin.x + c * local.x - s * local.y;
+      v.y = origin.y + s * local.x + c * local.y;
+      v.u = glm::mix(material.uvRect.x, material.uvRect.z, uv.x);
+      v.v = glm::mix(material.uvRect.y, material.uvRect.w, uv.y);
+      std::memcpy(v.color, color, 4);
+      std::memcpy(v.flags, flags, 4);
+      vertices.push_back(v);
+    }
+
+    stats.sprites++;
+    if (vertices.size() >= MAX_SPRITES_PER_DRAW * 4) {
+      flush();
+    }
+  }
+
+  void end() { flush(); }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  struct SpriteVertex {
+    float x, y;
+    float u, v;
+    uint8_t color[4];
+    uint8_t flags[4]; // x = useTexture, y = isCircle
+  };
+  static const size_t QUAD_BYTES = sizeof(SpriteVertex) * 4;
+
+  uint32_t vao = 0;
+  uint32_t vbo = 0;
+  uint32_t ebo = 0;
+  size_t ringCapacity;
+  size_t ringOffset = 0;
+
+  std::vector<SpriteVertex> vertices;
+  uint32_t currentTexture = 0;
+  BlendMode currentBlend = BlendMode::ALPHA;
+  glm::mat4 currentProjection = glm::mat4(1.0f);
+  bool projectionDirty = true;
+  Stats stats;
+
+  static uint8_t toByte(float value) {
+    return static_cast<uint8_t>(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+
+  void initBuffers() {
+    auto &glState = GLStateCache::instance();
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    glState.bindVertexArray(vao);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, ringCapacity, nullptr, GL_STREAM_DRAW);
+
+    // Quad indices never change, only the base vertex moves through the ring
+    std::vector<uint16_t> indices(MAX_SPRITES_PER_DRAW * 6);
+    for (uint32_t i = 0; i < MAX_SPRITES_PER_DRAW; i++) {
+      uint16_t base = static_cast<uint16_t>(i * 4);
+      uint16_t quad[6] = {base,
+                          static_cast<uint16_t>(base + 1),
+                          static_cast<uint16_t>(base + 2),
+                          static_cast<uint16_t>(base + 2),
+                          static_cast<uint16_t>(base + 3),
+                          base};
+      std::memcpy(&indices[i * 6], quad, sizeof(quad));
+    }
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t),
+                 indices.data(), GL_STATIC_DRAW);
+
+    GLsizei stride = sizeof(SpriteVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(SpriteVertex, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(SpriteVertex, u));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void *)offsetof(SpriteVertex, color));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void *)offsetof(SpriteVertex, flags));
+
+    glState.bindVertexArray(0);
+  }
+
+  void flush() {
+    if (vertices.empty())
+      return;
+
+    auto &glState = GLStateCache::instance();
+    size_t bytes = vertices.size() * sizeof(SpriteVertex);
+
+    // Out of room: orphan the store so the driver hands us fresh memory
+    // instead of waiting for draws still reading the old one
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    if (ringOffset + bytes > ringCapacity) {
+      ringOffset = 0;
+      access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+      stats.orphans++;
+    } else {
+      access |= GL_MAP_INVALIDATE_RANGE_BIT;
+    }
+
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, ringOffset, bytes, access);
+    if (!dst) {
+      std::cout << "ERROR::SPRITE_BATCH::MAP_FAILED" << std::endl;
+      vertices.clear();
+      return;
+    }
+    std::memcpy(dst, vertices.data(), bytes);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    Shader *shader = ResourceManager::instance().getShader("spriteBatch");
+    if (shader) {
+      shader->use();
+      if (projectionDirty) {
+        shader->setMat4("projection", currentProjection);
+        shader->setInt("image", 0);
+        projectionDirty = false;
+      }
+    }
+
+    if (currentBlend == BlendMode::ADDITIVE) {
+      glState.blendFunc(GL_SRC_ALPHA, GL_ONE);
+    } else {
+      glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    if (currentTexture != 0) {
+      glState.bindTexture(0, GL_TEXTURE_2D, currentTexture);
+    }
+
+    GLsizei quadCount = static_cast<GLsizei>(vertices.size() / 4);
+    GLint baseVertex = static_cast<GLint>(ringOffset / sizeof(SpriteVertex));
+    glState.bindVertexArray(vao);
+    glDrawElementsBaseVertex(GL_TRIANGLES, quadCount * 6, GL_UNSIGNED_SHORT,
+                             nullptr, baseVertex);
+
+    ringOffset += bytes;
+    stats.drawCalls++;
+    vertices.clear();
+    currentTexture = 0;
+  }
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "ResourceManager.hpp"
+
+#include "../components/MaterialComponent.hpp"
+#include "../components/MeshComponent.hpp"
+#include "../components/OccluderComponent.hpp"
+#include "../components/TransformComponent.hpp"
+#include "../ecs/Tag.hpp"
+#include "../ecs/World.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+
+// Bakes every opaque entity tagged STATIC into merged world space meshes at
+// scene load. Triangles are grouped by material and by a uniform grid of
+// cellSize world units (by centroid), so each (material, cell) pair becomes
+// one new entity tagged STATIC_BATCH with an identity transform. The batches
+// still go through frustum and occlusion culling, and since they all live in
+// the standard GeometryArena the opaque pass merges the visible cells of a
+// material into a single multi-draw.
+//
+// Baked source entities lose their MeshComponent and keep everything else;
+// occluders get their mesh bounds copied into the OccluderComponent so they
+// still occlude. Source meshes no other entity draws are released, the
+// batches hold copies. Transparent and outlined entities are left alone,
+// they need per entity sorting or stencil passes.
+//
+// With compact set the batches use CompactVertex, all quantised inside the
+// bounds of everything baked so every cell keeps the same decode uniforms.
+class StaticBatcher {
+public:
+  struct Result {
+    std::vector<Entity> batches; // New entities, owned by the caller
+    uint32_t sourceEntities = 0;
+    uint32_t triangles = 0;
+  };
+
+  static Result bake(World &world, float cellSize = 16.0f,
+                     bool compact = false) {
+    Result result;
+    auto &resources = ResourceManager::instance();
+
+    std::vector<MaterialComponent> groups;
+    std::map<std::tuple<size_t, int, int, int>, Batch> batches;
+    std::vector<Entity> baked;
+    std::vector<uint8_t> vertexBytes;
+    std::vector<uint32_t> indices;
+    uint32_t sourceID = 0;
+
+    world.forEachWith<TransformComponent, MeshComponent, MaterialComponent,
+                      TagComponent>([&](Entity entity,
+                                        TransformComponent &transform,
+                                        MeshComponent &mesh,
+                                        MaterialComponent &material,
+                                        TagComponent &tag) {
+      if (!tag.has(STATIC) || tag.has(OUTLINED) || material.hasTransparency)
+        return;
+      if (!mesh.isValid() || mesh.vertexCount == 0)
+        return;
+
+      GeometryArena *arena = resources.findArena(mesh.vao);
+      if (!arena) {
+        std::cout << "STATIC_BATCHER::UNSUPPORTED_MESH: entity " << entity
+                  << " has its own buffers, left dynamic" << std::endl;
+        return;
+      }
+
+      arena->readVertices(mesh.baseVertex, mesh.vertexCount, vertexBytes);
+      if (mesh.isIndexed()) {
+        arena->readIndices(mesh.firstIndex, mesh.indexCount, mesh.indexType,
+                           indices);
+      } else {
+        indices.resize(mesh.vertexCount);
+        for (uint32_t i = 0; i < mesh.vertexCount; i++) {
+          indices[i] = i;
+        }
+      }
+
+      std::vector<Vertex> worldVertices =
+          toWorldSpace(*arena, mesh, vertexBytes, transform.getModelMatrix());
+      size_t group = findGroup(groups, material);
+      sourceID++;
+
+      for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        uint32_t triangle[3] = {indices[i], indices[i + 1], indices[i + 2]};
+        if (triangle[0] >= worldVertices.size() ||
+            triangle[1] >= worldVertices.size() ||
+            triangle[2] >= worldVertices.size())
+          continue;
+
+        glm::vec3 centroid = (worldVertices[triangle[0]].Position +
+                              worldVertices[triangle[1]].Position +
+                              worldVertices[triangle[2]].Position) /
+                             3.0f;
+        glm::ivec3 cell = glm::ivec3(glm::floor(centroid / cellSize));
+        Batch &batch = batches[{group, cell.x, cell.y, cell.z}];
+        batch.addTriangle(sourceID, worldVertices, triangle);
+        result.triangles++;
+      }
+      baked.push_back(entity);
+    });
+
+    // Structural changes only after iterating
+    std::vector<MeshHandle> sourceMeshes;
+    for (Entity entity : baked) {
+      MeshComponent *mesh = world.getComponent<MeshComponent>(entity);
+      OccluderComponent *occluder =
+          world.getComponent<OccluderComponent>(entity);
+      if (occluder && !occluder->box.isValid()) {
+        occluder->box = mesh->bounds;
+      }
+      if (mesh->handle.isValid() &&
+          std::find(sourceMeshes.begin(), sourceMeshes.end(),
+                    mesh->handle) == sourceMeshes.end()) {
+        sourceMeshes.push_back(mesh->handle);
+      }
+      world.removeComponent<MeshComponent>(entity);
+    }
+    result.sourceEntities = static_cast<uint32_t>(baked.size());
+
+    // The batches hold copies of the source meshes, drop the scene's
+    // references so they can be evicted. Meshes entities that weren't baked
+    // still draw stay referenced
+    world.forEachWith<MeshComponent>([&](Entity, MeshComponent &mesh) {
+      sourceMeshes.erase(
+          std::remove(sourceMeshes.begin(), sourceMeshes.end(), mesh.handle),
+          sourceMeshes.end());
+    });
+    for (MeshHandle handle : sourceMeshes) {
+      resources.releaseFromScope(handle);
+    }
+
+    AABB quantizationBox;
+    for (auto &[key, batch] : batches) {
+      for (const Vertex &vertex : batch.vertices) {
+        quantizationBox.expand(vertex.Position);
+      }
+    }
+
+    for (auto &[key, batch] : batches) {
+      MeshData meshData =
+          compact ? resources.createCompactMesh(batch.vertices, batch.indices,
+                                                quantizationBox)
+                  : resources.createIndexedMesh(batch.vertices, batch.indices);
+
+      Entity entity = world.createEntity();
+      world.addComponent(entity, TransformComponent());
+      world.addComponent(entity, meshData.toComponent());
+      world.addComponent(entity, groups[std::get<0>(key)]);
+      world.addComponent(entity, TagComponent(STATIC_BATCH));
+      result.batches.push_back(entity);
+    }
+
+    std::cout << "Static batching: " << result.sourceEntities
+              << " entities, " << result.triangles << " triangles -> "
+              << result.batches.size() << " batches" << std::endl;
+    return result;
+  }
+
+private:
+  struct Batch {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Source vertex -> batch vertex for the source mesh being added, so
+    // shared vertices stay shared
+    uint32_t source = 0;
+    std::vector<uint32_t> remap;
+
+    void addTriangle(uint32_t sourceID, const std::vector<Vertex> &sourceVerts,
+                     const uint32_t triangle[3]) {
+      if (source != sourceID) {
+        source = sourceID;
+        remap.assign(sourceVerts.size(), UINT32_MAX);
+      }
+      for (int i = 0; i < 3; i++) {
+        uint32_t &mapped = remap[triangle[i]];
+        if (mapped == UINT32_MAX) {
+          mapped = static_cast<uint32_t>(vertices.size());
+          vertices.push_back(sourceVerts[triangle[i]]);
+        }
+        indices.push_back(mapped);
+      }
+    }
+  };
+
+  // Decodes any arena layout into Vertex the way the vertex shader sees it:
+  // location 0 = position, 1 = normal, 2 = texcoords, missing components 0
+  static std::vector<Vertex> toWorldSpace(const GeometryArena &arena,
+                                          const MeshComponent &mesh,
+                                          const std::vector<uint8_t> &bytes,
+                                          const glm::mat4 &model) {
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    size_t stride = arena.getStride();
+
+    std::vector<Vertex> vertices(mesh.vertexCount);
+    for (uint32_t v = 0; v < mesh.vertexCount; v++) {
+      const uint8_t *base = bytes.data() + v * stride;
+      glm::vec4 values[3] = {glm::vec4(0.0f), glm::vec4(0.0f),
+                             glm::vec4(0.0f)};
+      for (const VertexAttribute &attr : arena.getAttributes()) {
+        if (attr.location <= 2) {
+          values[attr.location] = VertexLayout::readAttribute(base, attr);
+        }
+      }
+
+      glm::vec3 position(values[0]);
+      glm::vec3 normal(values[1]);
+      if (mesh.compact) {
+        position = mesh.positionOffset + position * mesh.positionScale;
+        normal = VertexLayout::octDecode(glm::vec2(values[1]));
+      }
+
+      Vertex &vertex = vertices[v];
+      vertex.Position = glm::vec3(model * glm::vec4(position, 1.0f));
+      vertex.Normal = normalMatrix * normal;
+      vertex.TexCoords = glm::vec2(values[2]);
+    }
+    return vertices;
+  }
+
+  static size_t findGroup(std::vector<MaterialComponent> &groups,
+                          const MaterialComponent &material) {
+    for (size_t i = 0; i < groups.size(); i++) {
+      if (groups[i].doubleSided == material.doubleSided &&
+          groups[i].sharesRenderState(material))
+        return i;
+    }
+    groups.push_back(material);
+    return groups.size() - 1;
+  }
+};
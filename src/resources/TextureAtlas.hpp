@@ -0,0 +1,306 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "GLStateCache.hpp"
+#include "stb_image.h"
+#include "texture_2d_h.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where a packed image ended up: the atlas page texture and its UV
+// sub-rectangle (u0, v0, u1, v1), ready for MaterialComponent::uvRect
+struct AtlasRegion {
+  uint32_t textureID = 0;
+  glm::vec4 uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+  bool isValid() const { return textureID != 0; }
+};
+
+// Skyline bottom-left rectangle packer. The skyline is the top edge of
+// everything placed so far, a new rect goes where it ends up lowest (ties
+// broken by the narrowest fit).
+class SkylinePacker {
+public:
+  SkylinePacker(int width = 0, int height = 0) { reset(width, height); }
+
+  void reset(int pageWidth, int pageHeight) {
+    width = pageWidth;
+    height = pageHeight;
+    skyline.clear();
+    skyline.push_back({0, 0, pageWidth});
+  }
+
+  bool insert(int rectWidth, int rectHeight, int &outX, int &outY) {
+    int bestIndex = -1;
+    int bestY = height;
+    int bestWidth = width + 1;
+    for (size_t i = 0; i < skyline.size(); i++) {
+      int y = 0;
+      if (!fits(i, rectWidth, rectHeight, y))
+        continue;
+      if (y < bestY || (y == bestY && skyline[i].width < bestWidth)) {
+        bestIndex = static_cast<int>(i);
+        bestY = y;
+        bestWidth = skyline[i].width;
+      }
+    }
+    if (bestIndex < 0)
+      return false;
+
+    outX = skyline[bestIndex].x;
+    outY = bestY;
+    place(bestIndex, outX, bestY + rectHeight, rectWidth);
+    return true;
+  }
+
+private:
+  struct Segment {
+    int x;
+    int y;
+    int width;
+  };
+
+  int width = 0;
+  int height = 0;
+  std::vector<Segment> skyline;
+
+  // Rect starting at segment index rests on the highest segment it spans
+  bool fits(size_t index, int rectWidth, int rectHeight, int &outY) const {
+    int x = skyline[index].x;
+    if (x + rectWidth > width)
+      return false;
+    int remaining = rectWidth;
+    int y = 0;
+    for (size_t i = index; remaining > 0; i++) {
+      if (i >= skyline.size())
+        return false;
+      y = std::max(y, skyline[i].y);
+      if (y + rectHeight > height)
+        return false;
+      remaining -= skyline[i].width;
+    }
+    outY = y;
+    return true;
+  }
+
+  void place(int index, int x, int top, int rectWidth) {
+    skyline.insert(skyline.begin() + index, {x, top, rectWidth});
+
+    // Trim or drop the segments now covered by the new one
+    int right = x + rectWidth;
+    for (size_t i = index + 1; i < skyline.size();) {
+      Segment &segment = skyline[i];
+      if (segment.x >= right)
+        break;
+      int overlap = right - segment.x;
+      if (overlap >= segment.width) {
+        skyline.erase(skyline.begin() + i);
+        continue;
+      }
+      segment.x += overlap;
+      segment.width -= overlap;
+      break;
+    }
+
+    // Merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline.size();) {
+      if (skyline[i].y == skyline[i + 1].y) {
+        skyline[i].width += skyline[i + 1].width;
+        skyline.erase(skyline.begin() + i + 1);
+      } else {
+        i++;
+      }
+    }
+  }
+};
+
+// Packs images into one or more RGBA8 atlas pages at load time. Usage:
+//   atlas.add("ball", "ball.png"); ... atlas.build(); atlas.getRegion("ball")
+//
+// Every image is surrounded by `padding` pixels copied from its own edge
+// (extruded), so bilinear filtering never picks up a neighbour. Placements
+// are aligned to the padding and the mip chain stops once a texel would span
+// more than the padding, which keeps the borders valid in every mip level.
+class TextureAtlas {
+public:
+  TextureAtlas(int pageSize = 2048, int padding = 4)
+      : pageSize(pageSize), padding(std::max(1, padding)) {}
+
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+  // Queues an image, nothing is loaded until build()
+  void add(const std::string &name, const std::string &path,
+           bool flipY = true) {
+    pending.push_back({name, path, flipY});
+  }
+
+  // Loads and packs every queued image. Returns false if any image could not
+  // be loaded or is larger than a page, the others are still packed
+  bool build() {
+    bool ok = true;
+    std::vector<Image> images;
+    for (const Pending &entry : pending) {
+      Image image;
+      image.name = entry.name;
+      stbi_set_flip_vertically_on_load_thread(entry.flipY);
+      int channels = 0;
+      image.pixels = stbi_load(entry.path.c_str(), &image.width,
+                               &image.height, &channels, 4);
+      if (!image.pixels) {
+        std::cout << "ERROR::TEXTURE_ATLAS::LOAD_FAILED: " << entry.path
+                  << std::endl;
+        ok = false;
+        continue;
+      }
+      if (alignUp(image.width + 2 * padding) > pageSize ||
+          alignUp(image.height + 2 * padding) > pageSize) {
+        std::cout << "ERROR::TEXTURE_ATLAS::IMAGE_TOO_LARGE: " << entry.path
+                  << std::endl;
+        stbi_image_free(image.pixels);
+        ok = false;
+        continue;
+      }
+      images.push_back(image);
+    }
+    pending.clear();
+
+    // Tallest first packs noticeably tighter with a skyline
+    std::sort(images.begin(), images.end(),
+              [](const Image &a, const Image &b) {
+                return a.height != b.height ? a.height > b.height
+                                            : a.width > b.width;
+              });
+
+    std::vector<uint8_t> page;
+    SkylinePacker packer;
+    for (Image &image : images) {
+      int cellWidth = alignUp(image.width + 2 * padding);
+      int cellHeight = alignUp(image.height + 2 * padding);
+      int x = 0;
+      int y = 0;
+      if (page.empty() || !packer.insert(cellWidth, cellHeight, x, y)) {
+        if (!page.empty()) {
+          uploadPage(page);
+        }
+        page.assign(static_cast<size_t>(pageSize) * pageSize * 4, 0);
+        packer.reset(pageSize, pageSize);
+        packer.insert(cellWidth, cellHeight, x, y);
+      }
+
+      blit(page, image, x + padding, y + padding);
+
+      AtlasRegion region;
+      region.uvRect = glm::vec4(x + padding, y + padding,
+                                x + padding + image.width,
+                                y + padding + image.height) /
+                      static_cast<float>(pageSize);
+      regions[image.name] = {static_cast<uint32_t>(pages.size()), region};
+      stbi_image_free(image.pixels);
+    }
+    if (!page.empty()) {
+      uploadPage(page);
+    }
+
+    // Page textures only exist now, patch the IDs in
+    for (auto &[name, entry] : regions) {
+      entry.region.textureID = pages[entry.page]->getID();
+    }
+    return ok;
+  }
+
+  // Invalid region (textureID 0) if the name was never packed
+  AtlasRegion getRegion(const std::string &name) const {
+    auto it = regions.find(name);
+    return it != regions.end() ? it->second.region : AtlasRegion{};
+  }
+
+  size_t getPageCount() const { return pages.size(); }
+  // GPU memory of every page, mip levels included
+  size_t getBytes() const { return bytes; }
+  uint32_t getPageTexture(size_t page) const {
+    return page < pages.size() ? pages[page]->getID() : 0;
+  }
+
+private:
+  struct Pending {
+    std::string name;
+    std::string path;
+    bool flipY;
+  };
+
+  struct Image {
+    std::string name;
+    int width = 0;
+    int height = 0;
+    unsigned char *pixels = nullptr; // RGBA8, owned by stb_image
+  };
+
+  struct Entry {
+    uint32_t page;
+    AtlasRegion region;
+  };
+
+  int pageSize;
+  int padding;
+  std::vector<Pending> pending;
+  std::unordered_map<std::string, Entry> regions;
+  std::vector<std::unique_ptr<Texture2D>> pages;
+  size_t bytes = 0;
+
+  int alignUp(int value) const {
+    return (value + padding - 1) / padding * padding;
+  }
+
+  // Copies the image to (dstX, dstY) and extrudes its edge pixels into the
+  // surrounding padding
+  void blit(std::vector<uint8_t> &page, const Image &image, int dstX,
+            int dstY) const {
+    for (int y = -padding; y < image.height + padding; y++) {
+      int srcY = std::clamp(y, 0, image.height - 1);
+      const uint8_t *srcRow = image.pixels + srcY * image.width * 4;
+      uint8_t *dstRow =
+          page.data() + (static_cast<size_t>(dstY + y) * pageSize + dstX) * 4;
+      for (int x = -padding; x < 0; x++) {
+        std::memcpy(dstRow + x * 4, srcRow, 4);
+      }
+      std::memcpy(dstRow, srcRow, image.width * 4);
+      for (int x = image.width; x < image.width + padding; x++) {
+        std::memcpy(dstRow + x * 4, srcRow + (image.width - 1) * 4, 4);
+      }
+    }
+  }
+
+  void uploadPage(const std::vector<uint8_t> &page) {
+    // Mip level n averages 2^n texels, past log2(padding) a texel would mix
+    // two neighbouring images
+    int maxLevel = 0;
+    while ((2 << maxLevel) <= padding) {
+      maxLevel++;
+    }
+
+    auto texture = std::make_unique<Texture2D>();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pageSize, pageSize, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, page.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    pages.push_back(std::move(texture));
+    for (int level = 0; level <= maxLevel; level++) {
+      size_t size = static_cast<size_t>(std::max(1, pageSize >> level));
+      bytes += size * size * 4;
+    }
+  }
+};
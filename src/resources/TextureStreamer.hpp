@@ -0,0 +1,308 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../utils/ThreadPool.hpp"
+#include "CookedTexture.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Keeps only the mip levels of a texture that its on-screen size needs.
+//
+// AsyncTextureLoader uploads the tail of the chain (levels no larger than
+// TAIL_SIZE) and hands the CookedTexture over, usually a read only mapping
+// of the .mtex, so finer levels can be uploaded later without decoding.
+// Every frame TextureStreamingSystem calls request() with how many pixels
+// the texture covers on screen. update() then uploads finer levels one per
+// texture (coarse to fine, largest on screen first) and drops levels that
+// have not been needed for DROP_DELAY_FRAMES. A level read from a mapping
+// is faulted in on the ThreadPool first and only uploaded once resident, so
+// the render thread never waits for the disk. GL_TEXTURE_BASE_LEVEL clamps
+// sampling to what is resident; dropped levels are respecified as 0x0 so
+// the driver can release them.
+//
+// Levels above the tails share a memory budget. A level that does not fit
+// takes the place of the finest level of a texture smaller on screen, or
+// waits.
+class TextureStreamer {
+public:
+  // Levels up to this size (in texels, both sides) are always resident
+  static const uint32_t TAIL_SIZE = 64;
+  static const uint32_t DROP_DELAY_FRAMES = 60;
+  static const size_t DEFAULT_BUDGET = size_t(256) << 20;
+
+  // Called with a texture's resident bytes whenever they change
+  using ResidencyCallback =
+      std::function<void(uint32_t texture, size_t bytes)>;
+
+  struct Stats {
+    uint32_t textures = 0;
+    uint32_t streamedLastUpdate = 0; // Levels uploaded
+    uint32_t droppedLastUpdate = 0;  // Levels released
+    double uploadMsLastUpdate = 0.0;
+    size_t streamedBytes = 0; // Resident levels above the tails
+    size_t budget = 0;
+  };
+
+  // Whole chains stay resident when disabled
+  bool enabled = true;
+  // Added to the estimated level, negative values keep finer levels (for
+  // meshes whose UVs tile the texture several times)
+  float mipBias = 0.0f;
+
+  // First level the loader should upload for a chain of levels
+  static uint32_t tailLevel(const CookedTexture &texture) {
+    uint32_t level = 0;
+    while (level + 1 < texture.levels.size() &&
+           std::max(texture.levels[level].width,
+                    texture.levels[level].height) > TAIL_SIZE) {
+      level++;
+    }
+    return level;
+  }
+
+  // Takes over texture, whose levels from tail on are already uploaded
+  void add(uint32_t texture, CookedTexture &&cooked, uint32_t tail) {
+    Entry &entry = entries[texture];
+    entry.cooked = std::make_shared<CookedTexture>(std::move(cooked));
+    entry.tail = tail;
+    entry.resident = tail;
+    entry.target = tail;
+    entry.lastNeeded = frame;
+  }
+
+  // The texture was deleted, forget it
+  void remove(uint32_t texture) {
+    auto it = entries.find(texture);
+    if (it == entries.end())
+      return;
+    streamedBytes -= it->second.streamedBytes();
+    entries.erase(it);
+  }
+
+  void clear() {
+    entries.clear();
+    streamedBytes = 0;
+  }
+
+  // pixels: on-screen size of something textured with texture, the largest
+  // request of a frame counts. Unknown textures are ignored
+  void request(uint32_t texture, float pixels) {
+    auto it = entries.find(texture);
+    if (it != entries.end())
+      it->second.pixels = std::max(it->second.pixels, pixels);
+  }
+
+  // Call once per frame on the thread owning the GL context, after the
+  // requests for the previous frame
+  void update(double budgetMs) {
+    auto start = std::chrono::steady_clock::now();
+    frame++;
+    stats.streamedLastUpdate = 0;
+    stats.droppedLastUpdate = 0;
+    stats.uploadMsLastUpdate = 0.0;
+
+    std::vector<std::pair<uint32_t, Entry *>> wanting;
+    for (auto &[texture, entry] : entries) {
+      uint32_t desired = enabled ? levelFor(entry) : 0;
+      // Finer levels are wanted at once, coarser ones only after a while so
+      // turning around doesn't drop and reload everything
+      if (desired <= entry.target) {
+        entry.target = desired;
+        entry.lastNeeded = frame;
+      } else if (frame - entry.lastNeeded > DROP_DELAY_FRAMES) {
+        entry.target = desired;
+      }
+      entry.lastPixels = entry.pixels;
+      entry.pixels = 0.0f;
+
+      if (entry.resident < entry.target)
+        drop(texture, entry, entry.target);
+      else if (entry.resident > entry.target)
+        wanting.push_back({texture, &entry});
+    }
+
+    // Over budget after setMemoryBudget(), least visible first
+    while (streamedBytes > budget) {
+      auto victim = leastVisible(FLT_MAX);
+      if (!victim.second)
+        break;
+      drop(victim.first, *victim.second, victim.second->resident + 1);
+    }
+
+    std::sort(wanting.begin(), wanting.end(),
+              [](const auto &a, const auto &b) {
+                return a.second->lastPixels > b.second->lastPixels;
+              });
+    for (auto &[texture, entry] : wanting) {
+      if (!prefetched(*entry, entry->resident - 1))
+        continue;
+      size_t bytes = entry->cooked->levels[entry->resident - 1].bytes();
+      while (streamedBytes + bytes > budget) {
+        auto victim = leastVisible(entry->lastPixels);
+        if (!victim.second)
+          break;
+        drop(victim.first, *victim.second, victim.second->resident + 1);
+      }
+      if (streamedBytes + bytes > budget)
+        continue;
+
+      streamIn(texture, *entry);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      stats.uploadMsLastUpdate = elapsed.count();
+      if (elapsed.count() >= budgetMs)
+        break;
+    }
+
+    stats.textures = static_cast<uint32_t>(entries.size());
+    stats.streamedBytes = streamedBytes;
+    stats.budget = budget;
+  }
+
+  // Bytes for levels above the tails
+  void setMemoryBudget(size_t bytes) { budget = bytes; }
+  void setResidencyCallback(ResidencyCallback callback) {
+    onResidencyChanged = std::move(callback);
+  }
+  const Stats &getStats() const { return stats; }
+
+private:
+  // A level being faulted in on a worker. Holds on to the texture so the
+  // mapping outlives an entry removed meanwhile
+  struct Prefetch {
+    std::shared_ptr<const CookedTexture> cooked;
+    uint32_t level = 0;
+    std::atomic<bool> done{false};
+  };
+
+  struct Entry {
+    std::shared_ptr<CookedTexture> cooked;
+    std::shared_ptr<Prefetch> prefetch; // Of the next level to stream in
+    uint32_t tail = 0;     // Coarsest level that streams, always resident
+    uint32_t resident = 0; // Finest resident level
+    uint32_t target = 0;   // Finest level wanted
+    uint32_t lastNeeded = 0;
+    float pixels = 0.0f;     // Requested this frame
+    float lastPixels = 0.0f; // Requested last frame
+
+    size_t streamedBytes() const {
+      size_t bytes = 0;
+      for (uint32_t level = resident; level < tail; level++) {
+        bytes += cooked->levels[level].bytes();
+      }
+      return bytes;
+    }
+
+    size_t residentBytes() const {
+      size_t bytes = 0;
+      for (uint32_t level = resident; level < cooked->levels.size();
+           level++) {
+        bytes += cooked->levels[level].bytes();
+      }
+      return bytes;
+    }
+  };
+
+  std::unordered_map<uint32_t, Entry> entries;
+  size_t streamedBytes = 0;
+  size_t budget = DEFAULT_BUDGET;
+  uint32_t frame = 0;
+  ResidencyCallback onResidencyChanged;
+  Stats stats;
+
+  // Finest level worth sampling when the texture covers pixels on screen,
+  // assuming its UVs span the mesh once. The tail when it wasn't requested
+  uint32_t levelFor(const Entry &entry) const {
+    if (entry.pixels <= 0.0f)
+      return entry.tail;
+    const CookedTexture::Level &base = entry.cooked->levels[0];
+    float size = static_cast<float>(std::max(base.width, base.height));
+    float level = std::floor(std::log2(size / entry.pixels) + mipBias);
+    if (level <= 0.0f)
+      return 0;
+    return std::min(entry.tail, static_cast<uint32_t>(level));
+  }
+
+  // Texture with streamed levels that covered the fewest pixels last frame,
+  // fewer than pixels
+  std::pair<uint32_t, Entry *> leastVisible(float pixels) {
+    std::pair<uint32_t, Entry *> victim = {0, nullptr};
+    for (auto &[texture, entry] : entries) {
+      if (entry.resident < entry.tail && entry.lastPixels < pixels) {
+        victim = {texture, &entry};
+        pixels = entry.lastPixels;
+      }
+    }
+    return victim;
+  }
+
+  // True once level can be uploaded without touching the disk, starts
+  // faulting it in otherwise. Cooked in memory, it already is
+  bool prefetched(Entry &entry, uint32_t level) {
+    if (!entry.cooked->mapping)
+      return true;
+    if (!entry.prefetch || entry.prefetch->level != level) {
+      auto prefetch = std::make_shared<Prefetch>();
+      prefetch->cooked = entry.cooked;
+      prefetch->level = level;
+      entry.prefetch = prefetch;
+      ThreadPool::instance().submit([prefetch] {
+        const CookedTexture &cooked = *prefetch->cooked;
+        const CookedTexture::Level &mip = cooked.levels[prefetch->level];
+        cooked.mapping->prefetch(mip.pixels, mip.bytes());
+        prefetch->done = true;
+      });
+    }
+    return entry.prefetch->done.load();
+  }
+
+  void streamIn(uint32_t texture, Entry &entry) {
+    uint32_t level = entry.resident - 1;
+    const CookedTexture::Level &mip = entry.cooked->levels[level];
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), GL_RGBA8,
+                 mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 mip.pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+                    static_cast<GLint>(level));
+
+    entry.resident = level;
+    entry.prefetch.reset();
+    streamedBytes += mip.bytes();
+    stats.streamedLastUpdate++;
+    if (onResidencyChanged)
+      onResidencyChanged(texture, entry.residentBytes());
+  }
+
+  // Releases every level finer than level
+  void drop(uint32_t texture, Entry &entry, uint32_t level) {
+    level = std::min(level, entry.tail);
+    if (level <= entry.resident)
+      return;
+
+    // Clamp sampling first, the dropped levels become incomplete
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+                    static_cast<GLint>(level));
+    for (uint32_t dropped = entry.resident; dropped < level; dropped++) {
+      glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(dropped), GL_RGBA8, 0,
+                   0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+      streamedBytes -= entry.cooked->levels[dropped].bytes();
+      stats.droppedLastUpdate++;
+    }
+
+    entry.resident = level;
+    if (onResidencyChanged)
+      onResidencyChanged(texture, entry.residentBytes());
+  }
+};
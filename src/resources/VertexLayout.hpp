@@ -0,0 +1,233 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../spatial/Geometry.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+struct Vertex {
+  glm::vec3 Position;
+  glm::vec3 Normal;
+  glm::vec2 TexCoords;
+};
+
+// Half the size of Vertex. Positions are 16 bit fractions of a box given by
+// MeshComponent::positionOffset/positionScale, normals are octahedral
+// encoded and UVs are half floats. Decoded in the vertex shader, see
+// staticVertex.glsl
+struct CompactVertex {
+  uint16_t position[4]; // xyz, w is padding
+  int16_t normal[2];
+  uint16_t texCoords[2];
+};
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must stay packed");
+
+struct VertexAttribute {
+  unsigned int location; // Shader location (0, 1, 2, etc.)
+  int componentCount;    // Number of components (3 for vec3, 2 for vec2)
+  unsigned int type;     // GL_FLOAT, GL_INT, etc.
+  bool normalized;       // Should values be normalized?
+  int stride;            // Bytes between consecutive vertices
+  const void *offset;    // Offset of this attribute in the vertex data
+
+  VertexAttribute(unsigned int loc, int count, unsigned int t = GL_FLOAT,
+                  bool norm = false, int str = 0, const void *off = nullptr)
+      : location(loc), componentCount(count), type(t), normalized(norm),
+        stride(str), offset(off) {}
+
+  bool operator==(const VertexAttribute &other) const {
+    return location == other.location &&
+           componentCount == other.componentCount && type == other.type &&
+           normalized == other.normalized && stride == other.stride &&
+           offset == other.offset;
+  }
+};
+
+namespace VertexLayout {
+
+// Layout of Vertex, used by indexed meshes and imported models
+inline std::vector<VertexAttribute> standard() {
+  return {
+      {0, 3, GL_FLOAT, false, sizeof(Vertex), (void *)0},
+      {1, 3, GL_FLOAT, false, sizeof(Vertex), (void *)offsetof(Vertex, Normal)},
+      {2, 2, GL_FLOAT, false, sizeof(Vertex),
+       (void *)offsetof(Vertex, TexCoords)}};
+}
+
+inline std::vector<VertexAttribute> compact() {
+  return {{0, 3, GL_UNSIGNED_SHORT, true, sizeof(CompactVertex),
+           (void *)offsetof(CompactVertex, position)},
+          {1, 2, GL_SHORT, true, sizeof(CompactVertex),
+           (void *)offsetof(CompactVertex, normal)},
+          {2, 2, GL_HALF_FLOAT, false, sizeof(CompactVertex),
+           (void *)offsetof(CompactVertex, texCoords)}};
+}
+
+// IEEE half floats, rounded to nearest even. Local instead of
+// glm/gtc/packing.hpp, whose unions warn under -Wall
+inline uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) // Inf and NaN
+    return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+  if (magnitude >= 0x477ff000) // Rounds past 65504
+    return sign | 0x7c00;
+  if (magnitude < 0x38800000) { // Denormal or zero
+    // Let the FPU round by adding 0.5, which puts the half mantissa in the
+    // low bits
+    float shifted;
+    std::memcpy(&shifted, &magnitude, sizeof(shifted));
+    shifted += 0.5f;
+    uint32_t result;
+    std::memcpy(&result, &shifted, sizeof(result));
+    return sign | static_cast<uint16_t>(result - 0x3f000000);
+  }
+  uint32_t odd = (magnitude >> 13) & 1;
+  magnitude += 0xc8000fff + odd; // Rebias the exponent and round
+  return sign | static_cast<uint16_t>(magnitude >> 13);
+}
+
+inline float halfToFloat(uint16_t half) {
+  uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  float value;
+  if (exponent == 0) {
+    value = std::ldexp(static_cast<float>(mantissa), -24);
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  uint32_t bits = exponent == 0x1f
+                      ? sign | 0x7f800000 | (mantissa << 13)
+                      : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Octahedral normal encoding, the decoder in GLSL mirrors octDecode
+inline glm::vec2 octEncode(glm::vec3 n) {
+  float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (length <= 0.0f)
+    return glm::vec2(0.0f);
+  n /= length;
+  glm::vec2 e(n.x, n.y);
+  if (n.z < 0.0f) {
+    glm::vec2 signs(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    e = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signs;
+  }
+  return e;
+}
+
+inline glm::vec3 octDecode(glm::vec2 e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  if (n.z < 0.0f) {
+    glm::vec2 signs(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signs;
+    n.x = folded.x;
+    n.y = folded.y;
+  }
+  return glm::normalize(n);
+}
+
+// Packs a vertex, box is the quantisation box (usually the mesh bounds)
+inline CompactVertex compress(const Vertex &vertex, const AABB &box) {
+  CompactVertex out;
+  glm::vec3 extent = box.max - box.min;
+  for (int i = 0; i < 3; i++) {
+    float t = extent[i] > 0.0f
+                  ? (vertex.Position[i] - box.min[i]) / extent[i]
+                  : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    out.position[i] = static_cast<uint16_t>(std::lround(t * 65535.0f));
+  }
+  out.position[3] = 0;
+
+  glm::vec2 normal = octEncode(vertex.Normal);
+  for (int i = 0; i < 2; i++) {
+    out.normal[i] = static_cast<int16_t>(std::lround(normal[i] * 32767.0f));
+    out.texCoords[i] = floatToHalf(vertex.TexCoords[i]);
+  }
+  return out;
+}
+
+// One attribute of a vertex as the vertex shader would see it (missing
+// components are 0, w is 1). Handles the types used by the layouts above
+inline glm::vec4 readAttribute(const uint8_t *vertex,
+                               const VertexAttribute &attr) {
+  glm::vec4 value(0.0f, 0.0f, 0.0f, 1.0f);
+  const uint8_t *src = vertex + reinterpret_cast<size_t>(attr.offset);
+  for (int c = 0; c < attr.componentCount && c < 4; c++) {
+    switch (attr.type) {
+    case GL_FLOAT:
+      value[c] = reinterpret_cast<const float *>(src)[c];
+      break;
+    case GL_HALF_FLOAT: {
+      uint16_t half = reinterpret_cast<const uint16_t *>(src)[c];
+      value[c] = halfToFloat(half);
+      break;
+    }
+    case GL_UNSIGNED_SHORT: {
+      float raw = reinterpret_cast<const uint16_t *>(src)[c];
+      value[c] = attr.normalized ? raw / 65535.0f : raw;
+      break;
+    }
+    case GL_SHORT: {
+      float raw = reinterpret_cast<const int16_t *>(src)[c];
+      // GL 3.3 signed normalisation
+      value[c] = attr.normalized ? (2.0f * raw + 1.0f) / 65535.0f : raw;
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  return value;
+}
+
+// 16 bit indices whenever a mesh is small enough. Indices are relative to
+// the mesh's base vertex, so only the mesh's own size matters
+inline GLenum indexTypeFor(size_t vertexCount) {
+  return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline size_t typeSize(unsigned int type) {
+  switch (type) {
+  case GL_BYTE:
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_SHORT:
+  case GL_UNSIGNED_SHORT:
+  case GL_HALF_FLOAT:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+// Bytes per vertex of an interleaved layout. A single attribute may leave
+// the stride at 0 (tightly packed). Returns 0 for layouts that are not
+// interleaved, i.e. several attributes without a common stride
+inline size_t stride(const std::vector<VertexAttribute> &attributes) {
+  if (attributes.empty())
+    return 0;
+  if (attributes.size() == 1 && attributes[0].stride == 0) {
+    return attributes[0].componentCount * typeSize(attributes[0].type);
+  }
+  int common = attributes[0].stride;
+  for (const VertexAttribute &attr : attributes) {
+    if (attr.stride != common)
+      return 0;
+  }
+  return static_cast<size_t>(common);
+}
+
+} // namespace VertexLayout
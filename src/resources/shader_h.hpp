@@ -1,48 +1,78 @@
 #pragma once
 
 #include "../gl_common.hpp"
+#include "GLStateCache.hpp"
+#include "ProgramBinaryCache.hpp"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+// Sources are run through a small preprocessor before compiling:
+//   #include "file"  pastes file (relative to the including file) in place,
+//                    each file at most once per stage
+//   features         every bit set adds "#define FEATURE_<NAME>" right after
+//                    #version, so a shader can #ifdef away whatever the
+//                    draw doesn't use instead of branching per pixel
+// #line directives keep compiler messages pointing at the original files,
+// the source string number is the order in which files were first read.
 class Shader {
 
 public:
+  // Compile time switches for variants, see variant()
+  enum Feature : uint32_t {
+    // Lit materials
+    TEXTURES = 1 << 0,
+    DIR_LIGHT = 1 << 1,
+    POINT_LIGHTS = 1 << 2,
+    SPOT_LIGHT = 1 << 3,
+    // Screen effects (postprocess)
+    INVERT = 1 << 4,
+    GRAYSCALE = 1 << 5,
+    SHARPEN = 1 << 6,
+    BLUR = 1 << 7,
+    EDGES = 1 << 8,
+    // Breakout post processing
+    CHAOS = 1 << 9,
+    CONFUSE = 1 << 10,
+    SHAKE = 1 << 11,
+    // Scene drawn below the output size (postprocess)
+    UPSCALE = 1 << 12,
+  };
+
   unsigned int ID;
   // constructor generates the shader on the fly
   // ------------------------------------------------------------------------
-  Shader(const char *vertexPath, const char *fragmentPath) {
+  Shader(const char *vertexPath, const char *fragmentPath,
+         uint32_t features = 0)
+      : vertexPath(vertexPath), fragmentPath(fragmentPath),
+        features(features) {
     // 1. retrieve the vertex/fragment source code from filePath
     std::string vertexCode;
     std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-    // ensure ifstream objects can throw exceptions:
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-      // open files
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      std::stringstream vShaderStream, fShaderStream;
-      // read file's buffer contents into streams
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
-      // close file handlers
-      vShaderFile.close();
-      fShaderFile.close();
-      // convert stream into string
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (std::ifstream::failure &e) {
-      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what()
-                << std::endl;
+    preprocess(vertexPath, features, vertexCode);
+    preprocess(fragmentPath, features, fragmentCode);
+    for (uint32_t bit = 0; bit < FEATURE_COUNT; bit++) {
+      if (vertexCode.find(FEATURE_NAMES[bit]) != std::string::npos ||
+          fragmentCode.find(FEATURE_NAMES[bit]) != std::string::npos)
+        supportedFeatures |= 1u << bit;
     }
+    // 2. reuse the program linked by an earlier run if the driver allows
+    auto &binaryCache = ProgramBinaryCache::instance();
+    uint64_t binaryKey = binaryCache.keyFor({vertexCode, fragmentCode});
+    ID = binaryCache.load(binaryKey);
+    if (ID != 0)
+      return;
     const char *vShaderCode = vertexCode.c_str();
     const char *fShaderCode = fragmentCode.c_str();
-    // 2. compile shaders
+    // 3. compile shaders
     unsigned int vertex, fragment;
     // vertex shader
     vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -56,18 +86,79 @@ public:
     checkCompileErrors(fragment, "FRAGMENT");
     // shader Program
     ID = glCreateProgram();
+    binaryCache.prepare(ID);
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
+    binaryCache.store(ID, binaryKey);
     // delete the shaders as they're linked into our program now and no longer
     // necessary
     glDeleteShader(vertex);
     glDeleteShader(fragment);
   }
+  // vertex only program whose outputs are captured with transform feedback,
+  // interleaved in the order of feedbackVaryings. Draw with
+  // GL_RASTERIZER_DISCARD enabled, there is no fragment stage
+  // ------------------------------------------------------------------------
+  Shader(const char *vertexPath,
+         const std::vector<std::string> &feedbackVaryings)
+      : vertexPath(vertexPath) {
+    std::string vertexCode;
+    preprocess(vertexPath, 0, vertexCode);
+    // The varyings are part of the linked program, so part of the key
+    std::string varyingList;
+    for (const std::string &varying : feedbackVaryings) {
+      varyingList += varying + ';';
+    }
+    auto &binaryCache = ProgramBinaryCache::instance();
+    uint64_t binaryKey = binaryCache.keyFor({vertexCode, varyingList});
+    ID = binaryCache.load(binaryKey);
+    if (ID != 0)
+      return;
+
+    const char *vShaderCode = vertexCode.c_str();
+    unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex, 1, &vShaderCode, NULL);
+    glCompileShader(vertex);
+    checkCompileErrors(vertex, "VERTEX");
+
+    ID = glCreateProgram();
+    binaryCache.prepare(ID);
+    glAttachShader(ID, vertex);
+    // varyings have to be declared before linking
+    std::vector<const char *> names;
+    for (const std::string &varying : feedbackVaryings) {
+      names.push_back(varying.c_str());
+    }
+    glTransformFeedbackVaryings(ID, static_cast<GLsizei>(names.size()),
+                                names.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(ID);
+    checkCompileErrors(ID, "PROGRAM");
+    binaryCache.store(ID, binaryKey);
+    glDeleteShader(vertex);
+  }
   // activate the shader
   // ------------------------------------------------------------------------
-  void use() { glUseProgram(ID); }
+  void use() { GLStateCache::instance().useProgram(ID); }
+  // this program compiled with the features its sources mention out of
+  // features, this shader itself when that is all of its own. Compiled on
+  // first use and owned by this shader. Uniforms are per program, set them
+  // on the shader returned
+  // ------------------------------------------------------------------------
+  Shader *variant(uint32_t features) {
+    features &= supportedFeatures;
+    if (features == this->features || fragmentPath.empty())
+      return this;
+    std::unique_ptr<Shader> &shader = variants[features];
+    if (!shader) {
+      shader = std::make_unique<Shader>(vertexPath.c_str(),
+                                        fragmentPath.c_str(), features);
+    }
+    return shader.get();
+  }
+  uint32_t getFeatures() const { return features; }
+  size_t getVariantCount() const { return variants.size(); }
   // utility uniform functions
   // ------------------------------------------------------------------------
   void setBool(const std::string &name, bool value) const {
@@ -82,6 +173,21 @@ public:
     glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
   }
   // ------------------------------------------------------------------------
+  void setVec2(const std::string &name, glm::vec2 value) const {
+    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1,
+                 glm::value_ptr(value));
+  }
+  // ------------------------------------------------------------------------
+  void setIVec3(const std::string &name, glm::ivec3 value) const {
+    glUniform3iv(glGetUniformLocation(ID, name.c_str()), 1,
+                 glm::value_ptr(value));
+  }
+  // ------------------------------------------------------------------------
+  void setVec4(const std::string &name, glm::vec4 value) const {
+    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1,
+                 glm::value_ptr(value));
+  }
+  // ------------------------------------------------------------------------
   void setMat4(const std::string &name, glm::mat4 value) const {
     glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
                        glm::value_ptr(value));
@@ -99,12 +205,111 @@ public:
 
   ~Shader() {
     if (ID != 0) {
-      glDeleteProgram(ID);
+      GLStateCache::instance().deleteProgram(ID);
       ID = 0;
     }
   }
 
 private:
+  static const uint32_t FEATURE_COUNT = 13;
+  static constexpr const char *FEATURE_NAMES[FEATURE_COUNT] = {
+      "FEATURE_TEXTURES", "FEATURE_DIR_LIGHT", "FEATURE_POINT_LIGHTS",
+      "FEATURE_SPOT_LIGHT", "FEATURE_INVERT",   "FEATURE_GRAYSCALE",
+      "FEATURE_SHARPEN",  "FEATURE_BLUR",      "FEATURE_EDGES",
+      "FEATURE_CHAOS",    "FEATURE_CONFUSE",   "FEATURE_SHAKE",
+      "FEATURE_UPSCALE"};
+
+  std::string vertexPath;
+  std::string fragmentPath; // Empty for transform feedback programs
+  uint32_t features = 0;
+  uint32_t supportedFeatures = 0; // FEATURE_ names the sources mention
+  std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+
+  // code is path with its includes expanded and the feature defines added
+  static void preprocess(const std::string &path, uint32_t features,
+                         std::string &code) {
+    std::vector<std::string> files;
+    code.clear();
+    if (!expandIncludes(path, files, code))
+      return;
+
+    std::string defines;
+    for (uint32_t bit = 0; bit < FEATURE_COUNT; bit++) {
+      if (features & (1u << bit))
+        defines += std::string("#define ") + FEATURE_NAMES[bit] + "\n";
+    }
+    if (defines.empty())
+      return;
+    // #version has to stay first
+    size_t version = code.find("#version");
+    size_t insertAt = 0;
+    if (version != std::string::npos) {
+      insertAt = code.find('\n', version);
+      insertAt = insertAt == std::string::npos ? code.size() : insertAt + 1;
+    }
+    size_t line = std::count(code.begin(), code.begin() + insertAt, '\n');
+    code.insert(insertAt, defines + "#line " + std::to_string(line + 1) +
+                              " 0\n");
+  }
+
+  static bool expandIncludes(const std::string &path,
+                             std::vector<std::string> &files,
+                             std::string &code) {
+    std::string source;
+    std::ifstream file;
+    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    try {
+      file.open(path);
+      std::stringstream stream;
+      stream << file.rdbuf();
+      file.close();
+      source = stream.str();
+    } catch (std::ifstream::failure &e) {
+      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path
+                << ": " << e.what() << std::endl;
+      return false;
+    }
+    size_t fileIndex = files.size();
+    files.push_back(std::filesystem::path(path).lexically_normal().string());
+    std::filesystem::path directory =
+        std::filesystem::path(path).parent_path();
+
+    std::istringstream lines(source);
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(lines, line)) {
+      lineNumber++;
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos || line.compare(start, 8, "#include")) {
+        code += line;
+        code += '\n';
+        continue;
+      }
+
+      size_t open = line.find('"', start);
+      size_t close =
+          open == std::string::npos ? open : line.find('"', open + 1);
+      if (close == std::string::npos) {
+        std::cout << "ERROR::SHADER::INVALID_INCLUDE: " << path << ":"
+                  << lineNumber << std::endl;
+        return false;
+      }
+      std::string included =
+          (directory / line.substr(open + 1, close - open - 1))
+              .lexically_normal()
+              .string();
+      // Once only, which also stops include cycles
+      if (std::find(files.begin(), files.end(), included) == files.end()) {
+        code += "#line 1 " + std::to_string(files.size()) + "\n";
+        if (!expandIncludes(included, files, code))
+          return false;
+      }
+      code += "#line " + std::to_string(lineNumber + 1) + " " +
+              std::to_string(fileIndex) + "\n";
+    }
+    return true;
+  }
+
   // utility function for checking shader compilation/linking errors.
   // ------------------------------------------------------------------------
   void checkCompileErrors(unsigned int shader, std::string type) {
@@ -2,13 +2,12 @@
 #define TEXTURE_2D_HPP
 
 #include "../gl_common.hpp"
+#include "GLStateCache.hpp"
 #include <initializer_list>
 #include <iostream>
 #include <stddef.h>
 #include <string>
 
-#include "stb_image.h"
-
 struct TextureParam {
   GLenum name;
   GLint value;
@@ -22,7 +21,7 @@ class Texture2D {
 public:
   Texture2D(std::initializer_list<TextureParam> params) {
     glGenTextures(1, &ID);
-    glBindTexture(GL_TEXTURE_2D, ID);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, ID);
     for (const TextureParam &p : params) {
       glTexParameteri(GL_TEXTURE_2D, p.name, p.value);
     }
@@ -30,63 +29,11 @@ public:
 
   Texture2D() {
     glGenTextures(1, &ID);
-    glBindTexture(GL_TEXTURE_2D, ID);
-  }
-
-  void loadImage(const std::string &path) {
-    int width, height, nrChannels;
-
-    unsigned char *data =
-        stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-    if (data) {
-      GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-      glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                   GL_UNSIGNED_BYTE, data);
-      glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-      std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, ID);
   }
 
-  // unsigned int loadTexture(char const *path) {
-  //   unsigned int textureID;
-  //   glGenTextures(1, &textureID);
-  //
-  //   int width, height, nrComponents;
-  //   unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-  //   if (data) {
-  //     GLenum format;
-  //     if (nrComponents == 1)
-  //       format = GL_RED;
-  //     else if (nrComponents == 3)
-  //       format = GL_RGB;
-  //     else if (nrComponents == 4)
-  //       format = GL_RGBA;
-  //
-  //     glBindTexture(GL_TEXTURE_2D, textureID);
-  //     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-  //                  GL_UNSIGNED_BYTE, data);
-  //     glGenerateMipmap(GL_TEXTURE_2D);
-  //
-  //     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  //     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  //     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-  //                     GL_LINEAR_MIPMAP_LINEAR);
-  //     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  //
-  //   } else {
-  //     std::cout << "Texture failed to load at path: " << path << std::endl;
-  //   }
-  //
-  //   stbi_image_free(data);
-  //
-  //   return textureID;
-  // }
-  //
   void bind(unsigned int slot = 0) const {
-    glActiveTexture(GL_TEXTURE0 + slot);
-    glBindTexture(GL_TEXTURE_2D, ID);
+    GLStateCache::instance().bindTexture(slot, GL_TEXTURE_2D, ID);
 
 #ifdef DEBUG
     if (boundTextureUnits[slot] != ID) {
@@ -97,7 +44,7 @@ public:
 
   unsigned int getID() const { return ID; }
 
-  ~Texture2D() { glDeleteTextures(1, &ID); }
+  ~Texture2D() { GLStateCache::instance().deleteTexture(ID); }
 
 private:
   unsigned int ID{};
@@ -23,8 +23,6 @@ public:
 
   void load(World &world) override {
     auto &resources = ResourceManager::instance();
-    resources.createFramebuffer("main", screenWidth, screenHeight);
-
     uint32_t staticShaderID = resources.loadShader(
         "static", "../src/shaders/static/staticVertex.glsl",
         "../src/shaders/static/staticFragment.glsl");
@@ -61,9 +59,6 @@ public:
     createCubes(world, cubeMesh, staticShaderID, 0, 0);
     createCamera(world);
     createLights(world, lightCubeMesh, lightSourceShaderID);
-
-    glm::vec3 clearColor = getClearColor();
-    resources.setClearColorForFramebuffer("main", clearColor);
   }
 
   const std::string &getName() const override {
@@ -92,11 +87,7 @@ private:
       transform.position = glm::vec3(i + 5, 0, 0);
       world.addComponent(cube, transform);
 
-      MeshComponent meshComp;
-      meshComp.vao = mesh.vao;
-      meshComp.vertexCount = mesh.vertexCount;
-      meshComp.indexCount = 0;
-      world.addComponent(cube, meshComp);
+      world.addComponent(cube, mesh.toComponent());
 
       MaterialComponent material;
       material.shaderProgram = shaderID;
@@ -168,11 +159,7 @@ private:
                                     plConfig.quadratic);
       world.addComponent(pointLight, lightComp);
 
-      MeshComponent mesh;
-      mesh.vao = lightMesh.vao;
-      mesh.vertexCount = 36;
-      mesh.indexCount = 0;
-      world.addComponent(pointLight, mesh);
+      world.addComponent(pointLight, lightMesh.toComponent());
 
       MaterialComponent material;
       material.shaderProgram = lightShaderID;
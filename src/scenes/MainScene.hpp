@@ -4,11 +4,16 @@
 #include "../systems/CameraFollowSystem.hpp"
 #include "../systems/CameraSystem.hpp"
 #include "../systems/CompositeRenderSystem.hpp"
+#include "../systems/DynamicResolutionSystem.hpp"
 #include "../systems/LightingSystem.hpp"
+#include "../systems/MaterialSystem.hpp"
+#include "../systems/OcclusionCullingSystem.hpp"
 #include "../systems/PhysicsSystem.hpp"
 #include "../systems/PlayerControllerSystem.hpp"
 #include "../systems/RenderSystem.hpp" // Now OpaqueRenderSystem
 #include "../systems/SkyboxSystem.hpp"
+#include "../systems/SpatialIndexSystem.hpp"
+#include "../systems/TextureStreamingSystem.hpp"
 #include "../systems/TransparentRenderSystem.hpp"
 
 #include "../components/CameraComponent.hpp"
@@ -18,6 +23,7 @@
 #include "../components/MaterialComponent.hpp"
 #include "../components/MaterialPresets.hpp"
 #include "../components/MeshComponent.hpp"
+#include "../components/OccluderComponent.hpp"
 #include "../components/PhysicsComponent.hpp"
 #include "../components/PointLightComponent.hpp"
 #include "../components/SceneComponent.hpp"
@@ -27,6 +33,7 @@
 #include "../ecs/Tag.hpp"
 #include "../resources/ModelLoader.hpp"
 #include "../resources/ResourceManager.hpp"
+#include "../resources/StaticBatcher.hpp"
 #include "Scene.hpp"
 
 class MainScene : public Scene {
@@ -37,6 +44,7 @@ public:
   void initComponents(World &world) {
     world.registerComponent<TransformComponent>();
     world.registerComponent<MeshComponent>();
+    world.registerComponent<OccluderComponent>();
     world.registerComponent<MaterialComponent>();
     world.registerComponent<PhysicsComponent>();
     world.registerComponent<CameraComponent>();
@@ -56,10 +64,16 @@ public:
     world.addSystem<PhysicsSystem>();
     world.addSystem<CameraFollowSystem>();
     world.addSystem<CameraSystem>();
-    world.addSystem<LightingSystem>();
+    world.addSystem<MaterialSystem>();
+    // Sets the render scale the systems below record the frame at
+    world.addSystem<DynamicResolutionSystem>();
+    world.addSystem<LightingSystem>(width, height);
+    world.addSystem<SpatialIndexSystem>();
+    world.addSystem<OcclusionCullingSystem>(width, height);
     world.addSystem<OpaqueRenderSystem>(width, height);
     world.addSystem<SkyboxSystem>(width, height);
     world.addSystem<TransparentRenderSystem>(width, height);
+    world.addSystem<TextureStreamingSystem>(width, height);
     world.addSystem<CompositeRenderSystem>(width, height);
   }
 
@@ -76,9 +90,6 @@ public:
 
     auto &resources = ResourceManager::instance();
 
-    // Create framebuffer for post-processing
-    resources.createFramebuffer("main", screenWidth, screenHeight);
-
     // Load shaders
     uint32_t staticShaderID = resources.loadShader(
         "static", "../src/shaders/static/staticVertex.glsl",
@@ -146,10 +157,10 @@ public:
     uint32_t grassTexture = resources.loadTexture("../src/assets/grass.png");
     uint32_t windowTexture = resources.loadTexture("../src/assets/window.png");
 
-    glBindTexture(GL_TEXTURE_2D, grassTexture);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, grassTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_2D, 0);
 
     createFloor(world, planeMesh, staticShaderID);
 
@@ -169,12 +180,15 @@ public:
     createModel(world, staticShaderID, "../src/assets/robot/robot.obj");
 
     createCamera(world);
+
+    // Everything tagged STATIC above is merged into world space batches
+    for (Entity batch : StaticBatcher::bake(world, 16.0f, true).batches) {
+      trackEntity(batch);
+    }
     // glBindFramebuffer(GL_FRAMEBUFFER, 0);
     // glDisable(GL_DEPTH_TEST);
     // glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     // glClear(GL_COLOR_BUFFER_BIT);
-    glm::vec3 clearColor = getClearColor();
-    resources.setClearColorForFramebuffer("main", clearColor);
   }
 
   const std::string &getName() const override {
@@ -201,16 +215,15 @@ private:
     transform.position = glm::vec3(0.0f);
     world.addComponent(floor, transform);
 
-    MeshComponent meshComp;
-    meshComp.vao = mesh.vao;
-    meshComp.vertexCount = mesh.vertexCount;
-    meshComp.indexCount = mesh.indexCount;
-    world.addComponent(floor, meshComp);
+    world.addComponent(floor, mesh.toComponent());
+    world.addComponent(floor, OccluderComponent());
 
     MaterialComponent material =
         MaterialPresets::create(shaderID, MaterialType::OBSIDIAN);
     material.doubleSided = true;
     world.addComponent(floor, material);
+
+    world.addComponent(floor, TagComponent(STATIC));
   }
 
   void createCubes(World &world, const MeshData &mesh, uint32_t shaderID,
@@ -225,11 +238,9 @@ private:
       transform.rotation = glm::vec3(angle * 0.3f, angle, angle * 0.5f);
       world.addComponent(cube, transform);
 
-      MeshComponent meshComp;
-      meshComp.vao = mesh.vao;
-      meshComp.vertexCount = mesh.vertexCount;
-      meshComp.indexCount = 0;
-      world.addComponent(cube, meshComp);
+      world.addComponent(cube, mesh.toComponent());
+      // The cube mesh fills its bounds so it is a safe box occluder
+      world.addComponent(cube, OccluderComponent());
 
       MaterialComponent material;
       material.shaderProgram = shaderID;
@@ -253,11 +264,7 @@ private:
     Entity skybox = world.createEntity();
     // TransformComponent transform;
     // world.addComponent(skybox, transform);
-    MeshComponent skyboxMesh;
-    skyboxMesh.vao = mesh.vao;
-    skyboxMesh.vertexCount = mesh.vertexCount;
-    skyboxMesh.indexCount = 0;
-    world.addComponent(skybox, skyboxMesh);
+    world.addComponent(skybox, mesh.toComponent());
     MaterialComponent material;
     material.shaderProgram = skyboxShaderID;
     material.textures[0] = skyboxTexture;
@@ -295,11 +302,7 @@ private:
                                     plConfig.quadratic);
       world.addComponent(pointLight, lightComp);
 
-      MeshComponent mesh;
-      mesh.vao = lightMesh.vao;
-      mesh.vertexCount = 36;
-      mesh.indexCount = 0;
-      world.addComponent(pointLight, mesh);
+      world.addComponent(pointLight, lightMesh.toComponent());
 
       MaterialComponent material;
       material.shaderProgram = lightShaderID;
@@ -325,13 +328,15 @@ private:
   }
 
   void createModel(World &world, uint32_t shaderID, std::string path) {
-    std::vector<Entity> modelEntities = ModelLoader::load(
-        world, path, shaderID, glm::vec3(5.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+    std::vector<Entity> modelEntities =
+        ModelLoader::load(world, path, shaderID, glm::vec3(5.0f, 0.0f, 0.0f),
+                          glm::vec3(1.0f), true);
 
     for (Entity e : modelEntities) {
       // TagComponent tag;
       // tag.add(OUTLINED);
       // world.addComponent(e, tag);
+      world.addComponent(e, TagComponent(STATIC));
       trackEntity(e);
     }
     for (Entity e : modelEntities) {
@@ -352,11 +357,7 @@ private:
       transform.position = glm::vec3(i, -0.5, i);
       world.addComponent(grass, transform);
 
-      MeshComponent meshComp;
-      meshComp.vao = mesh.vao;
-      meshComp.vertexCount = mesh.vertexCount;
-      meshComp.indexCount = 0;
-      world.addComponent(grass, meshComp);
+      world.addComponent(grass, mesh.toComponent());
 
       MaterialComponent material;
       material.shaderProgram = shaderID;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../ecs/World.hpp"
+#include "../resources/ResourceManager.hpp"
 #include "glm/detail/type_vec.hpp"
 #include <iostream>
 #include <string>
@@ -19,13 +20,20 @@ public:
       world.destroyEntity(e);
     }
     trackedEntities.clear();
+    // Cached until the memory budget needs the space, so reloading the
+    // scene soon after is cheap
+    ResourceManager::instance().releaseScope(resourceScope);
   }
 
   virtual const std::string &getName() const = 0;
   virtual const glm::vec4 &getClearColor() const = 0;
 
+  // Holds everything load() loaded, see SceneManager::loadScene
+  ResourceScope &getResourceScope() { return resourceScope; }
+
 protected:
   void trackEntity(Entity e) { trackedEntities.push_back(e); }
 
   std::vector<Entity> trackedEntities;
+  ResourceScope resourceScope;
 };
@@ -6,6 +6,7 @@
 #include "../systems/CameraSystem.hpp"
 #include "../systems/CompositeRenderSystem.hpp"
 #include "../systems/LightingSystem.hpp"
+#include "../systems/MaterialSystem.hpp"
 #include "../systems/PhysicsSystem.hpp"
 #include "../systems/PlayerControllerSystem.hpp"
 #include "../systems/RenderSystem.hpp" // Now OpaqueRenderSystem
@@ -58,7 +59,8 @@ public:
     world.addSystem<PhysicsSystem>();
     world.addSystem<CameraFollowSystem>();
     world.addSystem<CameraSystem>();
-    world.addSystem<LightingSystem>();
+    world.addSystem<MaterialSystem>();
+    world.addSystem<LightingSystem>(width, height);
     world.addSystem<OpaqueRenderSystem>(width, height);
     world.addSystem<SkyboxSystem>(width, height);
     world.addSystem<TransparentRenderSystem>(width, height);
@@ -68,7 +70,7 @@ public:
   void load(World &world) override {
     initComponents(world);
     initSystems(world, screenWidth, screenHeight);
-    // ==== SCENE AND FRAMEBUFFER ====
+    // ==== SCENE ====
     std::cout << "Loading Scene2D..." << std::endl;
     Entity sceneEntity = world.createEntity();
     SceneComponent sceneComp = SceneComponent("Scene2D");
@@ -80,8 +82,6 @@ public:
 
     auto &resources = ResourceManager::instance();
 
-    resources.createFramebuffer("Scene2D", screenWidth, screenHeight);
-
     // ==== SHADERS ====
     uint32_t staticShaderID = resources.loadShader(
         "static", "../src/shaders/static/staticVertex.glsl",
@@ -190,11 +190,7 @@ private:
       transform.scale = glm::vec3(0.3f, 0.5f, 2.0f);
       world.addComponent(cube, transform);
 
-      MeshComponent meshComp;
-      meshComp.vao = mesh.vao;
-      meshComp.vertexCount = mesh.vertexCount;
-      meshComp.indexCount = 0;
-      world.addComponent(cube, meshComp);
+      world.addComponent(cube, mesh.toComponent());
 
       MaterialComponent material;
       material.shaderProgram = shaderID;
@@ -232,11 +228,7 @@ private:
     transformPlayer.scale = glm::vec3(0.5f, 0.5f, 0.5f);
     world.addComponent(player, transformPlayer);
 
-    MeshComponent playerMeshComp;
-    playerMeshComp.vao = mesh.vao;
-    playerMeshComp.vertexCount = mesh.vertexCount;
-    playerMeshComp.indexCount = 0;
-    world.addComponent(player, playerMeshComp);
+    world.addComponent(player, mesh.toComponent());
 
     MaterialComponent playerMaterial;
     playerMaterial.shaderProgram = shaderID;
@@ -266,11 +258,7 @@ private:
     transform.scale *= 2;
     world.addComponent(floor, transform);
 
-    MeshComponent meshComp;
-    meshComp.vao = mesh.vao;
-    meshComp.vertexCount = mesh.vertexCount;
-    meshComp.indexCount = mesh.indexCount;
-    world.addComponent(floor, meshComp);
+    world.addComponent(floor, mesh.toComponent());
 
     MaterialComponent material =
         MaterialPresets::create(shaderID, MaterialType::OBSIDIAN);
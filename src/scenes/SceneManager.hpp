@@ -1,6 +1,9 @@
 #pragma once
 
+#include "../resources/ProgramBinaryCache.hpp"
 #include "Scene.hpp"
+#include <chrono>
+#include <iostream>
 #include <memory>
 #include <unordered_map>
 
@@ -26,7 +29,25 @@ public:
     if (it != scenes.end()) {
       // Get the scene pointer
       currentScene = it->second.get();
+      auto &resources = ResourceManager::instance();
+      auto &binaryCache = ProgramBinaryCache::instance();
+      ProgramBinaryCache::Stats programsBefore = binaryCache.getStats();
+      auto start = std::chrono::steady_clock::now();
+
+      resources.pushScope(currentScene->getResourceScope());
       currentScene->load(world);
+      resources.popScope();
+
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      const ProgramBinaryCache::Stats &programs = binaryCache.getStats();
+      std::cout << "Loaded scene '" << name << "' in "
+                << static_cast<int>(elapsed.count()) << " ms - programs: "
+                << programs.hits - programsBefore.hits << " from cache, "
+                << programs.misses - programsBefore.misses << " compiled"
+                << (binaryCache.isSupported() ? "" : " (no binary support)")
+                << std::endl;
+      resources.printMemoryStats();
     }
   }
 
@@ -21,6 +21,7 @@
 #include "components/PostProcessingComponent.hpp"
 #include "components/PowerUpComponent.hpp"
 #include "components/VelocityComponent.hpp"
+#include "systems/GPUParticleSystem.hpp"
 #include "systems/ParticleSystem.hpp"
 #include "systems/PostProcessingSystem.hpp"
 #include "systems/PowerUpSystem.hpp"
@@ -59,13 +60,21 @@ private:
     auto *collision = world.addSystem<CollisionSystem2D>();
     CollisionHandlers::registerAll(collision);
 
-    world.addSystem<ParticleSystem>(width, height);
+    if (useGPUParticles) {
+      world.addSystem<GPUParticleSystem>(width, height);
+    } else {
+      world.addSystem<ParticleSystem>(width, height);
+    }
 
     // Post-processing must be last - renders framebuffer to screen
     world.addSystem<PostProcessingSystem>(width, height);
   }
 
 public:
+  // Simulate particles with transform feedback instead of on the CPU, must
+  // be set before load()
+  bool useGPUParticles = false;
+
   Breakout(float width, float height)
       : screenWidth(width), screenHeight(height) {}
 
@@ -83,35 +92,31 @@ public:
         "../src/scenes/breakout/shaders/spriteShaderFragment.glsl");
 
     // ==== TEXTURES ====
-    uint32_t blockTexture =
-        resources.loadTexture("../src/assets/breakout/block.png", false);
-    uint32_t blockSolidTexture =
-        resources.loadTexture("../src/assets/breakout/block_solid.png", false);
-    uint32_t particleTextureID =
-        resources.loadTexture("../src/assets/breakout/particle.png", false);
-
-    // PowerUp textures
-    uint32_t texSpeed = resources.loadTexture(
-        "../src/assets/breakout/powerup_speed.png", false);
-    uint32_t texSticky = resources.loadTexture(
-        "../src/assets/breakout/powerup_sticky.png", false);
-    uint32_t texPassThrough = resources.loadTexture(
-        "../src/assets/breakout/powerup_passthrough.png", false);
-    uint32_t texPadSize = resources.loadTexture(
-        "../src/assets/breakout/powerup_increase.png", false);
-    uint32_t texConfuse = resources.loadTexture(
-        "../src/assets/breakout/powerup_confuse.png", false);
-    uint32_t texChaos = resources.loadTexture(
-        "../src/assets/breakout/powerup_chaos.png", false);
+    // Every sprite lives in one atlas so the whole scene batches into a
+    // handful of draws
+    TextureAtlas &atlas = resources.createAtlas("breakout");
+    const std::string assets = "../src/assets/breakout/";
+    atlas.add("block", assets + "block.png", false);
+    atlas.add("blockSolid", assets + "block_solid.png", false);
+    atlas.add("particle", assets + "particle.png", false);
+    atlas.add("paddle", assets + "paddle.png", false);
+    atlas.add("ball", assets + "smiley.png", false);
+    atlas.add("powerupSpeed", assets + "powerup_speed.png", false);
+    atlas.add("powerupSticky", assets + "powerup_sticky.png", false);
+    atlas.add("powerupPassThrough", assets + "powerup_passthrough.png", false);
+    atlas.add("powerupPadSize", assets + "powerup_increase.png", false);
+    atlas.add("powerupConfuse", assets + "powerup_confuse.png", false);
+    atlas.add("powerupChaos", assets + "powerup_chaos.png", false);
+    atlas.build();
 
     // ==== SYSTEMS ====
     PowerUpTextures powerUpTextures;
-    powerUpTextures.speed = texSpeed;
-    powerUpTextures.sticky = texSticky;
-    powerUpTextures.passThrough = texPassThrough;
-    powerUpTextures.padSize = texPadSize;
-    powerUpTextures.confuse = texConfuse;
-    powerUpTextures.chaos = texChaos;
+    powerUpTextures.speed = atlas.getRegion("powerupSpeed");
+    powerUpTextures.sticky = atlas.getRegion("powerupSticky");
+    powerUpTextures.passThrough = atlas.getRegion("powerupPassThrough");
+    powerUpTextures.padSize = atlas.getRegion("powerupPadSize");
+    powerUpTextures.confuse = atlas.getRegion("powerupConfuse");
+    powerUpTextures.chaos = atlas.getRegion("powerupChaos");
 
     initSystems(world, screenWidth, screenHeight, spriteShaderID,
                 powerUpTextures);
@@ -136,9 +141,9 @@ public:
     level.levelWidth = screenWidth;
     level.levelHeight = screenHeight / 2;
     level.shaderID = spriteShaderID;
-    level.blockTexture = blockTexture;
-    level.blockSolidTexture = blockSolidTexture;
-    level.particleTextureID = particleTextureID;
+    level.blockSprite = atlas.getRegion("block");
+    level.blockSolidSprite = atlas.getRegion("blockSolid");
+    level.particleSprite = atlas.getRegion("particle");
     world.addComponent(standardLevel, level);
 
     level.path = "../src/scenes/breakout/levels/space_invader.txt";
@@ -150,15 +155,11 @@ public:
     world.addComponent(spaceInvaderLevel, TagComponent(ACTIVELEVEL));
 
     // ==== PLAYER ==== //
-    uint32_t paddleTexture =
-        resources.loadTexture("../src/assets/breakout/paddle.png", false);
-    createPlayer(world, spriteShaderID, paddleTexture);
+    createPlayer(world, spriteShaderID, atlas.getRegion("paddle"));
 
     // ==== BALL ==== //
-    uint32_t ballTexture =
-        resources.loadTexture("../src/assets/breakout/smiley.png", false);
-
-    createBall(world, spriteShaderID, ballTexture, particleTextureID);
+    createBall(world, spriteShaderID, atlas.getRegion("ball"),
+               atlas.getRegion("particle"));
 
     // ==== CAMERA ====
     createCamera(world);
@@ -176,7 +177,8 @@ private:
   float screenHeight;
   glm::vec4 clearColor = glm::vec4(0.2f, 0.2f, 0.2f, 1);
 
-  void createPlayer(World &world, uint32_t shaderID, uint32_t textureID) {
+  void createPlayer(World &world, uint32_t shaderID,
+                    const AtlasRegion &sprite) {
     const glm::vec2 PLAYER_SIZE(100.0f, 20.0f);
 
     Entity player = world.createEntity();
@@ -195,8 +197,9 @@ private:
 
     MaterialComponent material;
     material.shaderProgram = shaderID;
-    material.textures[0] = textureID;
-    material.useTextures = (textureID != 0);
+    material.textures[0] = sprite.textureID;
+    material.uvRect = sprite.uvRect;
+    material.useTextures = sprite.isValid();
     material.color = glm::vec3(1.0f);
     world.addComponent(player, material);
 
@@ -206,13 +209,10 @@ private:
     std::vector<VertexAttribute> layout = {
         {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
     auto &resources = ResourceManager::instance();
-    MeshData mesh = resources.createMesh(vertices, sizeof(vertices), layout, 6);
+    MeshData mesh =
+        resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
 
-    MeshComponent meshComp;
-    meshComp.vao = mesh.vao;
-    meshComp.vertexCount = mesh.vertexCount;
-    meshComp.indexCount = 0;
-    world.addComponent(player, meshComp);
+    world.addComponent(player, mesh.toComponent());
 
     // AABB collider for the paddle - collides with ball and powerups
     world.addComponent(
@@ -221,8 +221,8 @@ private:
                              CollisionLayer::Ball | CollisionLayer::PowerUp));
   }
 
-  void createBall(World &world, uint32_t shaderID, uint32_t textureID,
-                  uint32_t particleTextureID) {
+  void createBall(World &world, uint32_t shaderID, const AtlasRegion &sprite,
+                  const AtlasRegion &particleSprite) {
     Entity ball = world.createEntity();
 
     BallComponent ballComp;
@@ -252,8 +252,9 @@ private:
 
     MaterialComponent material;
     material.shaderProgram = shaderID;
-    material.textures[0] = textureID;
-    material.useTextures = (textureID != 0);
+    material.textures[0] = sprite.textureID;
+    material.uvRect = sprite.uvRect;
+    material.useTextures = sprite.isValid();
     material.color = glm::vec3(1.0f);
     world.addComponent(ball, material);
 
@@ -263,13 +264,10 @@ private:
     std::vector<VertexAttribute> layout = {
         {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
     auto &resources = ResourceManager::instance();
-    MeshData mesh = resources.createMesh(vertices, sizeof(vertices), layout, 6);
+    MeshData mesh =
+        resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
 
-    MeshComponent meshComp;
-    meshComp.vao = mesh.vao;
-    meshComp.vertexCount = mesh.vertexCount;
-    meshComp.indexCount = 0;
-    world.addComponent(ball, meshComp);
+    world.addComponent(ball, mesh.toComponent());
 
     // Particle emitter - particles trail behind the ball
     ParticleEmitterComponent emitter;
@@ -278,10 +276,8 @@ private:
     emitter.offset = glm::vec2(ballComp.radius / 2.0f);
     emitter.particleSize = glm::vec2(10.0f);
     emitter.gravity = glm::vec2(0.0f, -250.0f);
-    emitter.shaderID = shaderID;
-    emitter.textureID = particleTextureID;
-    emitter.meshVAO = mesh.vao;
-    emitter.meshVertexCount = mesh.vertexCount;
+    emitter.textureID = particleSprite.textureID;
+    emitter.uvRect = particleSprite.uvRect;
     world.addComponent(ball, emitter);
   }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../../../resources/TextureAtlas.hpp"
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -10,9 +11,9 @@ struct GameLevelComponent {
   unsigned int levelHeight;
 
   uint32_t shaderID = 0;
-  uint32_t blockTexture = 0;
-  uint32_t blockSolidTexture = 0;
-  uint32_t particleTextureID = 0;
+  AtlasRegion blockSprite;
+  AtlasRegion blockSolidSprite;
+  AtlasRegion particleSprite;
 
   std::vector<std::vector<unsigned int>> tileData;
   bool loaded = false;
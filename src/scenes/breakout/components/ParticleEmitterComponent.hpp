@@ -1,13 +1,65 @@
 #pragma once
 #include "../../gl_common.hpp"
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <vector>
 
-struct Particle {
-  glm::vec2 position;
-  glm::vec2 velocity;
-  glm::vec4 color;
-  float life = 0.0f;
+// Structure of arrays particle storage. Live particles are always packed into
+// [0, count): spawning appends, dying swaps the last live particle into the
+// hole. Arrays are padded to a multiple of LANES so the update kernel can
+// process whole SIMD registers without a scalar tail.
+struct ParticlePool {
+  static const uint32_t LANES = 4;
+
+  std::vector<float> posX, posY;
+  std::vector<float> velX, velY;
+  std::vector<float> r, g, b, a;
+  std::vector<float> life;
+
+  uint32_t count = 0;
+  uint32_t maxCount = 0;
+  // Slot recycled when the pool is full, cycles so the oldest spawns go first
+  uint32_t overwriteCursor = 0;
+
+  // Existing live particles are kept, anything past the new limit is dropped
+  void setCapacity(uint32_t capacity) {
+    maxCount = capacity;
+    size_t padded = (capacity + LANES - 1) / LANES * LANES;
+    for (std::vector<float> *array : arrays()) {
+      array->resize(padded, 0.0f);
+    }
+    count = std::min(count, capacity);
+    overwriteCursor = 0;
+  }
+
+  // O(1): the next packed slot, or a recycled one when full. Returns
+  // maxCount if the pool has no room at all
+  uint32_t spawn() {
+    if (count < maxCount)
+      return count++;
+    if (maxCount == 0)
+      return maxCount;
+    uint32_t index = overwriteCursor;
+    overwriteCursor = (overwriteCursor + 1) % maxCount;
+    return index;
+  }
+
+  void kill(uint32_t index) {
+    uint32_t last = --count;
+    if (index != last) {
+      for (std::vector<float> *array : arrays()) {
+        (*array)[index] = (*array)[last];
+      }
+    }
+  }
+
+  void clear() { count = 0; }
+
+private:
+  std::array<std::vector<float> *, 9> arrays() {
+    return {&posX, &posY, &velX, &velY, &r, &g, &b, &a, &life};
+  }
 };
 
 struct ParticleEmitterComponent {
@@ -27,13 +79,11 @@ struct ParticleEmitterComponent {
   float duration = 0.0f;
   float durationRemaining = 0.0f;
 
-  // Shared rendering resources for particles
-  uint32_t shaderID = 0;
+  // Particles are drawn instanced by ParticleSystem with its own shader,
+  // 0 draws untextured quads. uvRect selects an atlas sub-rectangle
   uint32_t textureID = 0;
-  uint32_t meshVAO = 0;
-  unsigned int meshVertexCount = 6;
+  glm::vec4 uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
 
-  // Per-emitter particle pool
-  std::vector<Particle> particles;
-  unsigned int lastUsedParticle = 0;
+  // Per-emitter particle pool, sized to maxParticles by ParticleSystem
+  ParticlePool particles;
 };
@@ -0,0 +1,16 @@
+#version 330 core
+in vec2 TexCoords;
+in vec4 Color;
+out vec4 color;
+
+uniform sampler2D image;
+uniform bool useTexture;
+
+void main()
+{
+  if (useTexture) {
+    color = Color * texture(image, TexCoords);
+  } else {
+    color = Color;
+  }
+}
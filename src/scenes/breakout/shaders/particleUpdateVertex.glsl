@@ -0,0 +1,71 @@
+#version 330 core
+// Advances one particle per vertex. The outputs are captured with transform
+// feedback into the other buffer of the emitter's ping-pong pair
+layout(location = 0) in vec2 aPosition;
+layout(location = 1) in vec2 aVelocity;
+layout(location = 2) in vec4 aColor;
+layout(location = 3) in float aLife;
+
+out vec2 outPosition;
+out vec2 outVelocity;
+out vec4 outColor;
+out float outLife;
+
+uniform float deltaTime;
+uniform float lifetime;
+uniform vec2 gravity;
+uniform bool trailMode;
+uniform vec2 emitterPosition; // Emitter offset already applied
+uniform vec2 emitterVelocity;
+// Slots [spawnStart, spawnStart + spawnCount), wrapping at maxParticles, are
+// respawned this frame. The CPU advances spawnStart like a ring allocator so
+// the oldest particles are recycled first
+uniform int spawnStart;
+uniform int spawnCount;
+uniform int maxParticles;
+uniform int seed;
+
+// PCG hash, returns [0, 1)
+float random(inout uint state)
+{
+  state = state * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  word = (word >> 22u) ^ word;
+  return float(word) / 4294967296.0;
+}
+
+void main()
+{
+  vec2 position = aPosition;
+  vec2 velocity = aVelocity;
+  vec4 color = aColor;
+  float life = aLife;
+
+  int slot = (gl_VertexID - spawnStart + maxParticles) % maxParticles;
+  if (slot < spawnCount) {
+    // Same distribution as ParticleSystem::respawnParticle
+    uint state = uint(gl_VertexID) * 1973u + uint(seed) * 9277u;
+    position = emitterPosition +
+               vec2(random(state), random(state)) * 10.0 - 5.0;
+    float shade = 0.5 + random(state);
+    color = vec4(shade, shade, shade, 1.0);
+    life = lifetime;
+    if (trailMode) {
+      velocity = emitterVelocity * 0.1;
+    } else {
+      velocity = vec2(random(state), random(state)) * 100.0 - 50.0;
+    }
+  }
+
+  life -= deltaTime;
+  if (life > 0.0) {
+    velocity += gravity * deltaTime;
+    position += (trailMode ? -velocity : velocity) * deltaTime;
+    color.a -= deltaTime / lifetime;
+  }
+
+  outPosition = position;
+  outVelocity = velocity;
+  outColor = color;
+  outLife = life;
+}
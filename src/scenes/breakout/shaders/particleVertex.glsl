@@ -0,0 +1,25 @@
+#version 330 core
+// One instance per particle, the quad corner comes from gl_VertexID
+// (triangle strip: 0 = top left, 1 = top right, 2 = bottom left, 3 = bottom
+// right)
+layout(location = 0) in vec2 aPosition; // Top left corner in screen space
+layout(location = 1) in vec2 aSize;
+layout(location = 2) in vec4 aColor;
+layout(location = 3) in float aLife; // <= 0 for dead slots
+
+out vec2 TexCoords;
+out vec4 Color;
+
+uniform mat4 projection;
+uniform vec4 uvRect; // u0, v0, u1, v1 of the particle texture
+
+void main()
+{
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  TexCoords = mix(uvRect.xy, uvRect.zw, corner);
+  Color = aColor;
+  gl_Position = projection * vec4(aPosition + corner * aSize, 0.0, 1.0);
+  // Dead slots go behind the far plane, clipped before rasterization
+  if (aLife <= 0.0)
+    gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+}
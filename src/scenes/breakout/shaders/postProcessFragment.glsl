@@ -3,44 +3,40 @@ in vec2 TexCoords;
 out vec4 FragColor;
 
 uniform sampler2D scene;
-uniform vec2 offsets[9];
-uniform int edge_kernel[9];
-uniform float blur_kernel[9];
 
-uniform bool chaos;
-uniform bool confuse;
-uniform bool shake;
+// Variants: FEATURE_CHAOS, FEATURE_CONFUSE and FEATURE_SHAKE, in that order
+// of precedence, see PostProcessingSystem
 
-void main() {
-  vec3 color = vec3(0.0);
-  vec3 samples[9];
+#include "../../../shaders/common/kernel.glsl"
+
+const float offset = 1.0 / 300.0;
 
-  // Sample texture at kernel offsets
-  if (chaos || shake) {
-    for (int i = 0; i < 9; i++) {
-      samples[i] = vec3(texture(scene, TexCoords + offsets[i]));
-    }
-  }
+void main() {
+  vec3 color;
 
-  // Apply effects
-  if (chaos) {
-    // Edge detection kernel
-    for (int i = 0; i < 9; i++) {
-      color += samples[i] * edge_kernel[i];
-    }
-    color = abs(color);
-  } else if (confuse) {
-    // Invert colors
-    color = vec3(1.0 - texture(scene, TexCoords));
-  } else if (shake) {
-    // Blur kernel
-    for (int i = 0; i < 9; i++) {
-      color += samples[i] * blur_kernel[i];
-    }
-  } else {
-    // No effect
-    color = vec3(texture(scene, TexCoords));
-  }
+#if defined(FEATURE_CHAOS)
+  // Edge detection kernel
+  float edgeKernel[9] = float[](
+      -1, -1, -1,
+      -1,  8, -1,
+      -1, -1, -1
+  );
+  color = abs(ApplyKernel(scene, TexCoords, offset, edgeKernel));
+#elif defined(FEATURE_CONFUSE)
+  // Invert colors
+  color = vec3(1.0 - texture(scene, TexCoords));
+#elif defined(FEATURE_SHAKE)
+  // Blur kernel
+  float blurKernel[9] = float[](
+      1.0 / 16, 2.0 / 16, 1.0 / 16,
+      2.0 / 16, 4.0 / 16, 2.0 / 16,
+      1.0 / 16, 2.0 / 16, 1.0 / 16
+  );
+  color = ApplyKernel(scene, TexCoords, offset, blurKernel);
+#else
+  // No effect
+  color = vec3(texture(scene, TexCoords));
+#endif
 
   FragColor = vec4(color, 1.0);
 }
@@ -5,6 +5,7 @@
 #include "../../ecs/World.hpp"
 #include "../../gl_common.hpp"
 #include "../../resources/ResourceManager.hpp"
+#include "../../resources/SpriteBatch.hpp"
 #include "../../systems/RenderCommon.hpp"
 #include "../components/BrickComponent.hpp"
 #include "../components/PowerUpComponent.hpp"
@@ -16,6 +17,7 @@ class BreakoutRenderSystem : public System {
 private:
   float screenWidth;
   float screenHeight;
+  SpriteBatch batch;
 
 public:
   BreakoutRenderSystem(float width = 800.0f, float height = 600.0f)
@@ -23,9 +25,10 @@ public:
 
   void render() override {
 
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    auto &glState = GLStateCache::instance();
+    glState.disable(GL_DEPTH_TEST);
+    glState.enable(GL_BLEND);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glm::mat4 projection =
         glm::ortho(0.0f, screenWidth, screenHeight, 0.0f, -1.0f, 1.0f);
@@ -62,27 +65,12 @@ public:
           sprites.emplace_back(renderable);
         });
 
-    auto &resources = ResourceManager::instance();
-
+    batch.begin(projection);
     for (const auto &sprite : sprites) {
-      Shader *shader = resources.getShader(sprite.material->shaderProgram);
-      if (!shader)
-        continue;
-
-      shader->use();
-      shader->setMat4("projection", projection);
-      shader->setMat4("model", sprite.transform->getSpriteModelMatrix());
-      shader->setVec3("spriteColor", sprite.material->color);
-      shader->setFloat("spriteAlpha", sprite.material->alpha);
-
-      shader->setBool("useTexture", sprite.material->useTextures);
-      if (sprite.material->useTextures && sprite.material->textures[0] != 0) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, sprite.material->textures[0]);
-        shader->setInt("image", 0);
-      }
-
-      RenderUtils::drawMesh(*sprite.mesh);
+      batch.draw(*sprite.transform, *sprite.material, *sprite.mesh);
     }
+    batch.end();
   }
+
+  const SpriteBatch::Stats &getBatchStats() const { return batch.getStats(); }
 };
@@ -0,0 +1,267 @@
+#pragma once
+#include "../../../ecs/System.hpp"
+#include "../../../ecs/World.hpp"
+#include "../../../resources/ResourceManager.hpp"
+#include "../../components/TransformComponent.hpp"
+#include "../../gl_common.hpp"
+#include "../components/ParticleEmitterComponent.hpp"
+#include "../components/VelocityComponent.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+extern World gWorld;
+
+// Alternative ParticleSystem backend that keeps particle state on the GPU.
+// Every emitter owns two buffers of maxParticles particles; update() runs a
+// transform feedback vertex shader that reads one and writes the other, with
+// spawning and lifetime handled in the shader. The CPU only uploads emitter
+// parameters as uniforms. render() draws the current buffer instanced with
+// the same particle shader as ParticleSystem. Only needs GL 3.3 core.
+class GPUParticleSystem : public System {
+public:
+  struct Stats {
+    uint32_t emitters = 0;
+    uint32_t particles = 0; // Slots simulated, live or not
+    uint32_t drawCalls = 0;
+  };
+
+  GPUParticleSystem(float screenWidth, float screenHeight)
+      : screenWidth(screenWidth), screenHeight(screenHeight) {
+    auto &resources = ResourceManager::instance();
+    if (!resources.getShader("particle")) {
+      resources.loadShader(
+          "particle", "../src/scenes/breakout/shaders/particleVertex.glsl",
+          "../src/scenes/breakout/shaders/particleFragment.glsl");
+    }
+    if (!resources.getShader("particleUpdate")) {
+      resources.loadFeedbackShader(
+          "particleUpdate",
+          "../src/scenes/breakout/shaders/particleUpdateVertex.glsl",
+          {"outPosition", "outVelocity", "outColor", "outLife"});
+    }
+  }
+
+  ~GPUParticleSystem() {
+    for (auto &[entity, gpu] : emitters) {
+      destroyEmitter(gpu);
+    }
+  }
+
+  GPUParticleSystem(const GPUParticleSystem &) = delete;
+  GPUParticleSystem &operator=(const GPUParticleSystem &) = delete;
+
+  void update(float &deltaTime) override {
+    Shader *shader = ResourceManager::instance().getShader("particleUpdate");
+    if (!shader)
+      return;
+
+    auto &glState = GLStateCache::instance();
+    shader->use();
+    shader->setFloat("deltaTime", deltaTime);
+
+    // Nothing is rasterised, the shader output only goes to the buffers
+    glState.enable(GL_RASTERIZER_DISCARD);
+    frame++;
+
+    gWorld.forEachWith<ParticleEmitterComponent, TransformComponent>(
+        [&](Entity entity, ParticleEmitterComponent &emitter,
+            TransformComponent &transform) {
+          // Handle emitter duration
+          if (emitter.durationRemaining > 0.0f) {
+            emitter.durationRemaining -= deltaTime;
+            if (emitter.durationRemaining <= 0.0f) {
+              emitter.spawnRate = 0;
+            }
+          }
+          if (emitter.maxParticles == 0)
+            return;
+
+          GPUEmitter &gpu = emitters[entity];
+          if (gpu.capacity != emitter.maxParticles) {
+            destroyEmitter(gpu);
+            createEmitter(gpu, emitter.maxParticles);
+          }
+          gpu.lastFrame = frame;
+
+          // Get velocity from emitter entity (e.g., ball)
+          VelocityComponent *vel =
+              gWorld.getComponent<VelocityComponent>(entity);
+          glm::vec2 emitterVelocity = vel ? vel->velocity : glm::vec2(0.0f);
+          glm::vec2 emitterPos =
+              glm::vec2(transform.position) + emitter.offset;
+          uint32_t spawnCount = std::min(emitter.spawnRate, gpu.capacity);
+
+          shader->setFloat("lifetime", emitter.particleLifetime);
+          shader->setVec2("gravity", emitter.gravity);
+          shader->setBool("trailMode", emitter.trailMode);
+          shader->setVec2("emitterPosition", emitterPos);
+          shader->setVec2("emitterVelocity", emitterVelocity);
+          shader->setInt("spawnStart", static_cast<int>(gpu.spawnCursor));
+          shader->setInt("spawnCount", static_cast<int>(spawnCount));
+          shader->setInt("maxParticles", static_cast<int>(gpu.capacity));
+          shader->setInt("seed", static_cast<int>(frame * 7919u + entity));
+
+          uint32_t next = 1 - gpu.current;
+          glState.bindVertexArray(gpu.updateVAO[gpu.current]);
+          glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gpu.buffers[next]);
+          glBeginTransformFeedback(GL_POINTS);
+          glDrawArrays(GL_POINTS, 0, gpu.capacity);
+          glEndTransformFeedback();
+
+          gpu.current = next;
+          gpu.spawnCursor = (gpu.spawnCursor + spawnCount) % gpu.capacity;
+        });
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glState.disable(GL_RASTERIZER_DISCARD);
+
+    // Free buffers of emitters that were removed
+    for (auto it = emitters.begin(); it != emitters.end();) {
+      if (it->second.lastFrame != frame) {
+        destroyEmitter(it->second);
+        it = emitters.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void render() override {
+    stats = Stats{};
+    Shader *shader = ResourceManager::instance().getShader("particle");
+    if (!shader || emitters.empty())
+      return;
+
+    glm::mat4 projection =
+        glm::ortho(0.0f, screenWidth, screenHeight, 0.0f, -1.0f, 1.0f);
+
+    auto &glState = GLStateCache::instance();
+    shader->use();
+    shader->setMat4("projection", projection);
+    shader->setInt("image", 0);
+
+    // Additive blending for glow effect
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE);
+
+    gWorld.forEachWith<ParticleEmitterComponent>(
+        [&](Entity entity, ParticleEmitterComponent &emitter) {
+          auto it = emitters.find(entity);
+          if (it == emitters.end())
+            return;
+          const GPUEmitter &gpu = it->second;
+
+          shader->setBool("useTexture", emitter.textureID != 0);
+          shader->setVec4("uvRect", emitter.uvRect);
+          if (emitter.textureID != 0) {
+            glState.bindTexture(0, GL_TEXTURE_2D, emitter.textureID);
+          }
+
+          glState.bindVertexArray(gpu.renderVAO[gpu.current]);
+          // Size is per emitter, fed through the disabled attribute's
+          // constant value
+          glVertexAttrib2f(1, emitter.particleSize.x, emitter.particleSize.y);
+          glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, gpu.capacity);
+
+          stats.emitters++;
+          stats.particles += gpu.capacity;
+          stats.drawCalls++;
+        });
+
+    // Restore default blending
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  // Matches the transform feedback varyings of particleUpdateVertex.glsl
+  struct GPUParticle {
+    glm::vec2 position;
+    glm::vec2 velocity;
+    glm::vec4 color;
+    float life;
+  };
+
+  struct GPUEmitter {
+    uint32_t buffers[2] = {0, 0};
+    uint32_t updateVAO[2] = {0, 0}; // Per vertex attributes, for feedback
+    uint32_t renderVAO[2] = {0, 0}; // Per instance attributes, for drawing
+    uint32_t capacity = 0;
+    uint32_t current = 0; // Buffer holding the latest state
+    uint32_t spawnCursor = 0;
+    uint32_t lastFrame = 0;
+  };
+
+  float screenWidth;
+  float screenHeight;
+
+  std::unordered_map<Entity, GPUEmitter> emitters;
+  uint32_t frame = 0;
+  Stats stats;
+
+  void createEmitter(GPUEmitter &gpu, uint32_t capacity) {
+    auto &glState = GLStateCache::instance();
+    gpu.capacity = capacity;
+    gpu.current = 0;
+    gpu.spawnCursor = 0;
+
+    // Zeroed particles have no life and no alpha, i.e. dead
+    std::vector<GPUParticle> initial(capacity, GPUParticle{});
+    glGenBuffers(2, gpu.buffers);
+    glGenVertexArrays(2, gpu.updateVAO);
+    glGenVertexArrays(2, gpu.renderVAO);
+
+    GLsizei stride = sizeof(GPUParticle);
+    for (int i = 0; i < 2; i++) {
+      glState.bindBuffer(GL_ARRAY_BUFFER, gpu.buffers[i]);
+      glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GPUParticle),
+                   initial.data(), GL_DYNAMIC_COPY);
+
+      glState.bindVertexArray(gpu.updateVAO[i]);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, position));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, velocity));
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, color));
+      glEnableVertexAttribArray(3);
+      glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, life));
+
+      // Layout of particleVertex.glsl, attribute 1 (size) stays disabled
+      glState.bindVertexArray(gpu.renderVAO[i]);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, position));
+      glVertexAttribDivisor(0, 1);
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, color));
+      glVertexAttribDivisor(2, 1);
+      // The shader collapses dead slots so they cost no fill rate
+      glEnableVertexAttribArray(3);
+      glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(GPUParticle, life));
+      glVertexAttribDivisor(3, 1);
+    }
+    glState.bindVertexArray(0);
+  }
+
+  void destroyEmitter(GPUEmitter &gpu) {
+    auto &glState = GLStateCache::instance();
+    for (int i = 0; i < 2; i++) {
+      if (gpu.updateVAO[i])
+        glState.deleteVertexArray(gpu.updateVAO[i]);
+      if (gpu.renderVAO[i])
+        glState.deleteVertexArray(gpu.renderVAO[i]);
+      if (gpu.buffers[i])
+        glState.deleteBuffer(gpu.buffers[i]);
+    }
+    gpu = GPUEmitter{};
+  }
+};
@@ -33,7 +33,7 @@ private:
         {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
 
     auto &resources = ResourceManager::instance();
-    spriteMesh = resources.createMesh(vertices, sizeof(vertices), layout, 6);
+    spriteMesh = resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
     meshInitialized = true;
   }
 
@@ -132,17 +132,15 @@ private:
 
     MaterialComponent material;
     material.shaderProgram = level.shaderID;
-    uint32_t tex = isSolid ? level.blockSolidTexture : level.blockTexture;
-    material.textures[0] = tex;
-    material.useTextures = (tex != 0);
+    const AtlasRegion &sprite =
+        isSolid ? level.blockSolidSprite : level.blockSprite;
+    material.textures[0] = sprite.textureID;
+    material.uvRect = sprite.uvRect;
+    material.useTextures = sprite.isValid();
     material.color = color;
     gWorld.addComponent(brick, material);
 
-    MeshComponent meshComp;
-    meshComp.vao = spriteMesh.vao;
-    meshComp.vertexCount = spriteMesh.vertexCount;
-    meshComp.indexCount = 0;
-    gWorld.addComponent(brick, meshComp);
+    gWorld.addComponent(brick, spriteMesh.toComponent());
 
     BrickComponent brickComp;
     brickComp.isSolid = isSolid;
@@ -164,10 +162,8 @@ private:
       emitter.particleLifetime = 2.0f;
       emitter.gravity = glm::vec2(0, 500.0f);
       emitter.trailMode = false;
-      emitter.shaderID = level.shaderID;
-      emitter.textureID = level.particleTextureID;
-      emitter.meshVAO = spriteMesh.vao;
-      emitter.meshVertexCount = spriteMesh.vertexCount;
+      emitter.textureID = level.particleSprite.textureID;
+      emitter.uvRect = level.particleSprite.uvRect;
       gWorld.addComponent(brick, emitter);
     }
   }
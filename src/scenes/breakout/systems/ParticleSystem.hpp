@@ -6,22 +6,59 @@
 #include "../../gl_common.hpp"
 #include "../components/ParticleEmitterComponent.hpp"
 #include "../components/VelocityComponent.hpp"
+#include <algorithm>
+#include <cstddef>
 #include <cstdlib>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) ||                                     \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PARTICLE_SSE 1
+#include <xmmintrin.h>
+#endif
 
 extern World gWorld;
 
+// Simulates particles on the CPU and draws them instanced: all live particles
+// are written to one instance buffer per frame and each emitter is a single
+// glDrawArraysInstanced over its range, the quad is built in the vertex shader
 class ParticleSystem : public System {
 public:
+  struct Stats {
+    uint32_t particles = 0;
+    uint32_t drawCalls = 0;
+  };
+
   ParticleSystem(float screenWidth, float screenHeight)
-      : screenWidth(screenWidth), screenHeight(screenHeight) {}
+      : screenWidth(screenWidth), screenHeight(screenHeight) {
+    auto &resources = ResourceManager::instance();
+    if (!resources.getShader("particle")) {
+      resources.loadShader(
+          "particle", "../src/scenes/breakout/shaders/particleVertex.glsl",
+          "../src/scenes/breakout/shaders/particleFragment.glsl");
+    }
+    initBuffers();
+  }
+
+  ~ParticleSystem() {
+    auto &glState = GLStateCache::instance();
+    if (vao)
+      glState.deleteVertexArray(vao);
+    if (vbo)
+      glState.deleteBuffer(vbo);
+  }
+
+  ParticleSystem(const ParticleSystem &) = delete;
+  ParticleSystem &operator=(const ParticleSystem &) = delete;
 
   void update(float &deltaTime) override {
     gWorld.forEachWith<ParticleEmitterComponent, TransformComponent>(
         [&](Entity entity, ParticleEmitterComponent &emitter,
             TransformComponent &transform) {
+          ParticlePool &pool = emitter.particles;
           // Resize particle pool if needed
-          if (emitter.particles.size() < emitter.maxParticles) {
-            emitter.particles.resize(emitter.maxParticles);
+          if (pool.maxCount != emitter.maxParticles) {
+            pool.setCapacity(emitter.maxParticles);
           }
 
           // Handle emitter duration
@@ -40,119 +77,235 @@ public:
 
           // Spawn new particles
           for (unsigned int i = 0; i < emitter.spawnRate; ++i) {
-            unsigned int idx = findUnusedParticle(emitter);
-            respawnParticle(emitter.particles[idx], emitterPos, emitterVelocity,
-                            emitter);
+            uint32_t idx = pool.spawn();
+            if (idx == pool.maxCount)
+              break;
+            respawnParticle(pool, idx, emitterPos, emitterVelocity, emitter);
           }
 
-          // Update all particles
-          for (unsigned int i = 0; i < emitter.maxParticles; ++i) {
-            Particle &p = emitter.particles[i];
-            p.life -= deltaTime;
-            if (p.life > 0.0f) {
-              p.velocity += emitter.gravity * deltaTime;
-              if (emitter.trailMode) {
-                p.position -= p.velocity * deltaTime;
-              } else {
-                p.position += p.velocity * deltaTime;
-              }
-              p.color.a -= deltaTime / emitter.particleLifetime;
+          integrate(pool, emitter, deltaTime);
+
+          // Swap-on-death keeps the live range packed, the swapped in
+          // particle is checked on the next iteration
+          for (uint32_t i = 0; i < pool.count;) {
+            if (pool.life[i] <= 0.0f) {
+              pool.kill(i);
+            } else {
+              ++i;
             }
           }
         });
   }
 
   void render() override {
-    auto &resources = ResourceManager::instance();
     glm::mat4 projection =
         glm::ortho(0.0f, screenWidth, screenHeight, 0.0f, -1.0f, 1.0f);
 
-    // Additive blending for glow effect
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
+    // Pack every live particle into one instance array, each emitter gets a
+    // contiguous range so it can be drawn with a single instanced call
+    instances.clear();
+    batches.clear();
     gWorld.forEachWith<ParticleEmitterComponent>(
         [&](Entity entity, ParticleEmitterComponent &emitter) {
-          if (emitter.particles.empty())
-            return;
-
-          Shader *shader = resources.getShader(emitter.shaderID);
-          if (!shader)
-            return;
+          EmitterBatch batch;
+          batch.first = static_cast<uint32_t>(instances.size());
+          batch.textureID = emitter.textureID;
+          batch.uvRect = emitter.uvRect;
+          const ParticlePool &pool = emitter.particles;
+          for (uint32_t i = 0; i < pool.count; ++i) {
+            instances.push_back({glm::vec2(pool.posX[i], pool.posY[i]),
+                                 emitter.particleSize,
+                                 glm::vec4(pool.r[i], pool.g[i], pool.b[i],
+                                           pool.a[i])});
+          }
+          batch.count = pool.count;
+          if (batch.count > 0) {
+            batches.push_back(batch);
+          }
+        });
 
-          shader->use();
-          shader->setMat4("projection", projection);
+    stats.particles = static_cast<uint32_t>(instances.size());
+    stats.drawCalls = 0;
+    if (instances.empty())
+      return;
 
-          if (emitter.textureID != 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, emitter.textureID);
-            shader->setInt("image", 0);
-          }
+    Shader *shader = ResourceManager::instance().getShader("particle");
+    if (!shader)
+      return;
 
-          for (const Particle &p : emitter.particles) {
-            if (p.life > 0.0f) {
-              glm::mat4 model = glm::mat4(1.0f);
-              model = glm::translate(model, glm::vec3(p.position, 0.0f));
-              model = glm::scale(model, glm::vec3(emitter.particleSize, 1.0f));
+    auto &glState = GLStateCache::instance();
+    uploadInstances();
 
-              shader->setMat4("model", model);
-              shader->setVec3("spriteColor", glm::vec3(p.color));
-              shader->setFloat("spriteAlpha", p.color.a);
+    shader->use();
+    shader->setMat4("projection", projection);
+    shader->setInt("image", 0);
 
-              glBindVertexArray(emitter.meshVAO);
-              glDrawArrays(GL_TRIANGLES, 0, emitter.meshVertexCount);
-            }
-          }
-        });
+    // Additive blending for glow effect
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE);
+    glState.bindVertexArray(vao);
+    // Only live particles are uploaded, life goes through the disabled
+    // attribute's constant value
+    glVertexAttrib1f(3, 1.0f);
 
-    glBindVertexArray(0);
+    for (const EmitterBatch &batch : batches) {
+      shader->setBool("useTexture", batch.textureID != 0);
+      shader->setVec4("uvRect", batch.uvRect);
+      if (batch.textureID != 0) {
+        glState.bindTexture(0, GL_TEXTURE_2D, batch.textureID);
+      }
+      // No base instance in GL 3.3, move the attribute pointers instead
+      setInstanceAttributes(batch.first * sizeof(ParticleInstance));
+      glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.count);
+      stats.drawCalls++;
+    }
 
     // Restore default blending
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
 
+  const Stats &getStats() const { return stats; }
+
 private:
+  // Per instance vertex data, matches the attributes in particleVertex.glsl
+  struct ParticleInstance {
+    glm::vec2 position;
+    glm::vec2 size;
+    glm::vec4 color;
+  };
+
+  struct EmitterBatch {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t textureID = 0;
+    glm::vec4 uvRect;
+  };
+
   float screenWidth;
   float screenHeight;
 
-  unsigned int findUnusedParticle(ParticleEmitterComponent &emitter) {
-    // Search from last used particle (usually finds one quickly)
-    for (unsigned int i = emitter.lastUsedParticle; i < emitter.maxParticles;
-         ++i) {
-      if (emitter.particles[i].life <= 0.0f) {
-        emitter.lastUsedParticle = i;
-        return i;
-      }
+  uint32_t vao = 0;
+  uint32_t vbo = 0;
+  size_t vboCapacity = 0; // In bytes
+  std::vector<ParticleInstance> instances;
+  std::vector<EmitterBatch> batches;
+  Stats stats;
+
+  void initBuffers() {
+    auto &glState = GLStateCache::instance();
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    glState.bindVertexArray(vao);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (GLuint attribute = 0; attribute < 3; attribute++) {
+      glEnableVertexAttribArray(attribute);
+      glVertexAttribDivisor(attribute, 1);
     }
-    // Linear search from beginning
-    for (unsigned int i = 0; i < emitter.lastUsedParticle; ++i) {
-      if (emitter.particles[i].life <= 0.0f) {
-        emitter.lastUsedParticle = i;
-        return i;
-      }
+    setInstanceAttributes(0);
+    glState.bindVertexArray(0);
+  }
+
+  // Expects vbo to be bound to GL_ARRAY_BUFFER
+  void setInstanceAttributes(size_t byteOffset) {
+    GLsizei stride = sizeof(ParticleInstance);
+    glVertexAttribPointer(
+        0, 2, GL_FLOAT, GL_FALSE, stride,
+        (void *)(byteOffset + offsetof(ParticleInstance, position)));
+    glVertexAttribPointer(
+        1, 2, GL_FLOAT, GL_FALSE, stride,
+        (void *)(byteOffset + offsetof(ParticleInstance, size)));
+    glVertexAttribPointer(
+        2, 4, GL_FLOAT, GL_FALSE, stride,
+        (void *)(byteOffset + offsetof(ParticleInstance, color)));
+  }
+
+  // One upload per frame. The store is orphaned every time so the driver
+  // never has to wait for last frame's draws to finish reading it
+  void uploadInstances() {
+    auto &glState = GLStateCache::instance();
+    size_t bytes = instances.size() * sizeof(ParticleInstance);
+    if (bytes > vboCapacity) {
+      vboCapacity = std::max(bytes, vboCapacity * 2);
+    }
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vboCapacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+  }
+
+  // Advances every live particle: life, gravity, position and alpha fade.
+  // Runs over whole SIMD lanes, the pool arrays are padded for it
+  void integrate(ParticlePool &pool, const ParticleEmitterComponent &emitter,
+                 float deltaTime) {
+    uint32_t lanes = ParticlePool::LANES;
+    uint32_t padded = (pool.count + lanes - 1) / lanes * lanes;
+    float direction = emitter.trailMode ? -1.0f : 1.0f;
+    float fade = deltaTime / emitter.particleLifetime;
+    float gravityX = emitter.gravity.x * deltaTime;
+    float gravityY = emitter.gravity.y * deltaTime;
+    float step = direction * deltaTime;
+
+    float *posX = pool.posX.data();
+    float *posY = pool.posY.data();
+    float *velX = pool.velX.data();
+    float *velY = pool.velY.data();
+    float *alpha = pool.a.data();
+    float *life = pool.life.data();
+
+#ifdef PARTICLE_SSE
+    __m128 dt4 = _mm_set1_ps(deltaTime);
+    __m128 fade4 = _mm_set1_ps(fade);
+    __m128 gravityX4 = _mm_set1_ps(gravityX);
+    __m128 gravityY4 = _mm_set1_ps(gravityY);
+    __m128 step4 = _mm_set1_ps(step);
+    for (uint32_t i = 0; i < padded; i += 4) {
+      __m128 vx = _mm_add_ps(_mm_loadu_ps(velX + i), gravityX4);
+      __m128 vy = _mm_add_ps(_mm_loadu_ps(velY + i), gravityY4);
+      _mm_storeu_ps(velX + i, vx);
+      _mm_storeu_ps(velY + i, vy);
+      _mm_storeu_ps(posX + i, _mm_add_ps(_mm_loadu_ps(posX + i),
+                                         _mm_mul_ps(vx, step4)));
+      _mm_storeu_ps(posY + i, _mm_add_ps(_mm_loadu_ps(posY + i),
+                                         _mm_mul_ps(vy, step4)));
+      _mm_storeu_ps(alpha + i, _mm_sub_ps(_mm_loadu_ps(alpha + i), fade4));
+      _mm_storeu_ps(life + i, _mm_sub_ps(_mm_loadu_ps(life + i), dt4));
+    }
+#else
+    for (uint32_t i = 0; i < padded; ++i) {
+      velX[i] += gravityX;
+      velY[i] += gravityY;
+      posX[i] += velX[i] * step;
+      posY[i] += velY[i] * step;
+      alpha[i] -= fade;
+      life[i] -= deltaTime;
     }
-    // All alive - override first
-    emitter.lastUsedParticle = 0;
-    return 0;
+#endif
   }
 
-  void respawnParticle(Particle &p, const glm::vec2 &pos, const glm::vec2 &vel,
+  void respawnParticle(ParticlePool &pool, uint32_t idx, const glm::vec2 &pos,
+                       const glm::vec2 &vel,
                        const ParticleEmitterComponent &emitter) {
     float randomX = ((std::rand() % 100) - 50) / 10.0f;
     float randomY = ((std::rand() % 100) - 50) / 10.0f;
     float rColor = 0.5f + ((std::rand() % 100) / 100.0f);
 
-    p.position = pos + glm::vec2(randomX, randomY) + emitter.offset;
-    p.color = glm::vec4(rColor, rColor, rColor, 1.0f);
-    p.life = emitter.particleLifetime;
+    glm::vec2 position = pos + glm::vec2(randomX, randomY) + emitter.offset;
+    pool.posX[idx] = position.x;
+    pool.posY[idx] = position.y;
+    pool.r[idx] = pool.g[idx] = pool.b[idx] = rColor;
+    pool.a[idx] = 1.0f;
+    pool.life[idx] = emitter.particleLifetime;
 
+    glm::vec2 velocity;
     if (emitter.trailMode) {
       // Trail behind emitter
-      p.velocity = vel * 0.1f;
+      velocity = vel * 0.1f;
     } else {
       // Scatter in random directions (explosion/debris)
       int scatterX = ((std::rand() % 100) - 50);
       int scatterY = ((std::rand() % 100) - 50);
-      p.velocity = glm::vec2(scatterX, scatterY);
+      velocity = glm::vec2(scatterX, scatterY);
     }
+    pool.velX[idx] = velocity.x;
+    pool.velY[idx] = velocity.y;
   }
 };
@@ -31,7 +31,8 @@ public:
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST);
+    auto &glState = GLStateCache::instance();
+    glState.disable(GL_DEPTH_TEST);
 
     // Find post-processing settings
     PostProcessingComponent *fx = nullptr;
@@ -43,19 +44,21 @@ public:
     if (!shader)
       return;
 
+    uint32_t features = 0;
+    if (fx) {
+      features |= fx->chaos ? Shader::CHAOS : 0;
+      features |= fx->confuse ? Shader::CONFUSE : 0;
+      features |= fx->shake ? Shader::SHAKE : 0;
+    }
+    shader = shader->variant(features);
     shader->use();
     shader->setFloat("time", time);
-    shader->setBool("confuse", fx ? fx->confuse : false);
-    shader->setBool("chaos", fx ? fx->chaos : false);
-    shader->setBool("shake", fx ? fx->shake : false);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, framebuffer.colorTexture);
+    glState.bindTexture(0, GL_TEXTURE_2D, framebuffer.colorTexture);
     shader->setInt("scene", 0);
 
-    glBindVertexArray(quadVAO);
+    glState.bindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
   }
 
   void update(float &deltaTime) override {
@@ -75,7 +78,7 @@ public:
     beginRender();
   }
 
-  void setScreenSize(unsigned int w, unsigned int h) {
+  void setScreenSize(unsigned int w, unsigned int h) override {
     if (width == w && height == h)
       return;
     width = w;
@@ -102,15 +105,16 @@ private:
     glGenVertexArrays(1, &quadVAO);
     glGenBuffers(1, &VBO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    auto &glState = GLStateCache::instance();
+    glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    glBindVertexArray(quadVAO);
+    glState.bindVertexArray(quadVAO);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
                           (void *)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+    glState.bindVertexArray(0);
   }
 
   void initShader() {
@@ -120,28 +124,15 @@ private:
         "../src/scenes/breakout/shaders/postProcessVertex.glsl",
         "../src/scenes/breakout/shaders/postProcessFragment.glsl");
 
+    // Power ups toggle the effects mid game, compile every combination
+    // now instead of stalling the first frame each one shows up
     Shader *shader = resources.getShader(shaderID);
     if (shader) {
-      shader->use();
-
-      // Set up kernel offsets
-      float offset = 1.0f / 300.0f;
-      float offsets[9][2] = {
-          {-offset, offset},  {0.0f, offset},  {offset, offset},
-          {-offset, 0.0f},    {0.0f, 0.0f},    {offset, 0.0f},
-          {-offset, -offset}, {0.0f, -offset}, {offset, -offset}};
-      glUniform2fv(glGetUniformLocation(shader->ID, "offsets"), 9,
-                   (float *)offsets);
-
-      int edgeKernel[9] = {-1, -1, -1, -1, 8, -1, -1, -1, -1};
-      glUniform1iv(glGetUniformLocation(shader->ID, "edge_kernel"), 9,
-                   edgeKernel);
-
-      float blurKernel[9] = {1.0f / 16.0f, 2.0f / 16.0f, 1.0f / 16.0f,
-                             2.0f / 16.0f, 4.0f / 16.0f, 2.0f / 16.0f,
-                             1.0f / 16.0f, 2.0f / 16.0f, 1.0f / 16.0f};
-      glUniform1fv(glGetUniformLocation(shader->ID, "blur_kernel"), 9,
-                   blurKernel);
+      for (uint32_t i = 0; i < 8; i++) {
+        shader->variant((i & 1 ? Shader::CHAOS : 0) |
+                        (i & 2 ? Shader::CONFUSE : 0) |
+                        (i & 4 ? Shader::SHAKE : 0));
+      }
     }
   }
 };
@@ -17,12 +17,12 @@
 extern World gWorld;
 
 struct PowerUpTextures {
-  uint32_t speed = 0;
-  uint32_t sticky = 0;
-  uint32_t passThrough = 0;
-  uint32_t padSize = 0;
-  uint32_t confuse = 0;
-  uint32_t chaos = 0;
+  AtlasRegion speed;
+  AtlasRegion sticky;
+  AtlasRegion passThrough;
+  AtlasRegion padSize;
+  AtlasRegion confuse;
+  AtlasRegion chaos;
 };
 
 class PowerUpSystem : public System {
@@ -135,8 +135,7 @@ private:
 
   float screenWidth, screenHeight;
   uint32_t shaderID;
-  uint32_t meshVAO = 0;
-  unsigned int meshVertexCount = 6;
+  MeshComponent spriteMesh;
   PowerUpTextures textures;
   std::vector<Entity> pool;
 
@@ -157,9 +156,9 @@ private:
         {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
 
     auto &resources = ResourceManager::instance();
-    MeshData mesh = resources.createMesh(vertices, sizeof(vertices), layout, 6);
-    meshVAO = mesh.vao;
-    meshVertexCount = mesh.vertexCount;
+    MeshData mesh =
+        resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
+    spriteMesh = mesh.toComponent();
   }
 
   void initPool(unsigned int poolSize) {
@@ -181,11 +180,7 @@ private:
       material.color = glm::vec3(1.0f);
       gWorld.addComponent(entity, material);
 
-      MeshComponent mesh;
-      mesh.vao = meshVAO;
-      mesh.vertexCount = meshVertexCount;
-      mesh.indexCount = 0;
-      gWorld.addComponent(entity, mesh);
+      gWorld.addComponent(entity, spriteMesh);
 
       gWorld.addComponent(
           entity,
@@ -206,39 +201,39 @@ private:
 
     glm::vec3 color;
     float duration;
-    uint32_t textureID;
+    AtlasRegion sprite;
 
     switch (powerUpType) {
     case PowerUpType::Speed:
       color = glm::vec3(0.5f, 0.5f, 1.0f);
       duration = 0.0f;
-      textureID = textures.speed;
+      sprite = textures.speed;
       break;
     case PowerUpType::Sticky:
       color = glm::vec3(1.0f, 0.5f, 1.0f);
       duration = 20.0f;
-      textureID = textures.sticky;
+      sprite = textures.sticky;
       break;
     case PowerUpType::PassThrough:
       color = glm::vec3(0.5f, 1.0f, 0.5f);
       duration = 10.0f;
-      textureID = textures.passThrough;
+      sprite = textures.passThrough;
       break;
     case PowerUpType::PadSizeInc:
       color = glm::vec3(1.0f, 0.6f, 0.4f);
       duration = 0.0f;
-      textureID = textures.padSize;
+      sprite = textures.padSize;
       break;
     case PowerUpType::Confuse:
       color = glm::vec3(1.0f, 0.3f, 0.3f);
       duration = 15.0f;
-      textureID = textures.confuse;
+      sprite = textures.confuse;
       break;
     case PowerUpType::Chaos:
     default:
       color = glm::vec3(0.9f, 0.25f, 0.25f);
       duration = 15.0f;
-      textureID = textures.chaos;
+      sprite = textures.chaos;
       break;
     }
 
@@ -250,8 +245,9 @@ private:
 
     transform->position = glm::vec3(position, 0.0f);
 
-    material->textures[0] = textureID;
-    material->useTextures = (textureID != 0);
+    material->textures[0] = sprite.textureID;
+    material->uvRect = sprite.uvRect;
+    material->useTextures = sprite.isValid();
     material->color = color;
     material->alpha = 1.0f; // Visible
   }
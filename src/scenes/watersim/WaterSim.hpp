@@ -146,11 +146,7 @@ private:
     transform.scale = glm::vec3(1.0f);
     world.addComponent(wall, transform);
 
-    MeshComponent mesh;
-    mesh.vao = wallMesh.vao;
-    mesh.vertexCount = wallMesh.vertexCount;
-    mesh.indexCount = wallMesh.indexCount;
-    world.addComponent(wall, mesh);
+    world.addComponent(wall, wallMesh.toComponent());
 
     MaterialComponent material;
     material.shaderProgram = spriteShaderID;
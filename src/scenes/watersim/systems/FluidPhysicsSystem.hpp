@@ -84,7 +84,7 @@ private:
                         1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f};
     std::vector<VertexAttribute> layout = {
         {0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0}};
-    quadMesh = resources.createMesh(vertices, sizeof(vertices), layout, 6);
+    quadMesh = resources.createMesh(vertices, sizeof(vertices), layout, 6, 2);
     meshCreated = true;
   }
 
@@ -101,11 +101,7 @@ private:
     transform.scale = glm::vec3(diameter, diameter, 1.0f);
     gWorld.addComponent(particle, transform);
 
-    MeshComponent mesh;
-    mesh.vao = quadMesh.vao;
-    mesh.vertexCount = quadMesh.vertexCount;
-    mesh.indexCount = quadMesh.indexCount;
-    gWorld.addComponent(particle, mesh);
+    gWorld.addComponent(particle, quadMesh.toComponent());
 
     MaterialComponent material;
     material.shaderProgram = spriteShaderID;
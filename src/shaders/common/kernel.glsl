@@ -0,0 +1,31 @@
+// 3x3 convolution of a texture around uv, offset apart (in UV units).
+// Kernels are listed row by row, top row first.
+
+vec3 ApplyKernel(sampler2D image, vec2 uv, float offset, float kernel[9])
+{
+  vec2 offsets[9] = vec2[](
+      vec2(-offset,  offset), vec2( 0.0,    offset), vec2( offset,  offset),
+      vec2(-offset,  0.0),    vec2( 0.0,    0.0),    vec2( offset,  0.0),
+      vec2(-offset, -offset), vec2( 0.0,   -offset), vec2( offset, -offset)
+  );
+
+  vec3 col = vec3(0.0);
+  for (int i = 0; i < 9; i++)
+    col += vec3(texture(image, uv + offsets[i])) * kernel[i];
+  return col;
+}
+
+// Sum of the 3x3 texels around uv, which must be a texel centre, in four
+// bilinear taps instead of nine. Along each axis the (1, 1, 1) row is one
+// tap on the first texel plus a tap halfway between the other two, weighted
+// twice.
+vec3 BoxSum3x3(sampler2D image, vec2 uv)
+{
+  vec2 texel = 1.0 / vec2(textureSize(image, 0));
+  vec2 single = -texel;
+  vec2 pair = 0.5 * texel;
+  return texture(image, uv + single).rgb +
+      2.0 * texture(image, uv + vec2(pair.x, single.y)).rgb +
+      2.0 * texture(image, uv + vec2(single.x, pair.y)).rgb +
+      4.0 * texture(image, uv + pair).rgb;
+}
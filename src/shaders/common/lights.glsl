@@ -0,0 +1,183 @@
+// Blinn-Phong lighting shared by the lit shaders. Every light type only
+// exists in variants compiled with its FEATURE_ define (Shader::Feature),
+// LightingSystem picks them from the lights in the scene. The including
+// shader declares `uniform mat4 view` and calls CalcLights.
+
+const float PI = 3.14159265;
+
+// Material colours at the fragment, sampled once before the lights
+struct Surface {
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+  float shininess;
+};
+
+vec3 BlinnPhong(Surface surface, vec3 ambient, vec3 diffuse, vec3 specular,
+                vec3 lightDir, vec3 normal, vec3 viewDir)
+{
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+  // specular shading (Blinn-Phong with energy conservation)
+  float kEnergyConservation = (8.0 + surface.shininess) / (8.0 * PI);
+  vec3 halfwayDir = normalize(lightDir + viewDir);
+  float spec = kEnergyConservation *
+      pow(max(dot(normal, halfwayDir), 0.0), surface.shininess);
+  // combine results
+  return ambient * surface.ambient + diffuse * diff * surface.diffuse +
+      specular * spec * surface.specular;
+}
+
+#ifdef FEATURE_DIR_LIGHT
+struct DirLight {
+  vec3 direction;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+uniform DirLight dirLight;
+
+vec3 CalcDirLight(Surface surface, vec3 normal, vec3 viewDir)
+{
+  vec3 lightDir = normalize(-dirLight.direction);
+  return BlinnPhong(surface, dirLight.ambient, dirLight.diffuse,
+                    dirLight.specular, lightDir, normal, viewDir);
+}
+#endif
+
+#ifdef FEATURE_POINT_LIGHTS
+struct PointLight {
+  vec3 position;
+  float radius;
+
+  float constant;
+  float linear;
+  float quadratic;
+
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+// Clustered point lights, filled in by LightingSystem / LightClusters
+uniform samplerBuffer clusterLights;   // 4 texels per light
+uniform usamplerBuffer clusterRanges;  // (offset, count) per cluster
+uniform usamplerBuffer clusterIndices; // light indices
+uniform ivec3 clusterGrid;
+uniform vec2 clusterTileScale; // clusters per pixel in x and y
+uniform float clusterDepthScale;
+uniform float clusterDepthBias;
+uniform bool clusterLogDepth;
+
+int ClusterIndex(vec3 fragPos)
+{
+  float depth = -(view * vec4(fragPos, 1.0)).z;
+  float slice = clusterLogDepth
+      ? log(max(depth, 1e-4)) * clusterDepthScale + clusterDepthBias
+      : depth * clusterDepthScale + clusterDepthBias;
+  ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterTileScale), int(slice));
+  cell = clamp(cell, ivec3(0), clusterGrid - 1);
+  return cell.x + clusterGrid.x * (cell.y + clusterGrid.y * cell.z);
+}
+
+PointLight FetchPointLight(int index)
+{
+  vec4 t0 = texelFetch(clusterLights, index * 4);
+  vec4 t1 = texelFetch(clusterLights, index * 4 + 1);
+  vec4 t2 = texelFetch(clusterLights, index * 4 + 2);
+  vec4 t3 = texelFetch(clusterLights, index * 4 + 3);
+  PointLight light;
+  light.position = t0.xyz;
+  light.radius = t0.w;
+  light.ambient = t1.rgb;
+  light.constant = t1.w;
+  light.diffuse = t2.rgb;
+  light.linear = t2.w;
+  light.specular = t3.rgb;
+  light.quadratic = t3.w;
+  return light;
+}
+
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal,
+                    vec3 fragPos, vec3 viewDir)
+{
+  vec3 lightDir = normalize(light.position - fragPos);
+  // attenuation
+  float distance = length(light.position - fragPos);
+  float attenuation = 1.0 / (light.constant + light.linear * distance +
+        light.quadratic * (distance * distance));
+  // fade to exactly zero at the cluster radius so the cut is invisible
+  float falloff = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+  attenuation *= falloff * falloff;
+  return attenuation * BlinnPhong(surface, light.ambient, light.diffuse,
+                                  light.specular, lightDir, normal, viewDir);
+}
+
+// Only the lights touching this fragment's cluster
+vec3 CalcPointLights(Surface surface, vec3 normal, vec3 fragPos,
+                     vec3 viewDir)
+{
+  vec3 result = vec3(0.0);
+  uvec2 range = texelFetch(clusterRanges, ClusterIndex(fragPos)).xy;
+  for (uint i = 0u; i < range.y; i++)
+  {
+    int index = int(texelFetch(clusterIndices, int(range.x + i)).r);
+    result += CalcPointLight(FetchPointLight(index), surface, normal,
+                             fragPos, viewDir);
+  }
+  return result;
+}
+#endif
+
+#ifdef FEATURE_SPOT_LIGHT
+struct SpotLight {
+  vec3 position;
+  vec3 direction;
+  float cutOff;
+  float outerCutOff;
+
+  float constant;
+  float linear;
+  float quadratic;
+
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+uniform SpotLight spotLight;
+
+vec3 CalcSpotLight(Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+  vec3 lightDir = normalize(spotLight.position - fragPos);
+  // attenuation
+  float distance = length(spotLight.position - fragPos);
+  float attenuation = 1.0 / (spotLight.constant + spotLight.linear * distance +
+        spotLight.quadratic * (distance * distance));
+  // spotlight intensity
+  float theta = dot(lightDir, normalize(-spotLight.direction));
+  float epsilon = spotLight.cutOff - spotLight.outerCutOff;
+  float intensity =
+      clamp((theta - spotLight.outerCutOff) / epsilon, 0.0, 1.0);
+  return attenuation * intensity *
+      BlinnPhong(surface, spotLight.ambient, spotLight.diffuse,
+                 spotLight.specular, lightDir, normal, viewDir);
+}
+#endif
+
+// Sum of every light type compiled in
+vec3 CalcLights(Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+  vec3 result = vec3(0.0);
+#ifdef FEATURE_DIR_LIGHT
+  result += CalcDirLight(surface, normal, viewDir);
+#endif
+#ifdef FEATURE_POINT_LIGHTS
+  result += CalcPointLights(surface, normal, fragPos, viewDir);
+#endif
+#ifdef FEATURE_SPOT_LIGHT
+  result += CalcSpotLight(surface, normal, fragPos, viewDir);
+#endif
+  return result;
+}
@@ -0,0 +1,29 @@
+// Attribute decode for CompactVertex meshes (see VertexLayout.hpp): aPos
+// holds 16 bit fractions of the mesh box and aNormal.xy an octahedral
+// normal. Other meshes pass through unchanged. The including shader
+// declares aPos and aNormal.
+//
+// Shared by every shader drawing scene meshes: the depth pre-pass relies on
+// depth/depthVertex.glsl computing bit identical positions to the lit pass.
+
+uniform bool compactVertex;
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+vec3 decodePosition()
+{
+  return compactVertex ? positionOffset + aPos * positionScale : aPos;
+}
+
+vec3 decodeNormal()
+{
+  if (!compactVertex)
+    return aNormal;
+  vec3 n = vec3(aNormal.xy, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+  if (n.z < 0.0)
+  {
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * signs;
+  }
+  return normalize(n);
+}
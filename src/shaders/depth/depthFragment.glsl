@@ -0,0 +1,12 @@
+#version 330 core
+// Only writes depth. Textured materials repeat the alpha test of the lit
+// shader, otherwise cut-out texels would hide what is behind them
+in vec2 TexCoords;
+
+uniform bool useTex;
+uniform sampler2D texture_diffuse1;
+
+void main()
+{
+  if (useTex && texture(texture_diffuse1, TexCoords).a < 0.1) discard;
+}
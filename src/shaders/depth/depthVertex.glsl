@@ -0,0 +1,24 @@
+#version 330 core
+// Depth pre-pass. Position math must match staticVertex.glsl exactly so the
+// lit pass can test against this depth with GL_LEQUAL, both decode through
+// common/vertexDecode.glsl
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal; // Only for vertexDecode.glsl
+layout(location = 2) in vec2 aTexCoord;
+
+out vec2 TexCoords;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+#include "../common/vertexDecode.glsl"
+
+invariant gl_Position;
+
+void main()
+{
+  vec3 fragPos = vec3(model * vec4(decodePosition(), 1.0));
+  TexCoords = aTexCoord;
+  gl_Position = projection * view * vec4(fragPos, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D image;
+
+// One axis of a separable Gaussian, see PostProcessChain. Tap 0 is the
+// centre texel, every other tap sits between two texels so one bilinear
+// fetch returns their weighted sum, and is mirrored to the other side
+const int MAX_TAPS = 6;
+uniform vec2 direction; // One texel along the blurred axis, in UV
+uniform int tapCount;
+uniform float tapWeights[MAX_TAPS];
+uniform float tapOffsets[MAX_TAPS];
+
+void main()
+{
+  vec3 color = texture(image, TexCoords).rgb * tapWeights[0];
+  for (int i = 1; i < tapCount; i++)
+  {
+    vec2 offset = direction * tapOffsets[i];
+    color += (texture(image, TexCoords + offset).rgb +
+              texture(image, TexCoords - offset).rgb) * tapWeights[i];
+  }
+  FragColor = vec4(color, 1.0);
+}
@@ -4,104 +4,120 @@ out vec4 FragColor;
 in vec2 TexCoords;
 
 uniform sampler2D screenTexture;
-uniform int effect; // 0 = normal, 1 = invert, 2 = grayscale, 3 = sharpen, 4 = blur, 5 = edge detection
 
-const float offset = 1.0 / 300.0;
-
-void main()
+// The fused pass of PostProcessChain, every effect that needs nothing but
+// screenTexture in one shader. Variants, applied in this order:
+//  - FEATURE_UPSCALE: the scene was drawn into part of screenTexture only,
+//    stretched over the output and sharpened
+//  - FEATURE_BLUR: screenTexture is the half resolution blur, upsampled
+//    with weights favouring the samples at this pixel's depth
+//  - FEATURE_SHARPEN or FEATURE_EDGES: 3x3 kernel, one texel apart
+//  - FEATURE_GRAYSCALE, then FEATURE_INVERT
+// Without any the input is copied as is
+
+#include "../common/kernel.glsl"
+
+#ifdef FEATURE_UPSCALE
+uniform vec2 contentScale; // Part of screenTexture the scene was drawn into
+uniform float sharpness;   // 0 to 1
+
+// Bilinear upscale, then the 4 neighbours one source texel away are
+// subtracted with contrast adaptive weights (as AMD's CAS does): less where
+// the neighbourhood already has contrast, so edges sharpen without ringing
+vec3 UpscaleSharpen(vec2 uv)
 {
-    vec3 color = texture(screenTexture, TexCoords).rgb;
-
-    if (effect == 0) {
-        // Normal - no post-processing
-        FragColor = vec4(color, 1.0);
-    }
-    else if (effect == 1) {
-        // Invert colors
-        FragColor = vec4(vec3(1.0 - color), 1.0);
-    }
-    else if (effect == 2) {
-        // Grayscale
-        float average = 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
-        FragColor = vec4(average, average, average, 1.0);
-    }
-    else if (effect == 3) {
-        // Sharpen kernel
-        vec2 offsets[9] = vec2[](
-            vec2(-offset,  offset), vec2( 0.0,    offset), vec2( offset,  offset),
-            vec2(-offset,  0.0),    vec2( 0.0,    0.0),    vec2( offset,  0.0),
-            vec2(-offset, -offset), vec2( 0.0,   -offset), vec2( offset, -offset)
-        );
-
-        float kernel[9] = float[](
-            -1, -1, -1,
-            -1,  9, -1,
-            -1, -1, -1
-        );
-
-        vec3 sampleTex[9];
-        for(int i = 0; i < 9; i++) {
-            sampleTex[i] = vec3(texture(screenTexture, TexCoords.st + offsets[i]));
-        }
-
-        vec3 col = vec3(0.0);
-        for(int i = 0; i < 9; i++)
-            col += sampleTex[i] * kernel[i];
-
-        FragColor = vec4(col, 1.0);
-    }
-    else if (effect == 4) {
-        // Blur kernel
-        vec2 offsets[9] = vec2[](
-            vec2(-offset,  offset), vec2( 0.0,    offset), vec2( offset,  offset),
-            vec2(-offset,  0.0),    vec2( 0.0,    0.0),    vec2( offset,  0.0),
-            vec2(-offset, -offset), vec2( 0.0,   -offset), vec2( offset, -offset)
-        );
-
-        float kernel[9] = float[](
-            1.0 / 16, 2.0 / 16, 1.0 / 16,
-            2.0 / 16, 4.0 / 16, 2.0 / 16,
-            1.0 / 16, 2.0 / 16, 1.0 / 16
-        );
-
-        vec3 sampleTex[9];
-        for(int i = 0; i < 9; i++) {
-            sampleTex[i] = vec3(texture(screenTexture, TexCoords.st + offsets[i]));
-        }
-
-        vec3 col = vec3(0.0);
-        for(int i = 0; i < 9; i++)
-            col += sampleTex[i] * kernel[i];
+  vec2 texel = 1.0 / vec2(textureSize(screenTexture, 0));
+  // Everything outside the drawn part is left over from other frames
+  vec2 low = 0.5 * texel;
+  vec2 high = contentScale - 0.5 * texel;
+  vec2 center = clamp(uv * contentScale, low, high);
+
+  vec3 middle = texture(screenTexture, center).rgb;
+  vec3 north = texture(screenTexture,
+      clamp(center + vec2(0.0, texel.y), low, high)).rgb;
+  vec3 south = texture(screenTexture,
+      clamp(center - vec2(0.0, texel.y), low, high)).rgb;
+  vec3 east = texture(screenTexture,
+      clamp(center + vec2(texel.x, 0.0), low, high)).rgb;
+  vec3 west = texture(screenTexture,
+      clamp(center - vec2(texel.x, 0.0), low, high)).rgb;
+
+  vec3 minimum = min(middle, min(min(north, south), min(east, west)));
+  vec3 maximum = max(middle, max(max(north, south), max(east, west)));
+  vec3 amount = sqrt(clamp(min(minimum, 1.0 - maximum) /
+      max(maximum, 1.0e-4), 0.0, 1.0));
+  vec3 weight = amount * mix(-0.125, -0.2, sharpness);
+  return (middle + (north + south + east + west) * weight) /
+      (1.0 + 4.0 * weight);
+}
+#endif
 
-        FragColor = vec4(col, 1.0);
-    }
-    else if (effect == 5) {
-        // Edge detection kernel
-        vec2 offsets[9] = vec2[](
-            vec2(-offset,  offset), vec2( 0.0,    offset), vec2( offset,  offset),
-            vec2(-offset,  0.0),    vec2( 0.0,    0.0),    vec2( offset,  0.0),
-            vec2(-offset, -offset), vec2( 0.0,   -offset), vec2( offset, -offset)
-        );
+#ifdef FEATURE_BLUR
+uniform sampler2D sceneDepth;
+uniform vec2 depthParams; // projection[2][2] and projection[3][2]
+uniform vec2 depthScale;  // Part of sceneDepth the scene was drawn into
 
-        float kernel[9] = float[](
-            1,  1,  1,
-            1, -8,  1,
-            1,  1,  1
-        );
+// Relative depth difference that halves a sample's weight
+const float DEPTH_TOLERANCE = 0.05;
 
-        vec3 sampleTex[9];
-        for(int i = 0; i < 9; i++) {
-            sampleTex[i] = vec3(texture(screenTexture, TexCoords.st + offsets[i]));
-        }
+float ViewDepth(vec2 uv)
+{
+  float ndc = texture(sceneDepth, uv * depthScale).r * 2.0 - 1.0;
+  return depthParams.y / (ndc + depthParams.x);
+}
 
-        vec3 col = vec3(0.0);
-        for(int i = 0; i < 9; i++)
-            col += sampleTex[i] * kernel[i];
+// Bilinear over the 4 nearest half resolution texels, each weight scaled
+// down the further its depth is from this pixel's, so the blur doesn't
+// bleed across silhouettes
+vec3 BilateralUpsample(vec2 uv)
+{
+  ivec2 size = textureSize(screenTexture, 0);
+  vec2 position = uv * vec2(size) - 0.5;
+  ivec2 base = ivec2(floor(position));
+  vec2 fraction = position - vec2(base);
+  float depth = ViewDepth(uv);
+
+  vec3 sum = vec3(0.0);
+  float total = 0.0;
+  for (int i = 0; i < 4; i++)
+  {
+    ivec2 corner = ivec2(i & 1, i >> 1);
+    ivec2 texel = clamp(base + corner, ivec2(0), size - 1);
+    vec2 bilinear = mix(1.0 - fraction, fraction, vec2(corner));
+    float sampleDepth = ViewDepth((vec2(texel) + 0.5) / vec2(size));
+    float difference = abs(sampleDepth - depth) / depth;
+    float weight = bilinear.x * bilinear.y /
+        (1.0 + difference / DEPTH_TOLERANCE);
+    sum += texelFetch(screenTexture, texel, 0).rgb * weight;
+    total += weight;
+  }
+  return sum / total;
+}
+#endif
 
-        FragColor = vec4(col, 1.0);
-    }
-    else {
-        // Default to normal
-        FragColor = vec4(color, 1.0);
-    }
+void main()
+{
+#if defined(FEATURE_UPSCALE)
+  vec3 color = UpscaleSharpen(TexCoords);
+#elif defined(FEATURE_BLUR)
+  vec3 color = BilateralUpsample(TexCoords);
+#elif defined(FEATURE_SHARPEN)
+  // -1 everywhere, 9 in the middle
+  vec3 color = 10.0 * texture(screenTexture, TexCoords).rgb -
+      BoxSum3x3(screenTexture, TexCoords);
+#elif defined(FEATURE_EDGES)
+  // 1 everywhere, -8 in the middle
+  vec3 color = BoxSum3x3(screenTexture, TexCoords) -
+      9.0 * texture(screenTexture, TexCoords).rgb;
+#else
+  vec3 color = texture(screenTexture, TexCoords).rgb;
+#endif
+
+#ifdef FEATURE_GRAYSCALE
+  color = vec3(dot(color, vec3(0.2126, 0.7152, 0.0722)));
+#endif
+#ifdef FEATURE_INVERT
+  color = 1.0 - color;
+#endif
+  FragColor = vec4(color, 1.0);
 }
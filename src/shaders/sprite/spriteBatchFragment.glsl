@@ -0,0 +1,24 @@
+#version 330 core
+in vec2 TexCoords;
+in vec4 Color;
+flat in vec2 Flags;
+out vec4 color;
+
+uniform sampler2D image;
+
+void main()
+{
+  if (Flags.y > 0.5) {
+    // Discard fragments outside circle (UV center is 0.5, 0.5)
+    vec2 center = TexCoords - vec2(0.5);
+    if (dot(center, center) > 0.25) { // 0.25 = 0.5^2
+      discard;
+    }
+  }
+
+  if (Flags.x > 0.5) {
+    color = Color * texture(image, TexCoords);
+  } else {
+    color = Color;
+  }
+}
@@ -0,0 +1,20 @@
+#version 330 core
+// Quads arrive already transformed to screen space by SpriteBatch
+layout(location = 0) in vec2 aPos;
+layout(location = 1) in vec2 aTexCoords;
+layout(location = 2) in vec4 aColor;
+layout(location = 3) in vec4 aFlags; // x = useTexture, y = isCircle
+
+out vec2 TexCoords;
+out vec4 Color;
+flat out vec2 Flags;
+
+uniform mat4 projection;
+
+void main()
+{
+  TexCoords = aTexCoords;
+  Color = aColor;
+  Flags = aFlags.xy;
+  gl_Position = projection * vec4(aPos, 0.0, 1.0);
+}
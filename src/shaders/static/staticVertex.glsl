@@ -11,10 +11,15 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+#include "../common/vertexDecode.glsl"
+
+// Must produce bit identical depth to depth/depthVertex.glsl for the pre-pass
+invariant gl_Position;
+
 void main()
 {
-  FragPos = vec3(model * vec4(aPos, 1.0));
-  Normal = mat3(transpose(inverse(model))) * aNormal;
+  FragPos = vec3(model * vec4(decodePosition(), 1.0));
+  Normal = mat3(transpose(inverse(model))) * decodeNormal();
   TexCoords = aTexCoord;
 
   gl_Position = projection * view * vec4(FragPos, 1.0);
@@ -12,13 +12,15 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform float outlineWidth;
 
+#include "../common/vertexDecode.glsl"
+
 void main()
 {
-  FragPos = vec3(model * vec4(aPos, 1.0));
+  FragPos = vec3(model * vec4(decodePosition(), 1.0));
 
   // vec3 outlinePos = aPos + normalize(aNormal) * outlineWidth;
   // FragPos = vec3(model * vec4(outlinePos, 1.0));
-  Normal = mat3(transpose(inverse(model))) * aNormal;
+  Normal = mat3(transpose(inverse(model))) * decodeNormal();
   TexCoords = aTexCoord;
   gl_Position = projection * view * vec4(FragPos, 1.0);
 }
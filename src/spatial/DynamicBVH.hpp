@@ -0,0 +1,551 @@
+#pragma once
+
+#include "../ecs/Entity.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+// Dynamic bounding volume hierarchy over entity bounds.
+// - Objects are stored as proxies with a "fat" box (tight box + margin) so
+//   small movements don't touch the tree at all
+// - Moving outside the fat box refits the leaf and its ancestors in place
+// - Refitting degrades tree quality over time, so rebuild() re-creates the
+//   whole tree with a binned SAH builder. The owner decides when via
+//   getQualityRatio()
+class DynamicBVH {
+public:
+  static constexpr int NULL_NODE = -1;
+
+  struct Stats {
+    size_t proxyCount;
+    size_t nodeCount;
+    int height;
+    float qualityRatio;
+  };
+
+  // ========== PROXIES ==========
+
+  // insertNow = false leaves the proxy out of the tree until the next
+  // rebuild(), which is much faster when adding many objects at once
+  int createProxy(const AABB &bounds, Entity entity, bool insertNow = true) {
+    int proxyId;
+    if (!freeProxies.empty()) {
+      proxyId = freeProxies.back();
+      freeProxies.pop_back();
+    } else {
+      proxyId = static_cast<int>(proxies.size());
+      proxies.emplace_back();
+    }
+
+    Proxy &proxy = proxies[proxyId];
+    proxy.fatBounds = bounds.fattened(margin);
+    proxy.entity = entity;
+    proxy.leaf = NULL_NODE;
+    proxy.alive = true;
+    proxyCount++;
+
+    if (insertNow) {
+      insertLeaf(proxyId);
+    } else {
+      pendingProxies++;
+    }
+    return proxyId;
+  }
+
+  void destroyProxy(int proxyId) {
+    Proxy &proxy = proxies[proxyId];
+    if (!proxy.alive)
+      return;
+
+    if (proxy.leaf != NULL_NODE) {
+      removeLeaf(proxy.leaf);
+      freeNode(proxy.leaf);
+    } else {
+      pendingProxies--;
+    }
+
+    proxy.alive = false;
+    proxy.leaf = NULL_NODE;
+    freeProxies.push_back(proxyId);
+    proxyCount--;
+  }
+
+  // Returns true if the tree had to be refit
+  bool moveProxy(int proxyId, const AABB &bounds) {
+    Proxy &proxy = proxies[proxyId];
+    if (proxy.fatBounds.contains(bounds))
+      return false;
+
+    proxy.fatBounds = bounds.fattened(margin);
+    if (proxy.leaf == NULL_NODE)
+      return false;
+
+    nodes[proxy.leaf].bounds = proxy.fatBounds;
+    refitAncestors(nodes[proxy.leaf].parent);
+    return true;
+  }
+
+  const AABB &getFatBounds(int proxyId) const {
+    return proxies[proxyId].fatBounds;
+  }
+
+  Entity getEntity(int proxyId) const { return proxies[proxyId].entity; }
+
+  bool hasPendingProxies() const { return pendingProxies > 0; }
+
+  size_t getProxyCount() const { return proxyCount; }
+
+  // Puts the proxies created with insertNow = false into the tree one by
+  // one, cheaper than rebuild() when they are few compared to the tree
+  void insertPending() {
+    if (pendingProxies == 0)
+      return;
+    for (int i = 0; i < static_cast<int>(proxies.size()); i++) {
+      if (proxies[i].alive && proxies[i].leaf == NULL_NODE)
+        insertLeaf(i);
+    }
+    pendingProxies = 0;
+  }
+
+  void setMargin(float m) { margin = m; }
+
+  // ========== BUILD ==========
+
+  // Top down binned SAH build over every live proxy
+  void rebuild() {
+    nodes.clear();
+    freeNodes.clear();
+    root = NULL_NODE;
+
+    buildRefs.clear();
+    buildRefs.reserve(proxyCount);
+    for (int i = 0; i < static_cast<int>(proxies.size()); i++) {
+      if (!proxies[i].alive)
+        continue;
+      buildRefs.push_back({i, proxies[i].fatBounds.center()});
+    }
+    pendingProxies = 0;
+
+    if (!buildRefs.empty()) {
+      nodes.reserve(buildRefs.size() * 2);
+      root = buildRecursive(0, static_cast<int>(buildRefs.size()), NULL_NODE);
+    }
+
+    builtCost = computeCost();
+  }
+
+  // Current SAH cost relative to the last rebuild, > 1 means refits have
+  // loosened the tree
+  float getQualityRatio() const {
+    if (builtCost <= 0.0f)
+      return 1.0f;
+    return computeCost() / builtCost;
+  }
+
+  Stats getStats() const {
+    return {proxyCount, nodes.size() - freeNodes.size(), getHeight(),
+            getQualityRatio()};
+  }
+
+  // ========== QUERIES ==========
+  // Callbacks receive (Entity, proxyId). Query callbacks return false to stop
+  // the traversal early.
+
+  template <typename Func>
+  void queryFrustum(const Frustum &frustum, Func &&callback) const {
+    traverse([&](const AABB &box) { return frustum.intersects(box); },
+             callback);
+  }
+
+  template <typename Func>
+  void queryAABB(const AABB &box, Func &&callback) const {
+    traverse([&](const AABB &nodeBox) { return nodeBox.overlaps(box); },
+             callback);
+  }
+
+  template <typename Func>
+  void querySphere(const Sphere &sphere, Func &&callback) const {
+    traverse([&](const AABB &nodeBox) { return sphere.overlaps(nodeBox); },
+             callback);
+  }
+
+  // Callback receives (Entity, proxyId, entryDistance) and returns the new
+  // max distance: return the hit distance for closest-hit, 0 to stop, or
+  // maxDistance to keep collecting every hit
+  template <typename Func>
+  void raycast(const Ray &ray, float maxDistance, Func &&callback) const {
+    if (root == NULL_NODE)
+      return;
+
+    glm::vec3 invDir = 1.0f / ray.direction;
+    NodeStack stack;
+    stack.push(root);
+
+    while (!stack.empty()) {
+      int nodeId = stack.pop();
+      const Node &node = nodes[nodeId];
+
+      float tEnter;
+      if (!Ray::intersects(ray.origin, invDir, node.bounds, maxDistance,
+                           tEnter))
+        continue;
+
+      if (node.isLeaf()) {
+        const Proxy &proxy = proxies[node.proxy];
+        maxDistance = callback(proxy.entity, node.proxy, tEnter);
+        if (maxDistance <= 0.0f)
+          return;
+      } else {
+        stack.push(node.children[0]);
+        stack.push(node.children[1]);
+      }
+    }
+  }
+
+private:
+  struct Node {
+    AABB bounds;
+    int parent = NULL_NODE;
+    int children[2] = {NULL_NODE, NULL_NODE};
+    int proxy = NULL_NODE;
+    int next = NULL_NODE; // Free list link
+
+    bool isLeaf() const { return children[0] == NULL_NODE; }
+  };
+
+  struct Proxy {
+    AABB fatBounds;
+    Entity entity = NULL_ENTITY;
+    int leaf = NULL_NODE;
+    bool alive = false;
+  };
+
+  struct BuildRef {
+    int proxy;
+    glm::vec3 centroid;
+  };
+
+  // Traversal stack that lives on the stack for normal tree depths and only
+  // falls back to the heap for degenerate trees
+  class NodeStack {
+  public:
+    void push(int node) {
+      if (count < fixed.size()) {
+        fixed[count++] = node;
+      } else {
+        overflow.push_back(node);
+      }
+    }
+    int pop() {
+      if (!overflow.empty()) {
+        int node = overflow.back();
+        overflow.pop_back();
+        return node;
+      }
+      return fixed[--count];
+    }
+    bool empty() const { return count == 0 && overflow.empty(); }
+
+  private:
+    std::array<int, 128> fixed;
+    size_t count = 0;
+    std::vector<int> overflow;
+  };
+
+  static constexpr int SAH_BINS = 12;
+  static constexpr float TRAVERSAL_COST = 1.0f;
+
+  std::vector<Node> nodes;
+  std::vector<int> freeNodes;
+  std::vector<Proxy> proxies;
+  std::vector<int> freeProxies;
+  std::vector<BuildRef> buildRefs;
+  int root = NULL_NODE;
+  size_t proxyCount = 0;
+  size_t pendingProxies = 0;
+  float margin = 0.1f;
+  float builtCost = 0.0f;
+
+  template <typename Test, typename Func>
+  void traverse(Test &&test, Func &&callback) const {
+    if (root == NULL_NODE)
+      return;
+
+    NodeStack stack;
+    stack.push(root);
+    while (!stack.empty()) {
+      const Node &node = nodes[stack.pop()];
+      if (!test(node.bounds))
+        continue;
+
+      if (node.isLeaf()) {
+        if (!callback(proxies[node.proxy].entity, node.proxy))
+          return;
+      } else {
+        stack.push(node.children[0]);
+        stack.push(node.children[1]);
+      }
+    }
+  }
+
+  // ========== NODE POOL ==========
+
+  int allocateNode() {
+    if (!freeNodes.empty()) {
+      int id = freeNodes.back();
+      freeNodes.pop_back();
+      nodes[id] = Node{};
+      return id;
+    }
+    nodes.emplace_back();
+    return static_cast<int>(nodes.size()) - 1;
+  }
+
+  void freeNode(int nodeId) { freeNodes.push_back(nodeId); }
+
+  // ========== INCREMENTAL INSERT / REMOVE ==========
+
+  void insertLeaf(int proxyId) {
+    int leaf = allocateNode();
+    nodes[leaf].bounds = proxies[proxyId].fatBounds;
+    nodes[leaf].proxy = proxyId;
+    proxies[proxyId].leaf = leaf;
+
+    if (root == NULL_NODE) {
+      root = leaf;
+      return;
+    }
+
+    // Walk down picking the child with the lowest insertion cost. A copy,
+    // allocating the new parent below may move the nodes
+    AABB leafBounds = nodes[leaf].bounds;
+    int index = root;
+    while (!nodes[index].isLeaf()) {
+      const Node &node = nodes[index];
+      float area = node.bounds.surfaceArea();
+      float combinedArea = AABB::merge(node.bounds, leafBounds).surfaceArea();
+
+      // Cost of making a new parent for this node and the leaf
+      float cost = 2.0f * combinedArea;
+      // Minimum cost of pushing the leaf further down
+      float inheritanceCost = 2.0f * (combinedArea - area);
+
+      float childCost[2];
+      for (int c = 0; c < 2; c++) {
+        const Node &child = nodes[node.children[c]];
+        AABB merged = AABB::merge(leafBounds, child.bounds);
+        childCost[c] = merged.surfaceArea() + inheritanceCost;
+        if (!child.isLeaf()) {
+          childCost[c] -= child.bounds.surfaceArea();
+        }
+      }
+
+      if (cost < childCost[0] && cost < childCost[1])
+        break;
+
+      index = childCost[0] < childCost[1] ? node.children[0]
+                                          : node.children[1];
+    }
+
+    int sibling = index;
+    int oldParent = nodes[sibling].parent;
+    int newParent = allocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].bounds = AABB::merge(leafBounds, nodes[sibling].bounds);
+    nodes[newParent].children[0] = sibling;
+    nodes[newParent].children[1] = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent == NULL_NODE) {
+      root = newParent;
+    } else {
+      Node &parent = nodes[oldParent];
+      parent.children[parent.children[0] == sibling ? 0 : 1] = newParent;
+    }
+
+    refitAncestors(oldParent);
+  }
+
+  void removeLeaf(int leaf) {
+    if (leaf == root) {
+      root = NULL_NODE;
+      return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = nodes[parent].children[0] == leaf ? nodes[parent].children[1]
+                                                    : nodes[parent].children[0];
+
+    if (grandParent == NULL_NODE) {
+      root = sibling;
+      nodes[sibling].parent = NULL_NODE;
+    } else {
+      Node &gp = nodes[grandParent];
+      gp.children[gp.children[0] == parent ? 0 : 1] = sibling;
+      nodes[sibling].parent = grandParent;
+      refitAncestors(grandParent);
+    }
+    freeNode(parent);
+  }
+
+  void refitAncestors(int index) {
+    while (index != NULL_NODE) {
+      Node &node = nodes[index];
+      node.bounds = AABB::merge(nodes[node.children[0]].bounds,
+                                nodes[node.children[1]].bounds);
+      index = node.parent;
+    }
+  }
+
+  // ========== BINNED SAH BUILD ==========
+
+  int buildRecursive(int begin, int end, int parent) {
+    int nodeId = allocateNode();
+    nodes[nodeId].parent = parent;
+
+    if (end - begin == 1) {
+      int proxyId = buildRefs[begin].proxy;
+      nodes[nodeId].bounds = proxies[proxyId].fatBounds;
+      nodes[nodeId].proxy = proxyId;
+      proxies[proxyId].leaf = nodeId;
+      return nodeId;
+    }
+
+    AABB bounds;
+    AABB centroidBounds;
+    for (int i = begin; i < end; i++) {
+      bounds.expand(proxies[buildRefs[i].proxy].fatBounds);
+      centroidBounds.expand(buildRefs[i].centroid);
+    }
+    nodes[nodeId].bounds = bounds;
+
+    int mid = findSahSplit(begin, end, centroidBounds);
+
+    // nodes may reallocate during recursion so don't hold references
+    int left = buildRecursive(begin, mid, nodeId);
+    int right = buildRecursive(mid, end, nodeId);
+    nodes[nodeId].children[0] = left;
+    nodes[nodeId].children[1] = right;
+    return nodeId;
+  }
+
+  // Partitions buildRefs[begin, end) and returns the split point
+  int findSahSplit(int begin, int end, const AABB &centroidBounds) {
+    glm::vec3 extent = centroidBounds.size();
+    int axis = 0;
+    if (extent.y > extent[axis])
+      axis = 1;
+    if (extent.z > extent[axis])
+      axis = 2;
+
+    int midpoint = begin + (end - begin) / 2;
+    // All centroids coincide, any split is as good as another
+    if (extent[axis] <= 0.0f) {
+      return midpoint;
+    }
+
+    struct Bin {
+      AABB bounds;
+      int count = 0;
+    };
+    std::array<Bin, SAH_BINS> bins{};
+
+    float axisMin = centroidBounds.min[axis];
+    float scale = SAH_BINS / extent[axis];
+    auto binIndex = [&](const BuildRef &ref) {
+      int b = static_cast<int>((ref.centroid[axis] - axisMin) * scale);
+      return std::min(b, SAH_BINS - 1);
+    };
+
+    for (int i = begin; i < end; i++) {
+      Bin &bin = bins[binIndex(buildRefs[i])];
+      bin.count++;
+      bin.bounds.expand(proxies[buildRefs[i].proxy].fatBounds);
+    }
+
+    // Sweep from the right to get suffix areas, then from the left to
+    // evaluate each of the SAH_BINS - 1 candidate planes
+    std::array<float, SAH_BINS> rightArea{};
+    std::array<int, SAH_BINS> rightCount{};
+    AABB accum;
+    int count = 0;
+    for (int b = SAH_BINS - 1; b > 0; b--) {
+      accum.expand(bins[b].bounds);
+      count += bins[b].count;
+      rightArea[b] = count > 0 ? accum.surfaceArea() : 0.0f;
+      rightCount[b] = count;
+    }
+
+    float bestCost = FLT_MAX;
+    int bestSplit = -1;
+    accum = AABB();
+    count = 0;
+    for (int b = 0; b < SAH_BINS - 1; b++) {
+      accum.expand(bins[b].bounds);
+      count += bins[b].count;
+      if (count == 0 || rightCount[b + 1] == 0)
+        continue;
+      float cost = TRAVERSAL_COST + accum.surfaceArea() * count +
+                   rightArea[b + 1] * rightCount[b + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    if (bestSplit < 0) {
+      return midpoint;
+    }
+
+    auto it = std::partition(
+        buildRefs.begin() + begin, buildRefs.begin() + end,
+        [&](const BuildRef &ref) { return binIndex(ref) <= bestSplit; });
+    int mid = static_cast<int>(it - buildRefs.begin());
+    if (mid == begin || mid == end) {
+      return midpoint;
+    }
+    return mid;
+  }
+
+  // Sum of internal node areas, proportional to the expected traversal cost
+  float computeCost() const {
+    if (root == NULL_NODE)
+      return 0.0f;
+
+    float cost = 0.0f;
+    NodeStack stack;
+    stack.push(root);
+    while (!stack.empty()) {
+      const Node &node = nodes[stack.pop()];
+      if (node.isLeaf())
+        continue;
+      cost += node.bounds.surfaceArea();
+      stack.push(node.children[0]);
+      stack.push(node.children[1]);
+    }
+    return cost;
+  }
+
+  int getHeight() const {
+    if (root == NULL_NODE)
+      return 0;
+
+    int height = 0;
+    std::vector<std::pair<int, int>> stack = {{root, 1}};
+    while (!stack.empty()) {
+      auto [nodeId, depth] = stack.back();
+      stack.pop_back();
+      height = std::max(height, depth);
+      const Node &node = nodes[nodeId];
+      if (!node.isLeaf()) {
+        stack.push_back({node.children[0], depth + 1});
+        stack.push_back({node.children[1], depth + 1});
+      }
+    }
+    return height;
+  }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <glm/glm.hpp>
+
+// Axis aligned bounding box. A default constructed box is empty (min > max)
+// so it can be grown with expand()
+struct AABB {
+  glm::vec3 min = glm::vec3(FLT_MAX);
+  glm::vec3 max = glm::vec3(-FLT_MAX);
+
+  AABB() = default;
+  AABB(const glm::vec3 &minPoint, const glm::vec3 &maxPoint)
+      : min(minPoint), max(maxPoint) {}
+
+  bool isValid() const {
+    return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+  }
+
+  void expand(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void expand(const AABB &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  glm::vec3 size() const { return max - min; }
+  glm::vec3 halfExtents() const { return (max - min) * 0.5f; }
+
+  // Used as the cost metric for the BVH (SAH)
+  float surfaceArea() const {
+    glm::vec3 d = max - min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  bool contains(const AABB &other) const {
+    return glm::all(glm::lessThanEqual(min, other.min)) &&
+           glm::all(glm::greaterThanEqual(max, other.max));
+  }
+
+  bool overlaps(const AABB &other) const {
+    return min.x <= other.max.x && max.x >= other.min.x &&
+           min.y <= other.max.y && max.y >= other.min.y &&
+           min.z <= other.max.z && max.z >= other.min.z;
+  }
+
+  AABB fattened(float margin) const {
+    return AABB(min - glm::vec3(margin), max + glm::vec3(margin));
+  }
+
+  // World space box of this box under an affine transform (Arvo's method),
+  // avoids transforming all 8 corners
+  AABB transformed(const glm::mat4 &m) const {
+    glm::vec3 newMin(m[3]);
+    glm::vec3 newMax(m[3]);
+    for (int col = 0; col < 3; col++) {
+      for (int row = 0; row < 3; row++) {
+        float a = m[col][row] * min[col];
+        float b = m[col][row] * max[col];
+        newMin[row] += std::min(a, b);
+        newMax[row] += std::max(a, b);
+      }
+    }
+    return AABB(newMin, newMax);
+  }
+
+  static AABB merge(const AABB &a, const AABB &b) {
+    return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+  }
+};
+
+struct Sphere {
+  glm::vec3 center = glm::vec3(0.0f);
+  float radius = 0.0f;
+
+  bool overlaps(const AABB &box) const {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 d = closest - center;
+    return glm::dot(d, d) <= radius * radius;
+  }
+};
+
+struct Ray {
+  glm::vec3 origin = glm::vec3(0.0f);
+  glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f); // Normalised
+
+  Ray() = default;
+  Ray(const glm::vec3 &o, const glm::vec3 &d) : origin(o), direction(d) {}
+
+  glm::vec3 at(float t) const { return origin + direction * t; }
+
+  // Slab test, invDir is passed in so it is only computed once per traversal.
+  // Returns the entry distance in tEnter (0 if the origin is inside the box)
+  static bool intersects(const glm::vec3 &origin, const glm::vec3 &invDir,
+                         const AABB &box, float maxDistance, float &tEnter) {
+    glm::vec3 t0 = (box.min - origin) * invDir;
+    glm::vec3 t1 = (box.max - origin) * invDir;
+    glm::vec3 tSmall = glm::min(t0, t1);
+    glm::vec3 tBig = glm::max(t0, t1);
+
+    float tMin =
+        std::max(std::max(tSmall.x, tSmall.y), std::max(tSmall.z, 0.0f));
+    float tMax =
+        std::min(std::min(tBig.x, tBig.y), std::min(tBig.z, maxDistance));
+
+    tEnter = tMin;
+    return tMin <= tMax;
+  }
+};
+
+// View frustum as 6 inward facing planes (xyz = normal, w = distance)
+struct Frustum {
+  enum Plane {
+    PLANE_LEFT,
+    PLANE_RIGHT,
+    PLANE_BOTTOM,
+    PLANE_TOP,
+    PLANE_NEAR,
+    PLANE_FAR
+  };
+  glm::vec4 planes[6];
+
+  // Gribb/Hartmann plane extraction from a projection * view matrix
+  static Frustum fromMatrix(const glm::mat4 &viewProjection) {
+    Frustum f;
+    const glm::mat4 &m = viewProjection;
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    f.planes[PLANE_LEFT] = row3 + row0;
+    f.planes[PLANE_RIGHT] = row3 - row0;
+    f.planes[PLANE_BOTTOM] = row3 + row1;
+    f.planes[PLANE_TOP] = row3 - row1;
+    f.planes[PLANE_NEAR] = row3 + row2;
+    f.planes[PLANE_FAR] = row3 - row2;
+
+    for (glm::vec4 &plane : f.planes) {
+      plane /= glm::length(glm::vec3(plane));
+    }
+    return f;
+  }
+
+  // Conservative test: may report boxes near frustum corners as visible
+  bool intersects(const AABB &box) const {
+    for (const glm::vec4 &plane : planes) {
+      // Corner furthest along the plane normal
+      glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                         plane.y >= 0.0f ? box.max.y : box.min.y,
+                         plane.z >= 0.0f ? box.max.z : box.min.z);
+      if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool intersects(const Sphere &sphere) const {
+    for (const glm::vec4 &plane : planes) {
+      if (glm::dot(glm::vec3(plane), sphere.center) + plane.w <
+          -sphere.radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
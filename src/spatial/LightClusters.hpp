@@ -0,0 +1,215 @@
+#pragma once
+
+#include "../utils/ThreadPool.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// CPU half of clustered forward shading. The view frustum is split into
+// GRID_X * GRID_Y screen tiles and GRID_Z depth slices (exponential for
+// perspective, linear for orthographic projections). assign() bins view space
+// light spheres into the clusters they touch, one ThreadPool item per depth
+// slice, and produces a compact (offset, count) range per cluster into one
+// shared index list. Nothing here touches GL so it can run headless.
+class LightClusters {
+public:
+  static const int GRID_X = 16;
+  static const int GRID_Y = 9;
+  static const int GRID_Z = 24;
+  static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+  // Keeps the worst case fragment cost bounded, extra lights are dropped
+  static const uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+
+  struct Stats {
+    uint32_t lights = 0;
+    uint32_t indices = 0;
+    uint32_t maxPerCluster = 0;
+    uint32_t overflowed = 0; // Clusters that hit MAX_LIGHTS_PER_CLUSTER
+  };
+
+  // Rebuilds the cluster bounds, cheap to call every frame since nothing is
+  // recomputed unless the projection changed
+  void setProjection(const glm::mat4 &projection, float nearPlane,
+                     float farPlane, bool orthographic) {
+    if (projection == currentProjection && nearPlane == currentNear &&
+        farPlane == currentFar && !bounds.empty())
+      return;
+    currentProjection = projection;
+    currentNear = nearPlane;
+    currentFar = farPlane;
+    logDepth = !orthographic && nearPlane > 0.0f;
+
+    if (logDepth) {
+      float logRatio = std::log(farPlane / nearPlane);
+      depthScale = GRID_Z / logRatio;
+      depthBias = -GRID_Z * std::log(nearPlane) / logRatio;
+    } else {
+      depthScale = GRID_Z / (farPlane - nearPlane);
+      depthBias = -nearPlane * depthScale;
+    }
+
+    for (int z = 0; z <= GRID_Z; z++) {
+      sliceDepths[z] = sliceStart(z);
+    }
+
+    // Each tile corner is a line through the frustum, unproject its near and
+    // far points once and interpolate along it for every slice depth
+    glm::mat4 invProjection = glm::inverse(projection);
+    std::vector<glm::vec3> nearCorners((GRID_X + 1) * (GRID_Y + 1));
+    std::vector<glm::vec3> farCorners(nearCorners.size());
+    for (int y = 0; y <= GRID_Y; y++) {
+      for (int x = 0; x <= GRID_X; x++) {
+        float ndcX = -1.0f + 2.0f * x / GRID_X;
+        float ndcY = -1.0f + 2.0f * y / GRID_Y;
+        glm::vec4 n = invProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+        glm::vec4 f = invProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+        nearCorners[y * (GRID_X + 1) + x] = glm::vec3(n) / n.w;
+        farCorners[y * (GRID_X + 1) + x] = glm::vec3(f) / f.w;
+      }
+    }
+
+    bounds.assign(CLUSTER_COUNT, AABB());
+    for (int z = 0; z < GRID_Z; z++) {
+      for (int y = 0; y < GRID_Y; y++) {
+        for (int x = 0; x < GRID_X; x++) {
+          AABB &box = bounds[clusterIndex(x, y, z)];
+          for (int corner = 0; corner < 4; corner++) {
+            int cx = x + (corner & 1);
+            int cy = y + (corner >> 1);
+            const glm::vec3 &n = nearCorners[cy * (GRID_X + 1) + cx];
+            const glm::vec3 &f = farCorners[cy * (GRID_X + 1) + cx];
+            box.expand(pointAtDepth(n, f, sliceDepths[z]));
+            box.expand(pointAtDepth(n, f, sliceDepths[z + 1]));
+          }
+        }
+      }
+    }
+  }
+
+  // Lights are spheres in view space (camera looks down -Z). Indices in the
+  // output refer to positions in this vector
+  void assign(const std::vector<Sphere> &lights) {
+    stats = Stats{};
+    stats.lights = static_cast<uint32_t>(lights.size());
+    const int clustersPerSlice = GRID_X * GRID_Y;
+
+    ThreadPool::instance().parallelFor(GRID_Z, [&](size_t slice) {
+      std::vector<uint16_t> &indices = sliceIndices[slice];
+      std::vector<uint32_t> &counts = sliceCounts[slice];
+      indices.clear();
+      counts.assign(clustersPerSlice, 0);
+
+      float sliceNear = sliceDepths[slice];
+      float sliceFar = sliceDepths[slice + 1];
+      sliceLights[slice].clear();
+      for (size_t i = 0; i < lights.size(); i++) {
+        float depth = -lights[i].center.z;
+        if (depth + lights[i].radius >= sliceNear &&
+            depth - lights[i].radius <= sliceFar) {
+          sliceLights[slice].push_back(static_cast<uint16_t>(i));
+        }
+      }
+
+      // Cluster major so each cluster's lights end up contiguous
+      int base = static_cast<int>(slice) * clustersPerSlice;
+      for (int cluster = 0; cluster < clustersPerSlice; cluster++) {
+        const AABB &box = bounds[base + cluster];
+        uint32_t count = 0;
+        for (uint16_t light : sliceLights[slice]) {
+          if (!lights[light].overlaps(box))
+            continue;
+          if (count == MAX_LIGHTS_PER_CLUSTER) {
+            sliceOverflow[slice]++;
+            break;
+          }
+          indices.push_back(light);
+          count++;
+        }
+        counts[cluster] = count;
+      }
+    });
+
+    // Stitch the per slice lists together
+    ranges.resize(CLUSTER_COUNT * 2);
+    lightIndices.clear();
+    for (int slice = 0; slice < GRID_Z; slice++) {
+      uint32_t offset = static_cast<uint32_t>(lightIndices.size());
+      lightIndices.insert(lightIndices.end(), sliceIndices[slice].begin(),
+                          sliceIndices[slice].end());
+      int base = slice * clustersPerSlice;
+      for (int cluster = 0; cluster < clustersPerSlice; cluster++) {
+        uint32_t count = sliceCounts[slice][cluster];
+        ranges[(base + cluster) * 2] = offset;
+        ranges[(base + cluster) * 2 + 1] = count;
+        offset += count;
+        stats.maxPerCluster = std::max(stats.maxPerCluster, count);
+      }
+      stats.overflowed += sliceOverflow[slice];
+      sliceOverflow[slice] = 0;
+    }
+    stats.indices = static_cast<uint32_t>(lightIndices.size());
+  }
+
+  // Slice for a positive view depth, matches the fragment shader
+  int sliceForDepth(float depth) const {
+    float slice = logDepth ? std::log(std::max(depth, 1e-4f)) * depthScale +
+                                 depthBias
+                           : depth * depthScale + depthBias;
+    return std::clamp(static_cast<int>(std::floor(slice)), 0, GRID_Z - 1);
+  }
+
+  static int clusterIndex(int x, int y, int z) {
+    return x + GRID_X * (y + GRID_Y * z);
+  }
+
+  // Two uint32 per cluster: offset into getLightIndices() and count
+  const std::vector<uint32_t> &getRanges() const { return ranges; }
+  const std::vector<uint16_t> &getLightIndices() const { return lightIndices; }
+  const AABB &getClusterBounds(int index) const { return bounds[index]; }
+
+  bool usesLogDepth() const { return logDepth; }
+  float getDepthScale() const { return depthScale; }
+  float getDepthBias() const { return depthBias; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  glm::mat4 currentProjection = glm::mat4(0.0f);
+  float currentNear = 0.0f;
+  float currentFar = 0.0f;
+  bool logDepth = true;
+  float depthScale = 1.0f;
+  float depthBias = 0.0f;
+  float sliceDepths[GRID_Z + 1] = {};
+
+  std::vector<AABB> bounds;
+  std::vector<uint32_t> ranges;
+  std::vector<uint16_t> lightIndices;
+
+  // Per slice scratch, written by one ThreadPool item each
+  std::vector<uint16_t> sliceLights[GRID_Z];
+  std::vector<uint16_t> sliceIndices[GRID_Z];
+  std::vector<uint32_t> sliceCounts[GRID_Z];
+  uint32_t sliceOverflow[GRID_Z] = {};
+
+  Stats stats;
+
+  float sliceStart(int slice) const {
+    float t = static_cast<float>(slice) / GRID_Z;
+    if (logDepth)
+      return currentNear * std::pow(currentFar / currentNear, t);
+    return currentNear + (currentFar - currentNear) * t;
+  }
+
+  // Point on the near->far line at a positive view depth
+  static glm::vec3 pointAtDepth(const glm::vec3 &nearPoint,
+                                const glm::vec3 &farPoint, float depth) {
+    float nearDepth = -nearPoint.z;
+    float farDepth = -farPoint.z;
+    float t = (depth - nearDepth) / (farDepth - nearDepth);
+    return glm::mix(nearPoint, farPoint, t);
+  }
+};
@@ -0,0 +1,347 @@
+#pragma once
+
+#include "../utils/ThreadPool.hpp"
+#include "Geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Low resolution software depth buffer for occlusion culling. It has no GL
+// dependency: occluder triangles are rasterised on the CPU (4 pixels at a time
+// with SSE2, split into horizontal strips across the ThreadPool), then a
+// max-depth hierarchical Z pyramid is built for conservative box tests.
+// Depth is NDC z remapped to [0, 1], cleared to 1 (far plane).
+class OcclusionBuffer {
+public:
+  struct Stats {
+    size_t trianglesSubmitted = 0;
+    size_t trianglesRasterized = 0;
+  };
+
+  OcclusionBuffer(int width = 256, int height = 144) { resize(width, height); }
+
+  // Width is rounded up to a multiple of 4 for the SIMD path
+  void resize(int newWidth, int newHeight) {
+    width = std::max(4, (newWidth + 3) & ~3);
+    height = std::max(1, newHeight);
+
+    levels.clear();
+    int w = width;
+    int h = height;
+    while (true) {
+      levels.push_back({w, h, std::vector<float>(w * h, 1.0f)});
+      if (w == 1 && h == 1)
+        break;
+      w = std::max(1, (w + 1) / 2);
+      h = std::max(1, (h + 1) / 2);
+    }
+  }
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  const float *getDepth() const { return levels[0].depth.data(); }
+  const Stats &getStats() const { return stats; }
+
+  void clear() {
+    std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+    triangles.clear();
+    stats = Stats{};
+  }
+
+  // ========== OCCLUDERS ==========
+
+  // Queues the 12 triangles of a box, mvp takes the box to clip space
+  void addOccluderBox(const AABB &box, const glm::mat4 &mvp) {
+    glm::vec4 corners[8];
+    for (int i = 0; i < 8; i++) {
+      glm::vec3 corner((i & 1) ? box.max.x : box.min.x,
+                       (i & 2) ? box.max.y : box.min.y,
+                       (i & 4) ? box.max.z : box.min.z);
+      corners[i] = mvp * glm::vec4(corner, 1.0f);
+    }
+
+    static const int faces[12][3] = {
+        {0, 1, 3}, {0, 3, 2}, {4, 6, 7}, {4, 7, 5}, // -z, +z
+        {0, 4, 5}, {0, 5, 1}, {2, 3, 7}, {2, 7, 6}, // -y, +y
+        {0, 2, 6}, {0, 6, 4}, {1, 5, 7}, {1, 7, 3}, // -x, +x
+    };
+    for (const auto &face : faces) {
+      addOccluderTriangle(corners[face[0]], corners[face[1]],
+                          corners[face[2]]);
+    }
+  }
+
+  // Clip space triangle, clipped against the near plane here. Both windings
+  // are rasterised
+  void addOccluderTriangle(const glm::vec4 &a, const glm::vec4 &b,
+                           const glm::vec4 &c) {
+    stats.trianglesSubmitted++;
+
+    // Sutherland-Hodgman against z >= -w, result has at most 4 vertices
+    glm::vec4 in[3] = {a, b, c};
+    glm::vec4 out[4];
+    int outCount = 0;
+    for (int i = 0; i < 3; i++) {
+      const glm::vec4 &p = in[i];
+      const glm::vec4 &q = in[(i + 1) % 3];
+      float dp = p.z + p.w;
+      float dq = q.z + q.w;
+      if (dp >= 0.0f)
+        out[outCount++] = p;
+      if ((dp >= 0.0f) != (dq >= 0.0f)) {
+        float t = dp / (dp - dq);
+        out[outCount++] = p + (q - p) * t;
+      }
+    }
+    if (outCount < 3)
+      return;
+
+    glm::vec3 screen[4];
+    for (int i = 0; i < outCount; i++) {
+      screen[i] = toScreen(out[i]);
+    }
+    setupTriangle(screen[0], screen[1], screen[2]);
+    if (outCount == 4) {
+      setupTriangle(screen[0], screen[2], screen[3]);
+    }
+  }
+
+  // Rasterises every queued triangle then rebuilds the HiZ pyramid
+  void rasterize(int stripCount = 8) {
+    stripCount = std::max(1, std::min(stripCount, height));
+    int stripHeight = (height + stripCount - 1) / stripCount;
+
+    ThreadPool::instance().parallelFor(stripCount, [&](size_t strip) {
+      int y0 = static_cast<int>(strip) * stripHeight;
+      int y1 = std::min(height - 1, y0 + stripHeight - 1);
+      for (const Triangle &tri : triangles) {
+        rasterizeTriangle(tri, y0, y1);
+      }
+    });
+
+    stats.trianglesRasterized = triangles.size();
+    buildHiZ();
+  }
+
+  // ========== OCCLUDEES ==========
+
+  // Conservative: returns true unless the box is certainly hidden behind
+  // the rasterised occluders
+  bool isVisible(const AABB &box, const glm::mat4 &viewProjection) const {
+    glm::vec2 minScreen(FLT_MAX);
+    glm::vec2 maxScreen(-FLT_MAX);
+    float nearestDepth = FLT_MAX;
+
+    for (int i = 0; i < 8; i++) {
+      glm::vec3 corner((i & 1) ? box.max.x : box.min.x,
+                       (i & 2) ? box.max.y : box.min.y,
+                       (i & 4) ? box.max.z : box.min.z);
+      glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+      // Crosses the near plane, can't be projected reliably
+      if (clip.z < -clip.w || clip.w <= 1e-5f)
+        return true;
+
+      glm::vec3 s = toScreen(clip);
+      minScreen = glm::min(minScreen, glm::vec2(s));
+      maxScreen = glm::max(maxScreen, glm::vec2(s));
+      nearestDepth = std::min(nearestDepth, s.z);
+    }
+
+    // Occluders cover a texel when they cover its centre, so they can reach
+    // up to half a texel less far than the buffer says. One texel of margin
+    // on each side keeps boxes peeking out past a silhouette visible
+    int x0 = std::max(0, static_cast<int>(std::floor(minScreen.x)) - 1);
+    int y0 = std::max(0, static_cast<int>(std::floor(minScreen.y)) - 1);
+    int x1 =
+        std::min(width - 1, static_cast<int>(std::floor(maxScreen.x)) + 1);
+    int y1 =
+        std::min(height - 1, static_cast<int>(std::floor(maxScreen.y)) + 1);
+    // Off screen, leave that decision to frustum culling
+    if (x0 > x1 || y0 > y1)
+      return true;
+
+    // Coarsest useful level: the rect covers at most 4x4 texels
+    size_t level = 0;
+    while (level + 1 < levels.size() &&
+           ((x1 >> level) - (x0 >> level) >= 4 ||
+            (y1 >> level) - (y0 >> level) >= 4)) {
+      level++;
+    }
+
+    const Level &l = levels[level];
+    for (int y = y0 >> level; y <= (y1 >> level); y++) {
+      for (int x = x0 >> level; x <= (x1 >> level); x++) {
+        if (nearestDepth <= l.depth[y * l.width + x])
+          return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Level {
+    int width;
+    int height;
+    std::vector<float> depth;
+  };
+
+  // Edge functions and depth plane in pixel space
+  struct Triangle {
+    float edgeA[3], edgeB[3], edgeC[3];
+    float depthA, depthB, depthC;
+    int minX, maxX, minY, maxY;
+  };
+
+  int width = 0;
+  int height = 0;
+  std::vector<Level> levels;
+  std::vector<Triangle> triangles;
+  Stats stats;
+
+  glm::vec3 toScreen(const glm::vec4 &clip) const {
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * width,
+                     (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+  }
+
+  void setupTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+    if (std::abs(area) < 1e-6f)
+      return;
+    if (area < 0.0f) {
+      std::swap(v1, v2);
+      area = -area;
+    }
+
+    Triangle tri;
+    tri.minX = std::max(0, static_cast<int>(std::floor(
+                               std::min({v0.x, v1.x, v2.x}))));
+    tri.maxX = std::min(width - 1, static_cast<int>(std::ceil(
+                                       std::max({v0.x, v1.x, v2.x}))));
+    tri.minY = std::max(0, static_cast<int>(std::floor(
+                               std::min({v0.y, v1.y, v2.y}))));
+    tri.maxY = std::min(height - 1, static_cast<int>(std::ceil(
+                                        std::max({v0.y, v1.y, v2.y}))));
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+      return;
+
+    // Edge i is opposite vertex i, positive inside
+    const glm::vec3 *v[3] = {&v0, &v1, &v2};
+    for (int i = 0; i < 3; i++) {
+      const glm::vec3 &p = *v[(i + 1) % 3];
+      const glm::vec3 &q = *v[(i + 2) % 3];
+      tri.edgeA[i] = p.y - q.y;
+      tri.edgeB[i] = q.x - p.x;
+      tri.edgeC[i] = p.x * q.y - p.y * q.x;
+    }
+
+    // z(x, y) = sum(edge_i(x, y) * z_i) / area, folded into one plane
+    float invArea = 1.0f / area;
+    tri.depthA = tri.depthB = tri.depthC = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      float z = v[i]->z * invArea;
+      tri.depthA += tri.edgeA[i] * z;
+      tri.depthB += tri.edgeB[i] * z;
+      tri.depthC += tri.edgeC[i] * z;
+    }
+
+    triangles.push_back(tri);
+  }
+
+  void rasterizeTriangle(const Triangle &tri, int stripY0, int stripY1) {
+    int y0 = std::max(tri.minY, stripY0);
+    int y1 = std::min(tri.maxY, stripY1);
+    if (y0 > y1)
+      return;
+
+    float *depth = levels[0].depth.data();
+    // Start on a 4 pixel boundary, width is a multiple of 4 so the last
+    // group never runs past the row
+    int x0 = tri.minX & ~3;
+
+#ifdef OCCLUSION_SSE2
+    const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a0 = _mm_set1_ps(tri.edgeA[0]);
+    __m128 a1 = _mm_set1_ps(tri.edgeA[1]);
+    __m128 a2 = _mm_set1_ps(tri.edgeA[2]);
+    __m128 aZ = _mm_set1_ps(tri.depthA);
+
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      __m128 row0 = _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]);
+      __m128 row1 = _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]);
+      __m128 row2 = _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]);
+      __m128 rowZ = _mm_set1_ps(tri.depthB * py + tri.depthC);
+      float *rowDepth = depth + y * width;
+
+      for (int x = x0; x <= tri.maxX; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffset);
+        __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+        __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+        __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+        __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+            _mm_cmpge_ps(e2, zero));
+        if (_mm_movemask_ps(inside) == 0)
+          continue;
+
+        __m128 z = _mm_add_ps(_mm_mul_ps(aZ, px), rowZ);
+        __m128 current = _mm_loadu_ps(rowDepth + x);
+        __m128 nearer = _mm_min_ps(current, z);
+        __m128 result = _mm_or_ps(_mm_and_ps(inside, nearer),
+                                  _mm_andnot_ps(inside, current));
+        _mm_storeu_ps(rowDepth + x, result);
+      }
+    }
+#else
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      float *rowDepth = depth + y * width;
+      for (int x = x0; x <= tri.maxX; x++) {
+        float px = x + 0.5f;
+        bool inside = true;
+        for (int i = 0; i < 3; i++) {
+          if (tri.edgeA[i] * px + tri.edgeB[i] * py + tri.edgeC[i] < 0.0f) {
+            inside = false;
+            break;
+          }
+        }
+        if (!inside)
+          continue;
+        float z = tri.depthA * px + tri.depthB * py + tri.depthC;
+        rowDepth[x] = std::min(rowDepth[x], z);
+      }
+    }
+#endif
+  }
+
+  // Each texel keeps the farthest depth of the 2x2 block below it
+  void buildHiZ() {
+    for (size_t i = 1; i < levels.size(); i++) {
+      const Level &src = levels[i - 1];
+      Level &dst = levels[i];
+      for (int y = 0; y < dst.height; y++) {
+        int sy0 = std::min(y * 2, src.height - 1);
+        int sy1 = std::min(y * 2 + 1, src.height - 1);
+        for (int x = 0; x < dst.width; x++) {
+          int sx0 = std::min(x * 2, src.width - 1);
+          int sx1 = std::min(x * 2 + 1, src.width - 1);
+          dst.depth[y * dst.width + x] =
+              std::max(std::max(src.depth[sy0 * src.width + sx0],
+                                src.depth[sy0 * src.width + sx1]),
+                       std::max(src.depth[sy1 * src.width + sx0],
+                                src.depth[sy1 * src.width + sx1]));
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../resources/ResourceManager.hpp"
+
+#include "../ecs/System.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Picks the RenderGraph's render scale every frame so the GPU time of the
+// frame stays within a budget. The scene is drawn at that scale into its
+// full size attachments and CompositeRenderSystem upscales it, so a new
+// scale costs nothing but the next frame's pixels.
+//
+// The time is what the graph measured for its last finished execute(). It
+// lags a few frames behind and is smoothed, so the scale drops by a limited
+// step per frame and rises by an even smaller one. Most of the cost is per
+// pixel, so the scale (per axis) follows the square root of budget / time.
+// The CPU frame time is no use here: the scale doesn't change it and it
+// includes waiting for the swap.
+class DynamicResolutionSystem : public System {
+public:
+  // Aims this far below the budget, a frame right at it misses now and then
+  static constexpr float HEADROOM = 0.9f;
+  // Largest change per frame, down and up
+  static constexpr float MAX_STEP_DOWN = 0.05f;
+  static constexpr float MAX_STEP_UP = 0.01f;
+  // Smaller changes are ignored, measurements are noisy
+  static constexpr float DEAD_BAND = 0.02f;
+  // Weight of the newest measurement in the smoothed time
+  static constexpr float SMOOTHING = 0.1f;
+
+  DynamicResolutionSystem(float budgetMs = 1000.0f / 60.0f,
+                          float minScale = 0.5f)
+      : budgetMs(budgetMs), minScale(minScale) {}
+
+  void setBudget(float milliseconds) { budgetMs = milliseconds; }
+  float getBudget() const { return budgetMs; }
+
+  // Disabled, the scene is drawn at full scale
+  void setEnabled(bool enable) { enabled = enable; }
+  bool isEnabled() const { return enabled; }
+
+  float getScale() const { return scale; }
+  // The smoothed GPU time the scale was picked for
+  float getFrameTime() const { return smoothedMs; }
+
+  void update(float &deltaTime) override {
+    auto &graph = ResourceManager::instance().getRenderGraph();
+    if (!enabled) {
+      scale = 1.0f;
+      graph.setRenderScale(scale);
+      return;
+    }
+
+    // Nothing measured yet, keep the scale
+    float frameMs = static_cast<float>(graph.getStats().gpuMilliseconds);
+    if (frameMs <= 0.0f)
+      return;
+    smoothedMs = smoothedMs > 0.0f
+                     ? smoothedMs + (frameMs - smoothedMs) * SMOOTHING
+                     : frameMs;
+
+    float target = scale * std::sqrt(budgetMs * HEADROOM / smoothedMs);
+    target = std::clamp(target, minScale, 1.0f);
+    if (std::abs(target - scale) < DEAD_BAND && target != 1.0f &&
+        target != minScale)
+      return;
+    scale = std::clamp(target, scale - MAX_STEP_DOWN, scale + MAX_STEP_UP);
+    graph.setRenderScale(scale);
+  }
+
+private:
+  float budgetMs;
+  float minScale;
+  bool enabled = true;
+  float scale = 1.0f;
+  float smoothedMs = 0.0f;
+};
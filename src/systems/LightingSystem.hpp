@@ -10,41 +10,150 @@
 #include "../ecs/System.hpp"
 #include "../ecs/Tag.hpp"
 #include "../ecs/World.hpp"
+#include "../ecs/utils/CameraUtils.hpp"
+#include "../spatial/LightClusters.hpp"
+#include "RenderCommon.hpp"
+#include <algorithm>
 #include <unordered_set>
+#include <vector>
 
 extern World gWorld;
 
+// Uploads the scene lights to every shader used by a lit material. Point
+// lights use clustered forward shading: they are binned into a view space
+// cluster grid (LightClusters) and handed to the shaders through buffer
+// textures, so each fragment only loops over the lights touching its cluster.
+//
+// Lit shaders are compiled per set of light types present (Shader::Feature),
+// the renderers pick the variant matching getShaderFeatures(). Must run
+// before them.
 class LightingSystem : public System {
 public:
+  // Must match the planes getActiveCamera uses for rendering
+  static constexpr float NEAR_PLANE = 0.1f;
+  static constexpr float FAR_PLANE = 100.0f;
+  static const size_t MAX_POINT_LIGHTS = 4096;
+
+  // Texture units of the cluster buffers, above the material textures
+  static const unsigned int LIGHT_DATA_UNIT = 8;
+  static const unsigned int CLUSTER_RANGE_UNIT = 9;
+  static const unsigned int LIGHT_INDEX_UNIT = 10;
+
+  LightingSystem(unsigned int width = 800, unsigned int height = 600)
+      : screenWidth(width), screenHeight(height) {
+    createBufferTexture(lightBuffer, lightTexture, GL_RGBA32F);
+    createBufferTexture(rangeBuffer, rangeTexture, GL_RG32UI);
+    createBufferTexture(indexBuffer, indexTexture, GL_R16UI);
+  }
+
+  ~LightingSystem() {
+    auto &glState = GLStateCache::instance();
+    glState.deleteTexture(lightTexture);
+    glState.deleteTexture(rangeTexture);
+    glState.deleteTexture(indexTexture);
+    glState.deleteBuffer(lightBuffer);
+    glState.deleteBuffer(rangeBuffer);
+    glState.deleteBuffer(indexBuffer);
+  }
+
+  void setScreenSize(unsigned int width, unsigned int height) override {
+    screenWidth = width;
+    screenHeight = height;
+  }
+
+  const LightClusters::Stats &getClusterStats() const {
+    return clusters.getStats();
+  }
+
+  // DIR_LIGHT, POINT_LIGHTS and SPOT_LIGHT for the lights found this frame
+  uint32_t getShaderFeatures() const { return shaderFeatures; }
+
   void render() override {
-    std::unordered_set<uint32_t> shadersNeedingLighting;
+    updateShaderFeatures();
+
+    auto &resources = ResourceManager::instance();
+    std::unordered_set<Shader *> shadersNeedingLighting;
 
     gWorld.forEachWith<MaterialComponent>(
         [&](Entity entity, MaterialComponent &material) {
-          if (material.receivesLighting && material.shaderProgram != 0) {
-            shadersNeedingLighting.insert(material.shaderProgram);
+          if (!material.receivesLighting || material.shaderProgram == 0)
+            return;
+          Shader *shader = resources.getShader(material.shaderProgram);
+          if (shader) {
+            shadersNeedingLighting.insert(shader->variant(
+                RenderUtils::getShaderFeatures(material, shaderFeatures)));
           }
         });
 
-    auto &resources = ResourceManager::instance();
+    if (shadersNeedingLighting.empty())
+      return;
+    if (shaderFeatures & Shader::POINT_LIGHTS)
+      buildClusters();
 
-    for (uint32_t shaderID : shadersNeedingLighting) {
-      Shader *shader = resources.getShader(shaderID);
-      if (shader) {
-        applyLightsToShader(shader);
-      }
+    for (Shader *shader : shadersNeedingLighting) {
+      applyLightsToShader(shader);
     }
   }
 
 private:
+  unsigned int screenWidth;
+  unsigned int screenHeight;
+  uint32_t shaderFeatures = 0;
+
+  LightClusters clusters;
+  std::vector<Sphere> lightSpheres;
+  std::vector<glm::vec4> lightData;
+
+  uint32_t lightBuffer = 0;
+  uint32_t lightTexture = 0;
+  uint32_t rangeBuffer = 0;
+  uint32_t rangeTexture = 0;
+  uint32_t indexBuffer = 0;
+  uint32_t indexTexture = 0;
+
+  static void createBufferTexture(uint32_t &buffer, uint32_t &texture,
+                                  GLenum format) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+    GLStateCache::instance().bindTexture(GL_TEXTURE_BUFFER, texture);
+    GLStateCache::instance().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+  }
+
+  // Orphans the old store, the texture keeps pointing at the buffer object
+  static void uploadBuffer(uint32_t buffer, const void *data, size_t bytes) {
+    GLStateCache::instance().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+  }
+
+  // Light types missing from the scene are compiled out of the variants
+  void updateShaderFeatures() {
+    shaderFeatures = 0;
+    gWorld.forEachWith<DirectionalLightComponent>(
+        [&](Entity entity, DirectionalLightComponent &light) {
+          shaderFeatures |= Shader::DIR_LIGHT;
+        });
+    gWorld.forEachWith<PointLightComponent, TransformComponent>(
+        [&](Entity entity, PointLightComponent &light,
+            TransformComponent &transform) {
+          shaderFeatures |= Shader::POINT_LIGHTS;
+        });
+
+    SpotLightComponent *spotLight = findSpotLight();
+    if (spotLight && spotLight->active && findActiveCamera(nullptr))
+      shaderFeatures |= Shader::SPOT_LIGHT;
+  }
+
   void applyLightsToShader(Shader *shader) {
     shader->use();
 
-    // TODO: Inefficient because we dont always have all of these types of
-    // lights
-    applyDirectionalLight(shader);
-    applyPointLights(shader);
-    applySpotLight(shader);
+    uint32_t features = shader->getFeatures();
+    if (features & Shader::DIR_LIGHT)
+      applyDirectionalLight(shader);
+    if (features & Shader::POINT_LIGHTS)
+      applyPointLights(shader);
+    if (features & Shader::SPOT_LIGHT)
+      applySpotLight(shader);
   }
 
   void applyDirectionalLight(Shader *shader) {
@@ -61,69 +170,115 @@ private:
           shader->setVec3("dirLight.specular", light.specular);
           found = true;
         });
-
-    if (!found) {
-      shader->setVec3("dirLight.ambient", glm::vec3(0.0f));
-      shader->setVec3("dirLight.diffuse", glm::vec3(0.0f));
-      shader->setVec3("dirLight.specular", glm::vec3(0.0f));
-    }
   }
 
-  void applyPointLights(Shader *shader) {
-    int index = 0;
+  // Point lights are clustered once per frame, every lit shader then only
+  // needs the grid parameters and the buffer textures
+  void buildClusters() {
+    float aspectRatio =
+        static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
+    ActiveCameraData camera =
+        getActiveCamera(gWorld, aspectRatio, NEAR_PLANE, FAR_PLANE);
+    bool orthographic = false;
+    gWorld.forEachWith<CameraComponent, TagComponent>(
+        [&](Entity entity, CameraComponent &cam, TagComponent &tag) {
+          if (tag.has(ACTIVE))
+            orthographic = cam.isOrthographic;
+        });
+    clusters.setProjection(camera.projection, NEAR_PLANE, FAR_PLANE,
+                           orthographic);
 
+    lightSpheres.clear();
+    lightData.clear();
     gWorld.forEachWith<PointLightComponent, TransformComponent>(
         [&](Entity entity, PointLightComponent &light,
             TransformComponent &transform) {
-          if (index >= 10)
+          if (lightSpheres.size() >= MAX_POINT_LIGHTS)
             return;
 
-          std::string base = "pointLights[" + std::to_string(index) + "]";
-          shader->setVec3(base + ".position", transform.position);
-          shader->setVec3(base + ".ambient", light.ambient);
-          shader->setVec3(base + ".diffuse", light.diffuse);
-          shader->setVec3(base + ".specular", light.specular);
-          shader->setFloat(base + ".constant", light.constant);
-          shader->setFloat(base + ".linear", light.linear);
-          shader->setFloat(base + ".quadratic", light.quadratic);
-          index++;
+          float radius = light.getRange();
+          Sphere sphere;
+          sphere.center =
+              glm::vec3(camera.view * glm::vec4(transform.position, 1.0f));
+          sphere.radius = radius;
+          lightSpheres.push_back(sphere);
+
+          // 4 texels per light, see fetchPointLight in staticFragment.glsl
+          lightData.push_back(glm::vec4(transform.position, radius));
+          lightData.push_back(glm::vec4(light.ambient, light.constant));
+          lightData.push_back(glm::vec4(light.diffuse, light.linear));
+          lightData.push_back(glm::vec4(light.specular, light.quadratic));
         });
 
-    // Zero out unused slots
-    for (int i = index; i < 10; i++) {
-      std::string base = "pointLights[" + std::to_string(i) + "]";
-      shader->setVec3(base + ".ambient", glm::vec3(0.0f));
-      shader->setVec3(base + ".diffuse", glm::vec3(0.0f));
-      shader->setVec3(base + ".specular", glm::vec3(0.0f));
-      shader->setFloat(base + ".constant", 1.0f);
-      shader->setFloat(base + ".linear", 0.0f);
-      shader->setFloat(base + ".quadratic", 1.0f);
+    clusters.assign(lightSpheres);
+
+    // Buffer textures need at least one texel to be complete
+    if (lightData.empty()) {
+      lightData.push_back(glm::vec4(0.0f));
     }
+    const std::vector<uint16_t> &indices = clusters.getLightIndices();
+    uploadBuffer(lightBuffer, lightData.data(),
+                 lightData.size() * sizeof(glm::vec4));
+    uploadBuffer(rangeBuffer, clusters.getRanges().data(),
+                 clusters.getRanges().size() * sizeof(uint32_t));
+    uint16_t emptyIndex = 0;
+    uploadBuffer(indexBuffer, indices.empty() ? &emptyIndex : indices.data(),
+                 std::max<size_t>(indices.size(), 1) * sizeof(uint16_t));
+
+    auto &glState = GLStateCache::instance();
+    glState.bindTexture(LIGHT_DATA_UNIT, GL_TEXTURE_BUFFER, lightTexture);
+    glState.bindTexture(CLUSTER_RANGE_UNIT, GL_TEXTURE_BUFFER, rangeTexture);
+    glState.bindTexture(LIGHT_INDEX_UNIT, GL_TEXTURE_BUFFER, indexTexture);
   }
 
-  void applySpotLight(Shader *shader) {
-    SpotLightComponent *spotLight = nullptr;
-    TransformComponent *spotTransform = nullptr;
-    CameraComponent *activeCamera = nullptr;
-    TransformComponent *cameraTransform = nullptr;
+  void applyPointLights(Shader *shader) {
+    shader->setInt("clusterLights", LIGHT_DATA_UNIT);
+    shader->setInt("clusterRanges", CLUSTER_RANGE_UNIT);
+    shader->setInt("clusterIndices", LIGHT_INDEX_UNIT);
+    shader->setIVec3("clusterGrid",
+                     glm::ivec3(LightClusters::GRID_X, LightClusters::GRID_Y,
+                                LightClusters::GRID_Z));
+    // The scene is drawn at the render scale, so are its fragment coords
+    float renderScale =
+        ResourceManager::instance().getRenderGraph().getRenderScale();
+    shader->setVec2("clusterTileScale",
+                    glm::vec2(LightClusters::GRID_X, LightClusters::GRID_Y) /
+                        (glm::vec2(screenWidth, screenHeight) * renderScale));
+    shader->setFloat("clusterDepthScale", clusters.getDepthScale());
+    shader->setFloat("clusterDepthBias", clusters.getDepthBias());
+    shader->setBool("clusterLogDepth", clusters.usesLogDepth());
+  }
 
+  // The first spot light, it shines from the active camera
+  static SpotLightComponent *findSpotLight() {
+    SpotLightComponent *spotLight = nullptr;
     gWorld.forEachWith<SpotLightComponent, TransformComponent>(
         [&](Entity entity, SpotLightComponent &light,
             TransformComponent &transform) {
-          if (!spotLight) {
+          if (!spotLight)
             spotLight = &light;
-            spotTransform = &transform;
-          }
         });
+    return spotLight;
+  }
 
+  static CameraComponent *findActiveCamera(TransformComponent **transform) {
+    CameraComponent *activeCamera = nullptr;
     gWorld.forEachWith<CameraComponent, TransformComponent, TagComponent>(
         [&](Entity entity, CameraComponent &camera,
-            TransformComponent &transform, TagComponent &tag) {
+            TransformComponent &cameraTransform, TagComponent &tag) {
           if (!activeCamera && tag.has(ACTIVE)) {
             activeCamera = &camera;
-            cameraTransform = &transform;
+            if (transform)
+              *transform = &cameraTransform;
           }
         });
+    return activeCamera;
+  }
+
+  void applySpotLight(Shader *shader) {
+    TransformComponent *cameraTransform = nullptr;
+    SpotLightComponent *spotLight = findSpotLight();
+    CameraComponent *activeCamera = findActiveCamera(&cameraTransform);
 
     if (spotLight && activeCamera && cameraTransform) {
       shader->setVec3("spotLight.position", cameraTransform->position);
@@ -136,9 +291,6 @@ private:
       shader->setFloat("spotLight.quadratic", spotLight->quadratic);
       shader->setFloat("spotLight.cutOff", spotLight->cutOff);
       shader->setFloat("spotLight.outerCutOff", spotLight->outerCutOff);
-      shader->setBool("spotLight.isActive", spotLight->active);
-    } else {
-      shader->setBool("spotLight.isActive", false);
     }
   }
 };
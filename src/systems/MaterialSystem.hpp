@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../components/MaterialComponent.hpp"
+#include "../resources/ResourceManager.hpp"
+
+#include "../ecs/System.hpp"
+#include "../ecs/World.hpp"
+
+extern World gWorld;
+
+// Points every lit material at the MaterialTable entry holding its current
+// values and uploads the entries that changed. Materials can be edited in
+// place (presets, power ups, ...), a changed material simply moves to the
+// entry for its new values. Must be added before the systems that draw.
+class MaterialSystem : public System {
+public:
+  void render() override {
+    auto &table = ResourceManager::instance().getMaterialTable();
+    table.beginFrame();
+    gWorld.forEachWith<MaterialComponent>(
+        [&](Entity entity, MaterialComponent &material) {
+          if (material.receivesLighting) {
+            material.materialID = table.acquire(
+                MaterialTable::Params::of(material), material.materialID);
+          }
+        });
+    table.endFrame();
+  }
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "../components/MeshComponent.hpp"
+#include "../components/OccluderComponent.hpp"
+#include "../components/TransformComponent.hpp"
+#include "../ecs/System.hpp"
+#include "../ecs/World.hpp"
+#include "../ecs/utils/CameraUtils.hpp"
+#include "../spatial/OcclusionBuffer.hpp"
+#include "SpatialIndexSystem.hpp"
+
+#include <vector>
+
+extern World gWorld;
+
+// Rasterises entities with an OccluderComponent into a CPU depth buffer at the
+// start of the render phase. OpaqueRenderSystem then asks isVisible() for each
+// draw, which tests the entity's world bounds (from SpatialIndexSystem)
+// against the HiZ pyramid. Must be added after SpatialIndexSystem and before
+// OpaqueRenderSystem.
+class OcclusionCullingSystem : public System {
+public:
+  struct Stats {
+    size_t occluders = 0;
+    size_t tested = 0;
+    size_t culled = 0;
+  };
+
+  bool enabled = true;
+  // Occluders covering less than this fraction of the screen height are
+  // skipped, they cost more to rasterise than they save
+  float minOccluderScreenSize = 0.05f;
+
+  OcclusionCullingSystem(unsigned int width = 800, unsigned int height = 600)
+      : screenWidth(width), screenHeight(height) {
+    resizeBuffer();
+  }
+
+  void setScreenSize(unsigned int width, unsigned int height) override {
+    screenWidth = width;
+    screenHeight = height;
+    resizeBuffer();
+  }
+
+  void render() override {
+    stats = Stats{};
+    buffer.clear();
+    if (!enabled)
+      return;
+
+    float aspectRatio =
+        static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
+    auto camera = getActiveCamera(gWorld, aspectRatio);
+    viewProjection = camera.projection * camera.view;
+    Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+    frame++;
+    // No MeshComponent needed when the box is explicit, e.g. for sources of
+    // a static batch
+    gWorld.forEachWith<TransformComponent, OccluderComponent>(
+        [&](Entity entity, TransformComponent &transform,
+            OccluderComponent &occluder) {
+          AABB localBox = occluder.box;
+          if (!localBox.isValid()) {
+            MeshComponent *mesh = gWorld.getComponent<MeshComponent>(entity);
+            if (mesh) {
+              localBox = mesh->bounds;
+            }
+          }
+          if (!localBox.isValid())
+            return;
+
+          glm::mat4 model = transform.getModelMatrix();
+          AABB worldBox = localBox.transformed(model);
+          if (!frustum.intersects(worldBox))
+            return;
+          if (!isLargeOnScreen(worldBox, camera.position))
+            return;
+
+          if (entity >= occluderFrame.size()) {
+            occluderFrame.resize(entity + 1, 0);
+          }
+          occluderFrame[entity] = frame;
+
+          buffer.addOccluderBox(localBox, viewProjection * model);
+          stats.occluders++;
+        });
+
+    buffer.rasterize(static_cast<int>(ThreadPool::instance().getWorkerCount()) +
+                     1);
+  }
+
+  // False only if the entity is certainly hidden this frame
+  bool isVisible(Entity entity) {
+    if (!enabled || stats.occluders == 0)
+      return true;
+    // An occluder would always pass its own test, skip the work
+    if (entity < occluderFrame.size() && occluderFrame[entity] == frame)
+      return true;
+
+    SpatialIndexSystem *spatialIndex = gWorld.getSystem<SpatialIndexSystem>();
+    if (!spatialIndex)
+      return true;
+    const AABB *bounds = spatialIndex->getWorldBounds(entity);
+    if (!bounds)
+      return true;
+
+    stats.tested++;
+    if (buffer.isVisible(*bounds, viewProjection))
+      return true;
+    stats.culled++;
+    return false;
+  }
+
+  const Stats &getStats() const { return stats; }
+  const OcclusionBuffer &getBuffer() const { return buffer; }
+
+private:
+  unsigned int screenWidth = 800;
+  unsigned int screenHeight = 600;
+
+  OcclusionBuffer buffer;
+  glm::mat4 viewProjection = glm::mat4(1.0f);
+  std::vector<uint32_t> occluderFrame; // Indexed by Entity
+  uint32_t frame = 0;
+  Stats stats;
+
+  // Fixed 256 wide buffer, height follows the window aspect ratio
+  void resizeBuffer() {
+    const int bufferWidth = 256;
+    int bufferHeight = static_cast<int>(bufferWidth * screenHeight /
+                                        std::max(1u, screenWidth));
+    buffer.resize(bufferWidth, std::max(1, bufferHeight));
+  }
+
+  // Cheap size estimate from the bounding sphere instead of projecting corners
+  bool isLargeOnScreen(const AABB &box, const glm::vec3 &cameraPos) const {
+    float radius = glm::length(box.halfExtents());
+    float distance = glm::length(box.center() - cameraPos);
+    if (distance <= radius)
+      return true;
+    return radius / distance >= minOccluderScreenSize;
+  }
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "../gl_common.hpp"
+#include "../resources/GLStateCache.hpp"
+#include "../resources/RenderGraph.hpp"
+#include "../resources/ResourceManager.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <string>
+
+// Builds the screen effects into as few RenderGraph passes as it can. The
+// per-pixel effects (grayscale, invert) and one 3x3 kernel (sharpen or
+// edges) are fused into one variant of screenFragment.glsl, which also
+// draws the result to the output.
+//
+// The blur is the expensive one and runs at half resolution: the input is
+// halved, blurred horizontally then vertically with linear-sampled
+// Gaussian taps (blurFragment.glsl), and the fused pass upsamples it with
+// depth-aware (bilateral) weights. Only a kernel after the blur needs the
+// upsampled image in a full resolution target of its own; the graph backs
+// it with the scene colour's texture, which is no longer used by then.
+//
+// An input drawn below the output size (a dynamic transient at a render
+// scale under 1) is stretched over the output and sharpened by the fused
+// pass as well. Only the blur and the kernels, which look at neighbouring
+// output pixels, get the upscaled image in a target of its own first.
+class PostProcessChain {
+public:
+  // The Shader::Feature bits it knows about
+  static constexpr uint32_t EFFECTS = Shader::INVERT | Shader::GRAYSCALE |
+                                      Shader::SHARPEN | Shader::BLUR |
+                                      Shader::EDGES;
+  // Blur width in UV, about what the old 3x3 [1 2 1] kernel with its taps
+  // 1/300 apart gave (its standard deviation is the spacing / sqrt(2))
+  static constexpr float BLUR_SIGMA = 1.0f / 424.0f;
+  // Must match blurFragment.glsl
+  static constexpr int MAX_TAPS = 6;
+
+  PostProcessChain() { setupScreenQuad(); }
+
+  ~PostProcessChain() {
+    auto &glState = GLStateCache::instance();
+    if (screenQuadVAO) {
+      glState.deleteVertexArray(screenQuadVAO);
+    }
+    if (screenQuadVBO) {
+      glState.deleteBuffer(screenQuadVBO);
+    }
+  }
+
+  PostProcessChain(const PostProcessChain &) = delete;
+  PostProcessChain &operator=(const PostProcessChain &) = delete;
+
+  // Any combination of EFFECTS, sharpen wins over edges
+  void setEffects(uint32_t features) { effects = features & EFFECTS; }
+  uint32_t getEffects() const { return effects; }
+
+  // 0 to 1, how much an upscaled input is sharpened
+  void setUpscaleSharpness(float sharpness) {
+    upscaleSharpness = std::clamp(sharpness, 0.0f, 1.0f);
+  }
+
+  // Adds the passes taking input to output. depth is the scene depth the
+  // blur is upsampled with (the blur is skipped without it), projection
+  // the matrix it was rendered with
+  void record(RenderGraph &graph, RenderGraph::ResourceID input,
+              RenderGraph::ResourceID depth, RenderGraph::ResourceID output,
+              const glm::mat4 &projection) {
+    Shader *screenShader = getShader("postprocess", "screenFragment.glsl");
+    if (!screenShader)
+      return;
+
+    uint32_t kernel = effects & (Shader::SHARPEN | Shader::EDGES);
+    uint32_t perPixel = effects & (Shader::GRAYSCALE | Shader::INVERT);
+    bool blur = (effects & Shader::BLUR) &&
+                depth != RenderGraph::INVALID_RESOURCE;
+    glm::vec2 depthParams(projection[2][2], projection[3][2]);
+    inputScale = graph.getContentScale(input);
+    depthScale = graph.getContentScale(depth);
+    bool upscale = inputScale != glm::vec2(1.0f);
+
+    RenderGraph::ResourceID source = input;
+    if (upscale && (blur || kernel)) {
+      source = graph.createTexture("postUpscaled", {RenderGraph::RGB8});
+      Shader *upscaler = screenShader->variant(Shader::UPSCALE);
+      graph
+          .addPass("postUpscale",
+                   [this, upscaler,
+                    input](const RenderGraph::PassContext &context) {
+                     drawScreen(*upscaler, context.getTexture(input), 0,
+                                glm::vec2(0.0f));
+                   })
+          .read(input)
+          .write(source);
+      upscale = false;
+    }
+    if (blur) {
+      source = recordBlur(graph, source, screenShader);
+      if (kernel) {
+        // The kernel needs its neighbours upsampled too
+        RenderGraph::ResourceID upsampled =
+            graph.createTexture("postUpsampled", {RenderGraph::RGB8});
+        Shader *upsample = screenShader->variant(Shader::BLUR);
+        graph
+            .addPass("postUpsample",
+                     [this, upsample, source, depth,
+                      depthParams](const RenderGraph::PassContext &context) {
+                       drawScreen(*upsample, context.getTexture(source),
+                                  context.getTexture(depth), depthParams);
+                     })
+            .read(source)
+            .read(depth)
+            .write(upsampled);
+        source = upsampled;
+        blur = false;
+      }
+    }
+
+    uint32_t first = upscale ? Shader::UPSCALE : blur ? Shader::BLUR : kernel;
+    Shader *fused = screenShader->variant(first | perPixel);
+    auto builder = graph.addPass(
+        "composite", [this, fused, source, depth, blur,
+                      depthParams](const RenderGraph::PassContext &context) {
+          GLuint depthTexture = blur ? context.getTexture(depth) : 0;
+          drawScreen(*fused, context.getTexture(source), depthTexture,
+                     depthParams);
+        });
+    builder.read(source).write(output);
+    if (blur) {
+      builder.read(depth);
+    }
+  }
+
+private:
+  unsigned int screenQuadVAO = 0;
+  unsigned int screenQuadVBO = 0;
+  uint32_t effects = 0;
+  float upscaleSharpness = 0.5f;
+  // Drawn parts of this frame's input and depth, see record()
+  glm::vec2 inputScale = glm::vec2(1.0f);
+  glm::vec2 depthScale = glm::vec2(1.0f);
+
+  Shader *getShader(const std::string &name, const std::string &fragment) {
+    auto &resources = ResourceManager::instance();
+    Shader *shader = resources.getShader(name);
+    if (!shader) {
+      resources.loadShader(
+          name, "../src/shaders/postprocess/screenVertex.glsl",
+          ("../src/shaders/postprocess/" + fragment).c_str());
+      shader = resources.getShader(name);
+    }
+    return shader;
+  }
+
+  // Half resolution copy of input, blurred along x then y. Returns the
+  // result. input must be drawn in full
+  RenderGraph::ResourceID recordBlur(RenderGraph &graph,
+                                     RenderGraph::ResourceID input,
+                                     Shader *screenShader) {
+    Shader *blurShader = getShader("postBlur", "blurFragment.glsl");
+    RenderGraph::TextureDesc half{RenderGraph::RGB8, 0.5f};
+    RenderGraph::ResourceID halved = graph.createTexture("postHalf", half);
+    RenderGraph::ResourceID blurredX = graph.createTexture("postBlurX", half);
+    RenderGraph::ResourceID blurredY = graph.createTexture("postBlurY", half);
+
+    // Each half resolution texel centre falls between 4 input texels, one
+    // bilinear fetch averages them
+    Shader *copy = screenShader->variant(0);
+    graph
+        .addPass("postDownsample",
+                 [this, copy, input](const RenderGraph::PassContext &context) {
+                   drawScreen(*copy, context.getTexture(input), 0,
+                              glm::vec2(0.0f));
+                 })
+        .read(input)
+        .write(halved);
+    graph
+        .addPass("postBlurX",
+                 [this, blurShader,
+                  halved](const RenderGraph::PassContext &context) {
+                   drawBlur(*blurShader, context.getTexture(halved),
+                            glm::vec2(1.0f / context.width, 0.0f),
+                            BLUR_SIGMA * context.width);
+                 })
+        .read(halved)
+        .write(blurredX);
+    graph
+        .addPass("postBlurY",
+                 [this, blurShader,
+                  blurredX](const RenderGraph::PassContext &context) {
+                   drawBlur(*blurShader, context.getTexture(blurredX),
+                            glm::vec2(0.0f, 1.0f / context.height),
+                            BLUR_SIGMA * context.height);
+                 })
+        .read(blurredX)
+        .write(blurredY);
+    return blurredY;
+  }
+
+  void drawScreen(Shader &shader, GLuint source, GLuint depth,
+                  glm::vec2 depthParams) {
+    auto &glState = GLStateCache::instance();
+    glState.disable(GL_DEPTH_TEST);
+    shader.use();
+    shader.setInt("screenTexture", 0);
+    glState.bindTexture(0, GL_TEXTURE_2D, source);
+    if (shader.getFeatures() & Shader::UPSCALE) {
+      shader.setVec2("contentScale", inputScale);
+      shader.setFloat("sharpness", upscaleSharpness);
+    }
+    if (depth) {
+      shader.setInt("sceneDepth", 1);
+      shader.setVec2("depthParams", depthParams);
+      shader.setVec2("depthScale", depthScale);
+      glState.bindTexture(1, GL_TEXTURE_2D, depth);
+    }
+    drawQuad();
+    glState.enable(GL_DEPTH_TEST);
+  }
+
+  // sigma in texels of the target
+  void drawBlur(Shader &shader, GLuint source, glm::vec2 direction,
+                float sigma) {
+    float weights[MAX_TAPS];
+    float offsets[MAX_TAPS];
+    int taps = gaussianTaps(sigma, weights, offsets);
+
+    auto &glState = GLStateCache::instance();
+    glState.disable(GL_DEPTH_TEST);
+    shader.use();
+    shader.setInt("image", 0);
+    shader.setVec2("direction", direction);
+    shader.setInt("tapCount", taps);
+    for (int i = 0; i < taps; i++) {
+      std::string index = "[" + std::to_string(i) + "]";
+      shader.setFloat("tapWeights" + index, weights[i]);
+      shader.setFloat("tapOffsets" + index, offsets[i]);
+    }
+    glState.bindTexture(0, GL_TEXTURE_2D, source);
+    drawQuad();
+    glState.enable(GL_DEPTH_TEST);
+  }
+
+  // Normalised Gaussian over (MAX_TAPS - 1) * 2 texels each side. Tap 0 is
+  // the centre, tap i merges texels 2i - 1 and 2i into one fetch placed at
+  // their weighted mean. Returns the number of taps used
+  static int gaussianTaps(float sigma, float *weights, float *offsets) {
+    const int radius = (MAX_TAPS - 1) * 2;
+    float texels[radius + 2];
+    sigma = std::max(sigma, 0.1f);
+    float total = 0.0f;
+    for (int i = 0; i <= radius; i++) {
+      texels[i] = std::exp(-0.5f * i * i / (sigma * sigma));
+      total += i == 0 ? texels[i] : 2.0f * texels[i];
+    }
+    texels[radius + 1] = 0.0f;
+
+    weights[0] = texels[0] / total;
+    offsets[0] = 0.0f;
+    int taps = 1;
+    for (int i = 1; i <= radius; i += 2) {
+      float weight = texels[i] + texels[i + 1];
+      if (weight / total < 1e-4f)
+        break;
+      weights[taps] = weight / total;
+      offsets[taps] = (i * texels[i] + (i + 1) * texels[i + 1]) / weight;
+      taps++;
+    }
+    return taps;
+  }
+
+  void drawQuad() {
+    GLStateCache::instance().bindVertexArray(screenQuadVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+  }
+
+  void setupScreenQuad() {
+    float quadVertices[] = {-1.0f, 1.0f,  0.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f,
+                            1.0f,  -1.0f, 1.0f, 0.0f, -1.0f, 1.0f,  0.0f, 1.0f,
+                            1.0f,  -1.0f, 1.0f, 0.0f, 1.0f,  1.0f,  1.0f, 1.0f};
+
+    glGenVertexArrays(1, &screenQuadVAO);
+    glGenBuffers(1, &screenQuadVBO);
+    auto &glState = GLStateCache::instance();
+    glState.bindVertexArray(screenQuadVAO);
+    glState.bindBuffer(GL_ARRAY_BUFFER, screenQuadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices,
+                 GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                          (void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                          (void *)(2 * sizeof(float)));
+    glState.bindVertexArray(0);
+  }
+};
@@ -7,6 +7,12 @@
 #include "../ecs/Tag.hpp"
 #include "../ecs/World.hpp"
 #include "../gl_common.hpp"
+#include "../resources/GLStateCache.hpp"
+#include "../resources/MaterialTable.hpp"
+#include "../resources/RenderGraph.hpp"
+#include "../resources/shader_h.hpp"
+
+#include <vector>
 
 struct RenderableEntity {
   Entity entity;
@@ -18,14 +24,68 @@ struct RenderableEntity {
 
 namespace RenderUtils {
 
+// RenderGraph transients the scene is drawn into, declared by
+// OpaqueRenderSystem and composited to the backbuffer. Both are dynamic, they
+// are drawn at the graph's render scale
+inline const char *const SCENE_COLOR = "sceneColor";
+inline const char *const SCENE_DEPTH = "sceneDepth";
+
+// The VAO is left bound, GLStateCache skips the rebind when the next draw
+// uses the same mesh
 inline void drawMesh(const MeshComponent &mesh) {
-  glBindVertexArray(mesh.vao);
+  GLStateCache::instance().bindVertexArray(mesh.vao);
   if (mesh.isIndexed()) {
-    glDrawElements(GL_TRIANGLES, mesh.indexCount, mesh.indexType, nullptr);
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, mesh.indexType,
+                             mesh.indexOffset(), mesh.baseVertex);
   } else {
-    glDrawArrays(GL_TRIANGLES, 0, mesh.vertexCount);
+    glDrawArrays(GL_TRIANGLES, mesh.baseVertex, mesh.vertexCount);
+  }
+}
+
+// Uniforms the vertex shaders use to unpack CompactVertex meshes, must be
+// set whenever the mesh changes between draws
+inline void setVertexDecode(const Shader &shader, const MeshComponent &mesh) {
+  shader.setBool("compactVertex", mesh.compact);
+  if (mesh.compact) {
+    shader.setVec3("positionScale", mesh.positionScale);
+    shader.setVec3("positionOffset", mesh.positionOffset);
   }
-  glBindVertexArray(0);
+}
+
+// Shader::Feature bits a material is drawn with. lightFeatures are the
+// lights in the scene (LightingSystem::getShaderFeatures), only lit
+// materials use them
+inline uint32_t getShaderFeatures(const MaterialComponent &material,
+                                  uint32_t lightFeatures) {
+  uint32_t features = material.receivesLighting ? lightFeatures : 0;
+  if (material.useTextures)
+    features |= Shader::TEXTURES;
+  return features;
+}
+
+// Samplers of the lit shaders, constant so set once per program. The values
+// come from MaterialTable, a draw only sets materialIndex
+inline void setMaterialSamplers(const Shader &shader) {
+  shader.setInt("material.texture_diffuse1", 0);
+  shader.setInt("material.texture_specular1", 1);
+  shader.setInt("materialParams", MaterialTable::TEXTURE_UNIT);
+}
+
+// GLStateCache skips the units that already hold the texture
+inline void bindMaterialTextures(const MaterialComponent &material) {
+  for (size_t i = 0; i < MAX_MATERIAL_TEXTURES; i++) {
+    if (material.textures[i] != 0) {
+      GLStateCache::instance().bindTexture(i, GL_TEXTURE_2D,
+                                           material.textures[i]);
+    }
+  }
+}
+
+// Static batches are baked in world space, skip the per frame matrix
+inline glm::mat4 getModelMatrix(const RenderableEntity &renderable) {
+  if (renderable.tag && renderable.tag->has(STATIC_BATCH))
+    return glm::mat4(1.0f);
+  return renderable.transform->getModelMatrix();
 }
 
 inline std::string getActiveSceneName(World &world) {
@@ -50,4 +110,78 @@ inline glm::vec3 getActiveSceneClearColor(World &world) {
   return clearColor;
 }
 
+inline bool isDepthPrePassEnabled(World &world) {
+  bool enabled = false;
+  world.forEachWith<SceneComponent, TagComponent>(
+      [&](Entity entity, SceneComponent &scene, TagComponent &tag) {
+        if (tag.has(ACTIVESCENE)) {
+          enabled = scene.depthPrePass;
+        }
+      });
+  return enabled;
+}
+
 } // namespace RenderUtils
+
+// Queues draws of meshes that live in the same GeometryArena (same VAO) and
+// submits them with one glMultiDrawElementsBaseVertex / glMultiDrawArrays.
+// It can't tell when uniforms or textures change, the caller must flush()
+// before touching them. Adding a mesh from another VAO flushes by itself.
+class MultiDrawBatch {
+public:
+  void add(const MeshComponent &mesh) {
+    bool indexed = mesh.isIndexed();
+    if (!counts.empty() &&
+        (mesh.vao != vao || indexed != isIndexed ||
+         (indexed && mesh.indexType != indexType))) {
+      flush();
+    }
+    vao = mesh.vao;
+    isIndexed = indexed;
+    indexType = mesh.indexType;
+
+    if (indexed) {
+      counts.push_back(static_cast<GLsizei>(mesh.indexCount));
+      offsets.push_back(mesh.indexOffset());
+      baseVertices.push_back(static_cast<GLint>(mesh.baseVertex));
+    } else {
+      counts.push_back(static_cast<GLsizei>(mesh.vertexCount));
+      baseVertices.push_back(static_cast<GLint>(mesh.baseVertex));
+    }
+    meshes++;
+  }
+
+  void flush() {
+    if (counts.empty())
+      return;
+    GLStateCache::instance().bindVertexArray(vao);
+    GLsizei drawCount = static_cast<GLsizei>(counts.size());
+    if (isIndexed) {
+      glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), indexType,
+                                    offsets.data(), drawCount,
+                                    baseVertices.data());
+    } else {
+      // Non indexed draws start at their base vertex
+      glMultiDrawArrays(GL_TRIANGLES, baseVertices.data(), counts.data(),
+                        drawCount);
+    }
+    drawCalls++;
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+  }
+
+  // Meshes queued and draw calls issued since the batch was created
+  uint32_t getMeshCount() const { return meshes; }
+  uint32_t getDrawCallCount() const { return drawCalls; }
+
+private:
+  uint32_t vao = 0;
+  bool isIndexed = false;
+  GLenum indexType = GL_UNSIGNED_INT;
+  std::vector<GLsizei> counts;
+  std::vector<const void *> offsets;
+  std::vector<GLint> baseVertices;
+  uint32_t meshes = 0;
+  uint32_t drawCalls = 0;
+};
@@ -2,38 +2,66 @@
 
 #include "../gl_common.hpp"
 #include "../resources/ResourceManager.hpp"
+#include "../utils/GPUTimer.hpp"
+#include "LightingSystem.hpp"
+#include "OcclusionCullingSystem.hpp"
 #include "RenderCommon.hpp"
+#include "SpatialIndexSystem.hpp"
 
 #include "../ecs/System.hpp"
 #include "../ecs/World.hpp"
 #include "../ecs/utils/CameraUtils.hpp"
 
+#include <algorithm>
 #include <unordered_set>
 
 extern World gWorld;
 
 // TODO: even after splitting up the rendering systems they are still a bit too
 // heavy, this one could be split into outlines
-// Also, the framebuffer management is a bit messy
+//
+// render() culls and collects the meshes, then adds the "opaque" pass to the
+// RenderGraph, which clears and draws into the scene colour and depth
+// attachments that SkyboxSystem, TransparentRenderSystem and
+// CompositeRenderSystem pick up by name.
+//
+// With SceneComponent::depthPrePass set, lit geometry is first drawn depth
+// only (colour writes off, trivial shader) and the lit pass then tests with
+// GL_LEQUAL, so the lighting shader runs at most once per pixel. Both passes
+// are timed on the GPU and count the samples that passed, see getPassStats().
 class OpaqueRenderSystem : public System {
 private:
   unsigned int screenWidth = 800;
   unsigned int screenHeight = 600;
 
 public:
+  struct PassStats {
+    bool depthPrePass = false;
+    GPUTimer::Result prePass;
+    GPUTimer::Result litPass; // samples = fragments that ran a colour shader
+    uint32_t meshes = 0;      // Opaque meshes drawn by the lit pass
+    uint32_t drawCalls = 0;   // After merging them into multi-draws
+  };
+
   OpaqueRenderSystem(unsigned int width = 800, unsigned int height = 600)
-      : screenWidth(width), screenHeight(height) {}
+      : screenWidth(width), screenHeight(height), prePassTimer(true),
+        litPassTimer(true) {}
+
+  PassStats getPassStats() const {
+    PassStats stats;
+    stats.depthPrePass = lastDepthPrePass;
+    stats.prePass = prePassTimer.getLastResult();
+    stats.litPass = litPassTimer.getLastResult();
+    stats.meshes = litMeshes;
+    stats.drawCalls = litDrawCalls;
+    return stats;
+  }
 
-  void setScreenSize(unsigned int width, unsigned int height) {
+  void setScreenSize(unsigned int width, unsigned int height) override {
     screenWidth = width;
     screenHeight = height;
   }
 
-  Framebuffer *getFramebuffer(const std::string &sceneName) {
-    auto &resources = ResourceManager::instance();
-    return resources.getFramebuffer(sceneName);
-  }
-
   void render() override {
     float aspectRatio =
         static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
@@ -52,27 +80,29 @@ public:
       clearColor = glm::vec3(0.2f, 0.2f, 0.2f);
     }
 
-    auto &resources = ResourceManager::instance();
-    Framebuffer *fb = resources.getFramebuffer(activeSceneName);
-
-    // Render opaque scene to framebuffer
-    if (fb) {
-      fb->bind();
+    // Frustum cull through the BVH, the result is reused by the transparent
+    // pass which runs later in the same frame
+    SpatialIndexSystem *spatialIndex = gWorld.getSystem<SpatialIndexSystem>();
+    if (spatialIndex) {
+      spatialIndex->cullFrustum(
+          Frustum::fromMatrix(camera.projection * camera.view));
     }
+    OcclusionCullingSystem *occlusion =
+        gWorld.getSystem<OcclusionCullingSystem>();
 
-    glEnable(GL_DEPTH_TEST);
-
-    glClearColor(clearColor.x, clearColor.y, clearColor.z, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-    std::vector<RenderableEntity> renderables;
-    bool hasOutlined = false;
+    singleSided.clear();
+    doubleSided.clear();
+    hasOutlined = false;
 
     gWorld.forEachWith<TransformComponent, MeshComponent, MaterialComponent>(
         [&](Entity entity, TransformComponent &transform, MeshComponent &mesh,
             MaterialComponent &material) {
           if (!mesh.isValid())
             return;
+          if (spatialIndex && !spatialIndex->isVisible(entity))
+            return;
+          if (occlusion && !occlusion->isVisible(entity))
+            return;
 
           RenderableEntity renderable;
           renderable.entity = entity;
@@ -85,55 +115,158 @@ public:
             hasOutlined = true;
           }
 
-          renderables.emplace_back(renderable);
+          if (material.doubleSided) {
+            doubleSided.emplace_back(renderable);
+          } else {
+            singleSided.emplace_back(renderable);
+          }
         });
 
-    std::vector<RenderableEntity> singleSided;
-    singleSided.reserve(renderables.size() / 2);
-    std::vector<RenderableEntity> doubleSided;
-    doubleSided.reserve(renderables.size() / 2);
+    lastDepthPrePass = RenderUtils::isDepthPrePassEnabled(gWorld);
+
+    auto &graph = ResourceManager::instance().getRenderGraph();
+    RenderGraph::ResourceID color = graph.createTexture(
+        RenderUtils::SCENE_COLOR, {RenderGraph::RGB8, 1.0f, true});
+    RenderGraph::ResourceID depth = graph.createTexture(
+        RenderUtils::SCENE_DEPTH, {RenderGraph::DEPTH24_STENCIL8, 1.0f, true});
+    graph
+        .addPass("opaque",
+                 [this, camera, clearColor](const RenderGraph::PassContext &) {
+                   drawScene(camera, clearColor);
+                 })
+        .write(color)
+        .depthStencil(depth);
+  }
 
-    for (const auto &renderable : renderables) {
-      if (renderable.material->doubleSided) {
-        doubleSided.emplace_back(renderable);
-      } else {
-        singleSided.emplace_back(renderable);
-      }
+private:
+  GPUTimer prePassTimer;
+  GPUTimer litPassTimer;
+  bool lastDepthPrePass = false;
+  uint32_t litMeshes = 0;
+  uint32_t litDrawCalls = 0;
+
+  // Collected by render(), drawn when the graph runs the pass
+  std::vector<RenderableEntity> singleSided;
+  std::vector<RenderableEntity> doubleSided;
+  bool hasOutlined = false;
+
+  void drawScene(const ActiveCameraData &camera, glm::vec3 clearColor) {
+    auto &resources = ResourceManager::instance();
+    auto &glState = GLStateCache::instance();
+    glState.enable(GL_DEPTH_TEST);
+    // glClear respects the write masks
+    glState.setDepthMask(true);
+    glState.setStencilMask(0xFF);
+
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    glState.setDepthFunc(GL_LESS);
+    if (lastDepthPrePass) {
+      prePassTimer.begin();
+      renderDepthPrePass(camera, resources, singleSided, doubleSided);
+      prePassTimer.end();
+      // Pre-passed pixels have exactly equal depth, everything else still
+      // depth tests and writes as usual
+      glState.setDepthFunc(GL_LEQUAL);
     }
 
-    glEnable(GL_CULL_FACE);
+    litMeshes = 0;
+    litDrawCalls = 0;
+    litPassTimer.begin();
+    glState.enable(GL_CULL_FACE);
     renderEntitiesWithCulling(camera, resources, singleSided, hasOutlined);
-    glDisable(GL_CULL_FACE);
+    glState.disable(GL_CULL_FACE);
     renderEntitiesWithCulling(camera, resources, doubleSided, hasOutlined);
+    litPassTimer.end();
+    glState.setDepthFunc(GL_LESS);
+  }
+
+  // Depth only pass over the lit materials. Unlit ones use other vertex
+  // shaders whose depth might not match bit for bit, and are cheap anyway
+  void renderDepthPrePass(const ActiveCameraData &camera,
+                          ResourceManager &resources,
+                          const std::vector<RenderableEntity> &singleSided,
+                          const std::vector<RenderableEntity> &doubleSided) {
+    Shader *depthShader = resources.getShader("depthPrePass");
+    if (!depthShader) {
+      resources.loadShader("depthPrePass",
+                           "../src/shaders/depth/depthVertex.glsl",
+                           "../src/shaders/depth/depthFragment.glsl");
+      depthShader = resources.getShader("depthPrePass");
+    }
 
-    // Keep framebuffer bound for next system (SkyboxSystem, then
-    // TransparentRenderSystem)
+    auto &glState = GLStateCache::instance();
+    glState.setColorMask(false);
+    depthShader->use();
+    depthShader->setMat4("view", camera.view);
+    depthShader->setMat4("projection", camera.projection);
+    depthShader->setInt("texture_diffuse1", 0);
+
+    // Only the model matrix, the vertex decode and the alpha tested texture
+    // matter here, runs sharing them become one multi-draw
+    auto draw = [&](const std::vector<RenderableEntity> &renderables) {
+      MultiDrawBatch batch;
+      const MeshComponent *currentMesh = nullptr;
+      glm::mat4 currentModel(1.0f);
+      uint32_t currentTexture = 0;
+      for (const auto &renderable : renderables) {
+        const MaterialComponent &material = *renderable.material;
+        if (!material.receivesLighting || material.hasTransparency)
+          continue;
+        bool alphaTested = material.useTextures && material.textures[0] != 0;
+        uint32_t texture = alphaTested ? material.textures[0] : 0;
+        glm::mat4 model = RenderUtils::getModelMatrix(renderable);
+        if (!currentMesh || model != currentModel ||
+            texture != currentTexture ||
+            !currentMesh->sameDecode(*renderable.mesh)) {
+          batch.flush();
+          depthShader->setMat4("model", model);
+          RenderUtils::setVertexDecode(*depthShader, *renderable.mesh);
+          depthShader->setBool("useTex", alphaTested);
+          if (alphaTested) {
+            glState.bindTexture(0, GL_TEXTURE_2D, texture);
+          }
+          currentModel = model;
+          currentTexture = texture;
+          currentMesh = renderable.mesh;
+        }
+        batch.add(*renderable.mesh);
+      }
+      batch.flush();
+    };
+
+    glState.enable(GL_CULL_FACE);
+    draw(singleSided);
+    glState.disable(GL_CULL_FACE);
+    draw(doubleSided);
+    glState.setColorMask(true);
   }
 
-private:
   void renderEntitiesWithCulling(
       const ActiveCameraData camera, ResourceManager &resources,
       const std::vector<RenderableEntity> &renderables, bool hasOutlined) {
+    auto &glState = GLStateCache::instance();
     if (hasOutlined) {
-      glStencilMask(0x00);
+      glState.setStencilMask(0x00);
       renderEntities(camera, resources, renderables, false, false);
 
       // Stencil outlining
       // Mask - 0xFF -> each bit is written as is
       //      - 0x00 -> each bit ends up as 0
       // Step 1: Render outlined entities with stencil writing enabled
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-      glStencilMask(0xFF);
+      glState.setStencilFunc(GL_ALWAYS, 1, 0xFF);
+      glState.setStencilMask(0xFF);
       renderEntities(camera, resources, renderables, true, false);
 
       // Step 2: Render outlines (scaled up, single color, where stencil != 1)
-      glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-      glStencilMask(0x00);
+      glState.setStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+      glState.setStencilMask(0x00);
       // glDisable(GL_DEPTH_TEST);
       renderOutlines(camera, resources, renderables);
 
-      glStencilMask(0xFF);
-      glStencilFunc(GL_ALWAYS, 0, 0xFF);
+      glState.setStencilMask(0xFF);
+      glState.setStencilFunc(GL_ALWAYS, 0, 0xFF);
       // glEnable(GL_DEPTH_TEST);
     } else {
       renderEntities(camera, resources, renderables, false, false);
@@ -142,12 +275,16 @@ private:
     // Transparent rendering is now handled by TransparentRenderSystem
   }
 
+  // Draws are sorted by program (and its variant), VAO and textures so that
+  // meshes sharing a GeometryArena, a transform and a material (e.g. the
+  // sub-meshes of an imported model) end up next to each other and go out as
+  // one multi-draw
   void renderEntities(const ActiveCameraData &camera,
                       ResourceManager &resources,
                       const std::vector<RenderableEntity> &renderables,
                       bool onlyOutlined, bool renderTransparent) {
-    std::unordered_set<uint32_t> configuredShaders;
-
+    std::vector<const RenderableEntity *> queue;
+    queue.reserve(renderables.size());
     for (const auto &renderable : renderables) {
       if (renderable.material->hasTransparency != renderTransparent)
         continue;
@@ -156,49 +293,78 @@ private:
       if (hasOutlineTag != onlyOutlined)
         continue;
 
-      Shader *shader = resources.getShader(renderable.material->shaderProgram);
+      queue.push_back(&renderable);
+    }
+    std::stable_sort(queue.begin(), queue.end(),
+                     [](const RenderableEntity *a, const RenderableEntity *b) {
+                       const MaterialComponent &ma = *a->material;
+                       const MaterialComponent &mb = *b->material;
+                       if (ma.shaderProgram != mb.shaderProgram)
+                         return ma.shaderProgram < mb.shaderProgram;
+                       if (ma.useTextures != mb.useTextures)
+                         return mb.useTextures;
+                       if (a->mesh->vao != b->mesh->vao)
+                         return a->mesh->vao < b->mesh->vao;
+                       return ma.textures < mb.textures;
+                     });
+
+    LightingSystem *lighting = gWorld.getSystem<LightingSystem>();
+    uint32_t lightFeatures = lighting ? lighting->getShaderFeatures() : 0;
+    std::unordered_set<uint32_t> configuredShaders;
+    MultiDrawBatch batch;
+    const RenderableEntity *current = nullptr;
+    glm::mat4 currentModel(1.0f);
+
+    for (const RenderableEntity *renderable : queue) {
+      glm::mat4 model = RenderUtils::getModelMatrix(*renderable);
+      if (current && model == currentModel &&
+          current->material->sharesRenderState(*renderable->material) &&
+          current->mesh->sameDecode(*renderable->mesh)) {
+        batch.add(*renderable->mesh);
+        continue;
+      }
+
+      Shader *shader = resources.getShader(renderable->material->shaderProgram);
       if (!shader)
         continue;
+      shader = shader->variant(
+          RenderUtils::getShaderFeatures(*renderable->material, lightFeatures));
 
+      batch.flush();
+      current = renderable;
+      currentModel = model;
       shader->use();
 
       // Configure shader once per unique shader program
-      if (configuredShaders.find(renderable.material->shaderProgram) ==
-          configuredShaders.end()) {
+      if (configuredShaders.find(shader->ID) == configuredShaders.end()) {
         shader->setMat4("view", camera.view);
         shader->setMat4("projection", camera.projection);
-        if (renderable.material->receivesLighting) {
+        if (renderable->material->receivesLighting) {
+          RenderUtils::setMaterialSamplers(*shader);
           shader->setVec3("viewPos", camera.position);
         }
-        configuredShaders.insert(renderable.material->shaderProgram);
+        configuredShaders.insert(shader->ID);
       }
 
-      shader->setMat4("model", renderable.transform->getModelMatrix());
-
-      if (renderable.material->receivesLighting) {
-        shader->setVec3("material.vAmbient", renderable.material->ambient);
-        shader->setVec3("material.vDiffuse", renderable.material->diffuse);
-        shader->setVec3("material.vSpecular", renderable.material->specular);
-        shader->setFloat("material.shininess", renderable.material->shininess);
-        shader->setBool("material.useTex", renderable.material->useTextures);
-
-        if (renderable.material->useTextures) {
-          for (size_t i = 0; i < MAX_MATERIAL_TEXTURES; i++) {
-            if (renderable.material->textures[i] != 0) {
-              glActiveTexture(GL_TEXTURE0 + i);
-              glBindTexture(GL_TEXTURE_2D, renderable.material->textures[i]);
-            }
-          }
-          shader->setInt("material.texture_diffuse1", 0);
-          shader->setInt("material.texture_specular1", 1);
+      shader->setMat4("model", model);
+      RenderUtils::setVertexDecode(*shader, *renderable->mesh);
+
+      if (renderable->material->receivesLighting) {
+        shader->setInt("materialIndex", renderable->material->materialID);
+        if (renderable->material->useTextures) {
+          RenderUtils::bindMaterialTextures(*renderable->material);
         }
       } else {
         // Unlit entity (light source shader)
-        shader->setVec3("objectColor", renderable.material->diffuse);
+        shader->setVec3("objectColor", renderable->material->diffuse);
       }
 
-      RenderUtils::drawMesh(*renderable.mesh);
+      batch.add(*renderable->mesh);
     }
+    batch.flush();
+
+    litMeshes += batch.getMeshCount();
+    litDrawCalls += batch.getDrawCallCount();
   }
 
   void renderOutlines(const ActiveCameraData &camera,
@@ -223,12 +389,13 @@ private:
       scaledTransform.scale *= outlineScale;
 
       outlineShader->setMat4("model", scaledTransform.getModelMatrix());
+      RenderUtils::setVertexDecode(*outlineShader, *renderable.mesh);
       outlineShader->setBool("useTex", renderable.material->useTextures);
 
       if (renderable.material->useTextures &&
           renderable.material->textures[0] != 0) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, renderable.material->textures[0]);
+        GLStateCache::instance().bindTexture(
+            0, GL_TEXTURE_2D, renderable.material->textures[0]);
         outlineShader->setInt("texture_diffuse1", 0);
       }
 
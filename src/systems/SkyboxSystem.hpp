@@ -26,27 +26,21 @@ public:
   SkyboxSystem(unsigned int width = 800, unsigned int height = 600)
       : screenWidth(width), screenHeight(height) {}
 
-  void setScreenSize(unsigned int width, unsigned int height) {
+  void setScreenSize(unsigned int width, unsigned int height) override {
     screenWidth = width;
     screenHeight = height;
   }
 
+  // Drawn after the opaque pass into the same attachments, only where
+  // nothing was drawn yet
   void render() override {
-    std::string activeSceneName = RenderUtils::getActiveSceneName(gWorld);
-    if (activeSceneName.empty()) {
-      return;
-    }
-
-    auto *opaqueSystem = gWorld.getSystem<class OpaqueRenderSystem>();
-    if (!opaqueSystem) {
-      return;
-    }
-
     auto &resources = ResourceManager::instance();
-    Framebuffer *fb = resources.getFramebuffer(activeSceneName);
-
-    if (fb) {
-      fb->bind();
+    auto &graph = resources.getRenderGraph();
+    RenderGraph::ResourceID color = graph.find(RenderUtils::SCENE_COLOR);
+    RenderGraph::ResourceID depth = graph.find(RenderUtils::SCENE_DEPTH);
+    if (color == RenderGraph::INVALID_RESOURCE ||
+        depth == RenderGraph::INVALID_RESOURCE) {
+      return;
     }
 
     SkyboxEntity skybox;
@@ -67,34 +61,43 @@ public:
     if (!foundSkybox)
       return;
 
+    Shader *shader = resources.getShader(skybox.material->shaderProgram);
+    if (!shader)
+      return;
+
     float aspectRatio =
         static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
     auto camera = getActiveCamera(gWorld, aspectRatio);
 
-    glDepthFunc(GL_LEQUAL);
+    graph
+        .addPass("skybox",
+                 [this, skybox, shader,
+                  camera](const RenderGraph::PassContext &) {
+                   drawSkybox(skybox, *shader, camera);
+                 })
+        .write(color)
+        .depthStencil(depth);
+  }
 
-    Shader *shader = resources.getShader(skybox.material->shaderProgram);
-    if (!shader)
-      return;
+private:
+  void drawSkybox(const SkyboxEntity &skybox, Shader &shader,
+                  const ActiveCameraData &camera) {
+    auto &glState = GLStateCache::instance();
+    glState.setDepthFunc(GL_LEQUAL);
 
-    shader->use();
+    shader.use();
     if (!shaderInitialized) {
-      shader->setInt("skybox", 0);
+      shader.setInt("skybox", 0);
       shaderInitialized = true;
     }
 
     glm::mat4 skyboxView = glm::mat4(glm::mat3(camera.view));
-    shader->setMat4("view", skyboxView);
-    shader->setMat4("projection", camera.projection);
-
-    glBindVertexArray(skybox.mesh->vao);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skybox.material->textures[0]);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    shader.setMat4("view", skyboxView);
+    shader.setMat4("projection", camera.projection);
 
-    glDepthFunc(GL_LESS);
+    glState.bindTexture(0, GL_TEXTURE_CUBE_MAP, skybox.material->textures[0]);
+    RenderUtils::drawMesh(*skybox.mesh);
 
-    // Keep framebuffer bound for next system (TransparentRenderSystem)
+    glState.setDepthFunc(GL_LESS);
   }
 };
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "../components/MeshComponent.hpp"
+#include "../components/TransformComponent.hpp"
+#include "../ecs/System.hpp"
+#include "../ecs/World.hpp"
+#include "../spatial/DynamicBVH.hpp"
+#include "../spatial/Geometry.hpp"
+
+#include <vector>
+
+extern World gWorld;
+
+struct RaycastHit {
+  Entity entity = NULL_ENTITY;
+  float distance = 0.0f;
+  glm::vec3 point = glm::vec3(0.0f);
+};
+
+// Keeps a scene wide DynamicBVH in sync with every entity that has a
+// TransformComponent and a MeshComponent with bounds.
+// Render systems use it for frustum culling, gameplay for picking/overlaps.
+// Entities without bounds are never indexed and always count as visible.
+class SpatialIndexSystem : public System {
+public:
+  // How often (in frames) tree quality is checked
+  unsigned int rebuildInterval = 30;
+  // Rebuild when refits have made the tree this much worse than a fresh build
+  float rebuildQualityThreshold = 1.5f;
+  // New entities above this fraction of the indexed ones (e.g. on load) go
+  // in with a rebuild, fewer are inserted one by one
+  float bulkInsertFraction = 0.25f;
+
+  void update(float &deltaTime) override { sync(); }
+
+  // ========== CULLING ==========
+
+  // Marks every indexed entity touching the frustum, read with isVisible()
+  void cullFrustum(const Frustum &frustum) {
+    cullStamp++;
+    bvh.queryFrustum(frustum, [&](Entity entity, int) {
+      tracked[entity].visibleStamp = cullStamp;
+      return true;
+    });
+  }
+
+  bool isVisible(Entity entity) const {
+    if (entity >= tracked.size() || tracked[entity].proxy < 0)
+      return true;
+    return tracked[entity].visibleStamp == cullStamp;
+  }
+
+  // ========== QUERIES ==========
+
+  void queryFrustum(const Frustum &frustum, std::vector<Entity> &out) const {
+    bvh.queryFrustum(frustum, [&](Entity entity, int) {
+      out.push_back(entity);
+      return true;
+    });
+  }
+
+  void queryAABB(const AABB &box, std::vector<Entity> &out) const {
+    bvh.queryAABB(box, [&](Entity entity, int) {
+      if (tracked[entity].worldBounds.overlaps(box))
+        out.push_back(entity);
+      return true;
+    });
+  }
+
+  void querySphere(const Sphere &sphere, std::vector<Entity> &out) const {
+    bvh.querySphere(sphere, [&](Entity entity, int) {
+      if (sphere.overlaps(tracked[entity].worldBounds))
+        out.push_back(entity);
+      return true;
+    });
+  }
+
+  // Closest entity whose world bounds the ray hits
+  bool raycast(const Ray &ray, float maxDistance, RaycastHit &hit) const {
+    glm::vec3 invDir = 1.0f / ray.direction;
+    hit.entity = NULL_ENTITY;
+
+    bvh.raycast(ray, maxDistance, [&](Entity entity, int, float) {
+      float t;
+      if (Ray::intersects(ray.origin, invDir, tracked[entity].worldBounds,
+                          maxDistance, t)) {
+        maxDistance = t;
+        hit.entity = entity;
+        hit.distance = t;
+      }
+      return maxDistance;
+    });
+
+    if (hit.entity != NULL_ENTITY) {
+      hit.point = ray.at(hit.distance);
+      return true;
+    }
+    return false;
+  }
+
+  const AABB *getWorldBounds(Entity entity) const {
+    if (entity >= tracked.size() || tracked[entity].proxy < 0)
+      return nullptr;
+    return &tracked[entity].worldBounds;
+  }
+
+  DynamicBVH::Stats getStats() const { return bvh.getStats(); }
+
+private:
+  struct TrackedEntity {
+    int proxy = -1;
+    uint32_t seenFrame = 0;
+    uint32_t visibleStamp = 0;
+    glm::vec3 position;
+    glm::vec3 rotation;
+    glm::vec3 scale;
+    AABB localBounds; // The mesh's, as of the last sync
+    AABB worldBounds;
+  };
+
+  DynamicBVH bvh;
+  std::vector<TrackedEntity> tracked; // Indexed by Entity
+  uint32_t frame = 0;
+  uint32_t cullStamp = 0;
+
+  void sync() {
+    frame++;
+    size_t inserted = 0;
+
+    gWorld.forEachWith<TransformComponent, MeshComponent>(
+        [&](Entity entity, TransformComponent &transform, MeshComponent &mesh) {
+          if (!mesh.isValid() || !mesh.hasBounds())
+            return;
+
+          if (entity >= tracked.size()) {
+            tracked.resize(entity + 1);
+          }
+          TrackedEntity &t = tracked[entity];
+          t.seenFrame = frame;
+
+          // A new mesh moves the proxy as much as a new transform does
+          if (t.proxy >= 0 && t.position == transform.position &&
+              t.rotation == transform.rotation &&
+              t.scale == transform.scale &&
+              t.localBounds.min == mesh.bounds.min &&
+              t.localBounds.max == mesh.bounds.max)
+            return;
+
+          t.position = transform.position;
+          t.rotation = transform.rotation;
+          t.scale = transform.scale;
+          t.localBounds = mesh.bounds;
+          t.worldBounds = mesh.bounds.transformed(transform.getModelMatrix());
+
+          if (t.proxy < 0) {
+            // Inserted below, once we know how many there are
+            t.proxy = bvh.createProxy(t.worldBounds, entity, false);
+            inserted++;
+          } else {
+            bvh.moveProxy(t.proxy, t.worldBounds);
+          }
+        });
+
+    // Drop entities that were destroyed or lost their mesh
+    for (Entity entity = 0; entity < tracked.size(); entity++) {
+      TrackedEntity &t = tracked[entity];
+      if (t.proxy >= 0 && t.seenFrame != frame) {
+        bvh.destroyProxy(t.proxy);
+        t = TrackedEntity{};
+      }
+    }
+
+    if (inserted > 0 && inserted > bulkInsertFraction * bvh.getProxyCount()) {
+      bvh.rebuild();
+    } else {
+      bvh.insertPending();
+      if (frame % rebuildInterval == 0 &&
+          bvh.getQualityRatio() > rebuildQualityThreshold) {
+        bvh.rebuild();
+      }
+    }
+  }
+};
@@ -6,6 +6,7 @@
 #include "../ecs/World.hpp"
 #include "../gl_common.hpp"
 #include "../resources/ResourceManager.hpp"
+#include "../resources/SpriteBatch.hpp"
 #include "RenderCommon.hpp"
 
 extern World gWorld;
@@ -14,6 +15,7 @@ class SpriteRenderSystem : public System {
 private:
   float screenWidth;
   float screenHeight;
+  SpriteBatch batch;
 
 public:
   SpriteRenderSystem(float width = 800.0f, float height = 600.0f)
@@ -26,15 +28,16 @@ public:
     glClear(GL_COLOR_BUFFER_BIT);
 
     // 2D sprite rendering setup
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    auto &glState = GLStateCache::instance();
+    glState.disable(GL_DEPTH_TEST);
+    glState.disable(GL_CULL_FACE);
+    glState.enable(GL_BLEND);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glm::mat4 projection =
         glm::ortho(0.0f, screenWidth, screenHeight, 0.0f, -1.0f, 1.0f);
 
-    auto &resources = ResourceManager::instance();
+    batch.begin(projection);
 
     gWorld.forEachWith<TransformComponent, MeshComponent, MaterialComponent>(
         [&](Entity entity, TransformComponent &transform, MeshComponent &mesh,
@@ -45,30 +48,16 @@ public:
           if (material.alpha <= 0.0f)
             return;
 
-          Shader *shader = resources.getShader(material.shaderProgram);
-          if (!shader)
-            return;
-
-          shader->use();
-          shader->setMat4("projection", projection);
-          shader->setMat4("model", transform.getSpriteModelMatrix());
-          shader->setVec3("spriteColor", material.color);
-          shader->setFloat("spriteAlpha", material.alpha);
-          shader->setBool("useTexture", material.useTextures);
-          shader->setBool("isCircle", material.isCircle);
-
-          if (material.useTextures && material.textures[0] != 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, material.textures[0]);
-            shader->setInt("image", 0);
-          }
-
-          RenderUtils::drawMesh(mesh);
+          batch.draw(transform, material, mesh);
         });
+
+    batch.end();
   }
 
-  void setScreenSize(float w, float h) {
-    screenWidth = w;
-    screenHeight = h;
+  const SpriteBatch::Stats &getBatchStats() const { return batch.getStats(); }
+
+  void setScreenSize(unsigned int width, unsigned int height) override {
+    screenWidth = static_cast<float>(width);
+    screenHeight = static_cast<float>(height);
   }
 };
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../components/MaterialComponent.hpp"
+#include "../components/MeshComponent.hpp"
+#include "../components/TransformComponent.hpp"
+#include "../resources/ResourceManager.hpp"
+#include "SpatialIndexSystem.hpp"
+
+#include "../ecs/System.hpp"
+#include "../ecs/World.hpp"
+#include "../ecs/utils/CameraUtils.hpp"
+
+extern World gWorld;
+
+// Feedback for the TextureStreamer: estimates how many pixels each visible
+// textured mesh covers on screen and requests that size for its textures.
+// Must be added after OpaqueRenderSystem, whose frustum cull (through
+// SpatialIndexSystem) it reuses. Meshes culled this frame request nothing,
+// so their textures fall back to the resident tail after a while.
+class TextureStreamingSystem : public System {
+public:
+  TextureStreamingSystem(unsigned int width = 800, unsigned int height = 600)
+      : screenWidth(width), screenHeight(height) {}
+
+  void setScreenSize(unsigned int width, unsigned int height) override {
+    screenWidth = width;
+    screenHeight = height;
+  }
+
+  void render() override {
+    float aspectRatio =
+        static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
+    auto camera = getActiveCamera(gWorld, aspectRatio);
+    if (!camera.found)
+      return;
+
+    auto &streamer = ResourceManager::instance().getTextureStreamer();
+    SpatialIndexSystem *spatialIndex = gWorld.getSystem<SpatialIndexSystem>();
+    // Projected size in pixels of one world unit at distance 1
+    float pixelsPerUnit = camera.projection[1][1] * 0.5f * screenHeight;
+
+    gWorld.forEachWith<TransformComponent, MeshComponent, MaterialComponent>(
+        [&](Entity entity, TransformComponent &transform, MeshComponent &mesh,
+            MaterialComponent &material) {
+          if (!material.useTextures)
+            return;
+          if (spatialIndex && !spatialIndex->isVisible(entity))
+            return;
+
+          const AABB *indexed =
+              spatialIndex ? spatialIndex->getWorldBounds(entity) : nullptr;
+          AABB box = indexed ? *indexed
+                             : mesh.bounds.transformed(
+                                   transform.getModelMatrix());
+          if (!box.isValid())
+            return;
+
+          // Bounding sphere, its near side decides the size
+          float radius = glm::length(box.halfExtents());
+          float distance =
+              glm::length(box.center() - camera.position) - radius;
+          float pixels =
+              2.0f * radius * pixelsPerUnit / std::max(distance, 0.1f);
+          for (uint32_t texture : material.textures) {
+            if (texture)
+              streamer.request(texture, pixels);
+          }
+        });
+  }
+
+private:
+  unsigned int screenWidth = 800;
+  unsigned int screenHeight = 600;
+};
@@ -2,7 +2,9 @@
 
 #include "../gl_common.hpp"
 #include "../resources/ResourceManager.hpp"
+#include "LightingSystem.hpp"
 #include "RenderCommon.hpp"
+#include "SpatialIndexSystem.hpp"
 
 #include "../ecs/System.hpp"
 #include "../ecs/World.hpp"
@@ -22,41 +24,36 @@ public:
   TransparentRenderSystem(unsigned int width = 800, unsigned int height = 600)
       : screenWidth(width), screenHeight(height) {}
 
-  void setScreenSize(unsigned int width, unsigned int height) {
+  void setScreenSize(unsigned int width, unsigned int height) override {
     screenWidth = width;
     screenHeight = height;
   }
 
+  // Blended on top of the opaque pass, in the same attachments
   void render() override {
-    float aspectRatio =
-        static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
-    auto camera = getActiveCamera(gWorld, aspectRatio);
-
-    std::string activeSceneName = RenderUtils::getActiveSceneName(gWorld);
-    if (activeSceneName.empty()) {
+    auto &graph = ResourceManager::instance().getRenderGraph();
+    RenderGraph::ResourceID color = graph.find(RenderUtils::SCENE_COLOR);
+    RenderGraph::ResourceID depth = graph.find(RenderUtils::SCENE_DEPTH);
+    if (color == RenderGraph::INVALID_RESOURCE ||
+        depth == RenderGraph::INVALID_RESOURCE) {
       return;
     }
 
-    auto *opaqueSystem = gWorld.getSystem<class OpaqueRenderSystem>();
-    if (!opaqueSystem) {
-      return;
-    }
-
-    auto &resources = ResourceManager::instance();
-    Framebuffer *fb = resources.getFramebuffer(activeSceneName);
-
-    // Ensure framebuffer is bound
-    if (fb) {
-      fb->bind();
-    }
+    float aspectRatio =
+        static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
+    auto camera = getActiveCamera(gWorld, aspectRatio);
 
-    std::vector<RenderableEntity> transparentEntities;
+    // Visibility was computed by OpaqueRenderSystem this frame
+    SpatialIndexSystem *spatialIndex = gWorld.getSystem<SpatialIndexSystem>();
 
+    transparentEntities.clear();
     gWorld.forEachWith<TransformComponent, MeshComponent, MaterialComponent>(
         [&](Entity entity, TransformComponent &transform, MeshComponent &mesh,
             MaterialComponent &material) {
           if (!mesh.isValid() || !material.hasTransparency)
             return;
+          if (spatialIndex && !spatialIndex->isVisible(entity))
+            return;
 
           RenderableEntity renderable;
           renderable.entity = entity;
@@ -67,18 +64,30 @@ public:
 
           transparentEntities.emplace_back(renderable);
         });
+    if (transparentEntities.empty())
+      return;
 
     // Sort transparent entities back-to-front (far to near)
     sortTransparentEntities(transparentEntities, camera.position);
 
-    glDepthMask(GL_FALSE);
-    renderTransparentEntities(camera, resources, transparentEntities);
-    glDepthMask(GL_TRUE);
-
-    // Keep framebuffer bound for next system
+    graph
+        .addPass("transparent",
+                 [this, camera](const RenderGraph::PassContext &) {
+                   auto &glState = GLStateCache::instance();
+                   glState.setDepthMask(false);
+                   renderTransparentEntities(camera,
+                                             ResourceManager::instance(),
+                                             transparentEntities);
+                   glState.setDepthMask(true);
+                 })
+        .write(color)
+        .depthStencil(depth);
   }
 
 private:
+  // Collected by render(), drawn when the graph runs the pass
+  std::vector<RenderableEntity> transparentEntities;
+
   void sortTransparentEntities(std::vector<RenderableEntity> &entities,
                                const glm::vec3 &cameraPos) {
     std::sort(
@@ -94,43 +103,36 @@ private:
   renderTransparentEntities(const ActiveCameraData &camera,
                             ResourceManager &resources,
                             const std::vector<RenderableEntity> &renderables) {
+    LightingSystem *lighting = gWorld.getSystem<LightingSystem>();
+    uint32_t lightFeatures = lighting ? lighting->getShaderFeatures() : 0;
     std::unordered_set<uint32_t> configuredShaders;
 
     for (const auto &renderable : renderables) {
       Shader *shader = resources.getShader(renderable.material->shaderProgram);
       if (!shader)
         continue;
+      shader = shader->variant(
+          RenderUtils::getShaderFeatures(*renderable.material, lightFeatures));
 
       shader->use();
 
-      if (configuredShaders.find(renderable.material->shaderProgram) ==
-          configuredShaders.end()) {
+      if (configuredShaders.find(shader->ID) == configuredShaders.end()) {
         shader->setMat4("view", camera.view);
         shader->setMat4("projection", camera.projection);
         if (renderable.material->receivesLighting) {
+          RenderUtils::setMaterialSamplers(*shader);
           shader->setVec3("viewPos", camera.position);
         }
-        configuredShaders.insert(renderable.material->shaderProgram);
+        configuredShaders.insert(shader->ID);
       }
 
       shader->setMat4("model", renderable.transform->getModelMatrix());
+      RenderUtils::setVertexDecode(*shader, *renderable.mesh);
 
       if (renderable.material->receivesLighting) {
-        shader->setVec3("material.vAmbient", renderable.material->ambient);
-        shader->setVec3("material.vDiffuse", renderable.material->diffuse);
-        shader->setVec3("material.vSpecular", renderable.material->specular);
-        shader->setFloat("material.shininess", renderable.material->shininess);
-        shader->setBool("material.useTex", renderable.material->useTextures);
-
+        shader->setInt("materialIndex", renderable.material->materialID);
         if (renderable.material->useTextures) {
-          for (size_t i = 0; i < MAX_MATERIAL_TEXTURES; i++) {
-            if (renderable.material->textures[i] != 0) {
-              glActiveTexture(GL_TEXTURE0 + i);
-              glBindTexture(GL_TEXTURE_2D, renderable.material->textures[i]);
-            }
-          }
-          shader->setInt("material.texture_diffuse1", 0);
-          shader->setInt("material.texture_specular1", 1);
+          RenderUtils::bindMaterialTextures(*renderable.material);
         }
       } else {
         shader->setVec3("objectColor", renderable.material->diffuse);
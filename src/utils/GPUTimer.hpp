@@ -0,0 +1,122 @@
+#pragma once
+
+#include "../gl_common.hpp"
+
+#include <stdint.h>
+
+// Measures a span of GL commands with GL_TIME_ELAPSED and, optionally, how
+// many samples passed the depth test (GL_SAMPLES_PASSED, i.e. how many
+// fragments were shaded). Queries are kept in a small ring and only read once
+// the driver says they are available, so measuring never stalls the pipeline;
+// results lag a couple of frames behind.
+//
+// Only one query per target can be active, so timers must not be nested. A
+// timer built with useTimestamps instead takes a GL_TIMESTAMP at begin() and
+// end(), which may enclose other timers (but can't count samples).
+class GPUTimer {
+public:
+  struct Result {
+    double milliseconds = 0.0;
+    uint64_t samples = 0;
+  };
+
+  GPUTimer(bool countSamples = false, bool useTimestamps = false)
+      : countSamples(countSamples && !useTimestamps),
+        useTimestamps(useTimestamps) {
+    glGenQueries(RING_SIZE, timeQueries);
+    if (this->countSamples)
+      glGenQueries(RING_SIZE, sampleQueries);
+    if (useTimestamps)
+      glGenQueries(RING_SIZE, endQueries);
+  }
+
+  ~GPUTimer() {
+    glDeleteQueries(RING_SIZE, timeQueries);
+    if (countSamples)
+      glDeleteQueries(RING_SIZE, sampleQueries);
+    if (useTimestamps)
+      glDeleteQueries(RING_SIZE, endQueries);
+  }
+
+  GPUTimer(const GPUTimer &) = delete;
+  GPUTimer &operator=(const GPUTimer &) = delete;
+
+  void begin() {
+    collect();
+    // Every slot still in flight, drop this measurement rather than wait
+    if (pending[head])
+      return;
+    if (useTimestamps) {
+      glQueryCounter(timeQueries[head], GL_TIMESTAMP);
+      active = true;
+      return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timeQueries[head]);
+    if (countSamples)
+      glBeginQuery(GL_SAMPLES_PASSED, sampleQueries[head]);
+    active = true;
+  }
+
+  void end() {
+    if (!active)
+      return;
+    if (useTimestamps) {
+      glQueryCounter(endQueries[head], GL_TIMESTAMP);
+    } else {
+      glEndQuery(GL_TIME_ELAPSED);
+    }
+    if (countSamples)
+      glEndQuery(GL_SAMPLES_PASSED);
+    pending[head] = true;
+    head = (head + 1) % RING_SIZE;
+    active = false;
+  }
+
+  // Most recent finished measurement
+  const Result &getLastResult() const { return last; }
+
+private:
+  static const int RING_SIZE = 4;
+
+  bool countSamples;
+  bool useTimestamps;
+  GLuint timeQueries[RING_SIZE] = {}; // Or the begin timestamps
+  GLuint sampleQueries[RING_SIZE] = {};
+  GLuint endQueries[RING_SIZE] = {}; // End timestamps
+  bool pending[RING_SIZE] = {};
+  int head = 0;
+  int tail = 0; // Oldest pending query
+  bool active = false;
+  Result last;
+
+  // Reads back finished queries in submission order
+  void collect() {
+    while (pending[tail]) {
+      // Timestamps complete in order, the end one being there is enough
+      GLuint query = useTimestamps ? endQueries[tail] : timeQueries[tail];
+      GLint available = 0;
+      glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available && countSamples) {
+        glGetQueryObjectiv(sampleQueries[tail], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+      }
+      if (!available)
+        return;
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(timeQueries[tail], GL_QUERY_RESULT, &nanoseconds);
+      if (useTimestamps) {
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(endQueries[tail], GL_QUERY_RESULT, &end);
+        nanoseconds = end - nanoseconds;
+      }
+      last.milliseconds = nanoseconds / 1.0e6;
+      if (countSamples) {
+        GLuint64 samples = 0;
+        glGetQueryObjectui64v(sampleQueries[tail], GL_QUERY_RESULT, &samples);
+        last.samples = samples;
+      }
+      pending[tail] = false;
+      tail = (tail + 1) % RING_SIZE;
+    }
+  }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read only memory mapping of a whole file. Pages are faulted in by the OS as
+// they are touched, nothing is copied into the process up front. The mapping
+// lives as long as the object.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *mapping = mmap(nullptr, static_cast<size_t>(info.st_size),
+                           PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        bytes = static_cast<const uint8_t *>(mapping);
+        length = static_cast<size_t>(info.st_size);
+      }
+    }
+    // The mapping keeps its own reference to the file
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (bytes)
+      munmap(const_cast<uint8_t *>(bytes), length);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isOpen() const { return bytes != nullptr; }
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Faults the pages of [begin, begin + bytes) in, so whoever reads them next
+  // doesn't wait for the disk. Blocks until they are resident, run it on a
+  // worker
+  void prefetch(const uint8_t *begin, size_t bytes) const {
+    if (!this->bytes || begin < this->bytes ||
+        begin + bytes > this->bytes + length || bytes == 0)
+      return;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t first = reinterpret_cast<uintptr_t>(begin) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(begin + bytes);
+    madvise(reinterpret_cast<void *>(first), end - first, MADV_WILLNEED);
+    // The advice only starts the reads, touching every page waits for them.
+    // The mapping starts on a page, so first is inside it
+    volatile uint8_t sink = 0;
+    for (uintptr_t address = first; address < end; address += page) {
+      sink = sink + *reinterpret_cast<const uint8_t *>(address);
+    }
+  }
+
+  // FNV-1a of the contents, keys caches built from source assets
+  uint64_t hash() const {
+    uint64_t value = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+      value = (value ^ bytes[i]) * 1099511628211ull;
+    }
+    return value;
+  }
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed size worker pool for data parallel engine work (culling,
+// light assignment, ...). parallelFor blocks until every item is processed
+// and the calling thread helps out, so it is safe to call from the main loop.
+// submit queues fire and forget background work (file decoding); workers
+// pick up parallelFor items first so frame work is not held up by it.
+class ThreadPool {
+public:
+  // Singleton
+  static ThreadPool &instance() {
+    static ThreadPool inst;
+    return inst;
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t getWorkerCount() const { return workers.size(); }
+
+  // Runs job(i) for every i in [0, count). Items are handed out one at a time
+  // so callers should pass coarse items (e.g. screen strips, not pixels)
+  void parallelFor(size_t count, const std::function<void(size_t)> &job) {
+    if (count == 0)
+      return;
+    if (count == 1 || workers.empty()) {
+      for (size_t i = 0; i < count; i++) {
+        job(i);
+      }
+      return;
+    }
+
+    // The previous call returned only once no worker was left in its
+    // runItems, so nobody touches the counters while they are reset
+    std::unique_lock<std::mutex> lock(mutex);
+    current.function = &job;
+    current.count = count;
+    current.generation++;
+    nextItem.store(0);
+    Job snapshot = current;
+    lock.unlock();
+    wakeWorkers.notify_all();
+
+    runItems(snapshot);
+
+    // Every item has been handed out, the ones still running belong to
+    // workers that haven't left runItems yet. Clearing the job under the
+    // lock stops late wakers from joining after we return
+    lock.lock();
+    jobDone.wait(lock, [&] { return activeWorkers == 0; });
+    current.function = nullptr;
+  }
+
+  // Runs task on a worker some time later, inline when there are no workers.
+  // Tasks must not call parallelFor
+  void submit(std::function<void()> task) {
+    if (workers.empty()) {
+      task();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    wakeWorkers.notify_one();
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wakeWorkers;
+  std::condition_variable jobDone;
+
+  // What a parallelFor call hands out. Workers copy it under the mutex
+  // before running items, they never read it unlocked
+  struct Job {
+    const std::function<void(size_t)> *function = nullptr;
+    size_t count = 0;
+    uint64_t generation = 0; // Bumped by every parallelFor call
+  };
+
+  Job current;
+  // Next item of current, only used by runItems of its generation
+  std::atomic<size_t> nextItem{0};
+  size_t activeWorkers = 0; // Inside runItems, guarded by the mutex
+  bool stopping = false;
+  std::deque<std::function<void()>> tasks;
+
+  ThreadPool() {
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    // Leave the main thread its own core, it takes part in every job anyway
+    unsigned int count = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    count = std::min(count, 7u);
+
+    for (unsigned int i = 0; i < count; i++) {
+      workers.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  void runItems(const Job &job) {
+    size_t i;
+    while ((i = nextItem.fetch_add(1)) < job.count) {
+      (*job.function)(i);
+    }
+  }
+
+  void workerLoop() {
+    uint64_t seenGeneration = 0;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeWorkers.wait(lock, [&] {
+        return stopping ||
+               (current.function && current.generation != seenGeneration) ||
+               !tasks.empty();
+      });
+      if (stopping)
+        return;
+      if (current.function && current.generation != seenGeneration) {
+        Job job = current;
+        seenGeneration = job.generation;
+        activeWorkers++;
+        lock.unlock();
+        runItems(job);
+        lock.lock();
+        if (--activeWorkers == 0)
+          jobDone.notify_all();
+        continue;
+      }
+
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+    }
+  }
+};